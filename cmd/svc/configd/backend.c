@@ -39,6 +39,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -113,14 +114,25 @@ typedef struct sqlite_backend {
 	int		be_writing;	/* held for writing */
 	backend_type_t	be_type;	/* type of db */
 	hrtime_t	be_lastcheck;	/* time of last read-only check */
+	int		be_packed;	/* schema 6:  values are packed */
+	int		be_nosync;	/* be_db commits skip the log sync */
 	backend_totals_t be_totals[2];	/* one for reading, one for writing */
 } sqlite_backend_t;
 
+/*
+ * Statements run with backend_tx_run_bound() are compiled once per
+ * transaction, and kept here until it ends.
+ */
+#define	BACKEND_TX_STMTS	4
+
 struct backend_tx {
 	sqlite_backend_t	*bt_be;
 	int			bt_readonly;
 	int			bt_type;
 	int			bt_full;	/* SQLITE_FULL during tx */
+	backend_durability_t	bt_durability;
+	const char		*bt_stmt_sql[BACKEND_TX_STMTS];
+	sqlite_vm		*bt_stmt[BACKEND_TX_STMTS];
 };
 
 #define	UPDATE_TOTALS_WR(sb, writing, field, ts, vts) { \
@@ -219,10 +231,17 @@ static uint_t flight_recorder_sequence = 0;
  * The schema has been changed to support value ordering,  but this change
  * is backwards-compatible - i.e. a previous svc.configd can use a
  * repository database with the new schema perfectly well.  As a result,
- * the schema version has not been updated,  allowing downgrade of systems
- * without losing repository data.
+ * the schema version was not updated for it.
+ *
+ * Version 6 stores each set of property values as a single, packed
+ * value_tbl row, or in value_part_tbl if the set is too large for one row,
+ * which older versions of svc.configd cannot read.
+ * Version 5 repositories are still accepted, read as they are until the
+ * repository is writable, and then converted by backend_check_upgrade().
+ * Downgrading a system means restoring a backup taken before the upgrade.
  */
-#define	BACKEND_SCHEMA_VERSION		5
+#define	BACKEND_SCHEMA_VERSION		6
+#define	BACKEND_SCHEMA_VERSION_UNPACKED	5
 
 static struct backend_tbl_info tbls_normal[] = { /* BACKEND_TYPE_NORMAL */
 	/*
@@ -297,6 +316,7 @@ static struct backend_idx_info idxs_normal[] = { /* BACKEND_TYPE_NORMAL */
 	{ "snapshot_lnk_tbl",	"name",	"lnk_inst_id, lnk_snap_name" },
 	{ "snapshot_lnk_tbl",	"snapid", "lnk_snap_id" },
 	{ "snaplevel_tbl",	"id",	"snap_id" },
+	{ "snaplevel_tbl",	"level", "snap_level_id" },
 	{ "snaplevel_lnk_tbl",	"id",	"snaplvl_pg_id" },
 	{ "snaplevel_lnk_tbl",	"level", "snaplvl_level_id" },
 	{ NULL, NULL, NULL }
@@ -341,16 +361,33 @@ static struct backend_tbl_info tbls_common[] = { /* all backend types */
 	},
 
 	/*
-	 * value_tbl maps a value_id to a set of values.  For any given
-	 * value_id, value_type is constant.  The table definition here
-	 * is repeated in backend_check_upgrade(),  and must be kept in-sync.
+	 * value_tbl maps a value_id to a set of value_count values of type
+	 * value_type, packed into value_value by backend_values_add().
+	 * value_hash is backend_values_t's bv_hash, which lets identical
+	 * sets be shared between properties.  The table definition here
+	 * is repeated in backend_pack_values(),  and must be kept in-sync.
 	 */
 	{
 		"value_tbl",
-		"value_id        INTEGER NOT NULL,"
+		"value_id        INTEGER PRIMARY KEY,"
 		"value_type      CHAR(1) NOT NULL,"
-		"value_value     VARCHAR NOT NULL,"
-		"value_order     INTEGER DEFAULT 0"
+		"value_hash      INTEGER NOT NULL,"
+		"value_count     INTEGER NOT NULL,"
+		"value_value     VARCHAR NOT NULL"
+	},
+
+	/*
+	 * value_part_tbl holds, in order of part_num, the parts of a packed
+	 * set of values too large for a single row.  Its value_tbl row has
+	 * an empty value_value, which no set that fits in one row has.
+	 * The table definition here is repeated in backend_pack_values(),
+	 * and must be kept in-sync.
+	 */
+	{
+		"value_part_tbl",
+		"part_value_id   INTEGER NOT NULL,"
+		"part_num        INTEGER NOT NULL,"
+		"part_value      VARCHAR NOT NULL"
 	},
 
 	/*
@@ -374,8 +411,9 @@ static struct backend_tbl_info tbls_common[] = { /* all backend types */
 };
 
 /*
- * The indexing of value_tbl is repeated in backend_check_upgrade() and
- * must be kept in sync with the indexing specification here.
+ * The indexing of value_tbl and value_part_tbl is repeated in
+ * backend_pack_values() and must be kept in sync with the indexing
+ * specification here.
  */
 static struct backend_idx_info idxs_common[] = { /* all backend types */
 	{ "pg_tbl",		"parent", "pg_parent_id" },
@@ -383,7 +421,8 @@ static struct backend_idx_info idxs_common[] = { /* all backend types */
 	{ "pg_tbl",		"type",	"pg_parent_id, pg_type" },
 	{ "prop_lnk_tbl",	"base",	"lnk_pg_id, lnk_gen_id" },
 	{ "prop_lnk_tbl",	"val",	"lnk_val_id" },
-	{ "value_tbl",		"id",	"value_id" },
+	{ "value_tbl",		"hash",	"value_hash" },
+	{ "value_part_tbl",	"id",	"part_value_id" },
 	{ "id_tbl",		"id",	"id_name" },
 	{ NULL, NULL, NULL }
 };
@@ -397,6 +436,7 @@ static rep_protocol_responseid_t backend_copy_repository(const char *,
     const char *, int);
 static rep_protocol_responseid_t backend_do_copy(const char *, int,
     const char *, int, size_t *);
+static size_t round_up_to_p2(size_t);
 
 /*
  * The flight recorder keeps track of events that happen primarily while
@@ -491,6 +531,175 @@ backend_is_readonly(struct sqlite *db, const char *path)
 	return (r);
 }
 
+/*
+ * The persistent repository is run in write-ahead log mode:  a commit
+ * appends the changed pages to "<repository>-wal" and syncs that once,
+ * rather than syncing a rollback journal and then the database itself.
+ * sqlite folds the log back into the database when it grows large.
+ * Anything which copies the database file must call
+ * backend_wal_checkpoint() first.
+ */
+static void
+backend_set_journal_mode(sqlite_backend_t *be, struct sqlite *db)
+{
+	be->be_nosync = 0;
+	if (be->be_type == BACKEND_TYPE_NORMAL)
+		(void) sqlite_exec(db, "PRAGMA journal_mode = WAL;",
+		    NULL, NULL, NULL);
+	else
+		(void) sqlite_exec(db, "PRAGMA synchronous = OFF;",
+		    NULL, NULL, NULL);
+}
+
+/*
+ * Fold the write-ahead log of db back into the database file at path, so
+ * that the file can be copied by itself.  This only fails if the log
+ * holds changes and someone else has the database open.
+ *
+ * Can return:
+ *	REP_PROTOCOL_SUCCESS		log is empty
+ *	REP_PROTOCOL_FAIL_UNKNOWN	checkpoint failed
+ */
+static rep_protocol_responseid_t
+backend_wal_checkpoint(struct sqlite *db, const char *path)
+{
+	struct run_single_int_info info;
+	uint32_t busy = 1;
+	char *errp = NULL;
+	int r;
+
+	info.rs_out = &busy;
+	info.rs_result = REP_PROTOCOL_FAIL_NOT_FOUND;
+
+	r = sqlite_exec(db, "PRAGMA wal_checkpoint;",
+	    run_single_int_callback, &info, &errp);
+	if (r != SQLITE_OK || info.rs_result != REP_PROTOCOL_SUCCESS ||
+	    busy != 0) {
+		configd_critical("Backend checkpoint of %s failed: %s\n", path,
+		    r != SQLITE_OK && errp != NULL ? errp : "database busy");
+		free(errp);
+		return (REP_PROTOCOL_FAIL_UNKNOWN);
+	}
+	return (REP_PROTOCOL_SUCCESS);
+}
+
+/*
+ * Transactions begun with BACKEND_TX_DEFERRED commit to the log without
+ * syncing it, and return as soon as their frames are written.  The
+ * first such commit sets backend_flush_due, and backend_flush_thread()
+ * syncs the log once that time has passed, without holding be_lock, so a
+ * burst of deferred commits costs a single fsync() which no writer or
+ * reader waits for.  A BACKEND_TX_IMMEDIATE commit syncs the same log
+ * file, so it clears any pending flush.
+ *
+ * Only the persistent repository is flushed.  The non-persistent one
+ * does not survive a reboot, so it never syncs at all.
+ */
+#define	BACKEND_FLUSH_WINDOW	((hrtime_t)NANOSEC / 10)
+
+static pthread_mutex_t	backend_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	backend_flush_cv = PTHREAD_COND_INITIALIZER;
+static hrtime_t		backend_flush_due;	/* 0 if nothing to flush */
+static char		backend_flush_path[PATH_MAX];	/* log to sync */
+static int		backend_flush_threaded;	/* flush thread running */
+
+/*
+ * Sync the log named in backend_flush_path.  Called with
+ * backend_flush_lock held;  it is dropped around the fsync(), so that
+ * more commits can be deferred meanwhile.
+ */
+static void
+backend_flush_locked(void)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	(void) strlcpy(path, backend_flush_path, sizeof (path));
+	backend_flush_due = 0;
+	(void) pthread_mutex_unlock(&backend_flush_lock);
+
+	/*
+	 * If the log is gone, a checkpoint or a repository switch has
+	 * already synced everything in it.
+	 */
+	if ((fd = open(path, O_RDWR)) >= 0) {
+		if (fsync(fd) != 0)
+			configd_critical("Backend flush of %s failed: %s\n",
+			    path, strerror(errno));
+		(void) close(fd);
+	} else if (errno != ENOENT) {
+		configd_critical("Backend flush of %s failed: %s\n", path,
+		    strerror(errno));
+	}
+
+	(void) pthread_mutex_lock(&backend_flush_lock);
+}
+
+/*ARGSUSED*/
+static void *
+backend_flush_thread(void *arg)
+{
+	struct timespec ts;
+	hrtime_t now;
+
+	(void) pthread_mutex_lock(&backend_flush_lock);
+	for (;;) {
+		while (backend_flush_due == 0)
+			(void) pthread_cond_wait(&backend_flush_cv,
+			    &backend_flush_lock);
+
+		now = gethrtime();
+		if (now < backend_flush_due) {
+			(void) clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += backend_flush_due - now;
+			if (ts.tv_nsec >= NANOSEC) {
+				ts.tv_sec++;
+				ts.tv_nsec -= NANOSEC;
+			}
+			(void) pthread_cond_timedwait(&backend_flush_cv,
+			    &backend_flush_lock, &ts);
+			continue;
+		}
+		backend_flush_locked();
+	}
+	/*NOTREACHED*/
+	return (NULL);
+}
+
+/*
+ * Note that a transaction on be has committed with the given durability.
+ * Called with be_lock held.
+ */
+static void
+backend_flush_schedule(sqlite_backend_t *be, backend_durability_t d)
+{
+	if (be->be_type != BACKEND_TYPE_NORMAL || IS_MEMORY(be))
+		return;
+
+	(void) pthread_mutex_lock(&backend_flush_lock);
+	if (d == BACKEND_TX_IMMEDIATE) {
+		backend_flush_due = 0;
+	} else if (d == BACKEND_TX_DEFERRED && backend_flush_due == 0) {
+		(void) snprintf(backend_flush_path,
+		    sizeof (backend_flush_path), "%s-wal", be->be_path);
+		backend_flush_due = gethrtime() + BACKEND_FLUSH_WINDOW;
+		(void) pthread_cond_signal(&backend_flush_cv);
+	}
+	(void) pthread_mutex_unlock(&backend_flush_lock);
+}
+
+/*
+ * Make every deferred commit durable now.
+ */
+static void
+backend_flush(void)
+{
+	(void) pthread_mutex_lock(&backend_flush_lock);
+	if (backend_flush_due != 0)
+		backend_flush_locked();
+	(void) pthread_mutex_unlock(&backend_flush_lock);
+}
+
 static void
 backend_trace_sql(void *arg, const char *sql)
 {
@@ -511,8 +720,10 @@ static sqlite_backend_t *bes[BACKEND_TYPE_TOTAL];
  */
 #ifdef NATIVE_BUILD
 static boolean_t be_normal_upgraded = B_TRUE;
+static boolean_t be_normal_indexed = B_TRUE;
 #else
 static boolean_t be_normal_upgraded = B_FALSE;
+static boolean_t be_normal_indexed = B_FALSE;
 #endif	/* NATIVE_BUILD */
 
 /*
@@ -527,6 +738,144 @@ backend_is_upgraded(backend_tx_t *bt)
 	return (be_normal_upgraded);
 }
 
+/*
+ * Are the backend's value sets packed?  Until a version 5 repository is
+ * writable, and converted, its values are still one row per value.
+ */
+boolean_t
+backend_values_packed(backend_tx_t *bt)
+{
+	return (bt->bt_be->be_packed);
+}
+
+/*
+ * A set of property values is stored as the concatenation, in order, of
+ * "<length>:<value>" for each of its values, where <length> is the length
+ * of <value> in decimal.  The lengths let values contain any character,
+ * and make the packed set look like text, never a number, to sqlite.
+ *
+ * backend_values_add() appends a value to the set being built in bv, and
+ * keeps bv_hash, the 32-bit FNV-1a hash of the packed set, up to date.
+ */
+#define	BACKEND_VALUES_HASH_INIT	2166136261U
+#define	BACKEND_VALUES_HASH_PRIME	16777619U
+
+void
+backend_values_init(backend_values_t *bv)
+{
+	bzero(bv, sizeof (*bv));
+	bv->bv_hash = BACKEND_VALUES_HASH_INIT;
+}
+
+void
+backend_values_fini(backend_values_t *bv)
+{
+	free(bv->bv_buf);
+	backend_values_init(bv);
+}
+
+/*
+ * Fails with
+ *   _NO_RESOURCES - out of memory
+ */
+int
+backend_values_add(backend_values_t *bv, const char *value)
+{
+	char prefix[24];
+	size_t vlen, plen, need, size;
+	uint32_t hash;
+	char *alloc, *p;
+
+	vlen = strlen(value);
+	plen = snprintf(prefix, sizeof (prefix), "%lu:", (ulong_t)vlen);
+
+	need = bv->bv_len + plen + vlen + 1;		/* count the '\0' */
+	if (need > bv->bv_size) {
+		size = round_up_to_p2(need);
+		if ((alloc = realloc(bv->bv_buf, size)) == NULL)
+			return (REP_PROTOCOL_FAIL_NO_RESOURCES);
+		bv->bv_buf = alloc;
+		bv->bv_size = size;
+	}
+
+	p = &bv->bv_buf[bv->bv_len];
+	(void) memcpy(p, prefix, plen);
+	(void) memcpy(p + plen, value, vlen + 1);
+	bv->bv_len += plen + vlen;
+	bv->bv_count++;
+
+	for (hash = bv->bv_hash; *p != 0; p++)
+		hash = (hash ^ (uint8_t)*p) * BACKEND_VALUES_HASH_PRIME;
+	bv->bv_hash = hash;
+
+	return (REP_PROTOCOL_SUCCESS);
+}
+
+/*
+ * Returns the length of the next part of bv's packed values to store in
+ * value_part_tbl, which starts at off and holds as many whole values as
+ * fit in BACKEND_VALUES_PART_MAX bytes, or one value if it alone does not.
+ * The lengths in bv_buf have been checked by backend_values_add().
+ */
+size_t
+backend_values_part(const backend_values_t *bv, size_t off)
+{
+	const char *start = &bv->bv_buf[off];
+	const char *p = start;
+	const char *next;
+	char *colon;
+	size_t len;
+
+	while (*p != 0) {
+		len = strtoul(p, &colon, 10);
+		next = colon + 1 + len;
+		if (p != start && next - start > BACKEND_VALUES_PART_MAX)
+			break;
+		p = next;
+	}
+	return (p - start);
+}
+
+/*
+ * Unpack the count values packed in packed into out, as consecutive
+ * '\0'-terminated strings.  If out is NULL, only the space they need is
+ * computed.  Either way, *sizep is set to that size.
+ *
+ * Fails with
+ *   _UNKNOWN - packed is malformed, or does not hold count values
+ */
+int
+backend_values_unpack(const char *packed, size_t count, char *out,
+    size_t *sizep)
+{
+	const char *p = packed;
+	size_t size = 0;
+	size_t i, len;
+	char *end;
+
+	for (i = 0; i < count; i++) {
+		if (*p < '0' || *p > '9')
+			return (REP_PROTOCOL_FAIL_UNKNOWN);
+		errno = 0;
+		len = strtoul(p, &end, 10);
+		if (errno != 0 || *end != ':' ||
+		    strnlen(end + 1, len) != len)
+			return (REP_PROTOCOL_FAIL_UNKNOWN);
+		p = end + 1;
+		if (out != NULL) {
+			(void) memcpy(&out[size], p, len);
+			out[size + len] = 0;
+		}
+		p += len;
+		size += len + 1;			/* count the '\0' */
+	}
+	if (*p != 0)
+		return (REP_PROTOCOL_FAIL_UNKNOWN);
+
+	*sizep = size;
+	return (REP_PROTOCOL_SUCCESS);
+}
+
 #define	BACKEND_PANIC_TIMEOUT	(50 * MILLISEC)
 /*
  * backend_panic() -- some kind of database problem or corruption has been hit.
@@ -858,7 +1207,10 @@ backend_checkpoint_repository(sqlite_backend_t *be)
 	assert(be->be_type == BACKEND_TYPE_NORMAL);
 	assert(be->be_checkpoint == NULL); /* Only 1 checkpoint */
 
-	r = backend_copy_repository(be->be_path, REPOSITORY_CHECKPOINT, 0);
+	r = backend_wal_checkpoint(be->be_db, be->be_path);
+	if (r == REP_PROTOCOL_SUCCESS)
+		r = backend_copy_repository(be->be_path,
+		    REPOSITORY_CHECKPOINT, 0);
 	if (r == REP_PROTOCOL_SUCCESS)
 		be->be_checkpoint = REPOSITORY_CHECKPOINT;
 
@@ -1061,6 +1413,10 @@ backend_create_backup_locked(sqlite_backend_t *be, const char *name)
 		backup_type = BE_FLIGHT_ST_REPO_BACKUP;
 		use_checkpoint = 0;
 		src = be->be_path;
+
+		result = backend_wal_checkpoint(be->be_db, src);
+		if (result != REP_PROTOCOL_SUCCESS)
+			goto out;
 	}
 	flight_recorder_event(BE_FLIGHT_EV_BACKUP, backup_type);
 	if (!backend_check_backup_needed(src, finalpath)) {
@@ -1187,6 +1543,206 @@ out:
 	return (result);
 }
 
+/*ARGSUSED*/
+static int
+backend_key_format_callback(void *arg, int columns, char **vals, char **names)
+{
+	boolean_t *is_text = arg;
+
+	assert(columns == 1);
+	*is_text = (vals[0] != NULL && strcmp(vals[0], "text") == 0);
+	return (BACKEND_CALLBACK_CONTINUE);
+}
+
+/*
+ * Store the value set bv, which is too large for a single row, in
+ * value_part_tbl as the parts of value id id.
+ */
+static int
+backend_pack_values_parts(sqlite_backend_t *be, uint32_t id,
+    backend_values_t *bv, char **errp)
+{
+	size_t off, len;
+	uint32_t num;
+	char *part;
+	int r = SQLITE_OK;
+
+	for (off = 0, num = 0; r == SQLITE_OK && off < bv->bv_len;
+	    off += len, num++) {
+		len = backend_values_part(bv, off);
+		if ((part = strndup(&bv->bv_buf[off], len)) == NULL)
+			return (SQLITE_NOMEM);
+		r = sqlite_exec_printf(be->be_db,
+		    "INSERT INTO value_part_tbl "
+		    "    (part_value_id, part_num, part_value) "
+		    "VALUES (%u, %u, '%q');",
+		    NULL, NULL, errp, id, num, part);
+		free(part);
+	}
+	return (r);
+}
+
+/*
+ * Store the value set bv, read from value_tbl as value id id, in
+ * value_pack_tbl.  If an identical set is already there, links to id are
+ * moved to it instead.  Sets too large for a single row are stored in
+ * value_part_tbl, and are not shared.
+ */
+static int
+backend_pack_values_store(sqlite_backend_t *be, uint32_t id, char type,
+    backend_values_t *bv, char **errp)
+{
+	struct run_single_int_info info;
+	uint32_t dup = 0;
+	char type_str[2];
+	int r;
+
+	type_str[0] = type;
+	type_str[1] = 0;
+
+	if (bv->bv_len > BACKEND_VALUES_PART_MAX) {
+		r = sqlite_exec_printf(be->be_db,
+		    "INSERT INTO value_pack_tbl "
+		    "    (value_id, value_type, value_hash, value_count, "
+		    "    value_value) "
+		    "VALUES (%u, '%q', %u, %u, '');",
+		    NULL, NULL, errp, id, type_str, bv->bv_hash,
+		    bv->bv_count);
+		if (r == SQLITE_OK)
+			r = backend_pack_values_parts(be, id, bv, errp);
+		return (r);
+	}
+
+	info.rs_out = &dup;
+	info.rs_result = REP_PROTOCOL_FAIL_NOT_FOUND;
+	r = sqlite_exec_printf(be->be_db,
+	    "SELECT value_id FROM value_pack_tbl "
+	    "    WHERE (value_hash = %u AND value_type = '%q' AND "
+	    "    value_value = '%q');",
+	    run_single_int_callback, &info, errp, bv->bv_hash, type_str,
+	    bv->bv_buf);
+	if (r != SQLITE_OK)
+		return (r);
+
+	if (info.rs_result == REP_PROTOCOL_SUCCESS)
+		return (sqlite_exec_printf(be->be_db,
+		    "UPDATE prop_lnk_tbl SET lnk_val_id = %u "
+		    "    WHERE (lnk_val_id = %u);",
+		    NULL, NULL, errp, dup, id));
+
+	return (sqlite_exec_printf(be->be_db,
+	    "INSERT INTO value_pack_tbl "
+	    "    (value_id, value_type, value_hash, value_count, value_value) "
+	    "VALUES (%u, '%q', %u, %u, '%q');",
+	    NULL, NULL, errp, id, type_str, bv->bv_hash, bv->bv_count,
+	    bv->bv_buf));
+}
+
+/*
+ * Convert the value_tbl of a version 5 repository, which has a row for
+ * every value, to one packed row per set of values, and make the
+ * repository version 6.  Identical sets are merged, with prop_lnk_tbl
+ * changed to link to the one which is kept.  The values cached for the
+ * ids which go away stay correct:  committed values are never changed,
+ * and committed ids are never handed out again.  As with the value_order
+ * upgrade, sqlite has no ALTER TABLE, so the new value_tbl is built in a
+ * temporary table, and copied.  Sets too large for one row go straight
+ * into value_part_tbl.
+ */
+static int
+backend_pack_values(sqlite_backend_t *be, char **errp)
+{
+	backend_values_t bv;
+	sqlite_vm *vm = NULL;
+	const char **vals, **cols;
+	uint32_t id = 0, cur = 0;
+	char type = 0;
+	char *endptr;
+	int ncols, r, step;
+
+	backend_values_init(&bv);
+
+	r = sqlite_exec(be->be_db,
+	    "BEGIN TRANSACTION; "
+	    "CREATE TABLE value_pack_tbl ( "
+	    "value_id    INTEGER PRIMARY KEY, "
+	    "value_type  CHAR(1) NOT NULL, "
+	    "value_hash  INTEGER NOT NULL, "
+	    "value_count INTEGER NOT NULL, "
+	    "value_value VARCHAR NOT NULL); "
+	    "CREATE INDEX value_pack_tbl_hash ON value_pack_tbl "
+	    "(value_hash); "
+	    "CREATE TABLE value_part_tbl ( "
+	    "part_value_id INTEGER NOT NULL, "
+	    "part_num      INTEGER NOT NULL, "
+	    "part_value    VARCHAR NOT NULL); "
+	    "CREATE INDEX value_part_tbl_id ON value_part_tbl "
+	    "(part_value_id); ",
+	    NULL, NULL, errp);
+	if (r == SQLITE_OK)
+		r = sqlite_compile(be->be_db,
+		    "SELECT value_id, value_type, value_value FROM value_tbl "
+		    "ORDER BY value_id, value_order",
+		    NULL, &vm, errp);
+
+	while (r == SQLITE_OK) {
+		step = sqlite_step(vm, &ncols, &vals, &cols);
+		if (step == SQLITE_ROW) {
+			assert(ncols == 3);
+			errno = 0;
+			cur = strtoul(vals[0], &endptr, 10);
+			if (cur == 0 || *endptr != 0 || errno != 0)
+				backend_panic("malformed value_id \"%20s\"",
+				    vals[0]);
+		}
+
+		if (bv.bv_count > 0 && (step != SQLITE_ROW || cur != id)) {
+			r = backend_pack_values_store(be, id, type, &bv, errp);
+			backend_values_fini(&bv);
+		}
+		if (step != SQLITE_ROW || r != SQLITE_OK)
+			break;
+
+		id = cur;
+		type = vals[1][0];
+		if (backend_values_add(&bv, vals[2]) != REP_PROTOCOL_SUCCESS)
+			r = SQLITE_NOMEM;
+	}
+	backend_values_fini(&bv);
+
+	if (vm != NULL) {
+		if (r == SQLITE_OK)
+			r = sqlite_finalize(vm, errp);
+		else
+			(void) sqlite_finalize(vm, NULL);
+	}
+
+	if (r == SQLITE_OK)
+		r = sqlite_exec_printf(be->be_db,
+		    "DROP TABLE value_tbl; "
+		    "CREATE TABLE value_tbl ( "
+		    "value_id    INTEGER PRIMARY KEY, "
+		    "value_type  CHAR(1) NOT NULL, "
+		    "value_hash  INTEGER NOT NULL, "
+		    "value_count INTEGER NOT NULL, "
+		    "value_value VARCHAR NOT NULL); "
+		    "INSERT INTO value_tbl SELECT * FROM value_pack_tbl; "
+		    "DROP TABLE value_pack_tbl; "
+		    "CREATE INDEX value_tbl_hash ON value_tbl (value_hash); "
+		    "UPDATE schema_version SET schema_version = %d; "
+		    "COMMIT TRANSACTION; ",
+		    NULL, NULL, errp, BACKEND_SCHEMA_VERSION);
+
+	if (r != SQLITE_OK) {
+		(void) sqlite_exec(be->be_db, "ROLLBACK TRANSACTION", NULL,
+		    NULL, NULL);
+		return (r);
+	}
+	be->be_packed = 1;
+
+	return (sqlite_exec(be->be_db, "VACUUM;", NULL, NULL, errp));
+}
+
 /*
  * Check if value_tbl has been upgraded in the main database,  and
  * if not (if the value_order column is not present),  and do_upgrade is true,
@@ -1202,21 +1758,29 @@ out:
  * statement that retrieves property values.  As a result, we need to check
  * if the repository has been upgraded prior to the point when we can
  * actually carry out the update.
+ *
+ * The remaining steps change how the repository is stored and indexed,
+ * so they are carried out once the repository is writable, whether or not
+ * the value_tbl check above found it already upgraded.
  */
 void
 backend_check_upgrade(sqlite_backend_t *be, boolean_t do_upgrade)
 {
+	boolean_t is_text = B_FALSE;
 	char *errp;
-	int r;
+	int r = SQLITE_OK;
 
-	if (be_normal_upgraded)
+	if (be_normal_upgraded && (be_normal_indexed || !do_upgrade))
 		return;
 	/*
 	 * Test if upgrade is needed. If value_order column does not exist,
-	 * we need to upgrade the schema.
+	 * we need to upgrade the schema.  Packed repositories have no
+	 * value_order column, and need no such upgrade.
 	 */
-	r = sqlite_exec(be->be_db, "SELECT value_order FROM value_tbl LIMIT 1;",
-	    NULL, NULL, NULL);
+	if (!be_normal_upgraded && !be->be_packed)
+		r = sqlite_exec(be->be_db,
+		    "SELECT value_order FROM value_tbl LIMIT 1;",
+		    NULL, NULL, NULL);
 	if (r == SQLITE_ERROR && do_upgrade) {
 		/* No value_order column - needs upgrade */
 		configd_info("Upgrading SMF repository format...");
@@ -1250,6 +1814,77 @@ backend_check_upgrade(sqlite_backend_t *be, boolean_t do_upgrade)
 			/* NOTREACHED */
 		}
 	}
+	/*
+	 * Snaplevels may be shared between snapshots, so deleting a
+	 * snapshot looks up the remaining users of its levels by
+	 * snap_level_id.  Repositories created before that need the index.
+	 */
+	if (r == SQLITE_OK && do_upgrade) {
+		struct run_single_int_info info;
+		uint32_t count = 0;
+
+		errp = NULL;
+		info.rs_out = &count;
+		info.rs_result = REP_PROTOCOL_FAIL_NOT_FOUND;
+		r = sqlite_exec(be->be_db,
+		    "SELECT count(*) FROM sqlite_master "
+		    "WHERE name = 'snaplevel_tbl_level';",
+		    run_single_int_callback, &info, NULL);
+		if (r == SQLITE_OK && count == 0)
+			r = sqlite_exec(be->be_db,
+			    "CREATE INDEX snaplevel_tbl_level "
+			    "ON snaplevel_tbl (snap_level_id);",
+			    NULL, NULL, &errp);
+		if (r != SQLITE_OK) {
+			backend_panic("%s: repository upgrade failed: %s",
+			    be->be_path, errp);
+			/* NOTREACHED */
+		}
+	}
+	/*
+	 * Version 5 repositories store each value in a row of its own.
+	 * Packing each set of values into a single row leaves value_tbl
+	 * with one row, and one index entry, for each distinct set, which
+	 * is read with a single lookup.
+	 */
+	if (r == SQLITE_OK && do_upgrade && !be->be_packed) {
+		errp = NULL;
+		configd_info("Packing SMF repository values...");
+		r = backend_pack_values(be, &errp);
+		if (r == SQLITE_OK) {
+			configd_info("SMF repository value packing is "
+			    "complete.");
+		} else {
+			backend_panic("%s: repository upgrade failed: %s",
+			    be->be_path, errp);
+			/* NOTREACHED */
+		}
+	}
+	/*
+	 * Index keys are built with fixed-width binary numbers, which makes
+	 * the id lookups behind every repository request cheaper.
+	 * Repositories written by older versions of sqlite use sortable
+	 * text and have their indices rebuilt once.
+	 */
+	if (r == SQLITE_OK && do_upgrade) {
+		errp = NULL;
+		r = sqlite_exec(be->be_db, "PRAGMA key_format;",
+		    backend_key_format_callback, &is_text, &errp);
+		if (r == SQLITE_OK && is_text) {
+			configd_info("Reindexing SMF repository...");
+			r = sqlite_exec(be->be_db,
+			    "PRAGMA key_format = binary;", NULL, NULL, &errp);
+			if (r == SQLITE_OK)
+				configd_info("SMF repository reindex is "
+				    "complete.");
+		}
+		if (r != SQLITE_OK) {
+			backend_panic("%s: repository upgrade failed: %s",
+			    be->be_path, errp);
+			/* NOTREACHED */
+		}
+		be_normal_indexed = B_TRUE;
+	}
 	if (r == SQLITE_OK)
 		be_normal_upgraded = B_TRUE;
 	else
@@ -1333,6 +1968,7 @@ backend_check_readonly(sqlite_backend_t *be, int writing, hrtime_t t)
 		    BE_FLIGHT_ST_SWITCH);
 		sqlite_close(be->be_db);
 		be->be_db = new;
+		backend_set_journal_mode(be, be->be_db);
 	}
 
 	if (be->be_type == BACKEND_TYPE_NORMAL)
@@ -1480,6 +2116,21 @@ backend_create_backup(const char *name)
 	return (result);
 }
 
+/*
+ * Remove the write-ahead log of the repository at path, if there is one.
+ */
+static void
+backend_remove_wal(const char *path)
+{
+	char wal[PATH_MAX];
+
+	if (snprintf(wal, sizeof (wal), "%s-wal", path) >= sizeof (wal))
+		return;
+	if (unlink(wal) < 0 && errno != ENOENT)
+		configd_critical("Backend copy failed: remove %s: %s\n",
+		    wal, strerror(errno));
+}
+
 /*
  * This function makes a copy of the repository at src, placing the copy at
  * dst.  It is used to copy a repository on permanent storage to volatile
@@ -1554,8 +2205,11 @@ backend_copy_repository(const char *src, const char *dst, int remove_src)
 	}
 
 	/*
-	 * Rename tmppath to dst
+	 * Any write-ahead log left beside dst belongs to the old file, and
+	 * must not be applied to the new one.  Remove it, then rename
+	 * tmppath to dst.
 	 */
+	backend_remove_wal(dst);
 	if (rename(tmppath, dst) < 0) {
 		configd_critical(
 		    "Backend copy failed: rename %s to %s: %s\n",
@@ -1579,6 +2233,7 @@ out:
 			configd_critical(
 			    "Backend copy failed: remove %s: %s\n",
 			    src, strerror(errno));
+		backend_remove_wal(src);
 	}
 
 	return (res);
@@ -1604,7 +2259,8 @@ backend_switch_check(struct sqlite *be_db, char **errp)
 
 	if (r == SQLITE_OK &&
 	    info.rs_result != REP_PROTOCOL_FAIL_NOT_FOUND &&
-	    val == BACKEND_SCHEMA_VERSION)
+	    (val == BACKEND_SCHEMA_VERSION ||
+	    val == BACKEND_SCHEMA_VERSION_UNPACKED))
 		return (0);
 	else
 		return (-1);
@@ -1668,6 +2324,10 @@ backend_switch(int dir)
 		goto errout;
 	}
 
+	result = backend_wal_checkpoint(be->be_db, be->be_path);
+	if (result != REP_PROTOCOL_SUCCESS)
+		goto errout;
+
 	result = backend_copy_repository(be->be_path, dst, dir);
 	if (result != REP_PROTOCOL_SUCCESS) {
 		goto errout;
@@ -1693,6 +2353,7 @@ backend_switch(int dir)
 			} else {
 				sqlite_close(be->be_db);
 				be->be_db = new;
+				backend_set_journal_mode(be, be->be_db);
 				if (dir) {
 					/* We're back on permanent storage. */
 					be->be_ppath = NULL;
@@ -1780,7 +2441,9 @@ backend_switch_recovery(void)
 
 	if (be_db != NULL) {
 		if (backend_switch_check(be_db, &errp) == 0) {
-			if (backend_copy_repository(fast_db,
+			if (backend_wal_checkpoint(be_db, fast_db) !=
+			    REP_PROTOCOL_SUCCESS ||
+			    backend_copy_repository(fast_db,
 			    REPOSITORY_DB, 1) != REP_PROTOCOL_SUCCESS) {
 				res = BACKEND_SWITCH_FATAL;
 			}
@@ -1876,6 +2539,7 @@ backend_create(backend_type_t backend_id, const char *db_file,
 		errp = NULL;
 		goto integrity_fail;
 	}
+	backend_set_journal_mode(be, be->be_db);
 
 	/*
 	 * check if we are inited and of the correct schema version
@@ -1913,11 +2577,13 @@ backend_create(backend_type_t backend_id, const char *db_file,
 	}
 	if (r == SQLITE_OK) {
 		if (info.rs_result == REP_PROTOCOL_FAIL_NOT_FOUND ||
-		    val != BACKEND_SCHEMA_VERSION) {
+		    (val != BACKEND_SCHEMA_VERSION &&
+		    val != BACKEND_SCHEMA_VERSION_UNPACKED)) {
 			configd_critical("%s: schema version mismatch\n",
 			    db_file);
 			goto fail;
 		}
+		be->be_packed = (val == BACKEND_SCHEMA_VERSION);
 	}
 
 	/*
@@ -2144,6 +2810,19 @@ backend_tx_begin_ro(backend_type_t t, backend_tx_t **txp)
 	return (backend_tx_begin_common(t, txp, 0));
 }
 
+static void
+backend_tx_stmt_fini(backend_tx_t *tx)
+{
+	int i;
+
+	for (i = 0; i < BACKEND_TX_STMTS; i++) {
+		if (tx->bt_stmt[i] != NULL)
+			(void) sqlite_finalize(tx->bt_stmt[i], NULL);
+		tx->bt_stmt[i] = NULL;
+		tx->bt_stmt_sql[i] = NULL;
+	}
+}
+
 static void
 backend_tx_end(backend_tx_t *tx)
 {
@@ -2151,6 +2830,8 @@ backend_tx_end(backend_tx_t *tx)
 
 	be = tx->bt_be;
 
+	backend_tx_stmt_fini(tx);
+
 	if (tx->bt_full) {
 		struct sqlite *new;
 
@@ -2163,6 +2844,7 @@ backend_tx_end(backend_tx_t *tx)
 		if (new != NULL) {
 			sqlite_close(be->be_db);
 			be->be_db = new;
+			backend_set_journal_mode(be, be->be_db);
 		}
 	}
 	backend_unlock(be);
@@ -2178,24 +2860,52 @@ backend_tx_end_ro(backend_tx_t *tx)
 }
 
 /*
+ * d says how durable the transaction must be once backend_tx_commit()
+ * returns:
+ *
+ *   BACKEND_TX_IMMEDIATE - on disk
+ *   BACKEND_TX_DEFERRED  - on disk within BACKEND_FLUSH_WINDOW
+ *   BACKEND_TX_VOLATILE  - on disk with the next commit which syncs
+ *
+ * A crash can lose a deferred or volatile transaction, but never leaves
+ * the repository inconsistent.  The level only matters for the
+ * persistent repository;  commits to the non-persistent one never sync.
+ *
  * Fails with
  *   _NO_RESOURCES - out of memory
  *   _BACKEND_ACCESS
  *   _BACKEND_READONLY
  */
 int
-backend_tx_begin(backend_type_t t, backend_tx_t **txp)
+backend_tx_begin(backend_type_t t, backend_durability_t d,
+    backend_tx_t **txp)
 {
 	int r;
 	char *errmsg;
 	hrtime_t ts, vts;
+	sqlite_backend_t *be;
+	int nosync;
 
 	r = backend_tx_begin_common(t, txp, 1);
 	if (r != REP_PROTOCOL_SUCCESS)
 		return (r);
 
+	be = (*txp)->bt_be;
+	(void) pthread_mutex_lock(&backend_flush_lock);
+	if (d == BACKEND_TX_DEFERRED && !backend_flush_threaded)
+		d = BACKEND_TX_IMMEDIATE;
+	(void) pthread_mutex_unlock(&backend_flush_lock);
+	(*txp)->bt_durability = d;
+
 	ts = gethrtime();
 	vts = gethrvtime();
+	nosync = (d != BACKEND_TX_IMMEDIATE);
+	if (be->be_type == BACKEND_TYPE_NORMAL && be->be_nosync != nosync) {
+		(void) sqlite_exec(be->be_db, nosync ?
+		    "PRAGMA wal_commit_sync = OFF;" :
+		    "PRAGMA wal_commit_sync = ON;", NULL, NULL, NULL);
+		be->be_nosync = nosync;
+	}
 	r = sqlite_exec((*txp)->bt_be->be_db, "BEGIN TRANSACTION", NULL, NULL,
 	    &errmsg);
 	UPDATE_TOTALS((*txp)->bt_be, bt_exec, ts, vts);
@@ -2227,6 +2937,7 @@ backend_tx_rollback(backend_tx_t *tx)
 
 	assert(tx != NULL && tx->bt_be != NULL && !tx->bt_readonly);
 	be = tx->bt_be;
+	backend_tx_stmt_fini(tx);
 
 	ts = gethrtime();
 	vts = gethrvtime();
@@ -2254,6 +2965,7 @@ backend_tx_commit(backend_tx_t *tx)
 
 	assert(tx != NULL && tx->bt_be != NULL && !tx->bt_readonly);
 	be = tx->bt_be;
+	backend_tx_stmt_fini(tx);
 	ts = gethrtime();
 	vts = gethrvtime();
 	r = sqlite_exec(be->be_db, "COMMIT TRANSACTION", NULL, NULL,
@@ -2275,6 +2987,7 @@ backend_tx_commit(backend_tx_t *tx)
 		backend_tx_end(tx);
 		return (r);
 	}
+	backend_flush_schedule(be, tx->bt_durability);
 	backend_tx_end(tx);
 	return (REP_PROTOCOL_SUCCESS);
 }
@@ -2376,6 +3089,82 @@ backend_tx_run(backend_tx_t *tx, backend_query_t *q,
 	return (ret);
 }
 
+/*
+ * Runs the single statement sql, with its '?' parameters bound to the
+ * nargs strings in args (a NULL binds SQL NULL).  sql is compiled the
+ * first time it is run in tx, and the compiled statement is reused for
+ * the rest of the transaction, so loops inserting many rows only parse
+ * their statement once.  The cache is keyed by address, so sql should be
+ * a constant.  Any rows the statement returns are ignored.
+ *
+ * Fails with
+ *   _NO_RESOURCES - out of memory
+ */
+int
+backend_tx_run_bound(backend_tx_t *tx, const char *sql, int nargs,
+    const char **args)
+{
+	sqlite_backend_t *be;
+	sqlite_vm *vm = NULL;
+	const char **vals, **cols;
+	char *errmsg = NULL;
+	hrtime_t ts, vts;
+	int i, slot, ncols;
+	int r;
+
+	assert(tx != NULL && tx->bt_be != NULL && !tx->bt_readonly);
+	be = tx->bt_be;
+
+	ts = gethrtime();
+	vts = gethrvtime();
+
+	for (slot = 0; slot < BACKEND_TX_STMTS; slot++) {
+		if (tx->bt_stmt_sql[slot] == sql ||
+		    tx->bt_stmt_sql[slot] == NULL)
+			break;
+	}
+	if (slot < BACKEND_TX_STMTS && tx->bt_stmt_sql[slot] == sql) {
+		vm = tx->bt_stmt[slot];
+	} else {
+		r = sqlite_compile(be->be_db, sql, NULL, &vm, &errmsg);
+		if (r != SQLITE_OK) {
+			UPDATE_TOTALS(be, bt_exec, ts, vts);
+			return (backend_error(be, r, errmsg));
+		}
+		assert(vm != NULL);
+		if (slot < BACKEND_TX_STMTS) {
+			tx->bt_stmt_sql[slot] = sql;
+			tx->bt_stmt[slot] = vm;
+		}
+	}
+
+	for (i = 0; i < nargs; i++) {
+		r = sqlite_bind(vm, i + 1, args[i], -1, 0);
+		if (r != SQLITE_OK)
+			backend_panic("binding parameter %d of \"%s\": %s",
+			    i + 1, sql, sqlite_error_string(r));
+	}
+
+	while ((r = sqlite_step(vm, &ncols, &vals, &cols)) == SQLITE_ROW)
+		continue;
+
+	/*
+	 * sqlite_reset() reports the outcome of the run, and readies the
+	 * statement for the next one.
+	 */
+	if (slot < BACKEND_TX_STMTS)
+		r = sqlite_reset(vm, &errmsg);
+	else
+		r = sqlite_finalize(vm, &errmsg);
+	UPDATE_TOTALS(be, bt_exec, ts, vts);
+	if (r == SQLITE_FULL)
+		tx->bt_full = 1;
+
+	r = backend_error(be, r, errmsg);
+	assert(r != REP_PROTOCOL_DONE);
+	return (r);
+}
+
 /*
  * Returns
  *   _NO_RESOURCES - out of memory
@@ -2528,6 +3317,7 @@ backend_init_schema(sqlite_backend_t *be, const char *db_file, backend_type_t t)
 
 	assert(t == BACKEND_TYPE_NORMAL || t == BACKEND_TYPE_NONPERSIST);
 
+	be->be_packed = 1;
 	if (t == BACKEND_TYPE_NORMAL) {
 		ret = BACKEND_ADD_SCHEMA(be, db_file, tbls_normal, idxs_normal);
 	} else if (t == BACKEND_TYPE_NONPERSIST) {
@@ -2601,6 +3391,8 @@ backend_init(const char *db_file, const char *npdb_file, int have_np)
 	int r;
 	backend_switch_results_t switch_result = BACKEND_SWITCH_OK;
 	int writable_persist = 1;
+	pthread_t thr;
+	sigset_t new, old;
 
 	/* set up our temporary directory */
 	sqlite_temp_directory = "/etc/svc/volatile";
@@ -2725,6 +3517,22 @@ backend_init(const char *db_file, const char *npdb_file, int have_np)
 			abort();
 			/*NOTREACHED*/
 		}
+
+		/*
+		 * The non-persistent repository is always writable, so one
+		 * left by an older svc.configd is converted right away.
+		 */
+		if (!be->be_packed) {
+			char *errp = NULL;
+
+			if (backend_pack_values(be, &errp) != SQLITE_OK) {
+				configd_critical("%s: unable to pack values: "
+				    "%s\n", npdb_file, errp);
+				free(errp);
+				backend_destroy(be);
+				return (CONFIGD_EXIT_DATABASE_INIT_FAILED);
+			}
+		}
 		backend_create_finish(BACKEND_TYPE_NONPERSIST, be);
 
 		if (r != BACKEND_CREATE_NEED_INIT) {
@@ -2830,6 +3638,20 @@ backend_init(const char *db_file, const char *npdb_file, int have_np)
 		backend_unlock(be);
 	}
 
+	/*
+	 * Start backend_flush_thread().  If that fails, deferred
+	 * transactions are made immediate.
+	 */
+	(void) sigfillset(&new);
+	(void) pthread_sigmask(SIG_SETMASK, &new, &old);
+	if (pthread_create(&thr, NULL, backend_flush_thread, NULL) == 0) {
+		(void) pthread_detach(thr);
+		(void) pthread_mutex_lock(&backend_flush_lock);
+		backend_flush_threaded = 1;
+		(void) pthread_mutex_unlock(&backend_flush_lock);
+	}
+	(void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+
 	return (CONFIGD_EXIT_OKAY);
 }
 
@@ -2843,6 +3665,7 @@ backend_fini(void)
 
 	(void) backend_lock(BACKEND_TYPE_NORMAL, 1, &be_normal);
 	(void) backend_lock(BACKEND_TYPE_NONPERSIST, 1, &be_np);
+	backend_flush();
 }
 
 #define	QUERY_BASE	128
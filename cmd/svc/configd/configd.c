@@ -649,6 +649,9 @@ main(int argc, char *argv[])
 	if (!rc_node_init())
 		exit(CONFIGD_EXIT_INIT_FAILED);
 
+	if (!object_init())
+		exit(CONFIGD_EXIT_INIT_FAILED);
+
 	(void) pthread_attr_setdetachstate(&thread_attr,
 	    PTHREAD_CREATE_DETACHED);
 	(void) pthread_attr_setscope(&thread_attr, PTHREAD_SCOPE_SYSTEM);
@@ -109,6 +109,15 @@ typedef enum backend_type {
 	BACKEND_TYPE_TOTAL			/* backend use only */
 } backend_type_t;
 
+/*
+ * How durable a committed transaction is.  See backend_tx_begin().
+ */
+typedef enum backend_durability {
+	BACKEND_TX_IMMEDIATE	= 0,	/* synced before commit returns */
+	BACKEND_TX_DEFERRED,		/* synced shortly, off be_lock */
+	BACKEND_TX_VOLATILE		/* synced by the next sync, if any */
+} backend_durability_t;
+
 /*
  * pre-declare rc_* types
  */
@@ -749,6 +758,7 @@ int rc_snapshot_attach(rc_node_ptr_t *, rc_node_ptr_t *);
 /*
  * file_object.c
  */
+int object_init(void);
 int object_fill_children(rc_node_t *);
 int object_create(rc_node_t *, uint32_t, const char *, rc_node_t **);
 int object_create_pg(rc_node_t *, uint32_t, const char *, const char *,
@@ -792,6 +802,7 @@ void rc_snaplevel_rele(rc_snaplevel_t *);
  */
 int backend_init(const char *, const char *, int);
 boolean_t backend_is_upgraded(backend_tx_t *);
+boolean_t backend_values_packed(backend_tx_t *);
 void backend_fini(void);
 
 rep_protocol_responseid_t backend_create_backup(const char *);
@@ -819,7 +830,7 @@ backend_run_callback_f backend_fail_if_seen;	/* aborts TX if called */
 int backend_run(backend_type_t, backend_query_t *,
     backend_run_callback_f *, void *);
 
-int backend_tx_begin(backend_type_t, backend_tx_t **);
+int backend_tx_begin(backend_type_t, backend_durability_t, backend_tx_t **);
 int backend_tx_begin_ro(backend_type_t, backend_tx_t **);
 void backend_tx_end_ro(backend_tx_t *);
 
@@ -842,10 +853,33 @@ int backend_tx_run_single_int(backend_tx_t *tx, backend_query_t *q,
     uint32_t *buf);
 int backend_tx_run(backend_tx_t *, backend_query_t *,
     backend_run_callback_f *, void *);
+int backend_tx_run_bound(backend_tx_t *, const char *, int, const char **);
 
 int backend_tx_commit(backend_tx_t *);
 void backend_tx_rollback(backend_tx_t *);
 
+/*
+ * A set of property values, packed for value_tbl.  sqlite refuses rows
+ * larger than MAX_BYTES_PER_ROW (1MB), so a set longer than
+ * BACKEND_VALUES_PART_MAX is stored in value_part_tbl, split into parts
+ * by backend_values_part().
+ */
+#define	BACKEND_VALUES_PART_MAX		(512 * 1024)
+
+typedef struct backend_values {
+	char		*bv_buf;	/* the packed values */
+	size_t		bv_len;		/* strlen(bv_buf) */
+	size_t		bv_size;	/* allocated size of bv_buf */
+	uint32_t	bv_count;	/* number of values */
+	uint32_t	bv_hash;	/* hash of bv_buf */
+} backend_values_t;
+
+void backend_values_init(backend_values_t *);
+void backend_values_fini(backend_values_t *);
+int backend_values_add(backend_values_t *, const char *);
+size_t backend_values_part(const backend_values_t *, size_t);
+int backend_values_unpack(const char *, size_t, char *, size_t *);
+
 #ifdef	__cplusplus
 }
 #endif
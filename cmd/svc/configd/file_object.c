@@ -36,7 +36,9 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -51,33 +53,24 @@ typedef struct child_info {
 	rc_node_lookup_t ci_base_nl;
 } child_info_t;
 
-typedef struct delete_ent delete_ent_t;
-typedef struct delete_stack delete_stack_t;
-typedef struct delete_info delete_info_t;
-
-typedef int	delete_cb_func(delete_info_t *, const delete_ent_t *);
-
-struct delete_ent {
-	delete_cb_func	*de_cb;		/* callback */
-	uint32_t	de_backend;
-	uint32_t	de_id;
-	uint32_t	de_gen;		/* only for property groups */
-};
-
-struct delete_stack {
-	struct delete_stack *ds_next;
-	uint32_t	ds_size;	/* number of elements */
-	uint32_t	ds_cur;		/* current offset */
-	delete_ent_t	ds_buf[1];	/* actually ds_size */
-};
-#define	DELETE_STACK_SIZE(x)	offsetof(delete_stack_t, ds_buf[(x)])
+/*
+ * Deletion is done a level at a time, rather than a row at a time.  Each
+ * level collects the ids of the rows it removes into an id_set_t, and the
+ * next level down is a single "DELETE ... WHERE x IN (...)" over that set,
+ * so the number of statements run for a delete does not depend on how
+ * many property groups, snapshots or properties the entity has.
+ */
+typedef struct id_set {
+	uint32_t	*is_ids;
+	uint32_t	is_count;
+	uint32_t	is_size;
+} id_set_t;
 
-struct delete_info {
+typedef struct delete_info {
 	backend_tx_t	*di_tx;
 	backend_tx_t	*di_np_tx;
-	delete_stack_t	*di_stack;
-	delete_stack_t	*di_free;
-};
+	id_set_t	di_values[BACKEND_TYPE_TOTAL];	/* for value_gc */
+} delete_info_t;
 
 typedef struct object_info {
 	uint32_t	obj_type;
@@ -91,7 +84,7 @@ typedef struct object_info {
 	    const char *);
 	int (*obj_insert_pg_child)(backend_tx_t *, rc_node_lookup_t *,
 	    const char *, const char *, uint32_t, uint32_t);
-	int (*obj_delete_start)(rc_node_t *, delete_info_t *);
+	int (*obj_delete)(rc_node_t *, delete_info_t *);
 } object_info_t;
 
 static void
@@ -102,426 +95,530 @@ string_to_id(const char *str, uint32_t *output, const char *fieldname)
 		    str, fieldname);
 }
 
-#define	NUM_NEEDED	50
+#define	ID_SET_INITIAL	64
 
 static int
-delete_stack_push(delete_info_t *dip, uint32_t be, delete_cb_func *cb,
-    uint32_t id, uint32_t gen)
-{
-	delete_stack_t *cur = dip->di_stack;
-	delete_ent_t *ent;
-
-	if (cur == NULL || cur->ds_cur == cur->ds_size) {
-		delete_stack_t *new = dip->di_free;
-		dip->di_free = NULL;
-		if (new == NULL) {
-			new = uu_zalloc(DELETE_STACK_SIZE(NUM_NEEDED));
-			if (new == NULL)
-				return (REP_PROTOCOL_FAIL_NO_RESOURCES);
-			new->ds_size = NUM_NEEDED;
+id_set_add(id_set_t *sp, uint32_t id)
+{
+	if (sp->is_count == sp->is_size) {
+		uint32_t size = (sp->is_size == 0) ? ID_SET_INITIAL :
+		    sp->is_size * 2;
+		uint32_t *new = uu_zalloc(size * sizeof (*new));
+
+		if (new == NULL)
+			return (REP_PROTOCOL_FAIL_NO_RESOURCES);
+		if (sp->is_ids != NULL) {
+			(void) memcpy(new, sp->is_ids,
+			    sp->is_count * sizeof (*new));
+			uu_free(sp->is_ids);
 		}
-		new->ds_cur = 0;
-		new->ds_next = dip->di_stack;
-		dip->di_stack = new;
-		cur = new;
+		sp->is_ids = new;
+		sp->is_size = size;
 	}
-	assert(cur->ds_cur < cur->ds_size);
-	ent = &cur->ds_buf[cur->ds_cur++];
-
-	ent->de_backend = be;
-	ent->de_cb = cb;
-	ent->de_id = id;
-	ent->de_gen = gen;
+	sp->is_ids[sp->is_count++] = id;
 
 	return (REP_PROTOCOL_SUCCESS);
 }
 
-static int
-delete_stack_pop(delete_info_t *dip, delete_ent_t *out)
+static void
+id_set_fini(id_set_t *sp)
 {
-	delete_stack_t *cur = dip->di_stack;
-	delete_ent_t *ent;
-
-	if (cur == NULL)
-		return (0);
-	assert(cur->ds_cur > 0 && cur->ds_cur <= cur->ds_size);
-	ent = &cur->ds_buf[--cur->ds_cur];
-	if (cur->ds_cur == 0) {
-		dip->di_stack = cur->ds_next;
-		cur->ds_next = NULL;
-
-		if (dip->di_free != NULL)
-			uu_free(dip->di_free);
-		dip->di_free = cur;
-	}
-	if (ent == NULL)
-		return (0);
-
-	*out = *ent;
-	return (1);
+	uu_free(sp->is_ids);
+	(void) memset(sp, 0, sizeof (*sp));
 }
 
-static void
-delete_stack_cleanup(delete_info_t *dip)
+/*
+ * Returns the set as an SQL list, "(id, id, ...)", or NULL if we run out of
+ * memory.  The set must not be empty.  The caller must uu_free() the result.
+ */
+static char *
+id_set_list(const id_set_t *sp)
 {
-	delete_stack_t *cur;
-	while ((cur = dip->di_stack) != NULL) {
-		dip->di_stack = cur->ds_next;
+	size_t size = 3 + (size_t)sp->is_count * 12;	/* ", 4294967295" */
+	char *list;
+	size_t off;
+	uint32_t i;
 
-		uu_free(cur);
-	}
+	assert(sp->is_count > 0);
 
-	if ((cur = dip->di_free) != NULL) {
-		assert(cur->ds_next == NULL);	/* should only be one */
-		uu_free(cur);
-		dip->di_free = NULL;
-	}
+	if ((list = uu_zalloc(size)) == NULL)
+		return (NULL);
+
+	list[0] = '(';
+	off = 1;
+	for (i = 0; i < sp->is_count; i++)
+		off += snprintf(list + off, size - off, "%s%u",
+		    (i == 0) ? "" : ", ", sp->is_ids[i]);
+	(void) strlcpy(list + off, ")", size - off);
+
+	return (list);
 }
 
-struct delete_cb_info {
-	delete_info_t	*dci_dip;
-	uint32_t	dci_be;
-	delete_cb_func	*dci_cb;
-	int		dci_result;
+struct id_set_cb_info {
+	id_set_t	*isi_sets[2];	/* one per result column */
+	int		isi_result;
 };
 
 /*ARGSUSED*/
 static int
-push_delete_callback(void *data, int columns, char **vals, char **names)
+id_set_callback(void *data, int columns, char **vals, char **names)
 {
-	struct delete_cb_info *info = data;
-
-	const char *id_str = *vals++;
-	const char *gen_str = *vals++;
-
+	struct id_set_cb_info *info = data;
 	uint32_t id;
-	uint32_t gen;
-
-	assert(columns == 2);
+	int i;
 
-	string_to_id(id_str, &id, "id");
-	string_to_id(gen_str, &gen, "gen_id");
+	assert(columns > 0 && columns <= 2);
 
-	info->dci_result = delete_stack_push(info->dci_dip, info->dci_be,
-	    info->dci_cb, id, gen);
+	for (i = 0; i < columns; i++) {
+		string_to_id(vals[i], &id, names[i]);
 
-	if (info->dci_result != REP_PROTOCOL_SUCCESS)
-		return (BACKEND_CALLBACK_ABORT);
+		info->isi_result = id_set_add(info->isi_sets[i], id);
+		if (info->isi_result != REP_PROTOCOL_SUCCESS)
+			return (BACKEND_CALLBACK_ABORT);
+	}
 	return (BACKEND_CALLBACK_CONTINUE);
 }
 
+/*
+ * Runs q in tx, adding the columns of any rows returned to a and b, and
+ * frees q.
+ */
 static int
-value_delete(delete_info_t *dip, const delete_ent_t *ent)
+delete_run(backend_tx_t *tx, backend_query_t *q, id_set_t *a, id_set_t *b)
 {
-	uint32_t be = ent->de_backend;
+	struct id_set_cb_info info;
 	int r;
 
-	backend_query_t *q;
-
-	backend_tx_t *tx = (be == BACKEND_TYPE_NORMAL)? dip->di_tx :
-	    dip->di_np_tx;
-
-	q = backend_query_alloc();
+	info.isi_sets[0] = a;
+	info.isi_sets[1] = b;
+	info.isi_result = REP_PROTOCOL_SUCCESS;
 
-	backend_query_add(q,
-	    "SELECT 1 FROM prop_lnk_tbl WHERE (lnk_val_id = %d); "
-	    "DELETE FROM value_tbl WHERE (value_id = %d); ",
-	    ent->de_id, ent->de_id);
-	r = backend_tx_run(tx, q, backend_fail_if_seen, NULL);
+	r = backend_tx_run(tx, q, id_set_callback, &info);
 	backend_query_free(q);
-	if (r == REP_PROTOCOL_DONE)
-		return (REP_PROTOCOL_SUCCESS);		/* still in use */
+
+	if (r == REP_PROTOCOL_DONE) {
+		assert(info.isi_result != REP_PROTOCOL_SUCCESS);
+		return (info.isi_result);
+	}
 	return (r);
 }
 
-static int
-pg_lnk_tbl_delete(delete_info_t *dip, const delete_ent_t *ent)
+static void
+delete_info_fini(delete_info_t *dip)
 {
-	struct delete_cb_info info;
-	uint32_t be = ent->de_backend;
-	int r;
+	int be;
 
-	backend_query_t *q;
+	for (be = 0; be < BACKEND_TYPE_TOTAL; be++)
+		id_set_fini(&dip->di_values[be]);
+}
 
+/*
+ * Delete the property groups in pgs, and those of their generations which
+ * are not held by a snapshot.  Snapshots only exist in the persistent
+ * backend.  The values of the deleted properties become candidates for
+ * value_gc.
+ */
+static int
+propertygrp_delete_set(delete_info_t *dip, backend_type_t be,
+    const id_set_t *pgs)
+{
 	backend_tx_t *tx = (be == BACKEND_TYPE_NORMAL)? dip->di_tx :
 	    dip->di_np_tx;
+	backend_query_t *q;
+	char *list;
+	char *cond;
 
-	/*
-	 * For non-persistent backends, we could only have one parent, and
-	 * it's already been deleted.
-	 *
-	 * For normal backends, we need to check to see if we're in
-	 * a snapshot or are the active generation for the property
-	 * group.  If we are, there's nothing to be done.
-	 */
-	if (be == BACKEND_TYPE_NORMAL) {
-		q = backend_query_alloc();
-		backend_query_add(q,
-		    "SELECT 1 "
-		    "FROM pg_tbl "
-		    "WHERE (pg_id = %d AND pg_gen_id = %d); "
-		    "SELECT 1 "
-		    "FROM snaplevel_lnk_tbl "
-		    "WHERE (snaplvl_pg_id = %d AND snaplvl_gen_id = %d);",
-		    ent->de_id, ent->de_gen,
-		    ent->de_id, ent->de_gen);
-		r = backend_tx_run(tx, q, backend_fail_if_seen, NULL);
-		backend_query_free(q);
+	if (pgs->is_count == 0)
+		return (REP_PROTOCOL_SUCCESS);
 
-		if (r == REP_PROTOCOL_DONE)
-			return (REP_PROTOCOL_SUCCESS);	/* still in use */
-	}
+	if ((list = id_set_list(pgs)) == NULL)
+		return (REP_PROTOCOL_FAIL_NO_RESOURCES);
 
-	info.dci_dip = dip;
-	info.dci_be =  be;
-	info.dci_cb = &value_delete;
-	info.dci_result = REP_PROTOCOL_SUCCESS;
+	if (be == BACKEND_TYPE_NORMAL)
+		cond = uu_msprintf(
+		    "lnk_pg_id IN %s AND lnk_gen_id NOT IN "
+		    "    (SELECT snaplvl_gen_id FROM snaplevel_lnk_tbl "
+		    "    WHERE snaplvl_pg_id IN %s)", list, list);
+	else
+		cond = uu_msprintf("lnk_pg_id IN %s", list);
+	if (cond == NULL) {
+		uu_free(list);
+		return (REP_PROTOCOL_FAIL_NO_RESOURCES);
+	}
 
 	q = backend_query_alloc();
 	backend_query_add(q,
-	    "SELECT DISTINCT lnk_val_id, 0 FROM prop_lnk_tbl "
-	    "WHERE "
-	    "    (lnk_pg_id = %d AND lnk_gen_id = %d AND lnk_val_id NOTNULL); "
-	    "DELETE FROM prop_lnk_tbl "
-	    "WHERE (lnk_pg_id = %d AND lnk_gen_id = %d)",
-	    ent->de_id, ent->de_gen, ent->de_id, ent->de_gen);
-
-	r = backend_tx_run(tx, q, push_delete_callback, &info);
-	backend_query_free(q);
-
-	if (r == REP_PROTOCOL_DONE) {
-		assert(info.dci_result != REP_PROTOCOL_SUCCESS);
-		return (info.dci_result);
-	}
-	return (r);
+	    "SELECT DISTINCT lnk_val_id FROM prop_lnk_tbl "
+	    "    WHERE (%s AND lnk_val_id NOTNULL); "
+	    "DELETE FROM prop_lnk_tbl WHERE (%s); "
+	    "DELETE FROM pg_tbl WHERE pg_id IN %s",
+	    cond, cond, list);
+	uu_free(cond);
+	uu_free(list);
+
+	return (delete_run(tx, q, &dip->di_values[be], NULL));
 }
 
+/*
+ * Delete the property groups of parent_id, in every backend.
+ */
 static int
-propertygrp_delete(delete_info_t *dip, const delete_ent_t *ent)
+pgparent_delete(delete_info_t *dip, uint32_t parent_id)
 {
-	uint32_t be = ent->de_backend;
 	backend_query_t *q;
-	uint32_t gen;
-
+	id_set_t pgs;
 	int r;
 
-	backend_tx_t *tx = (be == BACKEND_TYPE_NORMAL)? dip->di_tx :
-	    dip->di_np_tx;
+	(void) memset(&pgs, 0, sizeof (pgs));
 
 	q = backend_query_alloc();
 	backend_query_add(q,
-	    "SELECT pg_gen_id FROM pg_tbl WHERE pg_id = %d; "
-	    "DELETE FROM pg_tbl WHERE pg_id = %d",
-	    ent->de_id, ent->de_id);
-	r = backend_tx_run_single_int(tx, q, &gen);
-	backend_query_free(q);
+	    "SELECT pg_id FROM pg_tbl WHERE pg_parent_id = %d", parent_id);
+	r = delete_run(dip->di_tx, q, &pgs, NULL);
+	if (r == REP_PROTOCOL_SUCCESS)
+		r = propertygrp_delete_set(dip, BACKEND_TYPE_NORMAL, &pgs);
+	id_set_fini(&pgs);
 
-	if (r != REP_PROTOCOL_SUCCESS)
+	if (r != REP_PROTOCOL_SUCCESS || dip->di_np_tx == NULL)
 		return (r);
 
-	return (delete_stack_push(dip, be, &pg_lnk_tbl_delete,
-	    ent->de_id, gen));
+	q = backend_query_alloc();
+	backend_query_add(q,
+	    "SELECT pg_id FROM pg_tbl WHERE pg_parent_id = %d", parent_id);
+	r = delete_run(dip->di_np_tx, q, &pgs, NULL);
+	if (r == REP_PROTOCOL_SUCCESS)
+		r = propertygrp_delete_set(dip, BACKEND_TYPE_NONPERSIST, &pgs);
+	id_set_fini(&pgs);
+
+	return (r);
+}
+
+/*
+ * Snapshots are taken far more often than their contents change, so a
+ * snaplevel whose property groups and generations are identical to one
+ * already in the repository shares that level's snaplevel_lnk_tbl rows
+ * rather than copying them;  only the snaplevel_tbl row is per-snapshot.
+ *
+ * Candidate levels are found by a summary of their contents:  the number
+ * of property groups and an order-independent hash of the (pg_id, gen_id)
+ * pairs.  A level whose summary matches is only shared once its rows have
+ * been compared with the property groups being snapshotted.  The rows of
+ * a committed level never change, so summaries are cached by level id
+ * until the level is deleted.  A level id allocated by a transaction which
+ * is rolled back is handed out again, so only the summaries of levels read
+ * back from the repository are cached, never those of levels being added.
+ */
+typedef struct snaplevel_sum {
+	struct snaplevel_sum *ss_next;
+	uint32_t	ss_level_id;
+	uint32_t	ss_count;
+	uint64_t	ss_hash;
+} snaplevel_sum_t;
+
+#define	SNAPLEVEL_SUM_HASH_SIZE	256
+#define	SNAPLEVEL_SUM_HASH(id)	\
+	(&snaplevel_sums[(id) & (SNAPLEVEL_SUM_HASH_SIZE - 1)])
+
+static pthread_mutex_t	snaplevel_sum_lock = PTHREAD_MUTEX_INITIALIZER;
+static snaplevel_sum_t	*snaplevel_sums[SNAPLEVEL_SUM_HASH_SIZE];
+
+static uint64_t
+snaplevel_pg_hash(uint32_t pg_id, uint32_t gen_id)
+{
+	uint64_t x = ((uint64_t)pg_id << 32) | gen_id;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return (x);
 }
 
 static int
-snaplevel_lnk_delete(delete_info_t *dip, const delete_ent_t *ent)
+snaplevel_sum_lookup(uint32_t level_id, uint32_t *countp, uint64_t *hashp)
 {
-	uint32_t be = ent->de_backend;
-	backend_query_t *q;
-	struct delete_cb_info info;
+	snaplevel_sum_t *sp;
 
-	int r;
+	(void) pthread_mutex_lock(&snaplevel_sum_lock);
+	for (sp = *SNAPLEVEL_SUM_HASH(level_id); sp != NULL; sp = sp->ss_next) {
+		if (sp->ss_level_id == level_id) {
+			*countp = sp->ss_count;
+			*hashp = sp->ss_hash;
+			break;
+		}
+	}
+	(void) pthread_mutex_unlock(&snaplevel_sum_lock);
 
-	backend_tx_t *tx = (be == BACKEND_TYPE_NORMAL)? dip->di_tx :
-	    dip->di_np_tx;
+	return (sp != NULL);
+}
 
-	info.dci_dip = dip;
-	info.dci_be = be;
-	info.dci_cb = &pg_lnk_tbl_delete;
-	info.dci_result = REP_PROTOCOL_SUCCESS;
+/*
+ * Failure to cache a summary only costs us a later recomputation.
+ */
+static void
+snaplevel_sum_add(uint32_t level_id, uint32_t count, uint64_t hash)
+{
+	snaplevel_sum_t **bp = SNAPLEVEL_SUM_HASH(level_id);
+	snaplevel_sum_t *sp;
 
-	q = backend_query_alloc();
-	backend_query_add(q,
-	    "SELECT snaplvl_pg_id, snaplvl_gen_id "
-	    "    FROM snaplevel_lnk_tbl "
-	    "    WHERE snaplvl_level_id = %d; "
-	    "DELETE FROM snaplevel_lnk_tbl WHERE snaplvl_level_id = %d",
-	    ent->de_id, ent->de_id);
-	r = backend_tx_run(tx, q, push_delete_callback, &info);
-	backend_query_free(q);
+	(void) pthread_mutex_lock(&snaplevel_sum_lock);
+	for (sp = *bp; sp != NULL; sp = sp->ss_next)
+		if (sp->ss_level_id == level_id)
+			break;
+	if (sp == NULL && (sp = uu_zalloc(sizeof (*sp))) != NULL) {
+		sp->ss_level_id = level_id;
+		sp->ss_count = count;
+		sp->ss_hash = hash;
+		sp->ss_next = *bp;
+		*bp = sp;
+	}
+	(void) pthread_mutex_unlock(&snaplevel_sum_lock);
+}
 
-	if (r == REP_PROTOCOL_DONE) {
-		assert(info.dci_result != REP_PROTOCOL_SUCCESS);
-		return (info.dci_result);
+static void
+snaplevel_sum_remove(const id_set_t *levels)
+{
+	snaplevel_sum_t **spp, *sp;
+	uint32_t i;
+
+	(void) pthread_mutex_lock(&snaplevel_sum_lock);
+	for (i = 0; i < levels->is_count; i++) {
+		spp = SNAPLEVEL_SUM_HASH(levels->is_ids[i]);
+		while ((sp = *spp) != NULL) {
+			if (sp->ss_level_id == levels->is_ids[i]) {
+				*spp = sp->ss_next;
+				uu_free(sp);
+				break;
+			}
+			spp = &sp->ss_next;
+		}
 	}
-	return (r);
+	(void) pthread_mutex_unlock(&snaplevel_sum_lock);
 }
 
+/*
+ * The snapshot links to the snapshots in snaps have been removed.  Delete
+ * those snapshots which are no longer linked to, along with the snaplevels
+ * no other snapshot shares, and the property group generations which were
+ * only held by them.
+ */
 static int
-snaplevel_tbl_delete(delete_info_t *dip, const delete_ent_t *ent)
+snapshot_delete_set(delete_info_t *dip, const id_set_t *snaps)
 {
-	uint32_t be = ent->de_backend;
-	backend_tx_t *tx = (be == BACKEND_TYPE_NORMAL)? dip->di_tx :
-	    dip->di_np_tx;
-
-	struct delete_cb_info info;
+	backend_tx_t *tx = dip->di_tx;
 	backend_query_t *q;
+	id_set_t levels, pgs, gens;
+	char *list, *pglist, *genlist;
 	int r;
 
-	assert(be == BACKEND_TYPE_NORMAL);
-
-	q = backend_query_alloc();
-	backend_query_add(q,
-	    "SELECT 1 FROM snapshot_lnk_tbl WHERE lnk_snap_id = %d",
-	    ent->de_id);
-	r = backend_tx_run(tx, q, backend_fail_if_seen, NULL);
-	backend_query_free(q);
+	if (snaps->is_count == 0)
+		return (REP_PROTOCOL_SUCCESS);
 
-	if (r == REP_PROTOCOL_DONE)
-		return (REP_PROTOCOL_SUCCESS);		/* still in use */
+	(void) memset(&levels, 0, sizeof (levels));
+	(void) memset(&pgs, 0, sizeof (pgs));
+	(void) memset(&gens, 0, sizeof (gens));
 
-	info.dci_dip = dip;
-	info.dci_be = be;
-	info.dci_cb = &snaplevel_lnk_delete;
-	info.dci_result = REP_PROTOCOL_SUCCESS;
+	if ((list = id_set_list(snaps)) == NULL)
+		return (REP_PROTOCOL_FAIL_NO_RESOURCES);
 
 	q = backend_query_alloc();
 	backend_query_add(q,
-	    "SELECT snap_level_id, 0 FROM snaplevel_tbl WHERE snap_id = %d;"
-	    "DELETE FROM snaplevel_tbl WHERE snap_id = %d",
-	    ent->de_id, ent->de_id);
-	r = backend_tx_run(tx, q, push_delete_callback, &info);
-	backend_query_free(q);
-
-	if (r == REP_PROTOCOL_DONE) {
-		assert(info.dci_result != REP_PROTOCOL_SUCCESS);
-		return (info.dci_result);
+	    "SELECT snap_level_id FROM snaplevel_tbl "
+	    "    WHERE (snap_id IN %s AND snap_id NOT IN "
+	    "    (SELECT lnk_snap_id FROM snapshot_lnk_tbl "
+	    "    WHERE lnk_snap_id IN %s)); "
+	    "DELETE FROM snaplevel_tbl "
+	    "    WHERE (snap_id IN %s AND snap_id NOT IN "
+	    "    (SELECT lnk_snap_id FROM snapshot_lnk_tbl "
+	    "    WHERE lnk_snap_id IN %s))",
+	    list, list, list, list);
+	uu_free(list);
+	r = delete_run(tx, q, &levels, NULL);
+	if (r != REP_PROTOCOL_SUCCESS || levels.is_count == 0)
+		goto out;
+
+	if ((list = id_set_list(&levels)) == NULL) {
+		r = REP_PROTOCOL_FAIL_NO_RESOURCES;
+		goto out;
 	}
-	return (r);
-}
-
-static int
-snapshot_lnk_delete(delete_info_t *dip, const delete_ent_t *ent)
-{
-	uint32_t be = ent->de_backend;
-	backend_tx_t *tx = (be == BACKEND_TYPE_NORMAL)? dip->di_tx :
-	    dip->di_np_tx;
-
-	backend_query_t *q;
-	uint32_t snapid;
-	int r;
-
-	assert(be == BACKEND_TYPE_NORMAL);
-
 	q = backend_query_alloc();
 	backend_query_add(q,
-	    "SELECT lnk_snap_id FROM snapshot_lnk_tbl WHERE lnk_id = %d; "
-	    "DELETE FROM snapshot_lnk_tbl WHERE lnk_id = %d",
-	    ent->de_id, ent->de_id);
-	r = backend_tx_run_single_int(tx, q, &snapid);
-	backend_query_free(q);
-
-	if (r != REP_PROTOCOL_SUCCESS)
-		return (r);
-
-	return (delete_stack_push(dip, be, &snaplevel_tbl_delete, snapid, 0));
-}
-
-static int
-pgparent_delete_add_pgs(delete_info_t *dip, uint32_t parent_id)
-{
-	struct delete_cb_info info;
-	backend_query_t *q;
-	int r;
+	    "SELECT snaplvl_pg_id, snaplvl_gen_id FROM snaplevel_lnk_tbl "
+	    "    WHERE (snaplvl_level_id IN %s AND snaplvl_level_id NOT IN "
+	    "    (SELECT snap_level_id FROM snaplevel_tbl "
+	    "    WHERE snap_level_id IN %s)); "
+	    "DELETE FROM snaplevel_lnk_tbl "
+	    "    WHERE (snaplvl_level_id IN %s AND snaplvl_level_id NOT IN "
+	    "    (SELECT snap_level_id FROM snaplevel_tbl "
+	    "    WHERE snap_level_id IN %s))",
+	    list, list, list, list);
+	uu_free(list);
+	snaplevel_sum_remove(&levels);
+	r = delete_run(tx, q, &pgs, &gens);
+	if (r != REP_PROTOCOL_SUCCESS || gens.is_count == 0)
+		goto out;
 
-	info.dci_dip = dip;
-	info.dci_be = BACKEND_TYPE_NORMAL;
-	info.dci_cb = &propertygrp_delete;
-	info.dci_result = REP_PROTOCOL_SUCCESS;
+	/*
+	 * Generation ids are unique across property groups, so a generation
+	 * is garbage if it is neither the current generation of its property
+	 * group nor held by a remaining snaplevel.
+	 */
+	pglist = id_set_list(&pgs);
+	genlist = id_set_list(&gens);
+	list = NULL;
+	if (pglist != NULL && genlist != NULL)
+		list = uu_msprintf(
+		    "lnk_pg_id IN %s AND lnk_gen_id IN %s AND "
+		    "lnk_gen_id NOT IN (SELECT pg_gen_id FROM pg_tbl "
+		    "    WHERE pg_id IN %s) AND "
+		    "lnk_gen_id NOT IN (SELECT snaplvl_gen_id "
+		    "    FROM snaplevel_lnk_tbl WHERE snaplvl_pg_id IN %s)",
+		    pglist, genlist, pglist, pglist);
+	uu_free(pglist);
+	uu_free(genlist);
+	if (list == NULL) {
+		r = REP_PROTOCOL_FAIL_NO_RESOURCES;
+		goto out;
+	}
 
 	q = backend_query_alloc();
 	backend_query_add(q,
-	    "SELECT pg_id, 0 FROM pg_tbl WHERE pg_parent_id = %d",
-	    parent_id);
+	    "SELECT DISTINCT lnk_val_id FROM prop_lnk_tbl "
+	    "    WHERE (%s AND lnk_val_id NOTNULL); "
+	    "DELETE FROM prop_lnk_tbl WHERE (%s)",
+	    list, list);
+	uu_free(list);
+	r = delete_run(tx, q, &dip->di_values[BACKEND_TYPE_NORMAL], NULL);
+
+out:
+	id_set_fini(&levels);
+	id_set_fini(&pgs);
+	id_set_fini(&gens);
+	return (r);
+}
 
-	r = backend_tx_run(dip->di_tx, q, push_delete_callback, &info);
+/*
+ * Values are shared between the generations of a property group, and so
+ * between snapshots, and identical sets of values are shared between
+ * properties, so the deletions above do not remove them directly.
+ * Instead, once the deleting transaction has committed, the value ids it
+ * unlinked are handed to value_gc_thread(), which removes those which are
+ * no longer referenced by prop_lnk_tbl.  A transaction may link to a set
+ * again before it is collected, but the check for references is made in
+ * the collecting transaction, so collecting it later is safe.
+ */
+static pthread_mutex_t	value_gc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	value_gc_cv = PTHREAD_COND_INITIALIZER;
+static id_set_t		value_gc_pending[BACKEND_TYPE_TOTAL];
+static int		value_gc_threaded;	/* value_gc_thread() running */
 
-	if (r == REP_PROTOCOL_DONE) {
-		assert(info.dci_result != REP_PROTOCOL_SUCCESS);
-		backend_query_free(q);
-		return (info.dci_result);
-	}
-	if (r != REP_PROTOCOL_SUCCESS) {
-		backend_query_free(q);
-		return (r);
-	}
+static void
+value_gc_run(backend_type_t be, const id_set_t *vals)
+{
+	backend_tx_t *tx;
+	char *list;
+	int r;
 
-	if (dip->di_np_tx != NULL) {
-		info.dci_be = BACKEND_TYPE_NONPERSIST;
+	if (vals->is_count == 0)
+		return;
 
-		r = backend_tx_run(dip->di_np_tx, q, push_delete_callback,
-		    &info);
+	/*
+	 * If the backend has gone away or read-only since the delete, the
+	 * values are left behind;  they are unreachable, and harmless.
+	 * For the same reason, losing the collection to a crash is
+	 * harmless, so it need not wait for the disk.
+	 */
+	if (backend_tx_begin(be, BACKEND_TX_DEFERRED, &tx) !=
+	    REP_PROTOCOL_SUCCESS)
+		return;
 
-		if (r == REP_PROTOCOL_DONE) {
-			assert(info.dci_result != REP_PROTOCOL_SUCCESS);
-			backend_query_free(q);
-			return (info.dci_result);
-		}
-		if (r != REP_PROTOCOL_SUCCESS) {
-			backend_query_free(q);
-			return (r);
-		}
+	if ((list = id_set_list(vals)) == NULL) {
+		backend_tx_rollback(tx);
+		return;
 	}
-	backend_query_free(q);
-	return (REP_PROTOCOL_SUCCESS);
+	r = backend_tx_run_update(tx,
+	    "DELETE FROM value_tbl "
+	    "    WHERE (value_id IN %s AND value_id NOT IN "
+	    "    (SELECT lnk_val_id FROM prop_lnk_tbl "
+	    "    WHERE lnk_val_id IN %s)); "
+	    "DELETE FROM value_part_tbl "
+	    "    WHERE (part_value_id IN %s AND part_value_id NOT IN "
+	    "    (SELECT value_id FROM value_tbl WHERE value_id IN %s))",
+	    list, list, list, list);
+	uu_free(list);
+
+	if (r == REP_PROTOCOL_SUCCESS)
+		(void) backend_tx_commit(tx);
+	else
+		backend_tx_rollback(tx);
 }
 
-static int
-service_delete(delete_info_t *dip, const delete_ent_t *ent)
+/*ARGSUSED*/
+static void *
+value_gc_thread(void *arg)
 {
-	int r;
-
-	r = backend_tx_run_update_changed(dip->di_tx,
-	    "DELETE FROM service_tbl WHERE svc_id = %d", ent->de_id);
-	if (r != REP_PROTOCOL_SUCCESS)
-		return (r);
+	id_set_t work[BACKEND_TYPE_TOTAL];
+	int be;
+
+	(void) pthread_mutex_lock(&value_gc_lock);
+	for (;;) {
+		while (value_gc_pending[BACKEND_TYPE_NORMAL].is_count == 0 &&
+		    value_gc_pending[BACKEND_TYPE_NONPERSIST].is_count == 0)
+			(void) pthread_cond_wait(&value_gc_cv, &value_gc_lock);
+
+		(void) memcpy(work, value_gc_pending, sizeof (work));
+		(void) memset(value_gc_pending, 0, sizeof (value_gc_pending));
+		(void) pthread_mutex_unlock(&value_gc_lock);
+
+		for (be = 0; be < BACKEND_TYPE_TOTAL; be++) {
+			value_gc_run(be, &work[be]);
+			id_set_fini(&work[be]);
+		}
 
-	return (pgparent_delete_add_pgs(dip, ent->de_id));
+		(void) pthread_mutex_lock(&value_gc_lock);
+	}
+	/*NOTREACHED*/
+	return (NULL);
 }
 
-static int
-instance_delete(delete_info_t *dip, const delete_ent_t *ent)
+/*
+ * Hand the value candidates of a committed delete to value_gc_thread(), or
+ * collect them here if it is not running.
+ */
+static void
+value_gc_schedule(delete_info_t *dip)
 {
-	struct delete_cb_info info;
-	int r;
-	backend_query_t *q;
-
-	r = backend_tx_run_update_changed(dip->di_tx,
-	    "DELETE FROM instance_tbl WHERE instance_id = %d", ent->de_id);
-	if (r != REP_PROTOCOL_SUCCESS)
-		return (r);
-
-	r = pgparent_delete_add_pgs(dip, ent->de_id);
-	if (r != REP_PROTOCOL_SUCCESS)
-		return (r);
+	id_set_t *from, *to;
+	uint32_t i;
+	int be;
+
+	(void) pthread_mutex_lock(&value_gc_lock);
+	if (!value_gc_threaded) {
+		(void) pthread_mutex_unlock(&value_gc_lock);
+		for (be = 0; be < BACKEND_TYPE_TOTAL; be++)
+			value_gc_run(be, &dip->di_values[be]);
+		return;
+	}
 
-	info.dci_dip = dip;
-	info.dci_be = BACKEND_TYPE_NORMAL;
-	info.dci_cb = &snapshot_lnk_delete;
-	info.dci_result = REP_PROTOCOL_SUCCESS;
+	for (be = 0; be < BACKEND_TYPE_TOTAL; be++) {
+		from = &dip->di_values[be];
+		to = &value_gc_pending[be];
 
-	q = backend_query_alloc();
-	backend_query_add(q,
-	    "SELECT lnk_id, 0 FROM snapshot_lnk_tbl WHERE lnk_inst_id = %d",
-	    ent->de_id);
-	r = backend_tx_run(dip->di_tx, q, push_delete_callback, &info);
-	backend_query_free(q);
-
-	if (r == REP_PROTOCOL_DONE) {
-		assert(info.dci_result != REP_PROTOCOL_SUCCESS);
-		return (info.dci_result);
+		if (to->is_count == 0) {
+			id_set_fini(to);
+			*to = *from;
+			(void) memset(from, 0, sizeof (*from));
+			continue;
+		}
+		for (i = 0; i < from->is_count; i++) {
+			if (id_set_add(to, from->is_ids[i]) !=
+			    REP_PROTOCOL_SUCCESS)
+				break;		/* leave the rest behind */
+		}
 	}
-	return (r);
+	(void) pthread_cond_signal(&value_gc_cv);
+	(void) pthread_mutex_unlock(&value_gc_lock);
 }
 
 /*ARGSUSED*/
@@ -644,11 +741,114 @@ fill_pg_callback(void *data, int columns, char **vals, char **names)
 	return (BACKEND_CALLBACK_CONTINUE);
 }
 
+/*
+ * Values are never changed once committed, and only the ids of transactions
+ * which are rolled back are handed out again, so the values read for a
+ * given (backend, value_id) can be shared by every cached property which
+ * links to them:  the unchanged properties of successive generations of a
+ * property group, the snaplevels taken from them, and, in packed
+ * repositories, any property with the same values.
+ * rn_values therefore points into a reference-counted value_block_t, which
+ * is kept in value_blocks while any property holds it, and a property whose
+ * values are already in the cache is filled without touching value_tbl.
+ */
+typedef struct value_block {
+	struct value_block *vb_next;
+	uint32_t	vb_backend;
+	uint32_t	vb_id;			/* 0 if not in value_blocks */
+	uint32_t	vb_refs;		/* protected by value_block_lock */
+	size_t		vb_count;
+	size_t		vb_size;
+	uint64_t	vb_data[1];		/* actually vb_size bytes */
+} value_block_t;
+
+#define	VALUE_BLOCK_HASH_SIZE	512
+#define	VALUE_BLOCK_HASH(id)	\
+	(&value_blocks[(id) & (VALUE_BLOCK_HASH_SIZE - 1)])
+#define	VALUE_BLOCK(vals)	\
+	((value_block_t *)((uintptr_t)(vals) - \
+	offsetof(value_block_t, vb_data)))
+
+static pthread_mutex_t	value_block_lock = PTHREAD_MUTEX_INITIALIZER;
+static value_block_t	*value_blocks[VALUE_BLOCK_HASH_SIZE];
+
+static char *
+value_block_alloc(size_t size)
+{
+	value_block_t *vbp;
+
+	vbp = uu_zalloc(offsetof(value_block_t, vb_data) + size);
+	if (vbp == NULL)
+		return (NULL);
+	vbp->vb_refs = 1;
+	vbp->vb_size = size;
+	return ((char *)vbp->vb_data);
+}
+
+/*
+ * Returns a new hold on the values for value id val_id, or NULL if they
+ * are not in the cache.
+ */
+static const char *
+value_block_lookup(uint32_t backend, uint32_t val_id, size_t *countp,
+    size_t *sizep)
+{
+	value_block_t *vbp;
+
+	(void) pthread_mutex_lock(&value_block_lock);
+	for (vbp = *VALUE_BLOCK_HASH(val_id); vbp != NULL;
+	    vbp = vbp->vb_next) {
+		if (vbp->vb_id == val_id && vbp->vb_backend == backend) {
+			vbp->vb_refs++;
+			*countp = vbp->vb_count;
+			*sizep = vbp->vb_size;
+			break;
+		}
+	}
+	(void) pthread_mutex_unlock(&value_block_lock);
+
+	return (vbp == NULL ? NULL : (const char *)vbp->vb_data);
+}
+
+/*
+ * Enter the values we just read into the cache.  If another thread beat us
+ * to it, ours are released and theirs are returned instead.
+ */
+static const char *
+value_block_insert(uint32_t backend, uint32_t val_id, char *vals,
+    size_t count)
+{
+	value_block_t **bp = VALUE_BLOCK_HASH(val_id);
+	value_block_t *vbp;
+	value_block_t *new = VALUE_BLOCK(vals);
+
+	(void) pthread_mutex_lock(&value_block_lock);
+	for (vbp = *bp; vbp != NULL; vbp = vbp->vb_next)
+		if (vbp->vb_id == val_id && vbp->vb_backend == backend)
+			break;
+	if (vbp != NULL) {
+		vbp->vb_refs++;
+	} else {
+		new->vb_backend = backend;
+		new->vb_id = val_id;
+		new->vb_count = count;
+		new->vb_next = *bp;
+		*bp = new;
+	}
+	(void) pthread_mutex_unlock(&value_block_lock);
+
+	if (vbp == NULL)
+		return (vals);
+	uu_free(new);
+	return ((const char *)vbp->vb_data);
+}
+
 struct property_value_info {
 	char		*pvi_base;
 	size_t		pvi_pos;
 	size_t		pvi_size;
 	size_t		pvi_count;
+	backend_values_t pvi_parts;	/* packed set from value_part_tbl */
 };
 
 /*ARGSUSED*/
@@ -692,12 +892,112 @@ property_value_cb(void *data, int columns, char **vals, char **names)
 	return (BACKEND_CALLBACK_CONTINUE);
 }
 
+/*
+ * Unpacks the count values packed in packed into a new value block.
+ */
+static int
+property_value_unpack(struct property_value_info *info, const char *packed,
+    size_t count)
+{
+	size_t size;
+
+	if (backend_values_unpack(packed, count, NULL, &size) !=
+	    REP_PROTOCOL_SUCCESS)
+		backend_panic("malformed value set");
+
+	info->pvi_base = value_block_alloc(size);
+	if (info->pvi_base == NULL)
+		return (BACKEND_CALLBACK_ABORT);
+	(void) backend_values_unpack(packed, count, info->pvi_base, &size);
+	info->pvi_size = size;
+	info->pvi_count = count;
+
+	return (BACKEND_CALLBACK_CONTINUE);
+}
+
+/*
+ * Reads the packed set of values of a property.  Each set is a single
+ * value_tbl row, so this is called at most once.  A set too large for
+ * one row has an empty value_value;  its count is left in pvi_count for
+ * the caller to read its parts.
+ */
+/*ARGSUSED*/
+static int
+property_value_packed_cb(void *data, int columns, char **vals, char **names)
+{
+	struct property_value_info *info = data;
+	size_t count;
+	char *endptr;
+
+	assert(columns == 2);
+
+	errno = 0;
+	count = strtoul(vals[0], &endptr, 10);
+	if (count == 0 || *endptr != 0 || errno != 0)
+		backend_panic("malformed value set");
+
+	if (vals[1][0] == 0) {
+		info->pvi_count = count;
+		return (BACKEND_CALLBACK_CONTINUE);
+	}
+	return (property_value_unpack(info, vals[1], count));
+}
+
+/*
+ * Appends a part of a packed set read from value_part_tbl to pvi_parts.
+ * The parts end on value boundaries, so each can be added as it is.
+ */
+/*ARGSUSED*/
+static int
+property_value_part_cb(void *data, int columns, char **vals, char **names)
+{
+	struct property_value_info *info = data;
+	backend_values_t *bv = &info->pvi_parts;
+	size_t len, size;
+	char *alloc;
+
+	assert(columns == 1);
+
+	len = strlen(vals[0]);
+	if (bv->bv_len + len + 1 > bv->bv_size) {
+		size = bv->bv_len + len + 1;
+		if ((alloc = realloc(bv->bv_buf, size)) == NULL)
+			return (BACKEND_CALLBACK_ABORT);
+		bv->bv_buf = alloc;
+		bv->bv_size = size;
+	}
+	(void) memcpy(&bv->bv_buf[bv->bv_len], vals[0], len + 1);
+	bv->bv_len += len;
+
+	return (BACKEND_CALLBACK_CONTINUE);
+}
+
 /*ARGSUSED*/
 void
 object_free_values(const char *vals, uint32_t type, size_t count, size_t size)
 {
-	if (vals != NULL)
-		uu_free((void *)vals);
+	value_block_t **vbpp, *vbp;
+
+	if (vals == NULL)
+		return;
+
+	vbp = VALUE_BLOCK(vals);
+
+	(void) pthread_mutex_lock(&value_block_lock);
+	assert(vbp->vb_refs > 0);
+	if (--vbp->vb_refs > 0) {
+		(void) pthread_mutex_unlock(&value_block_lock);
+		return;
+	}
+	if (vbp->vb_id != 0) {
+		for (vbpp = VALUE_BLOCK_HASH(vbp->vb_id); *vbpp != vbp;
+		    vbpp = &(*vbpp)->vb_next)
+			assert(*vbpp != NULL);
+		*vbpp = vbp->vb_next;
+	}
+	(void) pthread_mutex_unlock(&value_block_lock);
+
+	uu_free(vbp);
 }
 
 /*ARGSUSED*/
@@ -712,6 +1012,8 @@ fill_property_callback(void *data, int columns, char **vals, char **names)
 	rep_protocol_value_type_t type;
 	rc_node_lookup_t *lp = &cp->ci_base_nl;
 	struct property_value_info info;
+	const char *values = NULL;
+	uint32_t val_id;
 	int rc;
 
 	assert(columns == 4);
@@ -737,9 +1039,69 @@ fill_property_callback(void *data, int columns, char **vals, char **names)
 	lp->rl_main_id = main_id;
 
 	/*
-	 * fill in the values, if any
+	 * fill in the values, if any, sharing them if they are in-cache
 	 */
 	if ((cur = *vals++) != NULL) {
+		string_to_id(cur, &val_id, "lnk_val_id");
+		values = value_block_lookup(lp->rl_backend, val_id,
+		    &info.pvi_count, &info.pvi_size);
+	}
+	if (cur != NULL && values == NULL && backend_values_packed(tx)) {
+		rep_protocol_responseid_t r;
+		backend_query_t *q = backend_query_alloc();
+
+		backend_query_add(q,
+		    "SELECT value_count, value_value FROM value_tbl "
+		    "WHERE (value_id = %d)",
+		    val_id);
+		r = backend_tx_run(tx, q, property_value_packed_cb, &info);
+		backend_query_free(q);
+		switch (r) {
+		case REP_PROTOCOL_SUCCESS:
+			break;
+
+		case REP_PROTOCOL_DONE:		/* out of memory in callback */
+		case REP_PROTOCOL_FAIL_NO_RESOURCES:
+			return (BACKEND_CALLBACK_ABORT);
+
+		default:
+			backend_panic("backend_tx_run() returned %d", r);
+		}
+		if (info.pvi_base == NULL && info.pvi_count > 0) {
+			q = backend_query_alloc();
+			backend_query_add(q,
+			    "SELECT part_value FROM value_part_tbl "
+			    "WHERE (part_value_id = %d) ORDER BY part_num",
+			    val_id);
+			backend_values_init(&info.pvi_parts);
+			r = backend_tx_run(tx, q, property_value_part_cb,
+			    &info);
+			backend_query_free(q);
+			if (r == REP_PROTOCOL_SUCCESS &&
+			    info.pvi_parts.bv_buf == NULL)
+				backend_panic("missing value set parts");
+			if (r == REP_PROTOCOL_SUCCESS &&
+			    property_value_unpack(&info, info.pvi_parts.bv_buf,
+			    info.pvi_count) != BACKEND_CALLBACK_CONTINUE)
+				r = REP_PROTOCOL_FAIL_NO_RESOURCES;
+			backend_values_fini(&info.pvi_parts);
+			switch (r) {
+			case REP_PROTOCOL_SUCCESS:
+				break;
+
+			case REP_PROTOCOL_DONE:
+			case REP_PROTOCOL_FAIL_NO_RESOURCES:
+				return (BACKEND_CALLBACK_ABORT);
+
+			default:
+				backend_panic("backend_tx_run() returned %d",
+				    r);
+			}
+		}
+		if (info.pvi_base != NULL)
+			values = value_block_insert(lp->rl_backend, val_id,
+			    info.pvi_base, info.pvi_count);
+	} else if (cur != NULL && values == NULL) {
 		rep_protocol_responseid_t r;
 		backend_query_t *q = backend_query_alloc();
 
@@ -781,7 +1143,7 @@ fill_property_callback(void *data, int columns, char **vals, char **names)
 			backend_panic("backend_tx_run() returned %d", r);
 		}
 		if (info.pvi_size > 0) {
-			info.pvi_base = uu_zalloc(info.pvi_size);
+			info.pvi_base = value_block_alloc(info.pvi_size);
 			if (info.pvi_base == NULL) {
 				backend_query_free(q);
 				return (BACKEND_CALLBACK_ABORT);
@@ -792,7 +1154,8 @@ fill_property_callback(void *data, int columns, char **vals, char **names)
 				break;
 
 			case REP_PROTOCOL_FAIL_NO_RESOURCES:
-				uu_free(info.pvi_base);
+				object_free_values(info.pvi_base, type, 0,
+				    info.pvi_size);
 				backend_query_free(q);
 				return (BACKEND_CALLBACK_ABORT);
 
@@ -801,12 +1164,14 @@ fill_property_callback(void *data, int columns, char **vals, char **names)
 				backend_panic("backend_tx_run() returned %d",
 				    r);
 			}
+			values = value_block_insert(lp->rl_backend, val_id,
+			    info.pvi_base, info.pvi_count);
 		}
 		backend_query_free(q);
 	}
 
 	rc = rc_node_create_property(cp->ci_parent, lp, name, type,
-	    info.pvi_base, info.pvi_count, info.pvi_size);
+	    values, info.pvi_count, info.pvi_size);
 	if (rc != REP_PROTOCOL_SUCCESS) {
 		assert(rc == REP_PROTOCOL_FAIL_NO_RESOURCES);
 		return (BACKEND_CALLBACK_ABORT);
@@ -1352,8 +1717,9 @@ generic_insert_pg_child(backend_tx_t *tx, rc_node_lookup_t *lp,
 }
 
 static int
-service_delete_start(rc_node_t *np, delete_info_t *dip)
+service_delete(rc_node_t *np, delete_info_t *dip)
 {
+	uint32_t id = np->rn_id.rl_main_id;
 	int r;
 	backend_query_t *q = backend_query_alloc();
 
@@ -1361,38 +1727,111 @@ service_delete_start(rc_node_t *np, delete_info_t *dip)
 	 * Check for child instances, and refuse to delete if they exist.
 	 */
 	backend_query_add(q,
-	    "SELECT 1 FROM instance_tbl WHERE instance_svc = %d",
-	    np->rn_id.rl_main_id);
+	    "SELECT 1 FROM instance_tbl WHERE instance_svc = %d", id);
 
 	r = backend_tx_run(dip->di_tx, q, backend_fail_if_seen, NULL);
 	backend_query_free(q);
 
 	if (r == REP_PROTOCOL_DONE)
 		return (REP_PROTOCOL_FAIL_EXISTS);	/* instances exist */
+	if (r != REP_PROTOCOL_SUCCESS)
+		return (r);
+
+	r = backend_tx_run_update_changed(dip->di_tx,
+	    "DELETE FROM service_tbl WHERE svc_id = %d", id);
+	if (r != REP_PROTOCOL_SUCCESS)
+		return (r);
 
-	return (delete_stack_push(dip, BACKEND_TYPE_NORMAL, &service_delete,
-	    np->rn_id.rl_main_id, 0));
+	return (pgparent_delete(dip, id));
 }
 
 static int
-instance_delete_start(rc_node_t *np, delete_info_t *dip)
+instance_delete(rc_node_t *np, delete_info_t *dip)
 {
-	return (delete_stack_push(dip, BACKEND_TYPE_NORMAL, &instance_delete,
-	    np->rn_id.rl_main_id, 0));
+	uint32_t id = np->rn_id.rl_main_id;
+	backend_query_t *q;
+	id_set_t snaps;
+	int r;
+
+	r = backend_tx_run_update_changed(dip->di_tx,
+	    "DELETE FROM instance_tbl WHERE instance_id = %d", id);
+	if (r != REP_PROTOCOL_SUCCESS)
+		return (r);
+
+	(void) memset(&snaps, 0, sizeof (snaps));
+
+	q = backend_query_alloc();
+	backend_query_add(q,
+	    "SELECT lnk_snap_id FROM snapshot_lnk_tbl WHERE lnk_inst_id = %d; "
+	    "DELETE FROM snapshot_lnk_tbl WHERE lnk_inst_id = %d",
+	    id, id);
+	r = delete_run(dip->di_tx, q, &snaps, NULL);
+
+	/*
+	 * The property groups go first, so that generations held only by
+	 * the instance's snapshots are collected with the snapshots.
+	 */
+	if (r == REP_PROTOCOL_SUCCESS)
+		r = pgparent_delete(dip, id);
+	if (r == REP_PROTOCOL_SUCCESS)
+		r = snapshot_delete_set(dip, &snaps);
+
+	id_set_fini(&snaps);
+	return (r);
 }
 
 static int
-snapshot_delete_start(rc_node_t *np, delete_info_t *dip)
+snapshot_delete(rc_node_t *np, delete_info_t *dip)
 {
-	return (delete_stack_push(dip, BACKEND_TYPE_NORMAL,
-	    &snapshot_lnk_delete, np->rn_id.rl_main_id, 0));
+	uint32_t id = np->rn_id.rl_main_id;
+	backend_query_t *q;
+	id_set_t snaps;
+	int r;
+
+	(void) memset(&snaps, 0, sizeof (snaps));
+
+	q = backend_query_alloc();
+	backend_query_add(q,
+	    "SELECT lnk_snap_id FROM snapshot_lnk_tbl WHERE lnk_id = %d; "
+	    "DELETE FROM snapshot_lnk_tbl WHERE lnk_id = %d",
+	    id, id);
+	r = delete_run(dip->di_tx, q, &snaps, NULL);
+	if (r == REP_PROTOCOL_SUCCESS && snaps.is_count == 0)
+		r = REP_PROTOCOL_FAIL_NOT_FOUND;
+	if (r == REP_PROTOCOL_SUCCESS)
+		r = snapshot_delete_set(dip, &snaps);
+
+	id_set_fini(&snaps);
+	return (r);
 }
 
 static int
-propertygrp_delete_start(rc_node_t *np, delete_info_t *dip)
+propertygrp_delete(rc_node_t *np, delete_info_t *dip)
 {
-	return (delete_stack_push(dip, np->rn_id.rl_backend,
-	    &propertygrp_delete, np->rn_id.rl_main_id, 0));
+	backend_type_t be = np->rn_id.rl_backend;
+	backend_tx_t *tx = (be == BACKEND_TYPE_NORMAL)? dip->di_tx :
+	    dip->di_np_tx;
+	backend_query_t *q;
+	id_set_t pgs;
+	int r;
+
+	if (tx == NULL)
+		return (REP_PROTOCOL_FAIL_BACKEND_ACCESS);
+
+	(void) memset(&pgs, 0, sizeof (pgs));
+
+	q = backend_query_alloc();
+	backend_query_add(q,
+	    "SELECT pg_id FROM pg_tbl WHERE pg_id = %d",
+	    np->rn_id.rl_main_id);
+	r = delete_run(tx, q, &pgs, NULL);
+	if (r == REP_PROTOCOL_SUCCESS && pgs.is_count == 0)
+		r = REP_PROTOCOL_FAIL_NOT_FOUND;
+	if (r == REP_PROTOCOL_SUCCESS)
+		r = propertygrp_delete_set(dip, be, &pgs);
+
+	id_set_fini(&pgs);
+	return (r);
 }
 
 static object_info_t info[] = {
@@ -1413,7 +1852,7 @@ static object_info_t info[] = {
 		service_query_child,
 		service_insert_child,
 		generic_insert_pg_child,
-		service_delete_start,
+		service_delete,
 	},
 	{REP_PROTOCOL_ENTITY_INSTANCE,
 		BACKEND_ID_SERVICE_INSTANCE,
@@ -1422,7 +1861,7 @@ static object_info_t info[] = {
 		instance_query_child,
 		instance_insert_child,
 		generic_insert_pg_child,
-		instance_delete_start,
+		instance_delete,
 	},
 	{REP_PROTOCOL_ENTITY_SNAPSHOT,
 		BACKEND_ID_SNAPNAME,
@@ -1431,7 +1870,7 @@ static object_info_t info[] = {
 		NULL,
 		NULL,
 		NULL,
-		snapshot_delete_start,
+		snapshot_delete,
 	},
 	{REP_PROTOCOL_ENTITY_SNAPLEVEL,
 		BACKEND_ID_SNAPLEVEL,
@@ -1445,13 +1884,38 @@ static object_info_t info[] = {
 		NULL,
 		NULL,
 		NULL,
-		propertygrp_delete_start,
+		propertygrp_delete,
 	},
 	{REP_PROTOCOL_ENTITY_PROPERTY},
 	{-1UL}
 };
 #define	NUM_INFO (sizeof (info) / sizeof (*info))
 
+/*
+ * Starts value_gc_thread().  If that fails, deletes collect their own
+ * values as they commit.  Returns 0 only if we run out of memory.
+ */
+int
+object_init(void)
+{
+	pthread_t thr;
+	sigset_t new, old;
+	int err;
+
+	(void) sigfillset(&new);
+	(void) pthread_sigmask(SIG_SETMASK, &new, &old);
+	err = pthread_create(&thr, NULL, value_gc_thread, NULL);
+	if (err == 0) {
+		(void) pthread_detach(thr);
+		(void) pthread_mutex_lock(&value_gc_lock);
+		value_gc_threaded = 1;
+		(void) pthread_mutex_unlock(&value_gc_lock);
+	}
+	(void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return (err != ENOMEM);
+}
+
 /*
  * object_fill_children() populates the child list of an rc_node_t by calling
  * the appropriate <type>_fill_children() which runs backend queries that
@@ -1477,20 +1941,21 @@ object_delete(rc_node_t *pp)
 	int rc;
 
 	delete_info_t dip;
-	delete_ent_t de;
 
 	uint32_t type = pp->rn_id.rl_type;
 	assert(type > 0 && type < NUM_INFO);
 
-	if (info[type].obj_delete_start == NULL)
+	if (info[type].obj_delete == NULL)
 		return (REP_PROTOCOL_FAIL_BAD_REQUEST);
 
 	(void) memset(&dip, '\0', sizeof (dip));
-	rc = backend_tx_begin(BACKEND_TYPE_NORMAL, &dip.di_tx);
+	rc = backend_tx_begin(BACKEND_TYPE_NORMAL, BACKEND_TX_IMMEDIATE,
+	    &dip.di_tx);
 	if (rc != REP_PROTOCOL_SUCCESS)
 		return (rc);
 
-	rc = backend_tx_begin(BACKEND_TYPE_NONPERSIST, &dip.di_np_tx);
+	rc = backend_tx_begin(BACKEND_TYPE_NONPERSIST, BACKEND_TX_IMMEDIATE,
+	    &dip.di_np_tx);
 	if (rc == REP_PROTOCOL_FAIL_BACKEND_ACCESS ||
 	    rc == REP_PROTOCOL_FAIL_BACKEND_READONLY)
 		dip.di_np_tx = NULL;
@@ -1499,31 +1964,27 @@ object_delete(rc_node_t *pp)
 		return (rc);
 	}
 
-	if ((rc = (*info[type].obj_delete_start)(pp, &dip)) !=
+	if ((rc = (*info[type].obj_delete)(pp, &dip)) !=
 	    REP_PROTOCOL_SUCCESS) {
 		goto fail;
 	}
 
-	while (delete_stack_pop(&dip, &de)) {
-		rc = (*de.de_cb)(&dip, &de);
-		if (rc != REP_PROTOCOL_SUCCESS)
-			goto fail;
-	}
-
 	rc = backend_tx_commit(dip.di_tx);
 	if (rc != REP_PROTOCOL_SUCCESS)
 		backend_tx_rollback(dip.di_np_tx);
 	else if (dip.di_np_tx)
 		(void) backend_tx_commit(dip.di_np_tx);
 
-	delete_stack_cleanup(&dip);
+	if (rc == REP_PROTOCOL_SUCCESS)
+		value_gc_schedule(&dip);
+	delete_info_fini(&dip);
 
 	return (rc);
 
 fail:
 	backend_tx_rollback(dip.di_tx);
 	backend_tx_rollback(dip.di_np_tx);
-	delete_stack_cleanup(&dip);
+	delete_info_fini(&dip);
 	return (rc);
 }
 
@@ -1610,8 +2071,8 @@ object_create(rc_node_t *pp, uint32_t type, const char *name, rc_node_t **cpp)
 	child_info_t ci;
 	int rc;
 
-	if ((rc = backend_tx_begin(pp->rn_id.rl_backend, &tx)) !=
-	    REP_PROTOCOL_SUCCESS) {
+	if ((rc = backend_tx_begin(pp->rn_id.rl_backend, BACKEND_TX_IMMEDIATE,
+	    &tx)) != REP_PROTOCOL_SUCCESS) {
 		return (rc);
 	}
 
@@ -1678,12 +2139,14 @@ object_create_pg(rc_node_t *pp, uint32_t type, const char *name,
 
 	if (!nonpersist) {
 		lp->rl_backend = BACKEND_TYPE_NORMAL;
-		rc_wr = backend_tx_begin(BACKEND_TYPE_NORMAL, &tx_wr);
+		rc_wr = backend_tx_begin(BACKEND_TYPE_NORMAL,
+		    BACKEND_TX_IMMEDIATE, &tx_wr);
 		rc_ro = backend_tx_begin_ro(BACKEND_TYPE_NONPERSIST, &tx_ro);
 	} else {
 		lp->rl_backend = BACKEND_TYPE_NONPERSIST;
 		rc_ro = backend_tx_begin_ro(BACKEND_TYPE_NORMAL, &tx_ro);
-		rc_wr = backend_tx_begin(BACKEND_TYPE_NONPERSIST, &tx_wr);
+		rc_wr = backend_tx_begin(BACKEND_TYPE_NONPERSIST,
+		    BACKEND_TX_IMMEDIATE, &tx_wr);
 	}
 
 	if (rc_wr != REP_PROTOCOL_SUCCESS) {
@@ -1833,7 +2296,7 @@ object_fill_snapshot(rc_snapshot_t *sp)
 	    "    snap_level_instance_id, snap_level_instance "
 	    "FROM snaplevel_tbl "
 	    "WHERE snap_id = %d "
-	    "ORDER BY snap_level_id DESC",
+	    "ORDER BY snap_level_num DESC",
 	    sp->rs_snap_id);
 
 	result = backend_run(BACKEND_TYPE_NORMAL, q, fill_snapshot_cb, sp);
@@ -2093,77 +2556,283 @@ object_copy_string(void *data_arg, int columns, char **vals, char **names)
 	return (BACKEND_CALLBACK_CONTINUE);
 }
 
-struct snaplevel_add_info {
-	backend_query_t *sai_q;
-	uint32_t	sai_level_id;
-	int		sai_used;		/* sai_q has been used */
+struct snaplevel_sum_info {
+	uint32_t	ssi_count;
+	uint64_t	ssi_hash;
 };
 
 /*ARGSUSED*/
 static int
-object_snaplevel_process_pg(void *data_arg, int columns, char **vals,
-    char **names)
+snaplevel_sum_cb(void *data_arg, int columns, char **vals, char **names)
 {
-	struct snaplevel_add_info *data = data_arg;
+	struct snaplevel_sum_info *data = data_arg;
+	uint32_t pg_id, gen_id;
 
-	assert(columns == 5);
+	assert(columns == 2);
 
-	backend_query_add(data->sai_q,
-	    "INSERT INTO snaplevel_lnk_tbl "
-	    "    (snaplvl_level_id, snaplvl_pg_id, snaplvl_pg_name, "
-	    "    snaplvl_pg_type, snaplvl_pg_flags, snaplvl_gen_id)"
-	    "VALUES (%d, %s, '%q', '%q', %s, %s);",
-	    data->sai_level_id, vals[0], vals[1], vals[2], vals[3], vals[4]);
+	string_to_id(vals[0], &pg_id, "pg_id");
+	string_to_id(vals[1], &gen_id, "pg_gen_id");
 
-	data->sai_used = 1;
+	data->ssi_count++;
+	data->ssi_hash += snaplevel_pg_hash(pg_id, gen_id);
 
 	return (BACKEND_CALLBACK_CONTINUE);
 }
 
+/*
+ * The levels of the snapshots an instance already has are the candidates
+ * for sharing with a new snapshot of it.  sc_sums[] parallels
+ * sc_levels.is_ids[].
+ */
+typedef struct snaplevel_cand {
+	id_set_t	sc_levels;
+	uint32_t	*sc_nums;
+	struct snaplevel_sum_info *sc_sums;
+} snaplevel_cand_t;
+
 /*ARGSUSED*/
 static int
-object_snapshot_add_level(backend_tx_t *tx, uint32_t snap_id,
-    uint32_t snap_level_num, uint32_t svc_id, const char *svc_name,
-    uint32_t inst_id, const char *inst_name)
+snaplevel_cand_cb(void *data_arg, int columns, char **vals, char **names)
+{
+	snaplevel_cand_t *cp = data_arg;
+	uint32_t level_id, num;
+	uint32_t *nums;
+	uint32_t i;
+
+	assert(columns == 2);
+
+	string_to_id(vals[0], &level_id, "snap_level_id");
+	string_to_id(vals[1], &num, "snap_level_num");
+
+	for (i = 0; i < cp->sc_levels.is_count; i++)
+		if (cp->sc_levels.is_ids[i] == level_id)
+			return (BACKEND_CALLBACK_CONTINUE);
+
+	if (id_set_add(&cp->sc_levels, level_id) != REP_PROTOCOL_SUCCESS)
+		return (BACKEND_CALLBACK_ABORT);
+
+	if ((nums = uu_zalloc(cp->sc_levels.is_count * sizeof (*nums))) ==
+	    NULL) {
+		cp->sc_levels.is_count--;
+		return (BACKEND_CALLBACK_ABORT);
+	}
+	(void) memcpy(nums, cp->sc_nums,
+	    (cp->sc_levels.is_count - 1) * sizeof (*nums));
+	nums[cp->sc_levels.is_count - 1] = num;
+	uu_free(cp->sc_nums);
+	cp->sc_nums = nums;
+
+	return (BACKEND_CALLBACK_CONTINUE);
+}
+
+/*ARGSUSED*/
+static int
+snaplevel_cand_sum_cb(void *data_arg, int columns, char **vals, char **names)
+{
+	snaplevel_cand_t *cp = data_arg;
+	uint32_t level_id, pg_id, gen_id;
+	uint32_t i;
+
+	assert(columns == 3);
+
+	string_to_id(vals[0], &level_id, "snaplvl_level_id");
+	string_to_id(vals[1], &pg_id, "snaplvl_pg_id");
+	string_to_id(vals[2], &gen_id, "snaplvl_gen_id");
+
+	for (i = 0; i < cp->sc_levels.is_count; i++) {
+		if (cp->sc_levels.is_ids[i] == level_id) {
+			cp->sc_sums[i].ssi_count++;
+			cp->sc_sums[i].ssi_hash +=
+			    snaplevel_pg_hash(pg_id, gen_id);
+			break;
+		}
+	}
+	return (BACKEND_CALLBACK_CONTINUE);
+}
+
+static void
+snaplevel_cand_fini(snaplevel_cand_t *cp)
+{
+	id_set_fini(&cp->sc_levels);
+	uu_free(cp->sc_nums);
+	uu_free(cp->sc_sums);
+	(void) memset(cp, 0, sizeof (*cp));
+}
+
+/*
+ * Gather the levels of inst_id's current snapshots, and their summaries.
+ * Summaries which are not cached are computed with a single query.
+ */
+static int
+snaplevel_cand_init(backend_tx_t *tx, uint32_t inst_id, snaplevel_cand_t *cp)
 {
-	struct snaplevel_add_info data;
 	backend_query_t *q;
+	id_set_t missing;
+	char *list;
+	uint32_t i;
+	int r;
+
+	(void) memset(cp, 0, sizeof (*cp));
+	(void) memset(&missing, 0, sizeof (missing));
+
+	q = backend_query_alloc();
+	backend_query_add(q,
+	    "SELECT snap_level_id, snap_level_num FROM snaplevel_tbl "
+	    "    WHERE snap_id IN (SELECT lnk_snap_id FROM snapshot_lnk_tbl "
+	    "    WHERE lnk_inst_id = %d)",
+	    inst_id);
+	r = backend_tx_run(tx, q, snaplevel_cand_cb, cp);
+	backend_query_free(q);
+	if (r == REP_PROTOCOL_DONE)
+		r = REP_PROTOCOL_FAIL_NO_RESOURCES;
+	if (r != REP_PROTOCOL_SUCCESS || cp->sc_levels.is_count == 0)
+		goto out;
+
+	cp->sc_sums = uu_zalloc(cp->sc_levels.is_count * sizeof (*cp->sc_sums));
+	if (cp->sc_sums == NULL) {
+		r = REP_PROTOCOL_FAIL_NO_RESOURCES;
+		goto out;
+	}
+
+	for (i = 0; i < cp->sc_levels.is_count; i++) {
+		if (!snaplevel_sum_lookup(cp->sc_levels.is_ids[i],
+		    &cp->sc_sums[i].ssi_count, &cp->sc_sums[i].ssi_hash) &&
+		    (r = id_set_add(&missing, cp->sc_levels.is_ids[i])) !=
+		    REP_PROTOCOL_SUCCESS)
+			goto out;
+	}
+	if (missing.is_count == 0)
+		goto out;
+
+	if ((list = id_set_list(&missing)) == NULL) {
+		r = REP_PROTOCOL_FAIL_NO_RESOURCES;
+		goto out;
+	}
+	q = backend_query_alloc();
+	backend_query_add(q,
+	    "SELECT snaplvl_level_id, snaplvl_pg_id, snaplvl_gen_id "
+	    "    FROM snaplevel_lnk_tbl WHERE snaplvl_level_id IN %s",
+	    list);
+	uu_free(list);
+	r = backend_tx_run(tx, q, snaplevel_cand_sum_cb, cp);
+	backend_query_free(q);
+	if (r != REP_PROTOCOL_SUCCESS)
+		goto out;
+
+	for (i = 0; i < cp->sc_levels.is_count; i++) {
+		uint32_t count;
+		uint64_t hash;
+
+		if (!snaplevel_sum_lookup(cp->sc_levels.is_ids[i], &count,
+		    &hash))
+			snaplevel_sum_add(cp->sc_levels.is_ids[i],
+			    cp->sc_sums[i].ssi_count, cp->sc_sums[i].ssi_hash);
+	}
+
+out:
+	id_set_fini(&missing);
+	if (r != REP_PROTOCOL_SUCCESS)
+		snaplevel_cand_fini(cp);
+	return (r);
+}
+
+/*
+ * level_id has count rows.  Are they the count property groups of
+ * parent_id, at their current generations?  A level holds each property
+ * group at most once, so they are if all count rows match one.
+ */
+static int
+snaplevel_matches(backend_tx_t *tx, uint32_t level_id, uint32_t parent_id,
+    uint32_t count, int *matchp)
+{
+	backend_query_t *q;
+	uint32_t same = 0;
+	int result;
+
+	q = backend_query_alloc();
+	backend_query_add(q,
+	    "SELECT count(*) FROM snaplevel_lnk_tbl, pg_tbl "
+	    "    WHERE (snaplvl_level_id = %d AND pg_id = snaplvl_pg_id AND "
+	    "    pg_gen_id = snaplvl_gen_id AND pg_parent_id = %d);",
+	    level_id, parent_id);
+	result = backend_tx_run_single_int(tx, q, &same);
+	backend_query_free(q);
+	if (result != REP_PROTOCOL_SUCCESS)
+		return (result);
+
+	*matchp = (same == count);
+	return (REP_PROTOCOL_SUCCESS);
+}
+
+/*ARGSUSED*/
+static int
+object_snapshot_add_level(backend_tx_t *tx, const snaplevel_cand_t *cp,
+    uint32_t snap_id, uint32_t snap_level_num, uint32_t svc_id,
+    const char *svc_name, uint32_t inst_id, const char *inst_name)
+{
+	struct snaplevel_sum_info sum;
+	backend_query_t *q;
+	uint32_t parent_id = (inst_name != NULL)? inst_id : svc_id;
+	uint32_t level_id = 0;
+	uint32_t i;
+	int match;
 	int result;
 
 	assert((snap_level_num == 1 && inst_name != NULL) ||
 	    snap_level_num == 2 && inst_name == NULL);
 
-	data.sai_level_id = backend_new_id(tx, BACKEND_ID_SNAPLEVEL);
-	if (data.sai_level_id == 0) {
-		return (REP_PROTOCOL_FAIL_NO_RESOURCES);
+	sum.ssi_count = 0;
+	sum.ssi_hash = 0;
+
+	q = backend_query_alloc();
+	backend_query_add(q,
+	    "SELECT pg_id, pg_gen_id FROM pg_tbl WHERE (pg_parent_id = %d);",
+	    parent_id);
+	result = backend_tx_run(tx, q, snaplevel_sum_cb, &sum);
+	backend_query_free(q);
+	if (result != REP_PROTOCOL_SUCCESS)
+		return (result);
+
+	for (i = 0; i < cp->sc_levels.is_count; i++) {
+		if (cp->sc_nums[i] != snap_level_num ||
+		    cp->sc_sums[i].ssi_count != sum.ssi_count ||
+		    cp->sc_sums[i].ssi_hash != sum.ssi_hash)
+			continue;
+
+		result = snaplevel_matches(tx, cp->sc_levels.is_ids[i],
+		    parent_id, sum.ssi_count, &match);
+		if (result != REP_PROTOCOL_SUCCESS)
+			return (result);
+		if (match) {
+			level_id = cp->sc_levels.is_ids[i];
+			break;
+		}
 	}
 
-	result = backend_tx_run_update(tx,
+	if (level_id == 0) {
+		level_id = backend_new_id(tx, BACKEND_ID_SNAPLEVEL);
+		if (level_id == 0)
+			return (REP_PROTOCOL_FAIL_NO_RESOURCES);
+
+		result = backend_tx_run_update(tx,
+		    "INSERT INTO snaplevel_lnk_tbl "
+		    "    (snaplvl_level_id, snaplvl_pg_id, snaplvl_pg_name, "
+		    "    snaplvl_pg_type, snaplvl_pg_flags, snaplvl_gen_id) "
+		    "SELECT %d, pg_id, pg_name, pg_type, pg_flags, pg_gen_id "
+		    "    FROM pg_tbl WHERE (pg_parent_id = %d);",
+		    level_id, parent_id);
+		if (result != REP_PROTOCOL_SUCCESS)
+			return (result);
+	}
+
+	return (backend_tx_run_update(tx,
 	    "INSERT INTO snaplevel_tbl "
 	    "    (snap_id, snap_level_num, snap_level_id, "
 	    "    snap_level_service_id, snap_level_service, "
 	    "    snap_level_instance_id, snap_level_instance) "
 	    "VALUES (%d, %d, %d, %d, %Q, %d, %Q);",
-	    snap_id, snap_level_num, data.sai_level_id, svc_id, svc_name,
-	    inst_id, inst_name);
-
-	q = backend_query_alloc();
-	backend_query_add(q,
-	    "SELECT pg_id, pg_name, pg_type, pg_flags, pg_gen_id FROM pg_tbl "
-	    "WHERE (pg_parent_id = %d);",
-	    (inst_name != NULL)? inst_id : svc_id);
-
-	data.sai_q = backend_query_alloc();
-	data.sai_used = 0;
-	result = backend_tx_run(tx, q, object_snaplevel_process_pg,
-	    &data);
-	backend_query_free(q);
-
-	if (result == REP_PROTOCOL_SUCCESS && data.sai_used != 0)
-		result = backend_tx_run(tx, data.sai_q, NULL, NULL);
-	backend_query_free(data.sai_q);
-
-	return (result);
+	    snap_id, snap_level_num, level_id, svc_id, svc_name,
+	    inst_id, inst_name));
 }
 
 /*
@@ -2182,9 +2851,13 @@ object_snapshot_do_take(uint32_t instid, const char *inst_name,
 
 	char *svc_name_alloc = NULL;
 	char *inst_name_alloc = NULL;
+	snaplevel_cand_t cand;
 	uint32_t snapid;
 
-	result = backend_tx_begin(BACKEND_TYPE_NORMAL, &tx);
+	(void) memset(&cand, 0, sizeof (cand));
+
+	result = backend_tx_begin(BACKEND_TYPE_NORMAL, BACKEND_TX_IMMEDIATE,
+	    &tx);
 	if (result != REP_PROTOCOL_SUCCESS)
 		return (result);
 
@@ -2241,13 +2914,17 @@ object_snapshot_do_take(uint32_t instid, const char *inst_name,
 			goto fail;
 	}
 
-	result = object_snapshot_add_level(tx, snapid, 1,
+	result = snaplevel_cand_init(tx, instid, &cand);
+	if (result != REP_PROTOCOL_SUCCESS)
+		goto fail;
+
+	result = object_snapshot_add_level(tx, &cand, snapid, 1,
 	    svcid, svc_name, instid, inst_name);
 
 	if (result != REP_PROTOCOL_SUCCESS)
 		goto fail;
 
-	result = object_snapshot_add_level(tx, snapid, 2,
+	result = object_snapshot_add_level(tx, &cand, snapid, 2,
 	    svcid, svc_name, 0, NULL);
 
 	if (result != REP_PROTOCOL_SUCCESS)
@@ -2256,6 +2933,7 @@ object_snapshot_do_take(uint32_t instid, const char *inst_name,
 	*snapid_out = snapid;
 	*tx_out = tx;
 
+	snaplevel_cand_fini(&cand);
 	free(svc_name_alloc);
 	free(inst_name_alloc);
 
@@ -2263,6 +2941,7 @@ object_snapshot_do_take(uint32_t instid, const char *inst_name,
 
 fail:
 	backend_tx_rollback(tx);
+	snaplevel_cand_fini(&cand);
 	free(svc_name_alloc);
 	free(inst_name_alloc);
 	return (result);
@@ -2345,7 +3024,10 @@ object_snapshot_attach(rc_node_lookup_t *snapi, uint32_t *snapid_ptr,
 	int result;
 
 	delete_info_t dip;
-	delete_ent_t de;
+	id_set_t snaps;
+
+	(void) memset(&dip, 0, sizeof (dip));
+	(void) memset(&snaps, 0, sizeof (snaps));
 
 	if (snapi->rl_type != REP_PROTOCOL_ENTITY_SNAPSHOT)
 		return (REP_PROTOCOL_FAIL_TYPE_MISMATCH);
@@ -2360,7 +3042,8 @@ object_snapshot_attach(rc_node_lookup_t *snapi, uint32_t *snapid_ptr,
 		if (result != REP_PROTOCOL_SUCCESS)
 			return (result);
 	} else {
-		result = backend_tx_begin(BACKEND_TYPE_NORMAL, &tx);
+		result = backend_tx_begin(BACKEND_TYPE_NORMAL,
+		    BACKEND_TX_IMMEDIATE, &tx);
 		if (result != REP_PROTOCOL_SUCCESS)
 			return (result);
 	}
@@ -2382,33 +3065,32 @@ object_snapshot_attach(rc_node_lookup_t *snapi, uint32_t *snapid_ptr,
 		goto fail;
 
 	/*
-	 * Now we use the delete stack to handle the possible unreferencing
-	 * of oldsnapid.
+	 * Now we use the snapshot deletion code to handle the possible
+	 * unreferencing of oldsnapid.
 	 */
-	(void) memset(&dip, 0, sizeof (dip));
 	dip.di_tx = tx;
 	dip.di_np_tx = NULL;	/* no need for non-persistant backend */
 
-	if ((result = delete_stack_push(&dip, BACKEND_TYPE_NORMAL,
-	    &snaplevel_tbl_delete, oldsnapid, 0)) != REP_PROTOCOL_SUCCESS)
+	if ((result = id_set_add(&snaps, oldsnapid)) != REP_PROTOCOL_SUCCESS)
 		goto fail;
 
-	while (delete_stack_pop(&dip, &de)) {
-		result = (*de.de_cb)(&dip, &de);
-		if (result != REP_PROTOCOL_SUCCESS)
-			goto fail;
-	}
+	if ((result = snapshot_delete_set(&dip, &snaps)) !=
+	    REP_PROTOCOL_SUCCESS)
+		goto fail;
 
 	result = backend_tx_commit(tx);
 	if (result != REP_PROTOCOL_SUCCESS)
 		goto fail;
 
-	delete_stack_cleanup(&dip);
+	value_gc_schedule(&dip);
+	delete_info_fini(&dip);
+	id_set_fini(&snaps);
 	*snapid_ptr = snapid;
 	return (REP_PROTOCOL_SUCCESS);
 
 fail:
 	backend_tx_rollback(tx);
-	delete_stack_cleanup(&dip);
+	delete_info_fini(&dip);
+	id_set_fini(&snaps);
 	return (result);
 }
@@ -66,8 +66,8 @@ struct tx_commit_data {
 	uint32_t	txc_gen;
 	uint32_t	txc_oldgen;
 	short		txc_backend;
+	short		txc_pinned;		/* oldgen is in a snapshot */
 	backend_tx_t	*txc_tx;
-	backend_query_t	*txc_inserts;
 	size_t		txc_count;
 	rep_protocol_responseid_t txc_result;
 	struct tx_cmd	txc_cmds[1];		/* actually txc_count */
@@ -89,13 +89,31 @@ tx_check_genid(void *data_arg, int columns, char **vals, char **names)
 }
 
 /*
- * tx_process_property() is called once for each property in current
- * property group generation.  Its purpose is threefold:
+ * Append the names of the properties the transaction operates on to q, as
+ * an SQL list.  The transaction must not be empty.
+ */
+static void
+tx_query_add_names(backend_query_t *q, const tx_commit_data_t *data)
+{
+	size_t idx;
+
+	assert(data->txc_count > 0);
+
+	for (idx = 0; idx < data->txc_count; idx++)
+		backend_query_add(q, "%s'%q'", (idx == 0) ? "(" : ", ",
+		    data->txc_cmds[idx].tx_prop);
+	backend_query_append(q, ")");
+}
+
+/*
+ * tx_process_property() is called once for each property in the current
+ * property group generation which is mentioned in the transaction.  (The
+ * rest are carried over unchanged by object_tx_commit(), with a single
+ * UPDATE or INSERT ... SELECT.)  Its purpose is twofold:
  *
- *	1. copy properties not mentioned in the transaction over unchanged.
- *	2. mark DELETEd properties as seen (they will be left out of the new
+ *	1. mark DELETEd properties as seen (they will be left out of the new
  *	   generation).
- *	3. consistancy-check NEW, CLEAR, and REPLACE commands.
+ *	2. consistancy-check NEW, CLEAR, and REPLACE commands.
  *
  * Any consistancy problems set tx_bad, and seen properties are marked
  * tx_found.  These is used later, in tx_process_cmds().
@@ -119,13 +137,7 @@ tx_process_property(void *data_arg, int columns, char **vals, char **names)
 	    sizeof (*data->txc_cmds), tx_cmd_compare);
 
 	if (elem == NULL) {
-		backend_query_add(data->txc_inserts,
-		    "INSERT INTO prop_lnk_tbl"
-		    "    (lnk_pg_id, lnk_gen_id, lnk_prop_name, lnk_prop_type,"
-		    "    lnk_val_id) "
-		    "VALUES ( %d, %d, '%q', '%q', %Q );",
-		    data->txc_pg_id, data->txc_gen, prop_name, prop_type,
-		    lnk_val_id);
+		return (BACKEND_CALLBACK_ABORT);	/* not what we asked for */
 	} else {
 		assert(!elem->tx_found);
 		elem->tx_found = 1;
@@ -170,6 +182,116 @@ tx_process_property(void *data_arg, int columns, char **vals, char **names)
 	return (BACKEND_CALLBACK_CONTINUE);
 }
 
+/*
+ * The inserts for new and changed properties are run once per property,
+ * so they are compiled once per transaction and bound to each row in turn.
+ */
+#define	UINT32_STR_SIZE		11	/* "4294967295" */
+
+static const char tx_insert_prop_sql[] =
+	"INSERT INTO prop_lnk_tbl "
+	"    (lnk_pg_id, lnk_gen_id, lnk_prop_name, lnk_prop_type, lnk_val_id) "
+	"VALUES (?, ?, ?, ?, ?);";
+
+static const char tx_insert_value_sql[] =
+	"INSERT INTO value_tbl "
+	"    (value_id, value_type, value_hash, value_count, value_value) "
+	"VALUES (?, ?, ?, ?, ?);";
+
+static const char tx_insert_value_part_sql[] =
+	"INSERT INTO value_part_tbl (part_value_id, part_num, part_value) "
+	"VALUES (?, ?, ?);";
+
+/*
+ * Store the values packed in bv, which are too large for a single row, in
+ * value_part_tbl as the parts of value id val_id.
+ *
+ * Fails with
+ *   _NO_RESOURCES - out of memory
+ */
+static int
+tx_store_value_parts(backend_tx_t *tx, const char *val_id,
+    backend_values_t *bv)
+{
+	char num[UINT32_STR_SIZE];
+	const char *args[3];
+	size_t off, len;
+	uint32_t i;
+	char *part;
+	int r;
+
+	for (off = 0, i = 0; off < bv->bv_len; off += len, i++) {
+		len = backend_values_part(bv, off);
+		if ((part = strndup(&bv->bv_buf[off], len)) == NULL)
+			return (REP_PROTOCOL_FAIL_NO_RESOURCES);
+
+		(void) snprintf(num, sizeof (num), "%u", i);
+		args[0] = val_id;
+		args[1] = num;
+		args[2] = part;
+		r = backend_tx_run_bound(tx, tx_insert_value_part_sql, 3, args);
+		free(part);
+		if (r != REP_PROTOCOL_SUCCESS)
+			return (r);
+	}
+	return (REP_PROTOCOL_SUCCESS);
+}
+
+/*
+ * Find the id of the values of type type packed in bv, adding them to
+ * value_tbl if no property has the same set of values.  The repository
+ * is writable, and so has been converted to packed values.  A set too
+ * large for a single row is always added, to value_part_tbl, and its
+ * value_tbl row has an empty value_value.
+ *
+ * Fails with
+ *   _NO_RESOURCES - out of memory
+ */
+static int
+tx_store_values(backend_tx_t *tx, const char *type, backend_values_t *bv,
+    uint32_t *val_idp)
+{
+	backend_query_t *q;
+	char val_id[UINT32_STR_SIZE], hash[UINT32_STR_SIZE];
+	char count[UINT32_STR_SIZE];
+	const char *args[5];
+	int split = (bv->bv_len > BACKEND_VALUES_PART_MAX);
+	int r;
+
+	assert(backend_values_packed(tx));
+
+	if (!split) {
+		q = backend_query_alloc();
+		backend_query_add(q,
+		    "SELECT value_id FROM value_tbl "
+		    "    WHERE (value_hash = %u AND value_type = '%q' AND "
+		    "    value_value = '%q')",
+		    bv->bv_hash, type, bv->bv_buf);
+		r = backend_tx_run_single_int(tx, q, val_idp);
+		backend_query_free(q);
+		if (r != REP_PROTOCOL_FAIL_NOT_FOUND)
+			return (r);
+	}
+
+	if ((*val_idp = backend_new_id(tx, BACKEND_ID_VALUE)) == 0)
+		return (REP_PROTOCOL_FAIL_NO_RESOURCES);
+
+	(void) snprintf(val_id, sizeof (val_id), "%u", *val_idp);
+	(void) snprintf(hash, sizeof (hash), "%u", bv->bv_hash);
+	(void) snprintf(count, sizeof (count), "%u", bv->bv_count);
+	args[0] = val_id;
+	args[1] = type;
+	args[2] = hash;
+	args[3] = count;
+	args[4] = split ? "" : bv->bv_buf;
+	r = backend_tx_run_bound(tx, tx_insert_value_sql, 5, args);
+	if (r != REP_PROTOCOL_SUCCESS)
+		return (r);
+	if (split)
+		return (tx_store_value_parts(tx, val_id, bv));
+	return (REP_PROTOCOL_SUCCESS);
+}
+
 /*
  * tx_process_cmds() finishes the job tx_process_property() started:
  *
@@ -192,37 +314,37 @@ tx_process_cmds(tx_commit_data_t *data)
 	uint32_t val_id = 0;
 	uint8_t type[3];
 
+	char pg_id[UINT32_STR_SIZE], gen[UINT32_STR_SIZE];
+	char val_id_str[UINT32_STR_SIZE];
+	char val_type[2];
+	const char *args[5];
+	backend_values_t bv;
+
 	backend_query_t *q;
 	int do_delete;
 
+	(void) snprintf(pg_id, sizeof (pg_id), "%u", data->txc_pg_id);
+	(void) snprintf(gen, sizeof (gen), "%u", data->txc_gen);
+
 	/*
-	 * For persistent pgs, we use backend_fail_if_seen to abort the
-	 * deletion if there is a snapshot using our current state.
+	 * If no snapshot is using the old generation, remove what is left of
+	 * it:  the rows for the properties this transaction mentions.
 	 *
 	 * All of the deletions in this function are safe, since
 	 * rc_tx_commit() guarantees that all the data is in-cache.
 	 */
-	q = backend_query_alloc();
-
-	if (data->txc_backend != BACKEND_TYPE_NONPERSIST) {
+	do_delete = !data->txc_pinned;
+	if (do_delete) {
+		q = backend_query_alloc();
 		backend_query_add(q,
-		    "SELECT 1 FROM snaplevel_lnk_tbl "
-		    "    WHERE (snaplvl_pg_id = %d AND snaplvl_gen_id = %d); ",
+		    "DELETE FROM prop_lnk_tbl"
+		    "    WHERE (lnk_pg_id = %d AND lnk_gen_id = %d)",
 		    data->txc_pg_id, data->txc_oldgen);
+		r = backend_tx_run(data->txc_tx, q, NULL, NULL);
+		backend_query_free(q);
+		if (r != REP_PROTOCOL_SUCCESS)
+			return (r);
 	}
-	backend_query_add(q,
-	    "DELETE FROM prop_lnk_tbl"
-	    "    WHERE (lnk_pg_id = %d AND lnk_gen_id = %d)",
-	    data->txc_pg_id, data->txc_oldgen);
-	r = backend_tx_run(data->txc_tx, q, backend_fail_if_seen, NULL);
-	backend_query_free(q);
-
-	if (r == REP_PROTOCOL_SUCCESS)
-		do_delete = 1;
-	else if (r == REP_PROTOCOL_DONE)
-		do_delete = 0;		/* old gen_id is in use */
-	else
-		return (r);
 
 	for (idx = 0; idx < count; idx++) {
 		elem = &data->txc_cmds[idx];
@@ -257,8 +379,11 @@ tx_process_cmds(tx_commit_data_t *data)
 			    "SELECT 1 FROM prop_lnk_tbl "
 			    "    WHERE (lnk_val_id = %d); "
 			    "DELETE FROM value_tbl"
-			    "    WHERE (value_id = %d)",
-			    elem->tx_orig_value_id, elem->tx_orig_value_id);
+			    "    WHERE (value_id = %d); "
+			    "DELETE FROM value_part_tbl"
+			    "    WHERE (part_value_id = %d)",
+			    elem->tx_orig_value_id, elem->tx_orig_value_id,
+			    elem->tx_orig_value_id);
 			r = backend_tx_run(data->txc_tx, q,
 			    backend_fail_if_seen, NULL);
 			backend_query_free(q);
@@ -273,61 +398,54 @@ tx_process_cmds(tx_commit_data_t *data)
 		type[1] = REP_PROTOCOL_SUBTYPE(elem->tx_cmd->rptc_type);
 		type[2] = 0;
 
+		args[0] = pg_id;
+		args[1] = gen;
+		args[2] = elem->tx_prop;
+		args[3] = (const char *)type;
+
 		if (elem->tx_nvalues == 0) {
-			r = backend_tx_run_update(data->txc_tx,
-			    "INSERT INTO prop_lnk_tbl"
-			    "    (lnk_pg_id, lnk_gen_id, "
-			    "    lnk_prop_name, lnk_prop_type, lnk_val_id) "
-			    "VALUES ( %d, %d, '%q', '%q', NULL );",
-			    data->txc_pg_id, data->txc_gen, elem->tx_prop,
-			    type);
+			args[4] = NULL;
+			r = backend_tx_run_bound(data->txc_tx,
+			    tx_insert_prop_sql, 5, args);
 		} else {
 			uint32_t *v, i = 0;
 			const char *str;
 
-			val_id = backend_new_id(data->txc_tx, BACKEND_ID_VALUE);
-			if (val_id == 0)
-				return (REP_PROTOCOL_FAIL_NO_RESOURCES);
-			r = backend_tx_run_update(data->txc_tx,
-			    "INSERT INTO prop_lnk_tbl "
-			    "    (lnk_pg_id, lnk_gen_id, "
-			    "    lnk_prop_name, lnk_prop_type, lnk_val_id) "
-			    "VALUES ( %d, %d, '%q', '%q', %d );",
-			    data->txc_pg_id, data->txc_gen, elem->tx_prop,
-			    type, val_id);
-
+			/*
+			 * The values are stored in order, packed into a
+			 * single row which properties with the same values
+			 * share.
+			 */
+			backend_values_init(&bv);
 			v = elem->tx_values;
-
 			for (i = 0; i < elem->tx_nvalues; i++) {
 				str = (const char *)&v[1];
-
-				/*
-				 * Update values in backend,  imposing
-				 * ordering via the value_order column.
-				 * This ordering is then used in subseqent
-				 * value retrieval operations.  We can
-				 * safely assume that the repository schema
-				 * has been upgraded (and hence has the
-				 * value_order column in value_tbl),  since
-				 * it is upgraded as soon as the repository
-				 * is writable.
-				 */
-				r = backend_tx_run_update(data->txc_tx,
-				    "INSERT INTO value_tbl (value_id, "
-				    "value_type, value_value, "
-				    "value_order) VALUES (%d, '%c', "
-				    "'%q', '%d');\n",
-				    val_id, elem->tx_cmd->rptc_type,
-				    str, i);
-				if (r != REP_PROTOCOL_SUCCESS)
-					break;
+				if (backend_values_add(&bv, str) !=
+				    REP_PROTOCOL_SUCCESS) {
+					backend_values_fini(&bv);
+					return (REP_PROTOCOL_FAIL_NO_RESOURCES);
+				}
 
 				/*LINTED alignment*/
 				v = (uint32_t *)((caddr_t)str + TX_SIZE(*v));
 			}
+
+			val_type[0] = elem->tx_cmd->rptc_type;
+			val_type[1] = 0;
+			r = tx_store_values(data->txc_tx, val_type, &bv,
+			    &val_id);
+			backend_values_fini(&bv);
+			if (r != REP_PROTOCOL_SUCCESS)
+				return (r);
+
+			(void) snprintf(val_id_str, sizeof (val_id_str), "%u",
+			    val_id);
+			args[4] = val_id_str;
+			r = backend_tx_run_bound(data->txc_tx,
+			    tx_insert_prop_sql, 5, args);
 		}
 		if (r != REP_PROTOCOL_SUCCESS)
-			return (REP_PROTOCOL_FAIL_UNKNOWN);
+			return (r);
 		elem->tx_processed = 1;
 	}
 
@@ -659,7 +777,7 @@ object_tx_commit(rc_node_lookup_t *lp, tx_commit_data_t *data, uint32_t *gen)
 	backend_query_t *q;
 	int backend = lp->rl_backend;
 
-	ret = backend_tx_begin(backend, &tx);
+	ret = backend_tx_begin(backend, BACKEND_TX_IMMEDIATE, &tx);
 	if (ret != REP_PROTOCOL_SUCCESS)
 		return (ret);
 
@@ -707,15 +825,67 @@ object_tx_commit(rc_node_lookup_t *lp, tx_commit_data_t *data, uint32_t *gen)
 		goto end;
 	}
 
+	/*
+	 * For persistent pgs, we use backend_fail_if_seen to find out whether
+	 * a snapshot is using the old generation.
+	 */
+	data->txc_pinned = 0;
+	if (backend != BACKEND_TYPE_NONPERSIST) {
+		q = backend_query_alloc();
+		backend_query_add(q,
+		    "SELECT 1 FROM snaplevel_lnk_tbl "
+		    "    WHERE (snaplvl_pg_id = %d AND snaplvl_gen_id = %d)",
+		    lp->rl_main_id, *gen);
+		r = backend_tx_run(tx, q, backend_fail_if_seen, NULL);
+		backend_query_free(q);
+
+		if (r == REP_PROTOCOL_DONE) {
+			data->txc_pinned = 1;
+		} else if (r != REP_PROTOCOL_SUCCESS) {
+			backend_tx_rollback(tx);
+			goto end;
+		}
+	}
+
+	/*
+	 * Look up the properties the transaction mentions, and carry the
+	 * rest into the new generation unchanged.  Only a snapshot can still
+	 * see the old generation, so unless one does, the unchanged rows are
+	 * simply moved to the new generation rather than copied, and the
+	 * commit writes nothing for them but the new gen_id.
+	 */
 	q = backend_query_alloc();
 
 	backend_query_add(q,
 	    "SELECT lnk_prop_name, lnk_prop_type, lnk_val_id "
 	    "FROM prop_lnk_tbl "
-	    "WHERE (lnk_pg_id = %d AND lnk_gen_id = %d)",
+	    "WHERE (lnk_pg_id = %d AND lnk_gen_id = %d AND "
+	    "    lnk_prop_name IN ",
 	    lp->rl_main_id, *gen);
+	tx_query_add_names(q, data);
+	if (data->txc_pinned) {
+		backend_query_add(q,
+		    "); "
+		    "INSERT INTO prop_lnk_tbl"
+		    "    (lnk_pg_id, lnk_gen_id, lnk_prop_name, lnk_prop_type,"
+		    "    lnk_val_id) "
+		    "SELECT lnk_pg_id, %d, lnk_prop_name, lnk_prop_type, "
+		    "    lnk_val_id "
+		    "FROM prop_lnk_tbl "
+		    "WHERE (lnk_pg_id = %d AND lnk_gen_id = %d AND "
+		    "    lnk_prop_name NOT IN ",
+		    new_gen, lp->rl_main_id, *gen);
+	} else {
+		backend_query_add(q,
+		    "); "
+		    "UPDATE prop_lnk_tbl SET lnk_gen_id = %d "
+		    "WHERE (lnk_pg_id = %d AND lnk_gen_id = %d AND "
+		    "    lnk_prop_name NOT IN ",
+		    new_gen, lp->rl_main_id, *gen);
+	}
+	tx_query_add_names(q, data);
+	backend_query_append(q, ");");
 
-	data->txc_inserts = backend_query_alloc();
 	r = backend_tx_run(tx, q, tx_process_property, data);
 	backend_query_free(q);
 
@@ -724,15 +894,6 @@ object_tx_commit(rc_node_lookup_t *lp, tx_commit_data_t *data, uint32_t *gen)
 
 	if (r != REP_PROTOCOL_SUCCESS ||
 	    (r = data->txc_result) != REP_PROTOCOL_SUCCESS) {
-		backend_query_free(data->txc_inserts);
-		backend_tx_rollback(tx);
-		goto end;
-	}
-
-	r = backend_tx_run(tx, data->txc_inserts, NULL, NULL);
-	backend_query_free(data->txc_inserts);
-
-	if (r != REP_PROTOCOL_SUCCESS) {
 		backend_tx_rollback(tx);
 		goto end;
 	}
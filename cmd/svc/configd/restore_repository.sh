@@ -315,6 +315,14 @@ if [ -r "$repo" ]; then
 	fi
 fi
 
+#
+# Any write-ahead log belongs to the repository we just moved aside.  It
+# must not be applied to the backup we are about to restore.
+#
+if [ -f $repo-wal ]; then
+	mv -f $repo-wal $new-wal || rm -f $repo-wal
+fi
+
 if [ -r $errors ]; then
 	echo "$errors"
 	echo "    -- copied --> ${new}_errors"
@@ -0,0 +1,118 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Timing, allocation and check reporting for the startd benchmarks and
+ * simulations, which are standalone programs that verify what they
+ * measure.  bench_fail() may be called from any thread; a benchmark
+ * returns bench_exit() from main() so that any failed check fails the
+ * run.
+ */
+
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+
+#define	BENCH_MAX_REPORTS	10	/* failures reported in full */
+
+static pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static int bench_nfailures;
+
+/*
+ * Returns CLOCK_MONOTONIC in nanoseconds.
+ */
+int64_t
+bench_now_ns(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/*
+ * Returns nelem zeroed elements of size sz, or exits.
+ */
+void *
+bench_zalloc(size_t nelem, size_t sz)
+{
+	void *p;
+
+	if ((p = calloc(nelem == 0 ? 1 : nelem, sz)) == NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	return (p);
+}
+
+/*
+ * Counts a failed check and reports it on stderr.  Only the first
+ * BENCH_MAX_REPORTS are printed, since one bug tends to fail every
+ * check after it.
+ */
+void
+bench_fail(const char *fmt, ...)
+{
+	va_list va;
+
+	(void) pthread_mutex_lock(&bench_lock);
+	if (bench_nfailures++ < BENCH_MAX_REPORTS) {
+		va_start(va, fmt);
+		(void) vfprintf(stderr, fmt, va);
+		va_end(va);
+		(void) fputc('\n', stderr);
+	}
+	(void) pthread_mutex_unlock(&bench_lock);
+}
+
+int
+bench_failures(void)
+{
+	int n;
+
+	(void) pthread_mutex_lock(&bench_lock);
+	n = bench_nfailures;
+	(void) pthread_mutex_unlock(&bench_lock);
+	return (n);
+}
+
+/*
+ * Reports the number of failed checks and returns the exit status for
+ * main().
+ */
+int
+bench_exit(void)
+{
+	int n = bench_failures();
+
+	if (n != 0) {
+		(void) printf("%d checks failed\n", n);
+		return (1);
+	}
+	return (0);
+}
@@ -29,66 +29,199 @@
 /*
  * dict.c - simple dictionary facility
  *
- * We maintain a dictionary, sorted by name to facilitate rapid id lookup by
- * name. It is used by both the restarter and graph code.
+ * We maintain a dictionary which maps instance names (FMRIs) to the graph
+ * vertex ids by which both the restarter and graph code know them.  Ids
+ * are handed out densely from 0, and dict_lookup_byid() maps them back
+ * through the dict_byid array.
  *
- * Right now, the dictionary is implemented as a sorted linked list which maps
- * instance names to graph vertex ids.  It should eventually be converted to a
- * better representation for quick lookups.
- *
- * For now, FMRIs are never deleted from the dictionary. A service deletion
+ * FMRIs are never deleted from the dictionary. A service deletion
  * and insertion of the same instance FMRI will result in reuse of the same
  * id. To implement dictionary entry delete, the locking strategy for graph
  * vertex dependency linking must be checked for accuracy, as assumptions may
  * exist that FMRI to id mapping is retained even after an instance is deleted.
+ *
+ * Nearly every event carries an FMRI, but new FMRIs are rare once the
+ * graph is built, so lookups take no lock.  Names are hashed into an
+ * open-addressed table of entry pointers (dict_table_t), kept at most
+ * half full.  Entries never change once they are in the dictionary, and
+ * dict_insert(), serialized by dict_lock, fills in an entry before
+ * publishing it in a slot.  When the table or dict_byid has to grow, a
+ * complete copy is built and then published in place of the old one.
+ * Readers may still be using the old copies, so they are never freed;
+ * as each copy is twice the size of the last, they take no more memory
+ * than the current ones.
+ *
+ * A lookup which races with the insertion of the same name may miss it.
+ * dict_insert() checks again under dict_lock, so it never creates two ids
+ * for a name.
  */
 
-#include <sys/time.h>
-
 #include <assert.h>
+#include <errno.h>
 #include <libuutil.h>
+#include <poll.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include "startd.h"
+#include "atomic.h"
+#include "dict.h"
+
+#define	DICT_MIN_SLOTS		1024	/* power of two */
+#define	DICT_MIN_IDS		512
+
+#define	DICT_FNV_INIT		2166136261U
+#define	DICT_FNV_PRIME		16777619U
+
+/* As startd_alloc(), which is not available to standalone builds. */
+#define	DICT_ALLOC_RETRY	3
+#define	DICT_ALLOC_DELAY	10
+#define	DICT_ALLOC_DELAY_MULT	10
 
-static uu_list_pool_t *dict_pool;
 dictionary_t *dictionary;
 
-static u_longlong_t dictionary_lookups;		/* number of lookups */
-static u_longlong_t dictionary_ns_total;	/* nanoseconds spent */
+static void *
+dict_zalloc(size_t sz)
+{
+	int try, msecs;
+	void *p;
+
+	if ((p = calloc(1, sz)) != NULL)
+		return (p);
+
+	msecs = DICT_ALLOC_DELAY;
+
+	for (try = 0; (errno == EAGAIN || errno == ENOMEM) &&
+	    try < DICT_ALLOC_RETRY; ++try) {
+		(void) poll(NULL, 0, msecs);
+		if ((p = calloc(1, sz)) != NULL)
+			return (p);
+		msecs *= DICT_ALLOC_DELAY_MULT;
+	}
+
+	uu_die("Insufficient memory.\n");
+	/* NOTREACHED */
+	return (NULL);
+}
+
+static uint32_t
+dict_hash(const char *name)
+{
+	const unsigned char *p;
+	uint32_t h = DICT_FNV_INIT;
+
+	for (p = (const unsigned char *)name; *p != '\0'; p++) {
+		h ^= *p;
+		h *= DICT_FNV_PRIME;
+	}
+	return (h);
+}
+
+static dict_table_t *
+dict_table_create(uint32_t nslots)
+{
+	dict_table_t *t;
+
+	t = dict_zalloc(sizeof (dict_table_t));
+	t->dt_mask = nslots - 1;
+	t->dt_slots = dict_zalloc(nslots * sizeof (dict_entry_t *));
+
+	return (t);
+}
+
+/*
+ * Returns the slot of t holding name, or the empty slot where it belongs.
+ */
+static dict_entry_t * volatile *
+dict_table_find(const dict_table_t *t, const char *name, uint32_t h)
+{
+	dict_entry_t * volatile *slots = t->dt_slots;
+	dict_entry_t *e;
+	uint32_t i;
+
+	for (i = h & t->dt_mask; (e = slots[i]) != NULL;
+	    i = (i + 1) & t->dt_mask) {
+		membar_consumer();
+		if (e->de_hash == h && strcmp(e->de_name, name) == 0)
+			break;
+	}
+	return (&slots[i]);
+}
+
+/*
+ * Publish a copy of the table twice the size of the current one.  Called
+ * with dict_lock held.
+ */
+static void
+dict_table_grow(void)
+{
+	dict_table_t *old = dictionary->dict_table;
+	dict_table_t *t;
+	dict_entry_t *e;
+	uint32_t i;
+
+	t = dict_table_create((old->dt_mask + 1) * 2);
+	for (i = 0; i <= old->dt_mask; i++) {
+		if ((e = old->dt_slots[i]) != NULL)
+			*dict_table_find(t, e->de_name, e->de_hash) = e;
+	}
+	t->dt_retired = old;
+
+	membar_producer();
+	dictionary->dict_table = t;
+}
 
-/*ARGSUSED*/
-static int
-dict_compare(const void *lc_arg, const void *rc_arg, void *private)
+/*
+ * Publish a copy of dict_byid twice the size of the current one.  Called
+ * with dict_lock held.
+ */
+static void
+dict_byid_grow(void)
 {
-	const char *lc_name = ((const dict_entry_t *)lc_arg)->de_name;
-	const char *rc_name = ((const dict_entry_t *)rc_arg)->de_name;
+	dict_entry_t **byid;
+	int size = dictionary->dict_byid_size * 2;
+
+	byid = dict_zalloc(size * sizeof (dict_entry_t *));
+	(void) memcpy(byid, dictionary->dict_byid,
+	    dictionary->dict_byid_size * sizeof (dict_entry_t *));
 
-	return (strcmp(lc_name, rc_name));
+	membar_producer();
+	dictionary->dict_byid = byid;
+	dictionary->dict_byid_size = size;
 }
 
 int
 dict_lookup_byname(const char *name)
 {
 	int id;
-	dict_entry_t *entry, tmp;
-	hrtime_t now = gethrtime();
+	dict_table_t *t;
+	dict_entry_t *entry;
 
-	tmp.de_name = name;
-
-	(void) pthread_mutex_lock(&dictionary->dict_lock);
-	if ((entry = uu_list_find(dictionary->dict_list, &tmp, NULL,
-	    NULL)) == NULL)
+	t = dictionary->dict_table;
+	membar_consumer();
+	if ((entry = *dict_table_find(t, name, dict_hash(name))) == NULL)
 		id = -1;
 	else
 		id = entry->de_id;
 
-	(void) pthread_mutex_unlock(&dictionary->dict_lock);
+	return (id);
+}
+
+/*
+ * const char *dict_lookup_byid(int)
+ *   Returns the name with the given ID, or NULL if there is none.
+ */
+const char *
+dict_lookup_byid(int id)
+{
+	dict_entry_t **byid;
 
-	dictionary_lookups++;
-	dictionary_ns_total += gethrtime() - now;
+	if (id < 0 || id >= dictionary->dict_new_id)
+		return (NULL);
+	membar_consumer();
+	byid = dictionary->dict_byid;
+	membar_consumer();
 
-	return (id);
+	return (byid[id]->de_name);
 }
 
 /*
@@ -98,30 +231,48 @@ dict_lookup_byname(const char *name)
 int
 dict_insert(const char *name)
 {
-	dict_entry_t *entry, tmp;
-	uu_list_index_t idx;
+	dict_entry_t *entry;
+	dict_entry_t * volatile *slot;
+	dict_table_t *t;
+	uint32_t h;
+	char *n;
 
 	assert(name != NULL);
 
-	tmp.de_name = name;
+	h = dict_hash(name);
 
 	(void) pthread_mutex_lock(&dictionary->dict_lock);
 
-	if ((entry = uu_list_find(dictionary->dict_list, &tmp, NULL,
-	    &idx)) != NULL) {
+	t = dictionary->dict_table;
+	slot = dict_table_find(t, name, h);
+	if (*slot != NULL) {
 		(void) pthread_mutex_unlock(&dictionary->dict_lock);
-		return (entry->de_id);
+		return ((*slot)->de_id);
 	}
 
-	entry = startd_alloc(sizeof (dict_entry_t));
+	entry = dict_zalloc(sizeof (dict_entry_t));
+
+	entry->de_id = dictionary->dict_new_id;
+	entry->de_hash = h;
+	n = dict_zalloc(strlen(name) + 1);
+	(void) strcpy(n, name);
+	entry->de_name = n;
 
-	entry->de_id = dictionary->dict_new_id++;
-	entry->de_name = startd_alloc(strlen(name) + 1);
-	(void) strcpy((char *)entry->de_name, name);
+	if (entry->de_id == dictionary->dict_byid_size)
+		dict_byid_grow();
+	dictionary->dict_byid[entry->de_id] = entry;
 
-	uu_list_node_init(entry, &entry->de_link, dict_pool);
+	/* dict_lookup_byid() trusts any id below dict_new_id. */
+	membar_producer();
+	dictionary->dict_new_id++;
+
+	/* The entry is complete before any reader can find it. */
+	membar_producer();
+	*slot = entry;
+
+	if ((uint32_t)dictionary->dict_new_id > (t->dt_mask + 1) / 2)
+		dict_table_grow();
 
-	uu_list_insert(dictionary->dict_list, entry, idx);
 	(void) pthread_mutex_unlock(&dictionary->dict_lock);
 
 	return (entry->de_id);
@@ -130,16 +281,13 @@ dict_insert(const char *name)
 void
 dict_init()
 {
-	dictionary = startd_zalloc(sizeof (dictionary_t));
+	dictionary = dict_zalloc(sizeof (dictionary_t));
 
 	(void) pthread_mutex_init(&dictionary->dict_lock, NULL);
 
-	dict_pool = startd_list_pool_create("dict", sizeof (dict_entry_t),
-	    offsetof(dict_entry_t, de_link), dict_compare, UU_LIST_POOL_DEBUG);
-	assert(dict_pool != NULL);
-
 	dictionary->dict_new_id = 0;
-	dictionary->dict_list = startd_list_create(dict_pool, dictionary,
-	    UU_LIST_SORTED);
-	assert(dictionary->dict_list != NULL);
+	dictionary->dict_table = dict_table_create(DICT_MIN_SLOTS);
+	dictionary->dict_byid = dict_zalloc(DICT_MIN_IDS *
+	    sizeof (dict_entry_t *));
+	dictionary->dict_byid_size = DICT_MIN_IDS;
 }
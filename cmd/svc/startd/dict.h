@@ -0,0 +1,67 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_DICT_H
+#define	_DICT_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hashed dictionary of FMRIs.  See dict.c.
+ */
+typedef struct dict_entry {
+	int			de_id;
+	uint32_t		de_hash;
+	const char		*de_name;
+} dict_entry_t;
+
+typedef struct dict_table {
+	uint32_t		dt_mask;	/* number of slots - 1 */
+	dict_entry_t		**dt_slots;
+	struct dict_table	*dt_retired;	/* table this one replaced */
+} dict_table_t;
+
+typedef struct dictionary {
+	dict_table_t * volatile	dict_table;	/* name -> entry */
+	dict_entry_t ** volatile dict_byid;	/* id -> entry */
+	int			dict_byid_size;
+	volatile int		dict_new_id;
+	pthread_mutex_t		dict_lock;	/* held by writers */
+} dictionary_t;
+
+extern dictionary_t *dictionary;
+
+void dict_init(void);
+int dict_lookup_byname(const char *);
+const char *dict_lookup_byid(int);
+int dict_insert(const char *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _DICT_H */
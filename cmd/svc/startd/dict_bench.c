@@ -0,0 +1,207 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * dict_bench - dictionary lookup throughput with many threads
+ *
+ * Fills the dictionary with N FMRIs, then for each thread count runs that
+ * many threads doing lookups by name of random FMRIs, while one more
+ * thread keeps inserting new FMRIs so that the tables grow underneath the
+ * readers.  Every result is checked:  an existing FMRI must map to its
+ * id, and that id back to the FMRI;  a new one must either be missing or
+ * map to an id which maps back to it.  Reports the total and per-thread
+ * lookup rate, and exits with 1 if any check failed.  Usage:
+ *
+ *	dict_bench [-n fmris] [-l lookups] [-w inserts] [threads ...]
+ *
+ * Defaults are 10000 FMRIs, 200000 lookups per thread, 1000 inserts per
+ * run and 1, 2, 4, 8, 16 and 32 threads.
+ */
+
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "dict.h"
+
+#define	MAX_THREADS	256
+
+static int nfmris = 10000;
+static long nlookups = 200000;
+static int ninserts = 1000;
+static int nextra;			/* new FMRIs inserted so far */
+static volatile int writer_done;
+
+static char **names;			/* the N preloaded FMRIs */
+
+static void
+extra_name(char *buf, size_t sz, int i)
+{
+	(void) snprintf(buf, sz, "svc:/site/bench/new%08d:default", i);
+}
+
+static void *
+reader(void *arg)
+{
+	unsigned int seed = (unsigned int)(uintptr_t)arg;
+	char buf[64];
+	const char *n;
+	long i;
+	int k, id;
+
+	for (i = 0; i < nlookups; i++) {
+		k = rand_r(&seed);
+		if ((k & 15) != 0) {
+			n = names[k % nfmris];
+			id = dict_lookup_byname(n);
+			if (id != k % nfmris)
+				bench_fail("lookup: %s -> %d", n, id);
+		} else {
+			/* an FMRI the writer may just have inserted */
+			extra_name(buf, sizeof (buf),
+			    nextra + (k >> 4) % ninserts);
+			n = buf;
+			id = dict_lookup_byname(n);
+			if (id == -1)
+				continue;
+		}
+		if (id < 0 || strcmp(dict_lookup_byid(id), n) != 0)
+			bench_fail("reverse lookup: %s -> %d", n, id);
+	}
+	return (NULL);
+}
+
+/* ARGSUSED */
+static void *
+writer(void *arg)
+{
+	char buf[64];
+	int i;
+
+	for (i = 0; i < ninserts && !writer_done; i++) {
+		extra_name(buf, sizeof (buf), nextra + i);
+		(void) dict_insert(buf);
+		(void) usleep(10);
+	}
+	nextra += ninserts;
+	return (NULL);
+}
+
+static void
+run(int nthreads)
+{
+	pthread_t tids[MAX_THREADS], wtid;
+	double t, rate;
+	int i;
+
+	writer_done = 0;
+	t = bench_now_ns();
+	(void) pthread_create(&wtid, NULL, writer, NULL);
+	for (i = 0; i < nthreads; i++)
+		(void) pthread_create(&tids[i], NULL, reader,
+		    (void *)(uintptr_t)(i + 1));
+	for (i = 0; i < nthreads; i++)
+		(void) pthread_join(tids[i], NULL);
+	t = bench_now_ns() - t;
+	writer_done = 1;
+	(void) pthread_join(wtid, NULL);
+
+	rate = nthreads * (double)nlookups / (t / 1e9);
+	(void) printf("%4d threads  %12.0f lookups/s  %12.0f per thread\n",
+	    nthreads, rate, rate / nthreads);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int def_threads[] = { 1, 2, 4, 8, 16, 32 };
+	char buf[64];
+	int c, i;
+
+	while ((c = getopt(argc, argv, "n:l:w:")) != -1) {
+		switch (c) {
+		case 'n':
+			nfmris = atoi(optarg);
+			break;
+		case 'l':
+			nlookups = atol(optarg);
+			break;
+		case 'w':
+			ninserts = atoi(optarg);
+			break;
+		default:
+			(void) fprintf(stderr, "usage: %s [-n fmris] "
+			    "[-l lookups] [-w inserts] [threads ...]\n",
+			    argv[0]);
+			return (2);
+		}
+	}
+	if (nfmris < 1 || ninserts < 1) {
+		(void) fprintf(stderr, "%s: -n and -w must be positive\n",
+		    argv[0]);
+		return (2);
+	}
+
+	dict_init();
+	if ((names = calloc(nfmris, sizeof (char *))) == NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		return (1);
+	}
+	for (i = 0; i < nfmris; i++) {
+		(void) snprintf(buf, sizeof (buf),
+		    "svc:/site/bench/svc%06d:default", i);
+		if ((names[i] = strdup(buf)) == NULL) {
+			(void) fprintf(stderr, "out of memory\n");
+			return (1);
+		}
+		if (dict_insert(names[i]) != i ||
+		    dict_insert(names[i]) != i) {
+			bench_fail("insert: %s -> %d", names[i], i);
+			return (1);
+		}
+	}
+	if (dict_lookup_byname("svc:/site/bench/none:default") != -1 ||
+	    dict_lookup_byid(-1) != NULL || dict_lookup_byid(nfmris) != NULL)
+		bench_fail("lookup of missing FMRI");
+
+	(void) printf("%d FMRIs, %ld lookups per thread\n", nfmris, nlookups);
+	if (optind == argc) {
+		for (i = 0; i < sizeof (def_threads) / sizeof (int); i++)
+			run(def_threads[i]);
+	} else {
+		for (; optind < argc; optind++) {
+			c = atoi(argv[optind]);
+			if (c < 1 || c > MAX_THREADS) {
+				(void) fprintf(stderr, "%s: 1 to %d threads\n",
+				    argv[0], MAX_THREADS);
+				return (2);
+			}
+			run(c);
+		}
+	}
+
+	return (bench_exit());
+}
@@ -340,3 +340,17 @@ set_smf_env(char **env, size_t env_sz, const char *path,
 
 	return (nenv);
 }
+
+/*
+ * Frees an environment returned by set_smf_env() for an env of env_sz
+ * entries.
+ */
+void
+free_smf_env(char **nenv, size_t env_sz)
+{
+	char **np;
+
+	for (np = nenv; *np != NULL; np++)
+		startd_free(*np, strlen(*np) + 1);
+	startd_free(nenv, sizeof (char *) * (glob_env_n + env_sz + 4 + 1 + 1));
+}
@@ -0,0 +1,324 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * event_queue.c - event queues between svc.startd threads
+ *
+ * Events for the graph engine and for the restarter are produced by many
+ * threads and consumed by one.  An evq_t is a linked list of objects
+ * through the evq_node_t embedded in each, to which producers append by
+ * atomically swapping their object in as the new tail and then linking
+ * the old tail to it.  The consumer takes objects from the head.  Neither
+ * side takes a lock, and producers never wait for one another or for the
+ * consumer.
+ *
+ * Between the swap and the link, the list is briefly cut at the old
+ * tail, and the objects behind it cannot be reached.  So that the
+ * consumer can tell this from an empty queue, evq_enqueue() counts each
+ * object after linking it, and evq_dequeue() waits for the link only
+ * while the count says there are objects.  The count also lets the
+ * producers batch wakeups:  evq_enqueue() returns 1 only for the object
+ * which made the queue non-empty, and only then need the consumer be
+ * woken.  A consumer which drains the queue each time it wakes sees every
+ * object.
+ *
+ * evq_dequeue() and evq_requeue() may only be called by one thread at a
+ * time.
+ *
+ * An evq_pool_t keeps freed objects for reuse in a fixed ring of slots,
+ * each with a sequence number which says whether it may be filled or
+ * emptied next, so that any thread may get or put without a lock.  When
+ * the ring is full, evq_pool_put() fails and the caller frees the object.
+ *
+ * Nothing here depends on the rest of svc.startd, so it can be built and
+ * measured on its own.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+#include "event_queue.h"
+
+struct evq {
+	evq_node_t * volatile	eq_tail;	/* producers */
+	char			eq_pad[64 - sizeof (void *)];
+	evq_node_t		*eq_head;	/* consumer */
+	evq_node_t		*eq_requeued;	/* consumer */
+	volatile uint32_t	eq_count;
+	evq_node_t		eq_stub;
+	size_t			eq_offset;	/* of node within object */
+};
+
+#define	EQ_NODE(eq, obj)	\
+	((evq_node_t *)((char *)(obj) + (eq)->eq_offset))
+#define	EQ_OBJ(eq, node)	((void *)((char *)(node) - (eq)->eq_offset))
+
+typedef struct evq_slot {
+	volatile uint32_t	es_seq;
+	void			*es_obj;
+} evq_slot_t;
+
+struct evq_pool {
+	volatile uint32_t	ep_put;
+	char			ep_pad0[64 - sizeof (uint32_t)];
+	volatile uint32_t	ep_get;
+	char			ep_pad1[64 - sizeof (uint32_t)];
+	uint32_t		ep_mask;	/* number of slots - 1 */
+	evq_slot_t		*ep_slots;
+};
+
+/*
+ * offset is the offset of the evq_node_t in the queued objects.  Returns
+ * NULL if out of memory.
+ */
+evq_t *
+evq_create(size_t offset)
+{
+	evq_t *eq;
+
+	if ((eq = calloc(1, sizeof (*eq))) == NULL)
+		return (NULL);
+	eq->eq_offset = offset;
+	eq->eq_head = eq->eq_tail = &eq->eq_stub;
+	return (eq);
+}
+
+/*
+ * The queue must be empty.
+ */
+void
+evq_destroy(evq_t *eq)
+{
+	assert(eq->eq_count == 0);
+	free(eq);
+}
+
+static void
+evq_push(evq_t *eq, evq_node_t *n)
+{
+	evq_node_t *prev;
+
+	n->eqn_next = NULL;
+	membar_producer();
+	prev = atomic_swap_ptr(&eq->eq_tail, n);
+	prev->eqn_next = n;
+}
+
+/*
+ * Appends obj.  Returns 1 if the queue was empty, in which case the
+ * consumer should be woken, and 0 otherwise.
+ */
+int
+evq_enqueue(evq_t *eq, void *obj)
+{
+	evq_push(eq, EQ_NODE(eq, obj));
+	return (atomic_add_32_nv(&eq->eq_count, 1) == 1);
+}
+
+/*
+ * Removes and returns the object at the head of the queue, or returns NULL
+ * if the queue is empty.
+ */
+void *
+evq_dequeue(evq_t *eq)
+{
+	evq_node_t *head, *next;
+
+	if ((head = eq->eq_requeued) != NULL) {
+		eq->eq_requeued = head->eqn_next;
+		atomic_add_32(&eq->eq_count, -1);
+		return (EQ_OBJ(eq, head));
+	}
+
+	if (eq->eq_count == 0)
+		return (NULL);
+
+	for (;;) {
+		head = eq->eq_head;
+		next = head->eqn_next;
+
+		if (head == &eq->eq_stub) {
+			if (next == NULL) {
+				/* a producer has yet to link its object */
+				(void) sched_yield();
+				continue;
+			}
+			eq->eq_head = head = next;
+			next = next->eqn_next;
+		}
+
+		if (next == NULL) {
+			/*
+			 * head may be the last object.  To take it we need
+			 * something behind it, so put the stub there.
+			 */
+			if (head != eq->eq_tail) {
+				(void) sched_yield();
+				continue;
+			}
+			evq_push(eq, &eq->eq_stub);
+			if ((next = head->eqn_next) == NULL) {
+				(void) sched_yield();
+				continue;
+			}
+		}
+
+		eq->eq_head = next;
+		membar_consumer();
+		atomic_add_32(&eq->eq_count, -1);
+		return (EQ_OBJ(eq, head));
+	}
+}
+
+/*
+ * Puts obj, which the consumer dequeued, back at the head of the queue.
+ */
+void
+evq_requeue(evq_t *eq, void *obj)
+{
+	evq_node_t *n = EQ_NODE(eq, obj);
+
+	n->eqn_next = eq->eq_requeued;
+	eq->eq_requeued = n;
+	atomic_add_32(&eq->eq_count, 1);
+}
+
+uint32_t
+evq_count(evq_t *eq)
+{
+	return (eq->eq_count);
+}
+
+/*
+ * Creates a pool which holds up to size objects, rounded up to a power of
+ * two.  Returns NULL if out of memory.
+ */
+evq_pool_t *
+evq_pool_create(uint32_t size)
+{
+	evq_pool_t *ep;
+	uint32_t n, i;
+
+	for (n = 1; n < size; n *= 2)
+		;
+
+	if ((ep = calloc(1, sizeof (*ep))) == NULL)
+		return (NULL);
+	if ((ep->ep_slots = calloc(n, sizeof (evq_slot_t))) == NULL) {
+		free(ep);
+		return (NULL);
+	}
+	ep->ep_mask = n - 1;
+	for (i = 0; i < n; i++)
+		ep->ep_slots[i].es_seq = i;
+	return (ep);
+}
+
+/*
+ * The pool must be empty.
+ */
+void
+evq_pool_destroy(evq_pool_t *ep)
+{
+	assert(ep->ep_get == ep->ep_put);
+	free(ep->ep_slots);
+	free(ep);
+}
+
+/*
+ * Slot pos & ep_mask may be filled when its sequence number is pos, and
+ * emptied when it is pos + 1.  Filling it sets it to pos + 1, and
+ * emptying it sets it to pos + ep_mask + 1, ready for the next time
+ * around the ring.
+ */
+
+/*
+ * Returns a pooled object, or NULL if the pool is empty.
+ */
+void *
+evq_pool_get(evq_pool_t *ep)
+{
+	evq_slot_t *s;
+	uint32_t pos, seq;
+	int32_t d;
+	void *obj;
+
+	pos = ep->ep_get;
+	for (;;) {
+		s = &ep->ep_slots[pos & ep->ep_mask];
+		seq = s->es_seq;
+		membar_consumer();
+		d = (int32_t)(seq - (pos + 1));
+		if (d == 0) {
+			if (atomic_cas_32(&ep->ep_get, pos, pos + 1) == pos)
+				break;
+			pos = ep->ep_get;
+		} else if (d < 0) {
+			return (NULL);
+		} else {
+			pos = ep->ep_get;
+		}
+	}
+
+	obj = s->es_obj;
+	membar_exit();
+	s->es_seq = pos + ep->ep_mask + 1;
+	return (obj);
+}
+
+/*
+ * Adds obj to the pool.  Returns 0 on success, or -1 if the pool is full.
+ */
+int
+evq_pool_put(evq_pool_t *ep, void *obj)
+{
+	evq_slot_t *s;
+	uint32_t pos, seq;
+	int32_t d;
+
+	pos = ep->ep_put;
+	for (;;) {
+		s = &ep->ep_slots[pos & ep->ep_mask];
+		seq = s->es_seq;
+		membar_consumer();
+		d = (int32_t)(seq - pos);
+		if (d == 0) {
+			if (atomic_cas_32(&ep->ep_put, pos, pos + 1) == pos)
+				break;
+			pos = ep->ep_put;
+		} else if (d < 0) {
+			return (-1);
+		} else {
+			pos = ep->ep_put;
+		}
+	}
+
+	s->es_obj = obj;
+	membar_producer();
+	s->es_seq = pos + 1;
+	return (0);
+}
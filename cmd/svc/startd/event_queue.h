@@ -0,0 +1,62 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_EVENT_QUEUE_H
+#define	_EVENT_QUEUE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * A queue of objects with many producers and one consumer, which takes
+ * no locks, and a bounded pool of free objects.  See event_queue.c.
+ */
+typedef struct evq evq_t;
+typedef struct evq_pool evq_pool_t;
+
+/* Embedded in each queued object. */
+typedef struct evq_node {
+	struct evq_node * volatile	eqn_next;
+} evq_node_t;
+
+evq_t *evq_create(size_t);
+void evq_destroy(evq_t *);
+
+int evq_enqueue(evq_t *, void *);
+void *evq_dequeue(evq_t *);
+void evq_requeue(evq_t *, void *);
+uint32_t evq_count(evq_t *);
+
+evq_pool_t *evq_pool_create(uint32_t);
+void evq_pool_destroy(evq_pool_t *);
+
+void *evq_pool_get(evq_pool_t *);
+int evq_pool_put(evq_pool_t *, void *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _EVENT_QUEUE_H */
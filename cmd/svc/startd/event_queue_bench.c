@@ -0,0 +1,373 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * event_queue_bench - protocol event queue throughput and stress test
+ *
+ * P producer threads each send E events, naming one of a set of FMRIs, to
+ * one consumer thread, which sleeps on a condition variable when the
+ * queue is empty as graph_event_thread() and restarter_event_thread() do.
+ * This is done two ways:
+ *
+ *	list	as protocol.c used to:  events and a copy of the FMRI are
+ *		allocated for each event, queued on a uu_list under a mutex,
+ *		and the consumer is signalled for every event
+ *
+ *	evq	as it does now:  events come from an evq_pool_t, the FMRI is
+ *		the dictionary's copy, they are queued on an evq_t, and the
+ *		consumer is signalled only when the queue becomes non-empty
+ *
+ * For each producer count, reports events per second, how many times the
+ * producers signalled the consumer and how many times it woke up, for
+ * both.  Every event is checked:  each producer's events must arrive once
+ * each and in order, with the right FMRI, and no pooled event may be
+ * handed out twice.  Exits with 1 if any check failed.  Usage:
+ *
+ *	event_queue_bench [-e events] [-f fmris] [producers ...]
+ *
+ * Defaults are 200000 events per producer, 5000 FMRIs and 1, 2, 4, 8 and
+ * 16 producers.
+ */
+
+#include <sys/types.h>
+
+#include <libuutil.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "atomic.h"
+#include "dict.h"
+#include "event_queue.h"
+
+#define	MAX_PRODUCERS	256
+
+typedef struct event {
+	const char		*ev_inst;
+	size_t			ev_inst_sz;	/* 0 if interned */
+	int			ev_producer;
+	int			ev_seq;
+	volatile uint32_t	ev_busy;
+	uu_list_node_t		ev_list_link;
+	evq_node_t		ev_link;
+} event_t;
+
+static long nevents = 200000;
+static int nfmris = 5000;
+
+static char **names;
+static int evq_mode;
+
+static evq_t *queue;
+static evq_pool_t *pool;
+static uu_list_pool_t *list_pool;
+static uu_list_t *list;
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Like gu_lock, gu_cv and gu_wakeup. */
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cv = PTHREAD_COND_INITIALIZER;
+static int wakeup;
+static long wakeups;
+static volatile uint32_t signals;
+
+static int nproducers;
+static long received;
+
+static void
+wake(void)
+{
+	atomic_add_32(&signals, 1);
+	(void) pthread_mutex_lock(&wake_lock);
+	wakeup = 1;
+	(void) pthread_cond_broadcast(&wake_cv);
+	(void) pthread_mutex_unlock(&wake_lock);
+}
+
+static void
+send_list(const char *inst, int producer, int seq)
+{
+	event_t *e = bench_zalloc(1, sizeof (event_t));
+
+	e->ev_inst_sz = strlen(inst) + 1;
+	e->ev_inst = bench_zalloc(1, e->ev_inst_sz);
+	(void) strlcpy((char *)e->ev_inst, inst, e->ev_inst_sz);
+	e->ev_producer = producer;
+	e->ev_seq = seq;
+
+	(void) pthread_mutex_lock(&list_lock);
+	uu_list_node_init(e, &e->ev_list_link, list_pool);
+	if (uu_list_insert_before(list, NULL, e) == -1)
+		uu_die("failed to enqueue event\n");
+	(void) pthread_mutex_unlock(&list_lock);
+
+	wake();
+}
+
+static event_t *
+receive_list(void)
+{
+	event_t *e;
+
+	(void) pthread_mutex_lock(&list_lock);
+	if ((e = uu_list_first(list)) != NULL)
+		uu_list_remove(list, e);
+	(void) pthread_mutex_unlock(&list_lock);
+	return (e);
+}
+
+static void
+release_list(event_t *e)
+{
+	uu_list_node_fini(e, &e->ev_list_link, list_pool);
+	free((void *)e->ev_inst);
+	free(e);
+}
+
+static void
+send_evq(const char *inst, int producer, int seq)
+{
+	event_t *e;
+	int id;
+
+	if ((e = evq_pool_get(pool)) == NULL)
+		e = bench_zalloc(1, sizeof (event_t));
+	else if (atomic_cas_32(&e->ev_busy, 0, 1) != 0)
+		bench_fail("pooled event in use: producer %d event %d",
+		    producer, seq);
+	bzero(e, sizeof (event_t));
+
+	if ((id = dict_lookup_byname(inst)) != -1) {
+		e->ev_inst = dict_lookup_byid(id);
+	} else {
+		e->ev_inst_sz = strlen(inst) + 1;
+		e->ev_inst = bench_zalloc(1, e->ev_inst_sz);
+		(void) strlcpy((char *)e->ev_inst, inst, e->ev_inst_sz);
+	}
+	e->ev_producer = producer;
+	e->ev_seq = seq;
+	e->ev_busy = 1;
+
+	if (evq_enqueue(queue, e))
+		wake();
+}
+
+static void
+release_evq(event_t *e)
+{
+	if (e->ev_inst_sz != 0)
+		free((void *)e->ev_inst);
+	e->ev_busy = 0;
+	if (evq_pool_put(pool, e) != 0)
+		free(e);
+}
+
+static void *
+producer(void *arg)
+{
+	int p = (int)(uintptr_t)arg;
+	long i;
+
+	for (i = 0; i < nevents; i++) {
+		if (evq_mode)
+			send_evq(names[(p + i) % nfmris], p, (int)i);
+		else
+			send_list(names[(p + i) % nfmris], p, (int)i);
+	}
+	return (NULL);
+}
+
+/* ARGSUSED */
+static void *
+consumer(void *arg)
+{
+	long total = nproducers * nevents;
+	int *next;
+	event_t *e;
+	int p;
+
+	next = bench_zalloc(nproducers, sizeof (int));
+
+	(void) pthread_mutex_lock(&wake_lock);
+	while (received < total) {
+		while (wakeup == 0)
+			(void) pthread_cond_wait(&wake_cv, &wake_lock);
+		wakeup = 0;
+		wakeups++;
+
+		while ((e = evq_mode ? evq_dequeue(queue) :
+		    receive_list()) != NULL) {
+			(void) pthread_mutex_unlock(&wake_lock);
+
+			p = e->ev_producer;
+			if (p < 0 || p >= nproducers) {
+				bench_fail("bad producer: producer %d event %d",
+				    p, e->ev_seq);
+				goto next;
+			}
+			if (e->ev_seq != next[p])
+				bench_fail("out of order: producer %d event %d",
+				    p, e->ev_seq);
+			next[p] = e->ev_seq + 1;
+			if (strcmp(e->ev_inst,
+			    names[(p + e->ev_seq) % nfmris]) != 0)
+				bench_fail("wrong FMRI: producer %d event %d",
+				    p, e->ev_seq);
+
+			received++;
+			if (evq_mode)
+				release_evq(e);
+			else
+				release_list(e);
+next:
+			(void) pthread_mutex_lock(&wake_lock);
+		}
+	}
+	(void) pthread_mutex_unlock(&wake_lock);
+
+	free(next);
+	return (NULL);
+}
+
+static void
+run(int mode, int np)
+{
+	pthread_t tids[MAX_PRODUCERS], ctid;
+	double t;
+	int i;
+
+	evq_mode = mode;
+	nproducers = np;
+	received = 0;
+	wakeup = 0;
+	wakeups = 0;
+	signals = 0;
+
+	t = bench_now_ns();
+	(void) pthread_create(&ctid, NULL, consumer, NULL);
+	for (i = 0; i < np; i++)
+		(void) pthread_create(&tids[i], NULL, producer,
+		    (void *)(uintptr_t)i);
+	for (i = 0; i < np; i++)
+		(void) pthread_join(tids[i], NULL);
+	(void) pthread_join(ctid, NULL);
+	t = bench_now_ns() - t;
+
+	if (received != np * nevents)
+		bench_fail("events lost: %ld received", received);
+	if (mode && evq_count(queue) != 0)
+		bench_fail("queue not empty: %u left", evq_count(queue));
+
+	(void) printf(" %10.0f/s %8u %8ld", received / (t / 1e9), signals,
+	    wakeups);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int def_producers[] = { 1, 2, 4, 8, 16 };
+	char buf[64];
+	int c, i, np;
+	event_t *e;
+
+	while ((c = getopt(argc, argv, "e:f:")) != -1) {
+		switch (c) {
+		case 'e':
+			nevents = atol(optarg);
+			break;
+		case 'f':
+			nfmris = atoi(optarg);
+			break;
+		default:
+			(void) fprintf(stderr, "usage: %s [-e events] "
+			    "[-f fmris] [producers ...]\n", argv[0]);
+			return (2);
+		}
+	}
+	if (nevents < 1 || nfmris < 1) {
+		(void) fprintf(stderr, "%s: -e and -f must be positive\n",
+		    argv[0]);
+		return (2);
+	}
+
+	dict_init();
+	names = bench_zalloc(nfmris, sizeof (char *));
+	for (i = 0; i < nfmris; i++) {
+		(void) snprintf(buf, sizeof (buf),
+		    "svc:/site/bench/svc%06d:default", i);
+		if ((names[i] = strdup(buf)) == NULL) {
+			(void) fprintf(stderr, "out of memory\n");
+			return (1);
+		}
+		/* leave some out, to be copied */
+		if (i % 10 != 0)
+			(void) dict_insert(names[i]);
+	}
+
+	if ((list_pool = uu_list_pool_create("events", sizeof (event_t),
+	    offsetof(event_t, ev_list_link), NULL, UU_LIST_POOL_DEBUG)) ==
+	    NULL || (list = uu_list_create(list_pool, NULL, 0)) == NULL ||
+	    (queue = evq_create(offsetof(event_t, ev_link))) == NULL ||
+	    (pool = evq_pool_create(1024)) == NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		return (1);
+	}
+
+	(void) printf("%ld events per producer, %d FMRIs\n", nevents, nfmris);
+	(void) printf("%9s %-30s %s\n", "", "list", "evq");
+	(void) printf("%9s %12s %8s %8s %12s %8s %8s\n", "", "events",
+	    "signals", "wakeups", "events", "signals", "wakeups");
+
+	if (optind == argc) {
+		for (i = 0; i < sizeof (def_producers) / sizeof (int); i++) {
+			(void) printf("%3d prod ", def_producers[i]);
+			run(0, def_producers[i]);
+			run(1, def_producers[i]);
+			(void) printf("\n");
+		}
+	} else {
+		for (; optind < argc; optind++) {
+			np = atoi(argv[optind]);
+			if (np < 1 || np > MAX_PRODUCERS) {
+				(void) fprintf(stderr, "%s: 1 to %d "
+				    "producers\n", argv[0], MAX_PRODUCERS);
+				return (2);
+			}
+			(void) printf("%3d prod ", np);
+			run(0, np);
+			run(1, np);
+			(void) printf("\n");
+		}
+	}
+
+	while ((e = evq_pool_get(pool)) != NULL)
+		free(e);
+	evq_pool_destroy(pool);
+	evq_destroy(queue);
+
+	return (bench_exit());
+}
@@ -38,7 +38,10 @@
  *
  *   The graph is stored in uu_list_t *dgraph and its vertices are
  *   graph_vertex_t's, each of which has a name and an integer id unique to
- *   its name (see dict.c).  A vertex's type attribute designates the type
+ *   its name (see dict.c).  dgraph is kept in id order, and the vertices
+ *   are also indexed by id and by name in dgraph_index (see
+ *   vertex_index.c), so that looking one up does not walk the graph.
+ *   A vertex's type attribute designates the type
  *   of object it represents: GVT_INST for service instances, GVT_SVC for
  *   service objects (since service instances may depend on another service,
  *   rather than service instance), GVT_FILE for files (which services may
@@ -168,6 +171,7 @@
 
 #include "startd.h"
 #include "protocol.h"
+#include "vertex_index.h"
 
 
 #define	MILESTONE_NONE	((graph_vertex_t *)1)
@@ -218,6 +222,7 @@ int info_events_all;
 
 static uu_list_pool_t *graph_edge_pool, *graph_vertex_pool;
 static uu_list_t *dgraph;
+static vertex_index_t *dgraph_index;
 static pthread_mutex_t dgraph_lock;
 
 /*
@@ -313,26 +318,6 @@ static boolean_t should_be_in_subgraph(graph_vertex_t *v);
 static int mark_subtree(graph_edge_t *, void *);
 static boolean_t insubtree_dependents_down(graph_vertex_t *);
 
-/*
- * graph_vertex_compare()
- *	This function can compare either int *id or * graph_vertex_t *gv
- *	values, as the vertex id is always the first element of a
- *	graph_vertex structure.
- */
-/* ARGSUSED */
-static int
-graph_vertex_compare(const void *lc_arg, const void *rc_arg, void *private)
-{
-	int lc_id = ((const graph_vertex_t *)lc_arg)->gv_id;
-	int rc_id = *(int *)rc_arg;
-
-	if (lc_id > rc_id)
-		return (1);
-	if (lc_id < rc_id)
-		return (-1);
-	return (0);
-}
-
 void
 graph_init()
 {
@@ -343,14 +328,17 @@ graph_init()
 
 	graph_vertex_pool = startd_list_pool_create("graph_vertices",
 	    sizeof (graph_vertex_t), offsetof(graph_vertex_t, gv_link),
-	    graph_vertex_compare, UU_LIST_POOL_DEBUG);
+	    NULL, UU_LIST_POOL_DEBUG);
 	assert(graph_vertex_pool != NULL);
 
 	(void) pthread_mutex_init(&dgraph_lock, &mutex_attrs);
 	(void) pthread_mutex_init(&single_user_thread_lock, &mutex_attrs);
-	dgraph = startd_list_create(graph_vertex_pool, NULL, UU_LIST_SORTED);
+	dgraph = startd_list_create(graph_vertex_pool, NULL, 0);
 	assert(dgraph != NULL);
 
+	if ((dgraph_index = vertex_index_create()) == NULL)
+		uu_die("Insufficient memory.\n");
+
 	if (!st->st_initial)
 		current_runlevel = utmpx_get_runlevel();
 
@@ -360,15 +348,9 @@ graph_init()
 static graph_vertex_t *
 vertex_get_by_name(const char *name)
 {
-	int id;
-
 	assert(MUTEX_HELD(&dgraph_lock));
 
-	id = dict_lookup_byname(name);
-	if (id == -1)
-		return (NULL);
-
-	return (uu_list_find(dgraph, &id, NULL, NULL));
+	return (vertex_index_lookup_name(dgraph_index, name));
 }
 
 static graph_vertex_t *
@@ -376,10 +358,33 @@ vertex_get_by_id(int id)
 {
 	assert(MUTEX_HELD(&dgraph_lock));
 
-	if (id == -1)
-		return (NULL);
+	return (vertex_index_lookup_id(dgraph_index, id));
+}
+
+/*
+ * Adds v to dgraph_index, with the same retry policy as startd_alloc().
+ */
+static void
+graph_index_vertex(graph_vertex_t *v)
+{
+	uint_t try, msecs;
+
+	if (vertex_index_insert(dgraph_index, v->gv_id, v->gv_name, v) == 0)
+		return;
+	assert(errno == ENOMEM);
+
+	msecs = ALLOC_DELAY;
+
+	for (try = 0; try < ALLOC_RETRY; ++try) {
+		(void) poll(NULL, 0, msecs);
+		if (vertex_index_insert(dgraph_index, v->gv_id, v->gv_name,
+		    v) == 0)
+			return;
+		msecs *= ALLOC_DELAY_MULT;
+	}
 
-	return (uu_list_find(dgraph, &id, NULL, NULL));
+	uu_die("Insufficient memory.\n");
+	/* NOTREACHED */
 }
 
 /*
@@ -391,8 +396,6 @@ graph_add_vertex(const char *name)
 {
 	int id;
 	graph_vertex_t *v;
-	void *p;
-	uu_list_index_t idx;
 
 	assert(MUTEX_HELD(&dgraph_lock));
 
@@ -408,11 +411,13 @@ graph_add_vertex(const char *name)
 	v->gv_dependencies = startd_list_create(graph_edge_pool, v, 0);
 	v->gv_dependents = startd_list_create(graph_edge_pool, v, 0);
 
-	p = uu_list_find(dgraph, &id, NULL, &idx);
-	assert(p == NULL);
+	assert(vertex_get_by_id(id) == NULL);
 
+	/* Keep dgraph in id order by inserting v before its successor. */
 	uu_list_node_init(v, &v->gv_link, graph_vertex_pool);
-	uu_list_insert(dgraph, v, idx);
+	(void) uu_list_insert_before(dgraph,
+	    vertex_index_next(dgraph_index, id), v);
+	graph_index_vertex(v);
 
 	return (v);
 }
@@ -429,7 +434,9 @@ graph_remove_vertex(graph_vertex_t *v)
 	assert(uu_list_numnodes(v->gv_dependencies) == 0);
 	assert(uu_list_numnodes(v->gv_dependents) == 0);
 	assert(v->gv_refs == 0);
+	assert((v->gv_flags & GV_STARTQ) == 0);
 
+	(void) vertex_index_remove(dgraph_index, v->gv_id);
 	startd_free(v->gv_name, strlen(v->gv_name) + 1);
 	uu_list_destroy(v->gv_dependencies);
 	uu_list_destroy(v->gv_dependents);
@@ -479,6 +486,9 @@ graph_remove_edge(graph_vertex_t *v, graph_vertex_t *dv)
 		}
 	}
 
+	if (v->gv_blocker == dv)
+		v->gv_blocker = NULL;
+
 	for (e = uu_list_first(dv->gv_dependents);
 	    e != NULL;
 	    e = uu_list_next(dv->gv_dependents, e)) {
@@ -1239,12 +1249,28 @@ static int
 require_all_satisfied(graph_vertex_t *groupv, boolean_t satbility)
 {
 	graph_edge_t *edge;
+	graph_vertex_t *bv;
 	int i;
 	boolean_t any_unsatisfied;
 
 	if (uu_list_numnodes(groupv->gv_dependencies) == 0)
 		return (1);
 
+	/*
+	 * When only satisfaction matters, one unsatisfied element is enough.
+	 * Try the one which blocked us last time first:  as dependencies
+	 * come online one by one, each evaluation of a vertex with many
+	 * dependencies then costs one check rather than a walk of the
+	 * elements which are already up.
+	 */
+	if (!satbility && (bv = groupv->gv_blocker) != NULL &&
+	    (i = dependency_satisfied(bv, B_FALSE)) != 1) {
+		log_framework2(LOG_DEBUG, DEBUG_DEPENDENCIES,
+		    "require_all(%s): %s is unsatisfi%s.\n", groupv->gv_name,
+		    bv->gv_name, i == 0 ? "ed" : "able");
+		return (0);
+	}
+
 	any_unsatisfied = B_FALSE;
 
 	for (edge = uu_list_first(groupv->gv_dependencies);
@@ -1258,8 +1284,10 @@ require_all_satisfied(graph_vertex_t *groupv, boolean_t satbility)
 		    "require_all(%s): %s is unsatisfi%s.\n", groupv->gv_name,
 		    edge->ge_vertex->gv_name, i == 0 ? "ed" : "able");
 
-		if (!satbility)
+		if (!satbility) {
+			groupv->gv_blocker = edge->ge_vertex;
 			return (0);
+		}
 
 		if (i == -1)
 			return (-1);
@@ -1267,6 +1295,9 @@ require_all_satisfied(graph_vertex_t *groupv, boolean_t satbility)
 		any_unsatisfied = B_TRUE;
 	}
 
+	if (!any_unsatisfied)
+		groupv->gv_blocker = NULL;
+
 	return (any_unsatisfied ? 0 : 1);
 }
 
@@ -1529,7 +1560,7 @@ instance_satisfied(graph_vertex_t *v, boolean_t satbility)
  * a group vertex, or of an instance vertex.
  */
 static int
-dependency_satisfied(graph_vertex_t *v, boolean_t satbility)
+dependency_evaluate(graph_vertex_t *v, boolean_t satbility)
 {
 	switch (v->gv_type) {
 	case GVT_INST:
@@ -1632,9 +1663,117 @@ dependency_satisfied(graph_vertex_t *v, boolean_t satbility)
 	}
 }
 
+/*
+ * Results of dependency_satisfied() are remembered while a batch of
+ * evaluations is in progress (between graph_sat_begin() and graph_sat_end()).
+ * Many instances share dependencies -- a service everything depends on, or
+ * the whole subtree behind an optional_all dependency, which is evaluated
+ * for satisfiability -- and these are then evaluated once per batch rather
+ * than once per instance which reaches them.
+ *
+ * A result is valid if it was computed in the current generation.
+ * Beginning a batch starts a new generation, which discards every result at
+ * once:  the inputs (states, flags, edges and files) change in too many
+ * places to invalidate results one by one between batches.  Nothing may
+ * change the graph during a batch without calling graph_sat_invalidate().
+ * Outside a batch nothing is remembered.  Protected by dgraph_lock.
+ */
+static uint32_t graph_sat_gen = 1;
+static int graph_sat_batch;
+
+static void
+graph_sat_invalidate(void)
+{
+	if (++graph_sat_gen == 0)
+		graph_sat_gen = 1;
+}
+
+static void
+graph_sat_begin(void)
+{
+	assert(MUTEX_HELD(&dgraph_lock));
+
+	if (graph_sat_batch++ == 0)
+		graph_sat_invalidate();
+}
+
+static void
+graph_sat_end(void)
+{
+	assert(graph_sat_batch > 0);
+	graph_sat_batch--;
+}
+
+static int
+dependency_satisfied(graph_vertex_t *v, boolean_t satbility)
+{
+	int i = satbility ? 1 : 0;
+	int r;
+
+	if (graph_sat_batch == 0)
+		return (dependency_evaluate(v, satbility));
+
+	if (v->gv_sat_gen[i] == graph_sat_gen)
+		return (v->gv_sat[i]);
+
+	r = dependency_evaluate(v, satbility);
+	v->gv_sat_gen[i] = graph_sat_gen;
+	v->gv_sat[i] = (int8_t)r;
+	return (r);
+}
+
+/*
+ * While graph_transition_propagate() walks the dependents of a vertex which
+ * has changed state, instances which may have become startable are queued
+ * here rather than evaluated on the spot.  An instance can be reached along
+ * several paths in one walk (through more than one of its dependency groups,
+ * or through both of the walks of PROPAGATE_SAT);  queueing it once means
+ * its dependencies are evaluated once, and it is sent at most one _START,
+ * per transition.  The queue is drained, in the order the instances were
+ * reached, once the walks are done.  Protected by dgraph_lock.
+ */
+static graph_vertex_t *graph_startq_head;
+static graph_vertex_t *graph_startq_tail;
+static int graph_startq_defer;
+
+static void
+graph_startq_drain(void)
+{
+	graph_vertex_t *v;
+
+	assert(MUTEX_HELD(&dgraph_lock));
+	assert(graph_startq_defer == 0);
+
+	graph_sat_begin();
+	while ((v = graph_startq_head) != NULL) {
+		graph_startq_head = v->gv_startq_next;
+		if (graph_startq_head == NULL)
+			graph_startq_tail = NULL;
+		v->gv_startq_next = NULL;
+		v->gv_flags &= ~GV_STARTQ;
+
+		graph_start_if_satisfied(v);
+	}
+	graph_sat_end();
+}
+
 void
 graph_start_if_satisfied(graph_vertex_t *v)
 {
+	if (graph_startq_defer > 0) {
+		assert(MUTEX_HELD(&dgraph_lock));
+
+		if ((v->gv_flags & GV_STARTQ) == 0) {
+			v->gv_flags |= GV_STARTQ;
+			if (graph_startq_tail == NULL)
+				graph_startq_head = v;
+			else
+				graph_startq_tail->gv_startq_next = v;
+			graph_startq_tail = v;
+		}
+		return;
+	}
+
 	if (v->gv_state == RESTARTER_STATE_OFFLINE &&
 	    instance_satisfied(v, B_FALSE) == 1) {
 		if (v->gv_start_f == NULL)
@@ -4932,6 +5071,10 @@ void
 graph_transition_propagate(graph_vertex_t *v, propagate_event_t type,
     restarter_error_t rerr)
 {
+	assert(MUTEX_HELD(&dgraph_lock));
+
+	graph_startq_defer++;
+
 	if (type == PROPAGATE_STOP) {
 		graph_walk_dependents(v, propagate_stop, (void *)rerr);
 	} else if (type == PROPAGATE_START || type == PROPAGATE_SAT) {
@@ -4946,6 +5089,9 @@ graph_transition_propagate(graph_vertex_t *v, propagate_event_t type,
 #endif
 		abort();
 	}
+
+	if (--graph_startq_defer == 0)
+		graph_startq_drain();
 }
 
 /*
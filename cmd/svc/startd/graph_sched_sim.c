@@ -0,0 +1,399 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * graph_sched_sim - boot makespan of a synthetic service graph
+ *
+ * Builds a layered graph of N services, each depending on a few services
+ * in lower layers, with two milestones in the manner of multi-user and
+ * multi-user-server:  the first depends on every service in the lower half
+ * of the layers and every service in the upper half depends on it;  the
+ * second depends on every service in the upper half.  Each service takes
+ * a random time to start.
+ *
+ * Boot is simulated in virtual time.  Started services run concurrently
+ * on W workers (the restarter threads, and the methods they run).  When a
+ * service comes online the single graph thread evaluates each of its
+ * dependents, at a fixed cost for each dependency it looks at, and hands
+ * those which are now satisfied to the workers.  The evaluation is done
+ * two ways:
+ *
+ *	scan	as require_all_satisfied() used to:  look at the dependencies
+ *		in order until one is unsatisfied
+ *
+ *	blocker	as it does now:  look first at the dependency which was
+ *		unsatisfied last time, and scan only if that one is satisfied
+ *
+ * For each worker count, reports the makespan of both, the number of
+ * dependencies looked at, and the lower bound given by the critical path.
+ * Checks that every service was started, none before all of its
+ * dependencies were online, that no makespan is below the bound and that
+ * the blocker never looks at more dependencies than the scan.  Exits with
+ * 1 if any check failed.  Usage:
+ *
+ *	graph_sched_sim [-n services] [-l layers] [-c check_ns] [-s seed]
+ *	    [workers ...]
+ *
+ * Defaults are 5000 services in 20 layers, 500 ns a check and 1, 4, 16,
+ * 64 and 1024 workers.  Services take 1 to 200 ms.
+ */
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "timeout_heap.h"
+
+#define	MAX_DEPS	4		/* random dependencies per service */
+
+typedef struct svc {
+	timeout_heap_node_t	s_node;		/* when it comes online */
+	int			s_layer;
+	int64_t			s_dur;
+	int			s_ndeps;
+	int			*s_deps;
+	int			s_nrdeps;
+	int			*s_rdeps;	/* dependents */
+	int			s_ndone;	/* deps online, for checking */
+	int			s_blocker;
+	int			s_ready;
+	int			s_online;
+	int64_t			s_start;
+	int64_t			s_finish;
+} svc_t;
+
+static int nsvcs = 5000;
+static int nlayers = 20;
+static int64_t check_ns = 500;
+static unsigned int seed = 1;
+
+static svc_t *svcs;
+static int nall;			/* services and milestones */
+static int *readyq;
+
+static void
+add_dep(int i, int d)
+{
+	int k;
+
+	for (k = 0; k < svcs[i].s_ndeps; k++) {
+		if (svcs[i].s_deps[k] == d)
+			return;
+	}
+	svcs[i].s_deps[svcs[i].s_ndeps++] = d;
+}
+
+static void
+build(void)
+{
+	int half = nlayers / 2;
+	int mu, mus, i, k, lo, nlo;
+	int *first;		/* first service in each layer */
+	svc_t *s;
+
+	nall = nsvcs + 2;
+	mu = nsvcs;
+	mus = nsvcs + 1;
+	svcs = bench_zalloc(nall, sizeof (svc_t));
+	readyq = bench_zalloc(nall, sizeof (int));
+	first = bench_zalloc(nlayers + 1, sizeof (int));
+
+	for (i = 0; i < nsvcs; i++) {
+		svcs[i].s_layer = (int)((int64_t)i * nlayers / nsvcs);
+		svcs[i].s_dur = (1 + rand_r(&seed) % 200) * 1000000LL;
+	}
+	for (i = nsvcs - 1; i >= 0; i--)
+		first[svcs[i].s_layer] = i;
+	first[nlayers] = nsvcs;
+	nlo = first[half];
+
+	svcs[mu].s_layer = half;
+	svcs[mus].s_layer = nlayers;
+	svcs[mu].s_deps = bench_zalloc(nlo, sizeof (int));
+	svcs[mus].s_deps = bench_zalloc(nsvcs - nlo, sizeof (int));
+
+	for (i = 0; i < nsvcs; i++) {
+		s = &svcs[i];
+		s->s_deps = bench_zalloc(MAX_DEPS + 1, sizeof (int));
+		if (s->s_layer >= half) {
+			add_dep(i, mu);
+			add_dep(mus, i);
+			lo = nlo;
+		} else {
+			add_dep(mu, i);
+			lo = 0;
+		}
+		if (s->s_layer == 0 || first[s->s_layer] == lo)
+			continue;
+		for (k = rand_r(&seed) % (MAX_DEPS + 1); k > 0; k--)
+			add_dep(i, lo +
+			    rand_r(&seed) % (first[s->s_layer] - lo));
+	}
+
+	for (i = 0; i < nall; i++) {
+		for (k = 0; k < svcs[i].s_ndeps; k++)
+			svcs[svcs[i].s_deps[k]].s_nrdeps++;
+	}
+	for (i = 0; i < nall; i++) {
+		svcs[i].s_rdeps = bench_zalloc(svcs[i].s_nrdeps, sizeof (int));
+		svcs[i].s_nrdeps = 0;
+	}
+	for (i = 0; i < nall; i++) {
+		for (k = 0; k < svcs[i].s_ndeps; k++) {
+			s = &svcs[svcs[i].s_deps[k]];
+			s->s_rdeps[s->s_nrdeps++] = i;
+		}
+	}
+
+	free(first);
+}
+
+/*
+ * Longest path, counting the time each service takes to start.  Services
+ * only depend on lower-numbered ones, except for the milestones.
+ */
+static int64_t
+critical_path(void)
+{
+	int64_t *done, t, best = 0;
+	int i, k, pass;
+
+	done = bench_zalloc(nall, sizeof (int64_t));
+	for (pass = 0; pass < 3; pass++) {
+		for (i = 0; i < nall; i++) {
+			t = 0;
+			for (k = 0; k < svcs[i].s_ndeps; k++) {
+				if (done[svcs[i].s_deps[k]] > t)
+					t = done[svcs[i].s_deps[k]];
+			}
+			done[i] = t + svcs[i].s_dur;
+			if (done[i] > best)
+				best = done[i];
+		}
+	}
+	free(done);
+	return (best);
+}
+
+/*
+ * Returns whether every dependency of s is online, and adds the number of
+ * dependencies looked at to *checks.
+ */
+static int
+satisfied(svc_t *s, int use_blocker, uint64_t *checks)
+{
+	int k;
+
+	if (use_blocker && s->s_blocker >= 0) {
+		++*checks;
+		if (!svcs[s->s_blocker].s_online)
+			return (0);
+	}
+
+	for (k = 0; k < s->s_ndeps; k++) {
+		++*checks;
+		if (!svcs[s->s_deps[k]].s_online) {
+			s->s_blocker = s->s_deps[k];
+			return (0);
+		}
+	}
+	s->s_blocker = -1;
+	return (1);
+}
+
+static int64_t
+simulate(int workers, int use_blocker, uint64_t *checks)
+{
+	timeout_heap_t *th;
+	svc_t *s, *d;
+	int64_t now, gtime = 0, end = 0;
+	uint64_t before;
+	int head = 0, tail = 0, idle = workers, i, k;
+
+	if ((th = timeout_heap_create(offsetof(svc_t, s_node))) == NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	*checks = 0;
+	for (i = 0; i < nall; i++) {
+		s = &svcs[i];
+		s->s_blocker = -1;
+		s->s_ready = s->s_online = 0;
+		s->s_ndone = 0;
+		s->s_start = s->s_finish = -1;
+		if (s->s_ndeps == 0) {
+			s->s_ready = 1;
+			readyq[tail++] = i;
+		}
+	}
+
+	now = 0;
+	for (;;) {
+		/* Hand ready services to idle workers. */
+		while (head < tail && idle > 0) {
+			s = &svcs[readyq[head++]];
+			s->s_start = now > gtime ? now : gtime;
+			if (s->s_dur == 0) {
+				/* milestones have no method to run */
+				s->s_finish = s->s_start;
+			} else {
+				s->s_finish = s->s_start + s->s_dur;
+				idle--;
+			}
+			if (timeout_heap_insert(th, s, s->s_finish) != 0) {
+				(void) fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+		}
+
+		if ((s = timeout_heap_min(th)) == NULL)
+			break;
+		timeout_heap_remove(th, s);
+		now = s->s_finish;
+		if (s->s_dur != 0)
+			idle++;
+		s->s_online = 1;
+		if (now > end)
+			end = now;
+
+		/* The graph thread handles one transition at a time. */
+		if (now > gtime)
+			gtime = now;
+		for (k = 0; k < s->s_nrdeps; k++) {
+			d = &svcs[s->s_rdeps[k]];
+			d->s_ndone++;
+			if (d->s_ready)
+				continue;
+			before = *checks;
+			if (satisfied(d, use_blocker, checks)) {
+				d->s_ready = 1;
+				readyq[tail++] = d - svcs;
+			}
+			gtime += (int64_t)(*checks - before) * check_ns;
+		}
+		if (gtime > now)
+			now = gtime;
+	}
+	timeout_heap_destroy(th);
+
+	for (i = 0; i < nall; i++) {
+		s = &svcs[i];
+		if (!s->s_online || s->s_ndone != s->s_ndeps) {
+			bench_fail("never started: service %d", i);
+			continue;
+		}
+		for (k = 0; k < s->s_ndeps; k++) {
+			if (svcs[s->s_deps[k]].s_finish > s->s_start)
+				bench_fail("started before its dependencies: "
+				    "service %d", i);
+		}
+	}
+	return (end);
+}
+
+static void
+run(int workers, int64_t bound)
+{
+	int64_t scan, blk;
+	uint64_t cscan, cblk;
+
+	scan = simulate(workers, 0, &cscan);
+	blk = simulate(workers, 1, &cblk);
+
+	(void) printf("%5d workers  %9.3f s %11llu checks  %9.3f s "
+	    "%11llu checks  %6.3f\n", workers, scan / 1e9,
+	    (unsigned long long)cscan, blk / 1e9, (unsigned long long)cblk,
+	    (double)blk / bound);
+
+	if (scan < bound || blk < bound)
+		bench_fail("makespan below critical path");
+	if (cblk > cscan)
+		bench_fail("blocker looked at more dependencies");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int def_workers[] = { 1, 4, 16, 64, 1024 };
+	int64_t bound;
+	uint64_t edges = 0;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "n:l:c:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			nsvcs = atoi(optarg);
+			break;
+		case 'l':
+			nlayers = atoi(optarg);
+			break;
+		case 'c':
+			check_ns = atoll(optarg);
+			break;
+		case 's':
+			seed = (unsigned int)atoi(optarg);
+			break;
+		default:
+			(void) fprintf(stderr, "usage: %s [-n services] "
+			    "[-l layers] [-c check_ns] [-s seed] "
+			    "[workers ...]\n", argv[0]);
+			return (2);
+		}
+	}
+	if (nsvcs < 2 || nlayers < 2 || nlayers > nsvcs || check_ns < 0) {
+		(void) fprintf(stderr, "%s: need 2 <= layers <= services\n",
+		    argv[0]);
+		return (2);
+	}
+
+	build();
+	bound = critical_path();
+	for (i = 0; i < nall; i++)
+		edges += svcs[i].s_ndeps;
+
+	(void) printf("%d services, %d layers, %llu dependencies, "
+	    "critical path %.3f s\n", nsvcs, nlayers,
+	    (unsigned long long)edges, bound / 1e9);
+	(void) printf("%13s  %-26s %-26s %s\n", "", "scan", "blocker",
+	    "blocker/bound");
+
+	if (optind == argc) {
+		for (i = 0; i < sizeof (def_workers) / sizeof (int); i++)
+			run(def_workers[i], bound);
+	} else {
+		for (; optind < argc; optind++) {
+			if ((c = atoi(argv[optind])) < 1) {
+				(void) fprintf(stderr, "%s: workers must be "
+				    "positive\n", argv[0]);
+				return (2);
+			}
+			run(c, bound);
+		}
+	}
+
+	return (bench_exit());
+}
@@ -0,0 +1,255 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * inst_index.c - hashed index of restarter instances
+ *
+ * Objects are hashed by id into a power-of-two table of buckets, each a
+ * chain through the inst_index_node_t embedded in the object.  The ids
+ * come from the dictionary (dict.c) and are dense, so the id itself is a
+ * perfect hash.
+ *
+ * Rather than one lock for the whole index, there are INST_INDEX_LOCKS
+ * locks, and bucket b is protected by lock b % INST_INDEX_LOCKS.  Since
+ * the number of buckets is a multiple of INST_INDEX_LOCKS, the lock for
+ * an id does not change when the table grows, and callers lock an id
+ * with inst_index_lock() without knowing the table size.  Work on
+ * unrelated ids then rarely waits for the same lock.
+ *
+ * inst_index_find(), _insert() and _remove() must be called with the lock
+ * for the id held.  A caller may hold one id's lock across a lookup and
+ * an insert to make the two atomic, but must never take a second id's
+ * lock while holding one.
+ *
+ * Growing the table needs every lock, so inserts never do it.  The owner
+ * calls inst_index_resize() at a point where it holds no lock which may
+ * be taken while holding an index lock.
+ *
+ * Nothing here depends on the rest of svc.startd, so it can be built and
+ * measured on its own.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "atomic.h"
+#include "inst_index.h"
+
+#define	INST_INDEX_LOCKS	64	/* power of two */
+#define	INST_INDEX_MIN_BUCKETS	INST_INDEX_LOCKS
+
+struct inst_index {
+	size_t			ii_offset;	/* of node within object */
+	inst_index_node_t	**ii_buckets;
+	uint32_t		ii_mask;	/* number of buckets - 1 */
+	volatile uint32_t	ii_count;
+	pthread_mutex_t		ii_locks[INST_INDEX_LOCKS];
+};
+
+#define	II_NODE(ii, obj)	\
+	((inst_index_node_t *)((char *)(obj) + (ii)->ii_offset))
+#define	II_OBJ(ii, node)	((void *)((char *)(node) - (ii)->ii_offset))
+#define	II_LOCK(ii, id)		(&(ii)->ii_locks[(id) & (INST_INDEX_LOCKS - 1)])
+
+/*
+ * offset is the offset of the inst_index_node_t in the indexed objects.
+ * Returns NULL if out of memory.
+ */
+inst_index_t *
+inst_index_create(size_t offset, const pthread_mutexattr_t *attr)
+{
+	inst_index_t *ii;
+	int i;
+
+	if ((ii = calloc(1, sizeof (*ii))) == NULL)
+		return (NULL);
+	if ((ii->ii_buckets = calloc(INST_INDEX_MIN_BUCKETS,
+	    sizeof (inst_index_node_t *))) == NULL) {
+		free(ii);
+		return (NULL);
+	}
+	ii->ii_offset = offset;
+	ii->ii_mask = INST_INDEX_MIN_BUCKETS - 1;
+	for (i = 0; i < INST_INDEX_LOCKS; i++)
+		(void) pthread_mutex_init(&ii->ii_locks[i], attr);
+
+	return (ii);
+}
+
+/*
+ * The index must be empty.
+ */
+void
+inst_index_destroy(inst_index_t *ii)
+{
+	int i;
+
+	assert(ii->ii_count == 0);
+	for (i = 0; i < INST_INDEX_LOCKS; i++)
+		(void) pthread_mutex_destroy(&ii->ii_locks[i]);
+	free(ii->ii_buckets);
+	free(ii);
+}
+
+void
+inst_index_lock(inst_index_t *ii, int id)
+{
+	(void) pthread_mutex_lock(II_LOCK(ii, id));
+}
+
+void
+inst_index_unlock(inst_index_t *ii, int id)
+{
+	(void) pthread_mutex_unlock(II_LOCK(ii, id));
+}
+
+/*
+ * Returns the object with the given id, or NULL.
+ */
+void *
+inst_index_find(inst_index_t *ii, int id)
+{
+	inst_index_node_t *n;
+
+	for (n = ii->ii_buckets[id & ii->ii_mask]; n != NULL; n = n->iin_next) {
+		if (n->iin_id == id)
+			return (II_OBJ(ii, n));
+	}
+	return (NULL);
+}
+
+/*
+ * Adds obj with the given id, which must not be in the index.
+ */
+void
+inst_index_insert(inst_index_t *ii, int id, void *obj)
+{
+	inst_index_node_t *n = II_NODE(ii, obj);
+	inst_index_node_t **b = &ii->ii_buckets[id & ii->ii_mask];
+
+	assert(inst_index_find(ii, id) == NULL);
+
+	n->iin_id = id;
+	n->iin_next = *b;
+	*b = n;
+	atomic_add_32(&ii->ii_count, 1);
+}
+
+/*
+ * Removes the object with the given id and returns it, or returns NULL if
+ * there is none.
+ */
+void *
+inst_index_remove(inst_index_t *ii, int id)
+{
+	inst_index_node_t *n, **np;
+
+	for (np = &ii->ii_buckets[id & ii->ii_mask]; (n = *np) != NULL;
+	    np = &n->iin_next) {
+		if (n->iin_id == id) {
+			*np = n->iin_next;
+			n->iin_next = NULL;
+			atomic_add_32(&ii->ii_count, -1);
+			return (II_OBJ(ii, n));
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Calls func(obj, arg) for each object, with the lock for the object's id
+ * held.  The locks are taken one at a time, so objects inserted or
+ * removed during the walk may or may not be seen.  Stops and returns the
+ * value if func returns nonzero.
+ */
+int
+inst_index_walk(inst_index_t *ii, inst_index_walk_f *func, void *arg)
+{
+	inst_index_node_t *n, *next;
+	uint32_t b;
+	int l, r;
+
+	for (l = 0; l < INST_INDEX_LOCKS; l++) {
+		(void) pthread_mutex_lock(&ii->ii_locks[l]);
+		for (b = l; b <= ii->ii_mask; b += INST_INDEX_LOCKS) {
+			for (n = ii->ii_buckets[b]; n != NULL; n = next) {
+				next = n->iin_next;
+				if ((r = func(II_OBJ(ii, n), arg)) != 0) {
+					(void) pthread_mutex_unlock(
+					    &ii->ii_locks[l]);
+					return (r);
+				}
+			}
+		}
+		(void) pthread_mutex_unlock(&ii->ii_locks[l]);
+	}
+	return (0);
+}
+
+/*
+ * Doubles the number of buckets while there are more objects than
+ * buckets.  Takes every lock, so the caller must hold none of them, nor
+ * anything which a holder of one of them may wait for.  If memory runs
+ * out the index keeps working with longer chains.
+ */
+void
+inst_index_resize(inst_index_t *ii)
+{
+	inst_index_node_t **nb, *n, *next;
+	uint32_t b, nmask;
+	int l;
+
+	if (ii->ii_count <= ii->ii_mask + 1)
+		return;
+
+	for (l = 0; l < INST_INDEX_LOCKS; l++)
+		(void) pthread_mutex_lock(&ii->ii_locks[l]);
+
+	nmask = ii->ii_mask;
+	while (ii->ii_count > nmask + 1)
+		nmask = nmask * 2 + 1;
+
+	if (nmask != ii->ii_mask && (nb = calloc((size_t)nmask + 1,
+	    sizeof (inst_index_node_t *))) != NULL) {
+		for (b = 0; b <= ii->ii_mask; b++) {
+			for (n = ii->ii_buckets[b]; n != NULL; n = next) {
+				next = n->iin_next;
+				n->iin_next = nb[n->iin_id & nmask];
+				nb[n->iin_id & nmask] = n;
+			}
+		}
+		free(ii->ii_buckets);
+		ii->ii_buckets = nb;
+		ii->ii_mask = nmask;
+	}
+
+	for (l = INST_INDEX_LOCKS - 1; l >= 0; l--)
+		(void) pthread_mutex_unlock(&ii->ii_locks[l]);
+}
+
+uint32_t
+inst_index_count(inst_index_t *ii)
+{
+	return (ii->ii_count);
+}
@@ -0,0 +1,65 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_INST_INDEX_H
+#define	_INST_INDEX_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * An index of objects by integer id, with a lock for each group of
+ * buckets.  See inst_index.c.
+ */
+typedef struct inst_index inst_index_t;
+
+/* Embedded in each indexed object. */
+typedef struct inst_index_node {
+	struct inst_index_node	*iin_next;
+	int			iin_id;
+} inst_index_node_t;
+
+typedef int inst_index_walk_f(void *, void *);
+
+inst_index_t *inst_index_create(size_t, const pthread_mutexattr_t *);
+void inst_index_destroy(inst_index_t *);
+
+void inst_index_lock(inst_index_t *, int);
+void inst_index_unlock(inst_index_t *, int);
+
+void *inst_index_find(inst_index_t *, int);
+void inst_index_insert(inst_index_t *, int, void *);
+void *inst_index_remove(inst_index_t *, int);
+
+int inst_index_walk(inst_index_t *, inst_index_walk_f *, void *);
+void inst_index_resize(inst_index_t *);
+uint32_t inst_index_count(inst_index_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _INST_INDEX_H */
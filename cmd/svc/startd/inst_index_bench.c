@@ -0,0 +1,246 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * inst_index_bench - restarter instance lookup scaling
+ *
+ * For each instance count N, builds N instances and looks random ones up
+ * by id the way restarter.c used to (a sorted uu_list behind one mutex)
+ * and through an inst_index_t, taking and dropping the lock around each
+ * lookup as inst_lookup_by_id() does.  Reports nanoseconds per lookup.
+ * Every lookup is checked, and exits with 1 if any check failed.  Usage:
+ *
+ *	inst_index_bench [-l lookups] [N ...]
+ *
+ * N defaults to 1000, 10000 and 100000.  The list lookups are linear, so
+ * only lookups / 100 of them are timed.
+ */
+
+#include <sys/types.h>
+
+#include <libuutil.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "inst_index.h"
+
+typedef struct bench_inst {
+	int			bi_id;
+	uu_list_node_t		bi_list_link;
+	inst_index_node_t	bi_index_link;
+} bench_inst_t;
+
+typedef struct bench_run {
+	int		br_use_index;
+	bench_inst_t	*br_insts;
+	uu_list_t	*br_list;
+	pthread_mutex_t	br_list_lock;
+	inst_index_t	*br_index;
+} bench_run_t;
+
+static uu_list_pool_t *inst_pool;
+
+/* As restarter_instance_compare() did. */
+/* ARGSUSED */
+static int
+inst_compare(const void *lc_arg, const void *rc_arg, void *private)
+{
+	int lc_id = ((const bench_inst_t *)lc_arg)->bi_id;
+	int rc_id = *(int *)rc_arg;
+
+	if (lc_id > rc_id)
+		return (1);
+	if (lc_id < rc_id)
+		return (-1);
+	return (0);
+}
+
+static bench_inst_t *
+lookup(bench_run_t *r, int id)
+{
+	bench_inst_t *bi;
+
+	if (r->br_use_index) {
+		inst_index_lock(r->br_index, id);
+		bi = inst_index_find(r->br_index, id);
+		inst_index_unlock(r->br_index, id);
+	} else {
+		(void) pthread_mutex_lock(&r->br_list_lock);
+		bi = uu_list_find(r->br_list, &id, NULL, NULL);
+		(void) pthread_mutex_unlock(&r->br_list_lock);
+	}
+	return (bi);
+}
+
+static void
+add(bench_run_t *r, bench_inst_t *bi)
+{
+	uu_list_index_t idx;
+
+	if (r->br_use_index) {
+		inst_index_lock(r->br_index, bi->bi_id);
+		inst_index_insert(r->br_index, bi->bi_id, bi);
+		inst_index_unlock(r->br_index, bi->bi_id);
+		inst_index_resize(r->br_index);
+	} else {
+		(void) pthread_mutex_lock(&r->br_list_lock);
+		(void) uu_list_find(r->br_list, &bi->bi_id, NULL, &idx);
+		uu_list_insert(r->br_list, bi, idx);
+		(void) pthread_mutex_unlock(&r->br_list_lock);
+	}
+}
+
+static void
+delete(bench_run_t *r, bench_inst_t *bi)
+{
+	if (r->br_use_index) {
+		inst_index_lock(r->br_index, bi->bi_id);
+		if (inst_index_remove(r->br_index, bi->bi_id) != bi)
+			bench_fail("remove: %d", bi->bi_id);
+		inst_index_unlock(r->br_index, bi->bi_id);
+	} else {
+		(void) pthread_mutex_lock(&r->br_list_lock);
+		uu_list_remove(r->br_list, bi);
+		(void) pthread_mutex_unlock(&r->br_list_lock);
+	}
+}
+
+static void
+run(int n, long lookups)
+{
+	bench_run_t r;
+	int *keys;
+	long i, nlist;
+	double t;
+	int id;
+
+	(void) memset(&r, 0, sizeof (r));
+	r.br_insts = bench_zalloc(n, sizeof (bench_inst_t));
+	keys = bench_zalloc(lookups, sizeof (int));
+	(void) pthread_mutex_init(&r.br_list_lock, NULL);
+	r.br_list = uu_list_create(inst_pool, NULL, UU_LIST_SORTED);
+	r.br_index = inst_index_create(offsetof(bench_inst_t, bi_index_link),
+	    NULL);
+	if (r.br_list == NULL || r.br_index == NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	/*
+	 * Descending order keeps each sorted insert at the head of the
+	 * list.
+	 */
+	for (id = n - 1; id >= 0; id--) {
+		r.br_insts[id].bi_id = id;
+		uu_list_node_init(&r.br_insts[id],
+		    &r.br_insts[id].bi_list_link, inst_pool);
+		r.br_use_index = 0;
+		add(&r, &r.br_insts[id]);
+		r.br_use_index = 1;
+		add(&r, &r.br_insts[id]);
+	}
+
+	for (i = 0; i < lookups; i++)
+		keys[i] = (int)(random() % n);
+	nlist = lookups / 100 > 0 ? lookups / 100 : 1;
+
+	(void) printf("%d instances\n", n);
+
+	r.br_use_index = 0;
+	t = bench_now_ns();
+	for (i = 0; i < nlist; i++) {
+		if (lookup(&r, keys[i]) != &r.br_insts[keys[i]])
+			bench_fail("list lookup: %d", keys[i]);
+	}
+	(void) printf("  %-32s %12.1f ns\n", "lookup, sorted list",
+	    (bench_now_ns() - t) / nlist);
+
+	r.br_use_index = 1;
+	t = bench_now_ns();
+	for (i = 0; i < lookups; i++) {
+		if (lookup(&r, keys[i]) != &r.br_insts[keys[i]])
+			bench_fail("index lookup: %d", keys[i]);
+	}
+	(void) printf("  %-32s %12.1f ns\n", "lookup, instance index",
+	    (bench_now_ns() - t) / lookups);
+	if (lookup(&r, n) != NULL || lookup(&r, -1) != NULL)
+		bench_fail("lookup of missing id: %d", n);
+	if (inst_index_count(r.br_index) != n)
+		bench_fail("count: %d", (int)inst_index_count(r.br_index));
+
+	for (id = 0; id < n; id++) {
+		r.br_use_index = 0;
+		delete(&r, &r.br_insts[id]);
+		r.br_use_index = 1;
+		delete(&r, &r.br_insts[id]);
+	}
+	inst_index_destroy(r.br_index);
+	uu_list_destroy(r.br_list);
+	(void) pthread_mutex_destroy(&r.br_list_lock);
+	free(keys);
+	free(r.br_insts);
+}
+
+int
+main(int argc, char *argv[])
+{
+	long lookups = 1000000;
+	int c;
+
+	while ((c = getopt(argc, argv, "l:")) != -1) {
+		switch (c) {
+		case 'l':
+			lookups = atol(optarg);
+			break;
+		default:
+			(void) fprintf(stderr,
+			    "usage: %s [-l lookups] [N ...]\n",
+			    argv[0]);
+			return (2);
+		}
+	}
+	if (lookups < 1)
+		lookups = 1;
+
+	inst_pool = uu_list_pool_create("bench_instances",
+	    sizeof (bench_inst_t), offsetof(bench_inst_t, bi_list_link),
+	    inst_compare, 0);
+	if (inst_pool == NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		return (1);
+	}
+
+	if (optind == argc) {
+		run(1000, lookups);
+		run(10000, lookups);
+		run(100000, lookups);
+	} else {
+		for (; optind < argc; optind++)
+			run(atoi(argv[optind]), lookups);
+	}
+
+	return (bench_exit());
+}
@@ -267,6 +267,27 @@ log_preexec()
 	closelog();
 }
 
+/*
+ * int log_open()
+ *   Open the log file for logstem, close-on-exec, for a method's output.
+ *   Returns the file descriptor, or -1.
+ */
+int
+log_open(const char *logstem)
+{
+	int fd;
+	char logfile[PATH_MAX];
+
+	(void) snprintf(logfile, PATH_MAX, "%s/%s", st->st_log_prefix, logstem);
+
+	(void) umask(fmask);
+	fd = open(logfile, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,
+	    S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	(void) umask(dmask);
+
+	return (fd);
+}
+
 /*
  * void setlog()
  *   Close file descriptors and redirect output.
@@ -275,20 +296,12 @@ void
 setlog(const char *logstem)
 {
 	int fd;
-	char logfile[PATH_MAX];
 
 	closefrom(0);
 
 	(void) open("/dev/null", O_RDONLY);
 
-	(void) snprintf(logfile, PATH_MAX, "%s/%s", st->st_log_prefix, logstem);
-
-	(void) umask(fmask);
-	fd = open(logfile, O_WRONLY|O_CREAT|O_APPEND,
-	    S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-	(void) umask(dmask);
-
-	if (fd == -1)
+	if ((fd = log_open(logstem)) == -1)
 		return;
 
 	(void) dup2(fd, STDOUT_FILENO);
@@ -29,7 +29,9 @@
  *
  * This file contains the routines needed to run a method:  a fork(2)-exec(2)
  * invocation monitored using either the contract filesystem or waitpid(2).
- * (Plain fork1(2) support is provided in fork.c.)
+ * (Plain fork1(2) support is provided in fork.c.)  Methods whose context
+ * needs only system calls to set are started with vfork(2) instead (see
+ * vspawn.c), so the cost doesn't grow with svc.startd's address space.
  *
  * Contract Transfer
  *   When we restart a service, we want to transfer any contracts that the old
@@ -74,6 +76,7 @@
 #include <libscf_priv.h>
 
 #include "startd.h"
+#include "vspawn.h"
 
 #define	SBIN_SH		"/sbin/sh"
 
@@ -599,6 +602,140 @@ exec_method(const restarter_inst_t *inst, int type, const char *method,
 	exit(10);
 }
 
+/*
+ * Exit status for a vspawn() child which failed at step with err, as
+ * exec_method() would have chosen.  Called in the child.
+ */
+static int
+method_spawn_exit(const char *step, int err)
+{
+	if (strcmp(step, "execve") == 0)
+		return (10);
+	if (strcmp(step, "chdir") == 0)
+		return (SMF_EXIT_ERR_CONFIG);
+
+	switch (err) {
+	case EINVAL:
+	case EPERM:
+	case ENOENT:
+	case ENAMETOOLONG:
+	case ERANGE:
+	case ESRCH:
+		return (SMF_EXIT_ERR_CONFIG);
+
+	default:
+		return (1);
+	}
+}
+
+/*
+ * pid_t method_spawn()
+ *   Start the method with vspawn() rather than fork(), if its context can be
+ *   set with system calls alone:  no project, resource pool, privilege sets,
+ *   core file pattern or utmpx entry, and no lookup of the user's groups.
+ *   Does in the parent what exec_method() does in the child up to the exec,
+ *   and leaves the child only setting its process group, descriptors,
+ *   descriptor limit, task, groups and ids, and directory.
+ *
+ *   Returns the pid, or -1 with *forkerr set, or 0 if the method must be
+ *   forked instead.
+ */
+static pid_t
+method_spawn(const restarter_inst_t *inst, int type, const char *method,
+    struct method_context *mcp, uint8_t need_session, int *forkerr)
+{
+	vspawn_t vs;
+	vspawn_err_t ve;
+	vspawn_rlimit_t rl;
+	char *argv[4];
+	char *cmd, **nenv;
+	int nullfd, logfd;
+	pid_t pid;
+
+	if ((inst->ri_utmpx_prefix != NULL &&
+	    inst->ri_utmpx_prefix[0] != '\0') ||
+	    mcp->corefile_pattern != NULL || mcp->project != NULL ||
+	    mcp->resource_pool != NULL || mcp->lpriv_set != NULL ||
+	    mcp->priv_set != NULL ||
+	    (mcp->ngroups == -1 && mcp->uid != (uid_t)-1))
+		return (0);
+
+	if ((nullfd = open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1) {
+		*forkerr = errno;
+		return (-1);
+	}
+	logfd = log_open(inst->ri_logstem);
+
+	log_instance(inst, B_FALSE, "Executing %s method (\"%s\").",
+	    method_names[type], method);
+
+	cmd = uu_msprintf("exec %s", method);
+	nenv = set_smf_env(mcp->env, mcp->env_sz, NULL, inst,
+	    method_names[type]);
+	argv[0] = SBIN_SH;
+	argv[1] = "-c";
+	argv[2] = cmd;
+	argv[3] = NULL;
+
+	/* Children get the descriptor limit svc.startd started with. */
+	rl.vr_resource = RLIMIT_NOFILE;
+	wait_fd_rlimit(&rl.vr_limit);
+
+	vspawn_init(&vs);
+	vs.vs_path = SBIN_SH;
+	vs.vs_argv = argv;
+	vs.vs_envp = nenv;
+	if (need_session)
+		vs.vs_flags |= VSPAWN_SETPGRP;
+	if (restarter_rm_libs_loadable())
+		vs.vs_flags |= VSPAWN_NEWTASK;
+	vs.vs_stdin = nullfd;
+	vs.vs_stdout = logfd;
+	vs.vs_closefrom = logfd != -1 ? STDERR_FILENO + 1 : STDOUT_FILENO;
+	vs.vs_rlimits = &rl;
+	vs.vs_nrlimits = 1;
+	if (mcp->ngroups != -1) {
+		vs.vs_ngroups = mcp->ngroups;
+		vs.vs_groups = mcp->groups;
+	}
+	if (mcp->gid != (gid_t)-1) {
+		vs.vs_gid = mcp->gid;
+		vs.vs_egid = mcp->egid != (gid_t)-1 ? mcp->egid : mcp->gid;
+	} else {
+		vs.vs_egid = mcp->egid;
+	}
+	if (mcp->uid != (uid_t)-1) {
+		vs.vs_uid = mcp->uid;
+		vs.vs_euid = mcp->euid != (uid_t)-1 ? mcp->euid : mcp->uid;
+	} else {
+		vs.vs_euid = mcp->euid;
+	}
+	vs.vs_cwd = mcp->working_dir;
+	vs.vs_exit = method_spawn_exit;
+
+	if ((pid = vspawn(&vs, &ve)) == -1) {
+		*forkerr = errno;
+	} else if (ve.ve_step != NULL && strcmp(ve.ve_step, "execve") != 0) {
+		if (strcmp(ve.ve_step, "chdir") == 0) {
+			log_instance(inst, B_FALSE, "%s: %s (\"%s\")",
+			    ve.ve_step, strerror(ve.ve_errno),
+			    mcp->working_dir);
+		} else {
+			log_instance(inst, B_FALSE, "svc.startd could not set "
+			    "context for method: %s: %s", ve.ve_step,
+			    strerror(ve.ve_errno));
+		}
+	}
+
+	free_smf_env(nenv, mcp->env_sz);
+	uu_free(cmd);
+	if (logfd != -1)
+		startd_close(logfd);
+	startd_close(nullfd);
+
+	return (pid);
+}
+
 static void
 write_status(restarter_inst_t *inst, const char *mname, int stat)
 {
@@ -880,9 +1017,12 @@ method_run(restarter_inst_t **instp, int type, int *exit_code)
 	}
 
 	atomic_add_16(&storing_contract, 1);
-	pid = startd_fork1(&forkerr);
-	if (pid == 0)
-		exec_method(inst, type, method, mcp, need_session);
+	pid = method_spawn(inst, type, method, mcp, need_session, &forkerr);
+	if (pid == 0) {
+		pid = startd_fork1(&forkerr);
+		if (pid == 0)
+			exec_method(inst, type, method, mcp, need_session);
+	}
 
 	if (pid == -1) {
 		atomic_add_16(&storing_contract, -1);
@@ -1266,6 +1406,7 @@ retry:
 
 out:
 	inst->ri_method_thread = 0;
+	restarter_resume_events(inst);
 
 	/*
 	 * Unlock the mutex after broadcasting to avoid a race condition
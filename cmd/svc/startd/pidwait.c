@@ -0,0 +1,124 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * pidwait.c - process exit notification for Linux
+ *
+ * This is the Linux counterpart of the /proc psinfo files and event port
+ * which wait.c uses elsewhere.  A pidfd, from pidfd_open(2), becomes
+ * readable when its process exits, so each watched process costs one fd
+ * in an epoll set and its exit is delivered by a single epoll_wait(2),
+ * with no reads of /proc.  A zombie's pidfd is readable at once, so a
+ * process which exits before it is associated is not missed.
+ *
+ * As with an event port, the caller opens the fd with pidwait_open() and
+ * records it before pidwait_associate() arms it, since the exit may be
+ * delivered to another thread at once.
+ *
+ * Each fd is registered with EPOLLONESHOT, so an exit is delivered once
+ * even if the fd is not closed promptly, or a forked child still holds a
+ * copy of it (which would keep the registration alive after close(2)).
+ * Removing a process is just closing its fd.
+ *
+ * Nothing here depends on the rest of svc.startd, so it can be built and
+ * tested on its own.
+ */
+
+#include "config.h"
+
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(Have_pidfd_open)
+#include <sys/pidfd.h>
+#endif
+
+#include "pidwait.h"
+
+#if !defined(Have_pidfd_open)
+static int
+pidfd_open(pid_t pid, unsigned int flags)
+{
+	return (syscall(SYS_pidfd_open, pid, flags));
+}
+#endif
+
+/*
+ * Returns a new, close-on-exec, set of watched processes, or -1 with errno
+ * set.
+ */
+int
+pidwait_create(void)
+{
+	return (epoll_create1(EPOLL_CLOEXEC));
+}
+
+/*
+ * Returns a close-on-exec pidfd for pid, to be passed to
+ * pidwait_associate(), or -1 with errno set to ESRCH if pid does not exist
+ * (which includes its having been reaped already), or another errno on
+ * failure.  The caller closes the fd once the exit has been delivered or
+ * the process is no longer of interest.
+ */
+int
+pidwait_open(pid_t pid)
+{
+	return (pidfd_open(pid, 0));
+}
+
+/*
+ * Starts watching the process of pidfd fd for exit in the set pw;  arg is
+ * returned by pidwait_get() when it exits, which may be before this
+ * returns.  Returns 0, or -1 with errno set.
+ */
+int
+pidwait_associate(int pw, int fd, void *arg)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = arg;
+	return (epoll_ctl(pw, EPOLL_CTL_ADD, fd, &ev));
+}
+
+/*
+ * Waits for a process in pw to exit, and sets *argp to the arg it was
+ * associated with.  Returns 0, or -1 with errno set (EINTR if a signal
+ * interrupted the wait).
+ */
+int
+pidwait_get(int pw, void **argp)
+{
+	struct epoll_event ev;
+	int n;
+
+	while ((n = epoll_wait(pw, &ev, 1, -1)) == 0)
+		;
+	if (n == -1)
+		return (-1);
+
+	*argp = ev.data.ptr;
+	return (0);
+}
@@ -0,0 +1,268 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * pidwait_bench - process exit delivery through pidwait.c
+ *
+ * Forks N short-lived children, at most C alive at a time, each of which
+ * sleeps for a random time up to S microseconds and exits with a status
+ * derived from its index.  Each is associated with a pidwait set as it is
+ * forked, and a waiter thread built like wait_thread() takes the exits and
+ * reaps the children.  Reports the rate at which children were run and
+ * how long after the end of its sleep each exit was delivered.
+ *
+ * Checks that every exit is delivered exactly once, only after the child
+ * has exited (waitpid() with WNOHANG must reap it), with the right status,
+ * and that a child which exited before it was associated is delivered
+ * too.  Exits with 1 if any check failed.  Usage:
+ *
+ *	pidwait_bench [-n children] [-c concurrent] [-s sleep_us]
+ *
+ * Defaults are 5000 children, 256 at a time, sleeping up to 2000 us.
+ */
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "pidwait.h"
+
+typedef struct bench_child {
+	pid_t		bc_pid;
+	int		bc_fd;
+	int		bc_delivered;
+	int64_t		bc_due;		/* end of the child's sleep */
+	int64_t		bc_latency;
+} bench_child_t;
+
+static int pw;
+static int nchildren = 5000;
+static int concurrent = 256;
+static int sleep_us = 2000;
+
+static bench_child_t *children;
+static pthread_mutex_t live_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t live_cv = PTHREAD_COND_INITIALIZER;
+static int live;
+static int reaped;
+
+/*
+ * As wait_thread() and wait_remove():  take an exit, reap the child and
+ * close its fd.
+ */
+/* ARGSUSED */
+static void *
+waiter(void *arg)
+{
+	bench_child_t *bc;
+	void *p;
+	int status, i;
+
+	for (;;) {
+		if (pidwait_get(pw, &p) != 0) {
+			if (errno == EINTR)
+				continue;
+			perror("pidwait_get");
+			exit(1);
+		}
+		bc = p;
+		i = bc - children;
+		if (bc->bc_delivered++ != 0)
+			bench_fail("exit delivered twice: child %d", i);
+		bc->bc_latency = bench_now_ns() - bc->bc_due;
+		if (waitpid(bc->bc_pid, &status, WNOHANG) != bc->bc_pid)
+			bench_fail("exit delivered before child exited: "
+			    "child %d", i);
+		else if (!WIFEXITED(status) || WEXITSTATUS(status) != (i & 0x7f))
+			bench_fail("wrong exit status: child %d", i);
+
+		(void) pthread_mutex_lock(&live_lock);
+		(void) close(bc->bc_fd);
+		live--;
+		reaped++;
+		(void) pthread_cond_signal(&live_cv);
+		(void) pthread_mutex_unlock(&live_lock);
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+static pid_t
+spawn(int i, int us)
+{
+	pid_t pid;
+
+	if ((pid = fork()) == -1) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		if (us > 0)
+			(void) usleep(us);
+		_exit(i & 0x7f);
+	}
+	return (pid);
+}
+
+/*
+ * A child which has exited before it is associated must still be
+ * delivered.
+ */
+static void
+check_zombie(void)
+{
+	bench_child_t bc;
+	void *p;
+	int status;
+
+	(void) memset(&bc, 0, sizeof (bc));
+	bc.bc_pid = spawn(0, 0);
+	(void) usleep(20000);
+	if ((bc.bc_fd = pidwait_open(bc.bc_pid)) == -1 ||
+	    pidwait_associate(pw, bc.bc_fd, &bc) != 0) {
+		bench_fail("associate with zombie: %s", strerror(errno));
+		(void) waitpid(bc.bc_pid, &status, 0);
+	} else {
+		if (pidwait_get(pw, &p) != 0 || p != &bc)
+			bench_fail("zombie exit not delivered: pid %d",
+			    (int)bc.bc_pid);
+		if (waitpid(bc.bc_pid, &status, WNOHANG) != bc.bc_pid)
+			bench_fail("zombie not reaped: pid %d", (int)bc.bc_pid);
+		(void) close(bc.bc_fd);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct rlimit rl;
+	pthread_t tid;
+	int64_t start, elapsed, total = 0, max = 0;
+	int c, i, us;
+
+	while ((c = getopt(argc, argv, "n:c:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			nchildren = atoi(optarg);
+			break;
+		case 'c':
+			concurrent = atoi(optarg);
+			break;
+		case 's':
+			sleep_us = atoi(optarg);
+			break;
+		default:
+			(void) fprintf(stderr, "usage: %s [-n children] "
+			    "[-c concurrent] [-s sleep_us]\n", argv[0]);
+			return (2);
+		}
+	}
+	if (nchildren < 1 || concurrent < 1 || sleep_us < 0) {
+		(void) fprintf(stderr, "%s: bad arguments\n", argv[0]);
+		return (2);
+	}
+
+	/* As wait_init(), make room for an fd per child. */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		(void) setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	if ((pw = pidwait_create()) == -1) {
+		perror("pidwait_create");
+		return (1);
+	}
+	check_zombie();
+
+	children = bench_zalloc(nchildren, sizeof (bench_child_t));
+	(void) pthread_create(&tid, NULL, waiter, NULL);
+
+	start = bench_now_ns();
+	for (i = 0; i < nchildren; i++) {
+		bench_child_t *bc = &children[i];
+
+		(void) pthread_mutex_lock(&live_lock);
+		while (live >= concurrent)
+			(void) pthread_cond_wait(&live_cv, &live_lock);
+		live++;
+		(void) pthread_mutex_unlock(&live_lock);
+
+		us = sleep_us > 0 ? random() % (sleep_us + 1) : 0;
+		bc->bc_due = bench_now_ns() + us * 1000LL;
+		bc->bc_pid = spawn(i, us);
+
+		if ((bc->bc_fd = pidwait_open(bc->bc_pid)) != -1 &&
+		    pidwait_associate(pw, bc->bc_fd, bc) != 0) {
+			(void) close(bc->bc_fd);
+			bc->bc_fd = -1;
+		}
+		if (bc->bc_fd == -1) {
+			bench_fail("associate: %s", strerror(errno));
+			(void) waitpid(bc->bc_pid, NULL, 0);
+			(void) pthread_mutex_lock(&live_lock);
+			live--;
+			reaped++;
+			(void) pthread_mutex_unlock(&live_lock);
+		}
+	}
+
+	(void) pthread_mutex_lock(&live_lock);
+	while (reaped < nchildren)
+		(void) pthread_cond_wait(&live_cv, &live_lock);
+	(void) pthread_mutex_unlock(&live_lock);
+	elapsed = bench_now_ns() - start;
+
+	/* The waiter is blocked in epoll_wait(), a cancellation point. */
+	(void) pthread_cancel(tid);
+	(void) pthread_join(tid, NULL);
+
+	for (i = 0; i < nchildren; i++) {
+		if (children[i].bc_fd == -1)
+			continue;
+		if (children[i].bc_delivered != 1) {
+			bench_fail("exit not delivered: child %d", i);
+			continue;
+		}
+		total += children[i].bc_latency;
+		if (children[i].bc_latency > max)
+			max = children[i].bc_latency;
+	}
+
+	(void) printf("%d children, %d at a time, sleeping up to %d us\n",
+	    nchildren, concurrent, sleep_us);
+	(void) printf("  %-28s %12.0f /s\n", "children run",
+	    nchildren / ((double)elapsed / 1e9));
+	(void) printf("  %-28s %12.1f us\n", "mean delivery after sleep",
+	    (double)total / nchildren / 1000);
+	(void) printf("  %-28s %12.1f us\n", "max delivery after sleep",
+	    (double)max / 1000);
+
+	return (bench_exit());
+}
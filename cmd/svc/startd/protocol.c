@@ -53,6 +53,7 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <libuutil.h>
+#include <stddef.h>
 
 #include <librestart.h>
 #include <librestart_priv.h>
@@ -60,77 +61,106 @@
 #include "protocol.h"
 #include "startd.h"
 
-/* Local event queue structures. */
-typedef struct graph_protocol_event_queue {
-	uu_list_t		*gpeq_event_list;
-	pthread_mutex_t		gpeq_lock;
-} graph_protocol_event_queue_t;
+/*
+ * Local event queues.  Each has one consumer (graph_event_thread() and
+ * restarter_event_thread()) and any number of producers;  see
+ * event_queue.c.  A producer wakes the consumer only when it makes the
+ * queue non-empty, and the consumer drains the queue before it sleeps
+ * again, so a burst of events costs one wakeup rather than one each.
+ *
+ * Freed events are kept in a pool for reuse rather than returned to the
+ * allocator.
+ */
+#define	PROTOCOL_EVENT_POOL	1024
 
-typedef struct restarter_protocol_event_queue {
-	uu_list_t		*rpeq_event_list;
-	pthread_mutex_t		rpeq_lock;
-} restarter_protocol_event_queue_t;
+static evq_t *restarter_queue;
+static evq_pool_t *restarter_event_pool;
 
-static uu_list_pool_t *restarter_protocol_event_queue_pool;
-static restarter_protocol_event_queue_t *restarter_queue;
+static evq_t *graph_queue;
+static evq_pool_t *graph_event_pool;
 
-static uu_list_pool_t *graph_protocol_event_queue_pool;
-static graph_protocol_event_queue_t *graph_queue;
+static void *
+protocol_event_alloc(evq_pool_t *pool, size_t sz)
+{
+	void *e;
 
-void
-graph_protocol_init()
+	if ((e = evq_pool_get(pool)) == NULL)
+		return (startd_zalloc(sz));
+
+	bzero(e, sz);
+	return (e);
+}
+
+static void
+protocol_event_free(evq_pool_t *pool, void *e, size_t sz)
+{
+	if (evq_pool_put(pool, e) != 0)
+		startd_free(e, sz);
+}
+
+/*
+ * Events name instances by FMRI.  Nearly every FMRI is in the dictionary,
+ * which keeps its strings for the life of svc.startd, so events point to
+ * the dictionary's copy.  Any other name is copied, and *szp is set to the
+ * size of the copy, or to 0 if there is none to free.
+ */
+static const char *
+protocol_intern(const char *inst, size_t *szp)
 {
-	graph_protocol_event_queue_pool = startd_list_pool_create(
-	    "graph_protocol_events", sizeof (graph_protocol_event_t),
-	    offsetof(graph_protocol_event_t, gpe_link), NULL,
-	    UU_LIST_POOL_DEBUG);
+	char *s;
+	int id;
 
-	graph_queue = startd_zalloc(sizeof (graph_protocol_event_queue_t));
+	if ((id = dict_lookup_byname(inst)) != -1) {
+		*szp = 0;
+		return (dict_lookup_byid(id));
+	}
 
-	(void) pthread_mutex_init(&graph_queue->gpeq_lock, &mutex_attrs);
-	graph_queue->gpeq_event_list = startd_list_create(
-	    graph_protocol_event_queue_pool, graph_queue, 0);
+	*szp = strlen(inst) + 1;
+	s = startd_alloc(*szp);
+	(void) strlcpy(s, inst, *szp);
+	return (s);
+}
+
+void
+graph_protocol_init()
+{
+	graph_queue = evq_create(offsetof(graph_protocol_event_t, gpe_link));
+	graph_event_pool = evq_pool_create(PROTOCOL_EVENT_POOL);
+	if (graph_queue == NULL || graph_event_pool == NULL)
+		uu_die("Insufficient memory.\n");
 }
 
 /*
- * "data" will be freed by the consumer
+ * "data" will be freed by the consumer.  Returns 1 if the graph event
+ * thread must be woken.
  */
-static void
+static int
 graph_event_enqueue(const char *inst, graph_event_type_t event,
     protocol_states_t *data)
 {
 	graph_protocol_event_t *e;
 
-	e = startd_zalloc(sizeof (graph_protocol_event_t));
+	e = protocol_event_alloc(graph_event_pool,
+	    sizeof (graph_protocol_event_t));
 
-	if (inst != NULL) {
-		int size = strlen(inst) + 1;
-		e->gpe_inst = startd_alloc(size);
-		e->gpe_inst_sz = size;
-		(void) strlcpy(e->gpe_inst, inst, size);
-	}
+	if (inst != NULL)
+		e->gpe_inst = protocol_intern(inst, &e->gpe_inst_sz);
 	e->gpe_type = event;
 	e->gpe_data = data;
 
 	(void) pthread_mutex_init(&e->gpe_lock, &mutex_attrs);
 
-	MUTEX_LOCK(&graph_queue->gpeq_lock);
-	uu_list_node_init(e, &e->gpe_link, graph_protocol_event_queue_pool);
-	if (uu_list_insert_before(graph_queue->gpeq_event_list, NULL, e) == -1)
-		uu_die("failed to enqueue graph event (%s: %s)\n",
-		    e->gpe_inst, uu_strerror(uu_error()));
-
-	MUTEX_UNLOCK(&graph_queue->gpeq_lock);
+	return (evq_enqueue(graph_queue, e));
 }
 
 void
 graph_event_release(graph_protocol_event_t *e)
 {
-	uu_list_node_fini(e, &e->gpe_link, graph_protocol_event_queue_pool);
 	(void) pthread_mutex_destroy(&e->gpe_lock);
-	if (e->gpe_inst != NULL)
-		startd_free(e->gpe_inst, e->gpe_inst_sz);
-	startd_free(e, sizeof (graph_protocol_event_t));
+	if (e->gpe_inst_sz != 0)
+		startd_free((void *)e->gpe_inst, e->gpe_inst_sz);
+	protocol_event_free(graph_event_pool, e,
+	    sizeof (graph_protocol_event_t));
 }
 
 /*
@@ -143,22 +173,7 @@ graph_event_release(graph_protocol_event_t *e)
 graph_protocol_event_t *
 graph_event_dequeue()
 {
-	graph_protocol_event_t *e;
-
-	MUTEX_LOCK(&graph_queue->gpeq_lock);
-
-	e = uu_list_first(graph_queue->gpeq_event_list);
-	if (e == NULL) {
-		MUTEX_UNLOCK(&graph_queue->gpeq_lock);
-		return (NULL);
-	}
-
-	if (uu_list_next(graph_queue->gpeq_event_list, e) != NULL)
-		gu->gu_wakeup = 1;
-	uu_list_remove(graph_queue->gpeq_event_list, e);
-	MUTEX_UNLOCK(&graph_queue->gpeq_lock);
-
-	return (e);
+	return (evq_dequeue(graph_queue));
 }
 
 /*
@@ -172,19 +187,16 @@ graph_event_requeue(graph_protocol_event_t *e)
 
 	log_framework(LOG_DEBUG, "Requeing event\n");
 
-	MUTEX_LOCK(&graph_queue->gpeq_lock);
-	if (uu_list_insert_after(graph_queue->gpeq_event_list, NULL, e) == -1)
-		uu_die("failed to requeue graph event (%s: %s)\n",
-		    e->gpe_inst, uu_strerror(uu_error()));
-
-	MUTEX_UNLOCK(&graph_queue->gpeq_lock);
+	evq_requeue(graph_queue, e);
 }
 
 void
 graph_protocol_send_event(const char *inst, graph_event_type_t event,
     protocol_states_t *data)
 {
-	graph_event_enqueue(inst, event, data);
+	if (graph_event_enqueue(inst, event, data) == 0)
+		return;
+
 	MUTEX_LOCK(&gu->gu_lock);
 	gu->gu_wakeup = 1;
 	(void) pthread_cond_broadcast(&gu->gu_cv);
@@ -194,55 +206,44 @@ graph_protocol_send_event(const char *inst, graph_event_type_t event,
 void
 restarter_protocol_init()
 {
-	restarter_protocol_event_queue_pool = startd_list_pool_create(
-	    "restarter_protocol_events", sizeof (restarter_protocol_event_t),
-	    offsetof(restarter_protocol_event_t, rpe_link), NULL,
-	    UU_LIST_POOL_DEBUG);
-
-	restarter_queue = startd_zalloc(
-	    sizeof (restarter_protocol_event_queue_t));
-
-	(void) pthread_mutex_init(&restarter_queue->rpeq_lock, &mutex_attrs);
-	restarter_queue->rpeq_event_list = startd_list_create(
-	    restarter_protocol_event_queue_pool, restarter_queue, 0);
+	restarter_queue = evq_create(offsetof(restarter_protocol_event_t,
+	    rpe_link));
+	restarter_event_pool = evq_pool_create(PROTOCOL_EVENT_POOL);
+	if (restarter_queue == NULL || restarter_event_pool == NULL)
+		uu_die("Insufficient memory.\n");
 
 	log_framework(LOG_DEBUG, "Initialized restarter protocol\n");
 }
 
 /*
- * void restarter_event_enqueue()
- *   Enqueue a restarter event.
+ * int restarter_event_enqueue()
+ *   Enqueue a restarter event.  Returns 1 if the restarter event thread
+ *   must be woken.
  */
-static void
+static int
 restarter_event_enqueue(const char *inst, restarter_event_type_t event,
     int32_t reason)
 {
 	restarter_protocol_event_t *e;
-	int r;
 
 	/* Allocate and populate the event structure. */
-	e = startd_zalloc(sizeof (restarter_protocol_event_t));
+	e = protocol_event_alloc(restarter_event_pool,
+	    sizeof (restarter_protocol_event_t));
 
-	e->rpe_inst = startd_alloc(strlen(inst) + 1);
-	(void) strlcpy(e->rpe_inst, inst, strlen(inst)+1);
+	e->rpe_inst = protocol_intern(inst, &e->rpe_inst_sz);
 	e->rpe_type = event;
 	e->rpe_reason = reason;
 
-	MUTEX_LOCK(&restarter_queue->rpeq_lock);
-	uu_list_node_init(e, &e->rpe_link, restarter_protocol_event_queue_pool);
-	r = uu_list_insert_before(restarter_queue->rpeq_event_list, NULL, e);
-	assert(r == 0);
-
-	MUTEX_UNLOCK(&restarter_queue->rpeq_lock);
-
+	return (evq_enqueue(restarter_queue, e));
 }
 
 void
 restarter_event_release(restarter_protocol_event_t *e)
 {
-	uu_list_node_fini(e, &e->rpe_link, restarter_protocol_event_queue_pool);
-	startd_free(e->rpe_inst, strlen(e->rpe_inst) + 1);
-	startd_free(e, sizeof (restarter_protocol_event_t));
+	if (e->rpe_inst_sz != 0)
+		startd_free((void *)e->rpe_inst, e->rpe_inst_sz);
+	protocol_event_free(restarter_event_pool, e,
+	    sizeof (restarter_protocol_event_t));
 }
 
 /*
@@ -255,22 +256,7 @@ restarter_event_release(restarter_protocol_event_t *e)
 restarter_protocol_event_t *
 restarter_event_dequeue()
 {
-	restarter_protocol_event_t *e = NULL;
-
-	MUTEX_LOCK(&restarter_queue->rpeq_lock);
-
-	e = uu_list_first(restarter_queue->rpeq_event_list);
-	if (e == NULL) {
-		MUTEX_UNLOCK(&restarter_queue->rpeq_lock);
-		return (NULL);
-	}
-
-	if (uu_list_next(restarter_queue->rpeq_event_list, e) != NULL)
-		ru->restarter_update_wakeup = 1;
-	uu_list_remove(restarter_queue->rpeq_event_list, e);
-	MUTEX_UNLOCK(&restarter_queue->rpeq_lock);
-
-	return (e);
+	return (evq_dequeue(restarter_queue));
 }
 
 static int
@@ -430,7 +416,8 @@ restarter_protocol_send_event(const char *inst, evchan_t *chan,
 	 * queue the event locally.
 	 */
 	if (chan == NULL) {
-		restarter_event_enqueue(inst, event, reason);
+		if (restarter_event_enqueue(inst, event, reason) == 0)
+			return;
 		MUTEX_LOCK(&ru->restarter_update_lock);
 		ru->restarter_update_wakeup = 1;
 		(void) pthread_cond_broadcast(&ru->restarter_update_cv);
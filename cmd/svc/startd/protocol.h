@@ -27,6 +27,8 @@
 
 #include <startd.h>
 
+#include "event_queue.h"
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
@@ -46,12 +48,12 @@ typedef struct protocol_states {
 
 
 typedef struct graph_protocol_event {
-	char			*gpe_inst;
-	size_t			gpe_inst_sz;
+	const char		*gpe_inst;
+	size_t			gpe_inst_sz;	/* 0 if interned */
 	graph_event_type_t	gpe_type;
 	protocol_states_t	*gpe_data;
 
-	uu_list_node_t		gpe_link;
+	evq_node_t		gpe_link;
 	pthread_mutex_t		gpe_lock;
 } graph_protocol_event_t;
 
@@ -66,11 +68,12 @@ typedef struct graph_update {
 } graph_update_t;
 
 typedef struct restarter_protocol_event {
-	char			*rpe_inst;
+	const char		*rpe_inst;
+	size_t			rpe_inst_sz;	/* 0 if interned */
 	restarter_event_type_t	rpe_type;
 	int32_t			rpe_reason;
 
-	uu_list_node_t		rpe_link;
+	evq_node_t		rpe_link;
 } restarter_protocol_event_t;
 
 typedef struct restarter_update {
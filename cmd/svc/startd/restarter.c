@@ -37,9 +37,17 @@
  *   - contract thread: thread to handle contract events
  *   - wait thread: thread to handle wait-based services
  *
- * The other threads are created as-needed:
- *   - per-instance method threads
- *   - per-instance event processing threads
+ * and two fixed sets of workers:
+ *   - event workers: process the event queues of instances with events
+ *   - method threads: run the methods handed to them by the event workers
+ *     and the contract and timeout threads
+ *
+ * An instance with events is put, by id, on restarter_runq, and stays
+ * there or with one event worker until its queue is empty, so its events
+ * are processed in order and by one thread at a time.  If a method is
+ * running or waiting to run for the instance, the event worker puts the
+ * instance aside rather than wait, and method_thread() hands it back when
+ * the method is done.
  *
  * The interaction of all threads must result in the following conditions
  * being satisfied (on a per-instance basis):
@@ -50,7 +58,10 @@
  *   - timeouts should fire even when a method is running
  *
  * Service instances are represented by restarter_inst_t's and are kept in the
- * instance_list list.
+ * instance_index, a hash of their ids with a lock for each group of buckets
+ * (see inst_index.c), so that events for unrelated instances seldom wait
+ * for each other.  "instance_index lock" below means the lock covering a
+ * particular id;  no thread holds more than one.
  *
  * Service States
  *   The current state of a service instance is kept in
@@ -61,14 +72,16 @@
  *   RESTARTER_STATE_NONE.  So usually i_next_state is _NONE when ri_lock is not
  *   held.  The exception is when we launch methods, which are done with
  *   a separate thread.  To keep any other threads from grabbing ri_lock before
- *   method_thread() does, we set ri_method_thread to the thread id of the
- *   method thread, and when it is nonzero any thread with a different thread id
+ *   method_thread() does, we set ri_method_queued until a method thread takes
+ *   the method, and then ri_method_thread to the thread id of the method
+ *   thread, and while either is set any thread with a different thread id
  *   waits on ri_method_cv.
  *
  * Method execution is serialized by blocking on ri_method_cv in
- * inst_lookup_by_id() and waiting for a 0 value of ri_method_thread.  This
- * also prevents the instance structure from being deleted until all
- * outstanding operations such as method_thread() have finished.
+ * inst_lookup_by_id() and waiting for ri_method_queued to clear and a 0 value
+ * of ri_method_thread.  This also prevents the instance structure from being
+ * deleted until all outstanding operations such as method_thread() have
+ * finished.
  *
  * Lock ordering:
  *
@@ -78,24 +91,25 @@
  *   st->st_load_lock
  *   wait_info_lock
  *   ru->restarter_update_lock
- *     restarter_queue->rpeq_lock
- *   instance_list.ril_lock
+ *   instance_index lock
  *     inst->ri_lock
  *   st->st_configd_live_lock
  *
- * instance_list.ril_lock
- *   graph_queue->gpeq_lock
+ * instance_index lock
  *   gu->gu_lock
  *   st->st_configd_live_lock
  *   dictionary->dict_lock
  *   inst->ri_lock
- *     graph_queue->gpeq_lock
  *     gu->gu_lock
- *     tu->tu_lock
  *     tq->tq_lock
  *     inst->ri_queue_lock
  *       wait_info_lock
  *       bp->cb_lock
+ *       restarter_runq->wq_lock
+ *     restarter_runq->wq_lock
+ *     restarter_methodq->wq_lock
+ *     restarter_method_lock
+ *       restarter_methodq->wq_lock
  *     utmpx_lock
  *
  * single_user_thread_lock
@@ -134,15 +148,182 @@
 
 #include "startd.h"
 #include "protocol.h"
+#include "work_queue.h"
 
 uu_list_pool_t *contract_list_pool;
-static uu_list_pool_t *restarter_instance_pool;
-static restarter_instance_list_t instance_list;
+static inst_index_t *instance_index;
 
 static uu_list_pool_t *restarter_queue_pool;
 
+/*
+ * Instances with events to process are put, by id, on restarter_runq, and
+ * methods to run are put on restarter_methodq.  Each is served by a fixed
+ * number of threads, but a method can hold its thread until its timeout
+ * while it waits for another service, whose method may be the one queued.
+ * So if no queued method has been taken for RESTARTER_METHOD_STALL_MS,
+ * restarter_method_monitor() starts another method thread, which exits
+ * again once it finds the queue empty.
+ */
+#define	RESTARTER_EVENT_WORKERS		16
+#define	RESTARTER_METHOD_WORKERS	64
+#define	RESTARTER_METHOD_STALL_MS	1000
+
+static work_queue_t *restarter_runq;
+static work_queue_t *restarter_methodq;
+
+static pthread_mutex_t restarter_method_lock;
+static pthread_cond_t restarter_method_cv;	/* a method was queued */
+static uint_t restarter_method_nworkers;
+static uint64_t restarter_method_ntaken;
+
 #define	WT_SVC_ERR_THROTTLE	1	/* 1 sec delay for erroring wait svc */
 
+/*
+ * Adds item to wq, with the same retry policy as startd_alloc().
+ */
+static void
+restarter_work_put(work_queue_t *wq, void *item)
+{
+	uint_t try, msecs;
+
+	if (work_queue_put(wq, item) == 0)
+		return;
+	assert(errno == ENOMEM);
+
+	msecs = ALLOC_DELAY;
+
+	for (try = 0; try < ALLOC_RETRY; ++try) {
+		(void) poll(NULL, 0, msecs);
+		if (work_queue_put(wq, item) == 0)
+			return;
+		msecs *= ALLOC_DELAY_MULT;
+	}
+
+	uu_die("Insufficient memory.\n");
+	/* NOTREACHED */
+}
+
+/*
+ * Hands info to the method threads.  Until one of them takes it, other
+ * threads wait in inst_lookup_by_id() as they would for a running method.
+ */
+static void
+restarter_method_dispatch(restarter_inst_t *inst, fork_info_t *info)
+{
+	assert(MUTEX_HELD(&inst->ri_lock));
+	assert(inst->ri_method_thread == 0 && !inst->ri_method_queued);
+
+	info->sf_inst = inst;
+	inst->ri_method_queued = B_TRUE;
+	restarter_work_put(restarter_methodq, info);
+
+	MUTEX_LOCK(&restarter_method_lock);
+	(void) pthread_cond_signal(&restarter_method_cv);
+	MUTEX_UNLOCK(&restarter_method_lock);
+}
+
+/*
+ * A method thread.  The instance can't be freed while ri_method_queued is
+ * set, so info->sf_inst is safe to lock.
+ */
+/*ARGSUSED*/
+static void *
+restarter_method_worker(void *unused)
+{
+	fork_info_t *info;
+	restarter_inst_t *inst;
+
+	for (;;) {
+		info = work_queue_get(restarter_methodq);
+		inst = info->sf_inst;
+
+		MUTEX_LOCK(&restarter_method_lock);
+		restarter_method_ntaken++;
+		MUTEX_UNLOCK(&restarter_method_lock);
+
+		MUTEX_LOCK(&inst->ri_lock);
+		assert(inst->ri_method_queued);
+		assert(inst->ri_method_thread == 0);
+		inst->ri_method_queued = B_FALSE;
+		inst->ri_method_thread = pthread_self();
+		MUTEX_UNLOCK(&inst->ri_lock);
+
+		(void) method_thread(info);
+
+		/* Threads started for a stall go once it has cleared. */
+		MUTEX_LOCK(&restarter_method_lock);
+		if (restarter_method_nworkers > RESTARTER_METHOD_WORKERS &&
+		    work_queue_count(restarter_methodq) == 0) {
+			restarter_method_nworkers--;
+			MUTEX_UNLOCK(&restarter_method_lock);
+			return (NULL);
+		}
+		MUTEX_UNLOCK(&restarter_method_lock);
+	}
+
+	/*NOTREACHED*/
+	return (NULL);
+}
+
+/*
+ * Starts another method thread whenever methods have been queued for
+ * RESTARTER_METHOD_STALL_MS without any being taken, which means every
+ * method thread is busy with a method that is taking its time.
+ */
+/*ARGSUSED*/
+static void *
+restarter_method_monitor(void *unused)
+{
+	uint64_t taken;
+
+	(void) pthread_setname_np(pthread_self(), "restarter_method_monitor");
+
+	MUTEX_LOCK(&restarter_method_lock);
+
+	/*CONSTCOND*/
+	while (1) {
+		if (work_queue_count(restarter_methodq) == 0) {
+			(void) pthread_cond_wait(&restarter_method_cv,
+			    &restarter_method_lock);
+			continue;
+		}
+
+		taken = restarter_method_ntaken;
+		MUTEX_UNLOCK(&restarter_method_lock);
+		(void) poll(NULL, 0, RESTARTER_METHOD_STALL_MS);
+		MUTEX_LOCK(&restarter_method_lock);
+
+		if (restarter_method_ntaken != taken ||
+		    work_queue_count(restarter_methodq) == 0)
+			continue;
+
+		restarter_method_nworkers++;
+		log_framework(LOG_DEBUG, "No method started for %d ms, "
+		    "%u method threads now.\n", RESTARTER_METHOD_STALL_MS,
+		    restarter_method_nworkers);
+		(void) startd_thread_create(restarter_method_worker, NULL);
+	}
+
+	/*NOTREACHED*/
+	return (NULL);
+}
+
+/*
+ * Called by method_thread() when it is done with inst.  If an event worker
+ * put off inst's events while the method ran, hand inst back to them.
+ */
+void
+restarter_resume_events(restarter_inst_t *inst)
+{
+	assert(MUTEX_HELD(&inst->ri_lock));
+
+	if (inst->ri_events_deferred) {
+		inst->ri_events_deferred = B_FALSE;
+		restarter_work_put(restarter_runq,
+		    (void *)(uintptr_t)inst->ri_id);
+	}
+}
+
 /*
  * Function used to reset the restart times for an instance, when
  * an administrative task comes along and essentially makes the times
@@ -155,21 +336,6 @@ reset_start_times(restarter_inst_t *inst)
 	bzero(inst->ri_start_time, sizeof (inst->ri_start_time));
 }
 
-/*ARGSUSED*/
-static int
-restarter_instance_compare(const void *lc_arg, const void *rc_arg,
-    void *private)
-{
-	int lc_id = ((const restarter_inst_t *)lc_arg)->ri_id;
-	int rc_id = *(int *)rc_arg;
-
-	if (lc_id > rc_id)
-		return (1);
-	if (lc_id < rc_id)
-		return (-1);
-	return (0);
-}
-
 static restarter_inst_t *
 inst_lookup_by_name(const char *name)
 {
@@ -187,15 +353,16 @@ inst_lookup_by_id(int id)
 {
 	restarter_inst_t *inst;
 
-	MUTEX_LOCK(&instance_list.ril_lock);
-	inst = uu_list_find(instance_list.ril_instance_list, &id, NULL, NULL);
+	inst_index_lock(instance_index, id);
+	inst = inst_index_find(instance_index, id);
 	if (inst != NULL)
 		MUTEX_LOCK(&inst->ri_lock);
-	MUTEX_UNLOCK(&instance_list.ril_lock);
+	inst_index_unlock(instance_index, id);
 
 	if (inst != NULL) {
-		while (inst->ri_method_thread != 0 &&
-		    !pthread_equal(inst->ri_method_thread, pthread_self())) {
+		while ((inst->ri_method_thread != 0 &&
+		    !pthread_equal(inst->ri_method_thread, pthread_self())) ||
+		    inst->ri_method_queued) {
 			++inst->ri_method_waiters;
 			(void) pthread_cond_wait(&inst->ri_method_cv,
 			    &inst->ri_lock);
@@ -217,11 +384,11 @@ inst_lookup_queue(const char *name)
 	if (id == -1)
 		return (NULL);
 
-	MUTEX_LOCK(&instance_list.ril_lock);
-	inst = uu_list_find(instance_list.ril_instance_list, &id, NULL, NULL);
+	inst_index_lock(instance_index, id);
+	inst = inst_index_find(instance_index, id);
 	if (inst != NULL)
 		MUTEX_LOCK(&inst->ri_queue_lock);
-	MUTEX_UNLOCK(&instance_list.ril_lock);
+	inst_index_unlock(instance_index, id);
 
 	return (inst);
 }
@@ -316,7 +483,6 @@ restarter_insert_inst(scf_handle_t *h, const char *name)
 {
 	int id, r;
 	restarter_inst_t *inst;
-	uu_list_index_t idx;
 	scf_service_t *scf_svc;
 	scf_instance_t *scf_inst;
 	scf_snapshot_t *snap = NULL;
@@ -330,20 +496,20 @@ restarter_insert_inst(scf_handle_t *h, const char *name)
 	pid_t start_pid;
 	restarter_str_t reason = restarter_str_insert_in_graph;
 
-	MUTEX_LOCK(&instance_list.ril_lock);
+	/*
+	 * The id should already be in the dictionary since we use the same
+	 * dictionary as graph.c, but just in case.
+	 */
+	id = dict_insert(name);
 
 	/*
 	 * We don't use inst_lookup_by_name() here because we want the lookup
 	 * & insert to be atomic.
 	 */
-	id = dict_lookup_byname(name);
-	if (id != -1) {
-		inst = uu_list_find(instance_list.ril_instance_list, &id, NULL,
-		    &idx);
-		if (inst != NULL) {
-			MUTEX_UNLOCK(&instance_list.ril_lock);
-			return (0);
-		}
+	inst_index_lock(instance_index, id);
+	if (inst_index_find(instance_index, id) != NULL) {
+		inst_index_unlock(instance_index, id);
+		return (0);
 	}
 
 	/* Allocate an instance */
@@ -356,11 +522,7 @@ restarter_insert_inst(scf_handle_t *h, const char *name)
 
 	inst->ri_queue = startd_list_create(restarter_queue_pool, inst, 0);
 
-	/*
-	 * id shouldn't be -1 since we use the same dictionary as graph.c, but
-	 * just in case.
-	 */
-	inst->ri_id = (id != -1 ? id : dict_insert(name));
+	inst->ri_id = id;
 
 	special_online_hooks_get(name, &inst->ri_pre_online_hook,
 	    &inst->ri_post_online_hook, &inst->ri_post_offline_hook);
@@ -635,9 +797,8 @@ rep_retry:
 
 	(void) pthread_cond_init(&inst->ri_method_cv, NULL);
 
-	uu_list_node_init(inst, &inst->ri_link, restarter_instance_pool);
-	uu_list_insert(instance_list.ril_instance_list, inst, idx);
-	MUTEX_UNLOCK(&instance_list.ril_lock);
+	inst_index_insert(instance_index, id, inst);
+	inst_index_unlock(instance_index, id);
 
 	if (start_pid != -1 &&
 	    (inst->ri_flags & RINST_STYLE_MASK) == RINST_WAIT) {
@@ -674,6 +835,8 @@ rep_retry:
 	MUTEX_UNLOCK(&inst->ri_queue_lock);
 	MUTEX_UNLOCK(&inst->ri_lock);
 
+	inst_index_resize(instance_index);
+
 	startd_free(svc_name, max_scf_name_size);
 	startd_free(inst_name, max_scf_name_size);
 	scf_snapshot_destroy(snap);
@@ -686,7 +849,7 @@ rep_retry:
 	return (0);
 
 deleted:
-	MUTEX_UNLOCK(&instance_list.ril_lock);
+	inst_index_unlock(instance_index, id);
 	startd_free(inst_name, max_scf_name_size);
 	startd_free(svc_name, max_scf_name_size);
 	if (snap != NULL)
@@ -718,32 +881,30 @@ restarter_delete_inst(restarter_inst_t *ri)
 	assert(MUTEX_HELD(&ri->ri_lock));
 
 	/*
-	 * Must drop the instance lock so we can pick up the instance_list
+	 * Must drop the instance lock so we can pick up the instance_index
 	 * lock & remove the instance.
 	 */
 	id = ri->ri_id;
 	MUTEX_UNLOCK(&ri->ri_lock);
 
-	MUTEX_LOCK(&instance_list.ril_lock);
+	inst_index_lock(instance_index, id);
 
-	rip = uu_list_find(instance_list.ril_instance_list, &id, NULL, NULL);
+	rip = inst_index_remove(instance_index, id);
 	if (rip == NULL) {
-		MUTEX_UNLOCK(&instance_list.ril_lock);
+		inst_index_unlock(instance_index, id);
 		return;
 	}
 
 	assert(ri == rip);
 
-	uu_list_remove(instance_list.ril_instance_list, ri);
-
 	log_framework(LOG_DEBUG, "%s: deleted instance from restarter list\n",
 	    ri->ri_i.i_fmri);
 
-	MUTEX_UNLOCK(&instance_list.ril_lock);
+	inst_index_unlock(instance_index, id);
 
 	/*
-	 * We can lock the instance without holding the instance_list lock
-	 * since we removed the instance from the list.
+	 * We can lock the instance without holding the instance_index lock
+	 * since we removed the instance from the index.
 	 */
 	MUTEX_LOCK(&ri->ri_lock);
 	MUTEX_LOCK(&ri->ri_queue_lock);
@@ -751,7 +912,8 @@ restarter_delete_inst(restarter_inst_t *ri)
 	if (ri->ri_i.i_primary_ctid >= 1)
 		contract_hash_remove(ri->ri_i.i_primary_ctid);
 
-	while (ri->ri_method_thread != 0 || ri->ri_method_waiters > 0)
+	while (ri->ri_method_thread != 0 || ri->ri_method_queued ||
+	    ri->ri_method_waiters > 0)
 		(void) pthread_cond_wait(&ri->ri_method_cv, &ri->ri_lock);
 
 	while ((e = uu_list_teardown(ri->ri_queue, &cookie)) != NULL)
@@ -923,69 +1085,69 @@ restarter_mark_pending_snapshot(const char *fmri, uint_t flag)
 	MUTEX_UNLOCK(&inst->ri_lock);
 }
 
-static void
-restarter_take_pending_snapshots(scf_handle_t *h)
+static int
+restarter_take_pending_snapshot(void *obj, void *arg)
 {
-	restarter_inst_t *inst;
+	restarter_inst_t *inst = obj;
+	scf_handle_t *h = arg;
+	const char *fmri;
+	scf_instance_t *sinst = NULL;
 	int r;
 
-	MUTEX_LOCK(&instance_list.ril_lock);
-
-	for (inst = uu_list_first(instance_list.ril_instance_list);
-	    inst != NULL;
-	    inst = uu_list_next(instance_list.ril_instance_list, inst)) {
-		const char *fmri;
-		scf_instance_t *sinst = NULL;
-
-		MUTEX_LOCK(&inst->ri_lock);
+	MUTEX_LOCK(&inst->ri_lock);
 
-		/*
-		 * This is where we'd check inst->ri_method_thread and if it
-		 * were nonzero we'd wait in anticipation of another thread
-		 * executing a method for inst.  Doing so with the instance_list
-		 * locked, though, leads to deadlock.  Since taking a snapshot
-		 * during that window won't hurt anything, we'll just continue.
-		 */
+	/*
+	 * This is where we'd check inst->ri_method_thread and if it
+	 * were nonzero we'd wait in anticipation of another thread
+	 * executing a method for inst.  Doing so with the instance_index
+	 * locked, though, leads to deadlock.  Since taking a snapshot
+	 * during that window won't hurt anything, we'll just continue.
+	 */
 
-		fmri = inst->ri_i.i_fmri;
+	fmri = inst->ri_i.i_fmri;
 
-		if (inst->ri_flags & RINST_RETAKE_RUNNING) {
-			scf_snapshot_t *rsnap;
+	if (inst->ri_flags & RINST_RETAKE_RUNNING) {
+		scf_snapshot_t *rsnap;
 
-			(void) libscf_fmri_get_instance(h, fmri, &sinst);
+		(void) libscf_fmri_get_instance(h, fmri, &sinst);
 
-			rsnap = libscf_get_or_make_running_snapshot(sinst,
-			    fmri, B_FALSE);
+		rsnap = libscf_get_or_make_running_snapshot(sinst,
+		    fmri, B_FALSE);
 
-			scf_instance_destroy(sinst);
+		scf_instance_destroy(sinst);
 
-			if (rsnap != NULL)
-				inst->ri_flags &= ~RINST_RETAKE_RUNNING;
+		if (rsnap != NULL)
+			inst->ri_flags &= ~RINST_RETAKE_RUNNING;
 
-			scf_snapshot_destroy(rsnap);
-		}
+		scf_snapshot_destroy(rsnap);
+	}
 
-		if (inst->ri_flags & RINST_RETAKE_START) {
-			switch (r = libscf_snapshots_poststart(h, fmri,
-			    B_FALSE)) {
-			case 0:
-			case ENOENT:
-				inst->ri_flags &= ~RINST_RETAKE_START;
-				break;
+	if (inst->ri_flags & RINST_RETAKE_START) {
+		switch (r = libscf_snapshots_poststart(h, fmri, B_FALSE)) {
+		case 0:
+		case ENOENT:
+			inst->ri_flags &= ~RINST_RETAKE_START;
+			break;
 
-			case ECONNABORTED:
-				break;
+		case ECONNABORTED:
+			break;
 
-			case EACCES:
-			default:
-				bad_error("libscf_snapshots_poststart", r);
-			}
+		case EACCES:
+		default:
+			bad_error("libscf_snapshots_poststart", r);
 		}
-
-		MUTEX_UNLOCK(&inst->ri_lock);
 	}
 
-	MUTEX_UNLOCK(&instance_list.ril_lock);
+	MUTEX_UNLOCK(&inst->ri_lock);
+
+	return (0);
+}
+
+static void
+restarter_take_pending_snapshots(scf_handle_t *h)
+{
+	(void) inst_index_walk(instance_index, restarter_take_pending_snapshot,
+	    h);
 }
 
 /* ARGSUSED */
@@ -1230,14 +1392,14 @@ stop_instance(scf_handle_t *local_handle, restarter_inst_t *inst,
 	info->sf_method_type = METHOD_STOP;
 	info->sf_event_type = re;
 	info->sf_reason = reason;
-	inst->ri_method_thread = startd_thread_create(method_thread, info);
+	restarter_method_dispatch(inst, info);
 
 	return (0);
 }
 
 /*
  * Returns
- *   ENOENT - fmri is not in instance_list
+ *   ENOENT - fmri is not in instance_index
  *   0 - success
  *   ECONNRESET - success, though handle was rebound
  *   -1 - instance is in transition
@@ -1557,7 +1719,7 @@ start_instance(scf_handle_t *local_handle, restarter_inst_t *inst,
 	info->sf_method_type = METHOD_START;
 	info->sf_event_type = RERR_NONE;
 	info->sf_reason = new_reason;
-	inst->ri_method_thread = startd_thread_create(method_thread, info);
+	restarter_method_dispatch(inst, info);
 }
 
 static int
@@ -1667,7 +1829,7 @@ maintain_instance(scf_handle_t *h, restarter_inst_t *rip, int immediate,
 	info->sf_method_type = METHOD_STOP;
 	info->sf_event_type = RERR_RESTART;
 	info->sf_reason = reason;
-	rip->ri_method_thread = startd_thread_create(method_thread, info);
+	restarter_method_dispatch(rip, info);
 }
 
 static void
@@ -1742,8 +1904,7 @@ rep_retry:
 		info->sf_reason = 0;
 
 		assert(rip->ri_method_thread == 0);
-		rip->ri_method_thread =
-		    startd_thread_create(method_thread, info);
+		restarter_method_dispatch(rip, info);
 	}
 
 	scf_snapshot_destroy(snap);
@@ -1758,51 +1919,50 @@ const char *event_names[] = { "INVALID", "ADD_INSTANCE", "REMOVE_INSTANCE",
 };
 
 /*
- * void *restarter_process_events()
+ * void restarter_process_events()
  *
- *   Called in a separate thread to process the events on an instance's
- *   queue.  Empties the queue completely, and tries to keep the thread
- *   around for a little while after the queue is empty to save on
- *   startup costs.
+ *   Called by an event worker to process the events on the queue of the
+ *   instance with the given id.  Empties the queue completely, unless a
+ *   method is running or waiting to run for the instance, in which case the
+ *   rest of the events are put off until method_thread() is done.
  */
-static void *
-restarter_process_events(void *arg)
+static void
+restarter_process_events(scf_handle_t *h, int id)
 {
-	scf_handle_t *h;
 	restarter_instance_qentry_t *event;
-	restarter_inst_t *rip;
-	char *fmri = (char *)arg;
-	struct timespec to;
-
-	(void) pthread_setname_np(pthread_self(), "restarter_process_events");
-
-	assert(fmri != NULL);
-
-	h = libscf_handle_create_bound_loop();
-
-	/* grab the queue lock */
-	rip = inst_lookup_queue(fmri);
-	if (rip == NULL)
-		goto out;
-
-again:
-
-	while ((event = uu_list_first(rip->ri_queue)) != NULL) {
-		restarter_inst_t *inst;
-
-		/* drop the queue lock */
-		MUTEX_UNLOCK(&rip->ri_queue_lock);
+	restarter_inst_t *inst;
 
+	for (;;) {
 		/*
-		 * Grab the inst lock -- this waits until any outstanding
-		 * method finishes running.
+		 * Grab the inst lock, but don't wait for a method:  the
+		 * worker has other instances to see to.
 		 */
-		inst = inst_lookup_by_name(fmri);
+		inst_index_lock(instance_index, id);
+		inst = inst_index_find(instance_index, id);
+		if (inst != NULL)
+			MUTEX_LOCK(&inst->ri_lock);
+		inst_index_unlock(instance_index, id);
+
 		if (inst == NULL) {
 			/* Getting deleted in the middle isn't an error. */
-			goto cont;
+			return;
+		}
+
+		if (inst->ri_method_thread != 0 || inst->ri_method_queued) {
+			inst->ri_events_deferred = B_TRUE;
+			MUTEX_UNLOCK(&inst->ri_lock);
+			return;
 		}
 
+		MUTEX_LOCK(&inst->ri_queue_lock);
+		if ((event = uu_list_first(inst->ri_queue)) == NULL) {
+			inst->ri_queue_busy = 0;
+			MUTEX_UNLOCK(&inst->ri_queue_lock);
+			MUTEX_UNLOCK(&inst->ri_lock);
+			return;
+		}
+		MUTEX_UNLOCK(&inst->ri_queue_lock);
+
 		assert(instance_in_transition(inst) == 0);
 
 		/* process the event */
@@ -1818,9 +1978,9 @@ again:
 			break;
 
 		case RESTARTER_EVENT_TYPE_REMOVE_INSTANCE:
+			/* This frees the queue, event and all. */
 			restarter_delete_inst(inst);
-			inst = NULL;
-			goto cont;
+			return;
 
 		case RESTARTER_EVENT_TYPE_STOP_RESET:
 			reset_start_times(inst);
@@ -1906,40 +2066,35 @@ again:
 			abort();
 		}
 
-		assert(inst != NULL);
-		MUTEX_UNLOCK(&inst->ri_lock);
-
-cont:
-		/* grab the queue lock */
-		rip = inst_lookup_queue(fmri);
-		if (rip == NULL)
-			goto out;
-
 		/* delete the event */
-		uu_list_remove(rip->ri_queue, event);
+		MUTEX_LOCK(&inst->ri_queue_lock);
+		uu_list_remove(inst->ri_queue, event);
+		MUTEX_UNLOCK(&inst->ri_queue_lock);
+		MUTEX_UNLOCK(&inst->ri_lock);
 		startd_free(event, sizeof (restarter_instance_qentry_t));
 	}
+}
 
-	assert(rip != NULL);
+/*
+ * An event worker:  processes the events of each instance taken from
+ * restarter_runq.
+ */
+/*ARGSUSED*/
+static void *
+restarter_event_worker(void *unused)
+{
+	scf_handle_t *h;
 
-	/*
-	 * Try to preserve the thread for a little while for future use.
-	 */
-	to.tv_sec = 3;
-	to.tv_nsec = 0;
-	(void) pthread_cond_reltimedwait_np(&rip->ri_queue_cv,
-	    &rip->ri_queue_lock, &to);
+	(void) pthread_setname_np(pthread_self(), "restarter_process_events");
 
-	if (uu_list_first(rip->ri_queue) != NULL)
-		goto again;
+	h = libscf_handle_create_bound_loop();
 
-	rip->ri_queue_thread = 0;
-	MUTEX_UNLOCK(&rip->ri_queue_lock);
+	for (;;) {
+		restarter_process_events(h,
+		    (int)(uintptr_t)work_queue_get(restarter_runq));
+	}
 
-out:
-	(void) scf_handle_unbind(h);
-	scf_handle_destroy(h);
-	free(fmri);
+	/*NOTREACHED*/
 	return (NULL);
 }
 
@@ -2012,7 +2167,6 @@ restarter_event_thread(void *unused)
 
 		while ((e = restarter_event_dequeue()) != NULL) {
 			restarter_inst_t *rip;
-			char *fmri;
 
 			MUTEX_UNLOCK(&ru->restarter_update_lock);
 
@@ -2067,21 +2221,14 @@ restarter_event_thread(void *unused)
 			/* Now add the event to the instance queue. */
 			restarter_queue_event(rip, e);
 
-			if (rip->ri_queue_thread == 0) {
+			if (!rip->ri_queue_busy) {
 				/*
-				 * Start a thread if one isn't already
-				 * running.
+				 * Hand the instance to the event workers if
+				 * they don't already have it.
 				 */
-				fmri = safe_strdup(e->rpe_inst);
-				rip->ri_queue_thread =  startd_thread_create(
-				    restarter_process_events, (void *)fmri);
-			} else {
-				/*
-				 * Signal the existing thread that there's
-				 * a new event.
-				 */
-				(void) pthread_cond_broadcast(
-				    &rip->ri_queue_cv);
+				rip->ri_queue_busy = 1;
+				restarter_work_put(restarter_runq,
+				    (void *)(uintptr_t)rip->ri_id);
 			}
 
 			MUTEX_UNLOCK(&rip->ri_queue_lock);
@@ -2350,15 +2497,12 @@ restarter_contracts_event_thread(void *unused)
  * Timeout queue, processed by restarter_timeouts_event_thread().
  */
 timeout_queue_t *timeouts;
-static uu_list_pool_t *timeout_pool;
-
-typedef struct timeout_update {
-	pthread_mutex_t		tu_lock;
-	pthread_cond_t		tu_cv;
-	int			tu_wakeup;
-} timeout_update_t;
 
-timeout_update_t *tu;
+/*
+ * Once a timeout has fired, its contract is killed again at this interval
+ * until the method's exit removes the timeout.
+ */
+#define	TIMEOUT_REKILL_INTERVAL	NANOSEC
 
 static const char *timeout_ovr_svcs[] = {
 	"svc:/system/manifest-import:default",
@@ -2390,39 +2534,55 @@ is_timeout_ovr(restarter_inst_t *inst)
 	return (0);
 }
 
-/*ARGSUSED*/
-static int
-timeout_compare(const void *lc_arg, const void *rc_arg, void *private)
-{
-	hrtime_t t1 = ((const timeout_entry_t *)lc_arg)->te_timeout;
-	hrtime_t t2 = ((const timeout_entry_t *)rc_arg)->te_timeout;
-
-	if (t1 > t2)
-		return (1);
-	else if (t1 < t2)
-		return (-1);
-	return (0);
-}
-
 void
 timeout_init()
 {
+	pthread_condattr_t attr;
+
 	timeouts = startd_zalloc(sizeof (timeout_queue_t));
 
 	(void) pthread_mutex_init(&timeouts->tq_lock, &mutex_attrs);
 
-	timeout_pool = startd_list_pool_create("timeouts",
-	    sizeof (timeout_entry_t), offsetof(timeout_entry_t, te_link),
-	    timeout_compare, UU_LIST_POOL_DEBUG);
-	assert(timeout_pool != NULL);
+	/*
+	 * Deadlines are gethrtime() values, so the timeout thread must
+	 * wait against the same monotonic clock.
+	 */
+	(void) pthread_condattr_init(&attr);
+	(void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	(void) pthread_cond_init(&timeouts->tq_cv, &attr);
+	(void) pthread_condattr_destroy(&attr);
 
-	timeouts->tq_list = startd_list_create(timeout_pool,
-	    timeouts, UU_LIST_SORTED);
-	assert(timeouts->tq_list != NULL);
+	if ((timeouts->tq_heap = timeout_heap_create(offsetof(timeout_entry_t,
+	    te_node))) == NULL)
+		uu_die("Insufficient memory.\n");
+}
 
-	tu = startd_zalloc(sizeof (timeout_update_t));
-	(void) pthread_cond_init(&tu->tu_cv, NULL);
-	(void) pthread_mutex_init(&tu->tu_lock, &mutex_attrs);
+/*
+ * Queues e to expire at when, with the same retry policy as startd_alloc().
+ * tq_lock must be held.
+ */
+static void
+timeout_queue_entry(timeout_entry_t *e, hrtime_t when)
+{
+	uint_t try, msecs;
+
+	assert(MUTEX_HELD(&timeouts->tq_lock));
+
+	if (timeout_heap_insert(timeouts->tq_heap, e, when) == 0)
+		return;
+	assert(errno == ENOMEM);
+
+	msecs = ALLOC_DELAY;
+
+	for (try = 0; try < ALLOC_RETRY; ++try) {
+		(void) poll(NULL, 0, msecs);
+		if (timeout_heap_insert(timeouts->tq_heap, e, when) == 0)
+			return;
+		msecs *= ALLOC_DELAY_MULT;
+	}
+
+	uu_die("Insufficient memory.\n");
+	/* NOTREACHED */
 }
 
 void
@@ -2430,7 +2590,6 @@ timeout_insert(restarter_inst_t *inst, ctid_t cid, uint64_t timeout_sec)
 {
 	hrtime_t now, timeout;
 	timeout_entry_t *entry;
-	uu_list_index_t idx;
 
 	assert(MUTEX_HELD(&inst->ri_lock));
 
@@ -2450,25 +2609,24 @@ timeout_insert(restarter_inst_t *inst, ctid_t cid, uint64_t timeout_sec)
 	timeout = now + (timeout_sec * 1000000000LL);
 
 	entry = startd_alloc(sizeof (timeout_entry_t));
-	entry->te_timeout = timeout;
 	entry->te_ctid = cid;
 	entry->te_fmri = safe_strdup(inst->ri_i.i_fmri);
 	entry->te_logstem = safe_strdup(inst->ri_logstem);
 	entry->te_fired = 0;
-	/* Insert the calculated timeout time onto the queue. */
+
+	/*
+	 * Insert the calculated timeout time onto the queue, and if it is
+	 * now the first to expire, wake the timeout thread so that it waits
+	 * for this one instead.
+	 */
 	MUTEX_LOCK(&timeouts->tq_lock);
-	(void) uu_list_find(timeouts->tq_list, entry, NULL, &idx);
-	uu_list_node_init(entry, &entry->te_link, timeout_pool);
-	uu_list_insert(timeouts->tq_list, entry, idx);
+	timeout_queue_entry(entry, timeout);
+	if (timeout_heap_min(timeouts->tq_heap) == entry)
+		(void) pthread_cond_signal(&timeouts->tq_cv);
 	MUTEX_UNLOCK(&timeouts->tq_lock);
 
 	assert(inst->ri_timeout == NULL);
 	inst->ri_timeout = entry;
-
-	MUTEX_LOCK(&tu->tu_lock);
-	tu->tu_wakeup = 1;
-	(void) pthread_cond_broadcast(&tu->tu_cv);
-	MUTEX_UNLOCK(&tu->tu_lock);
 }
 
 
@@ -2482,8 +2640,12 @@ timeout_remove(restarter_inst_t *inst, ctid_t cid)
 
 	assert(inst->ri_timeout->te_ctid == cid);
 
+	/*
+	 * There is no need to wake the timeout thread if this was the first
+	 * timeout:  it will find nothing to do when its wait ends early.
+	 */
 	MUTEX_LOCK(&timeouts->tq_lock);
-	uu_list_remove(timeouts->tq_list, inst->ri_timeout);
+	timeout_heap_remove(timeouts->tq_heap, inst->ri_timeout);
 	MUTEX_UNLOCK(&timeouts->tq_lock);
 
 	free(inst->ri_timeout->te_fmri);
@@ -2492,42 +2654,39 @@ timeout_remove(restarter_inst_t *inst, ctid_t cid)
 	inst->ri_timeout = NULL;
 }
 
-static int
+/*
+ * Kills the contract of each method whose timeout has expired, and requeues
+ * the timeout so that the contract is killed again if the method is still
+ * running TIMEOUT_REKILL_INTERVAL later.  Returns the first expiration time
+ * still pending, or -1 if the queue is empty.  tq_lock must be held.
+ */
+static hrtime_t
 timeout_now()
 {
 	timeout_entry_t *e;
 	hrtime_t now;
-	int ret;
 
-	now = gethrtime();
+	assert(MUTEX_HELD(&timeouts->tq_lock));
 
-	/*
-	 * Walk through the (sorted) timeouts list.  While the timeout
-	 * at the head of the list is <= the current time, kill the
-	 * method.
-	 */
-	MUTEX_LOCK(&timeouts->tq_lock);
+	now = gethrtime();
 
-	for (e = uu_list_first(timeouts->tq_list);
-	    e != NULL && e->te_timeout <= now;
-	    e = uu_list_next(timeouts->tq_list, e)) {
-		log_framework(LOG_WARNING, "%s: Method or service exit timed "
-		    "out.  Killing contract %ld.\n", e->te_fmri, e->te_ctid);
-		log_instance_fmri(e->te_fmri, e->te_logstem, B_TRUE,
-		    "Method or service exit timed out.  Killing contract %ld.",
-		    e->te_ctid);
-		e->te_fired = 1;
+	while ((e = timeout_heap_min(timeouts->tq_heap)) != NULL &&
+	    timeout_heap_when(timeouts->tq_heap, e) <= now) {
+		if (!e->te_fired) {
+			log_framework(LOG_WARNING, "%s: Method or service "
+			    "exit timed out.  Killing contract %ld.\n",
+			    e->te_fmri, e->te_ctid);
+			log_instance_fmri(e->te_fmri, e->te_logstem, B_TRUE,
+			    "Method or service exit timed out.  Killing "
+			    "contract %ld.", e->te_ctid);
+			e->te_fired = 1;
+		}
 		(void) contract_kill(e->te_ctid, SIGKILL, e->te_fmri);
+		timeout_heap_update(timeouts->tq_heap, e,
+		    now + TIMEOUT_REKILL_INTERVAL);
 	}
 
-	if (uu_list_numnodes(timeouts->tq_list) > 0)
-		ret = 0;
-	else
-		ret = -1;
-
-	MUTEX_UNLOCK(&timeouts->tq_lock);
-
-	return (ret);
+	return (e != NULL ? timeout_heap_when(timeouts->tq_heap, e) : -1);
 }
 
 /*
@@ -2539,60 +2698,70 @@ timeout_now()
 static void *
 restarter_timeouts_event_thread(void *unused)
 {
+	hrtime_t next;
+	struct timespec ts;
+
 	/*
 	 * Timeouts are entered on a priority queue, which is processed by
-	 * this thread.  As timeouts are specified in seconds, we'll do
-	 * the necessary processing every second, as long as the queue
-	 * is not empty.
+	 * this thread.  It sleeps until the first timeout expires, or
+	 * indefinitely while the queue is empty;  timeout_insert() wakes it
+	 * whenever a new timeout becomes the first.
 	 */
 
 	(void) pthread_setname_np(pthread_self(), "restarter_timeouts_event");
 
+	MUTEX_LOCK(&timeouts->tq_lock);
+
 	/*CONSTCOND*/
 	while (1) {
-		/*
-		 * As long as the timeout list isn't empty, process it
-		 * every second.
-		 */
-		if (timeout_now() == 0) {
-			(void) sleep(1);
+		if ((next = timeout_now()) == -1) {
+			(void) pthread_cond_wait(&timeouts->tq_cv,
+			    &timeouts->tq_lock);
 			continue;
 		}
 
-		/* The list is empty, wait until we have more timeouts. */
-		MUTEX_LOCK(&tu->tu_lock);
-
-		while (tu->tu_wakeup == 0)
-			(void) pthread_cond_wait(&tu->tu_cv, &tu->tu_lock);
-
-		tu->tu_wakeup = 0;
-		MUTEX_UNLOCK(&tu->tu_lock);
+		ts.tv_sec = next / NANOSEC;
+		ts.tv_nsec = next % NANOSEC;
+		(void) pthread_cond_timedwait(&timeouts->tq_cv,
+		    &timeouts->tq_lock, &ts);
 	}
 
+	/*NOTREACHED*/
 	return (NULL);
 }
 
 void
 restarter_start()
 {
+	int i;
+
 	(void) startd_thread_create(restarter_timeouts_event_thread, NULL);
 	(void) startd_thread_create(restarter_event_thread, NULL);
 	(void) startd_thread_create(restarter_contracts_event_thread, NULL);
 	(void) startd_thread_create(wait_thread, NULL);
+
+	for (i = 0; i < RESTARTER_EVENT_WORKERS; i++)
+		(void) startd_thread_create(restarter_event_worker, NULL);
+
+	restarter_method_nworkers = RESTARTER_METHOD_WORKERS;
+	for (i = 0; i < RESTARTER_METHOD_WORKERS; i++)
+		(void) startd_thread_create(restarter_method_worker, NULL);
+	(void) startd_thread_create(restarter_method_monitor, NULL);
 }
 
 
 void
 restarter_init()
 {
-	restarter_instance_pool = startd_list_pool_create("restarter_instances",
-	    sizeof (restarter_inst_t), offsetof(restarter_inst_t,
-	    ri_link), restarter_instance_compare, UU_LIST_POOL_DEBUG);
-	(void) memset(&instance_list, 0, sizeof (instance_list));
-
-	(void) pthread_mutex_init(&instance_list.ril_lock, &mutex_attrs);
-	instance_list.ril_instance_list = startd_list_create(
-	    restarter_instance_pool, &instance_list, UU_LIST_SORTED);
+	if ((instance_index = inst_index_create(offsetof(restarter_inst_t,
+	    ri_link), &mutex_attrs)) == NULL)
+		uu_die("Insufficient memory.\n");
+
+	if ((restarter_runq = work_queue_create(&mutex_attrs)) == NULL ||
+	    (restarter_methodq = work_queue_create(&mutex_attrs)) == NULL)
+		uu_die("Insufficient memory.\n");
+	(void) pthread_mutex_init(&restarter_method_lock, &mutex_attrs);
+	(void) pthread_cond_init(&restarter_method_cv, NULL);
 
 	restarter_queue_pool = startd_list_pool_create(
 	    "restarter_instance_queue", sizeof (restarter_instance_qentry_t),
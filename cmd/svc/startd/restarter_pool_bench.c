@@ -0,0 +1,732 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+/*
+ * restarter_pool_bench - threads and memory of the restarter's workers
+ *
+ * Plays a storm of restarter events, E for each of N instances, where
+ * processing each event runs a method which sleeps for 1 to S ms with a
+ * few pages of stack in use, as a short start, stop or refresh method
+ * does.  The locking is that of restarter.c, and it is done two ways:
+ *
+ *	threads	as restarter.c used to:  a thread for each instance
+ *		with events, which waits for the instance's method to
+ *		finish and lingers for L ms once the queue is empty, and a
+ *		thread for each method
+ *
+ *	pool	as it does now:  instances with events are put on a
+ *		work_queue_t served by W event workers, which put an instance
+ *		aside while its method runs, and methods are put on another
+ *		served by M method threads
+ *
+ * Each way runs in its own process, and reports the time taken, the most
+ * threads the process had at once and its peak resident set size.  Checks
+ * that every event of every instance is processed once and in order, that
+ * no instance has its events processed by two threads at once or while
+ * its method runs, and that no more than M methods run at once in the
+ * pool.  The pool is then given M + 1 methods which each wait for all the
+ * others to be running, and must clear them by starting a method thread
+ * past the M, which must exit again afterwards.  Exits with 1 if any
+ * check failed.  Usage:
+ *
+ *	restarter_pool_bench [-n instances] [-e events] [-s sleep_ms]
+ *	    [-l linger_ms] [-w workers] [-m methods]
+ *
+ * Defaults are 2000 instances, 4 events each, methods of up to 20 ms, a
+ * linger of 3000 ms as restarter.c had, 16 event workers and 64 method
+ * threads.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "work_queue.h"
+
+#define	METHOD_STACK	(16 * 1024)	/* stack a method uses */
+#define	METHOD_STALL_MS	1000		/* as RESTARTER_METHOD_STALL_MS */
+
+typedef struct event {
+	struct event	*e_next;
+	int		e_seq;
+} event_t;
+
+typedef struct inst {
+	int		i_id;
+
+	pthread_mutex_t	i_lock;		/* as ri_lock */
+	pthread_cond_t	i_method_cv;
+	int		i_method_running;
+	int		i_method_queued;
+	int		i_events_deferred;
+	uint32_t	i_workers;	/* threads processing its events */
+	int		i_last_seq;
+	int		i_method_ms;
+	int		i_stall;	/* methods it waits to run with */
+
+	pthread_mutex_t	i_queue_lock;	/* as ri_queue_lock */
+	pthread_cond_t	i_queue_cv;
+	event_t		*i_head;
+	event_t		*i_tail;
+	int		i_queue_busy;	/* has a thread or is on runq */
+} inst_t;
+
+typedef struct result {
+	double		r_ms;
+	long		r_threads;
+	long		r_rss_kb;
+	long		r_failures;
+	long		r_max_methods;
+	double		r_stall_ms;
+} result_t;
+
+static int ninsts = 2000;
+static int nevents = 4;
+static int sleep_ms = 20;
+static int linger_ms = 3000;
+static int nworkers = 16;
+static int nmethods = 64;
+
+static inst_t *insts;
+static int pool;
+static work_queue_t *runq;
+static work_queue_t *methodq;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cv = PTHREAD_COND_INITIALIZER;
+static long ndone;		/* methods finished */
+static long methods_running;
+static long max_methods;
+
+static pthread_mutex_t method_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t method_cv = PTHREAD_COND_INITIALIZER;
+static int method_workers;	/* as restarter_method_nworkers */
+static long methods_taken;
+
+static pthread_mutex_t stall_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stall_cv = PTHREAD_COND_INITIALIZER;
+static int stall_running;
+static int stall_done;
+
+static volatile int sampling;
+static long max_threads;
+
+static void
+fail(const char *msg, inst_t *ip)
+{
+	bench_fail("%s: instance %d: %s", pool ? "pool" : "threads", ip->i_id,
+	    msg);
+}
+
+/* As startd_thread_create(), but waits out EAGAIN. */
+static void
+thread_create(void *(*func)(void *), void *arg)
+{
+	pthread_t tid;
+	int err;
+
+	while ((err = pthread_create(&tid, NULL, func, arg)) == EAGAIN)
+		(void) poll(NULL, 0, 1);
+	if (err != 0) {
+		(void) fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		exit(1);
+	}
+	(void) pthread_detach(tid);
+}
+
+static void
+work_put(work_queue_t *wq, void *item)
+{
+	while (work_queue_put(wq, item) != 0)
+		(void) poll(NULL, 0, 10);
+}
+
+static long
+proc_status(const char *field)
+{
+	char line[128];
+	size_t len = strlen(field);
+	long v = -1;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/status", "r")) == NULL)
+		return (-1);
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (strncmp(line, field, len) == 0) {
+			v = atol(line + len);
+			break;
+		}
+	}
+	(void) fclose(fp);
+	return (v);
+}
+
+/*ARGSUSED*/
+static void *
+sampler(void *unused)
+{
+	long n;
+
+	while (sampling) {
+		if ((n = proc_status("Threads:")) > max_threads)
+			max_threads = n;
+		(void) poll(NULL, 0, 1);
+	}
+	return (NULL);
+}
+
+/*
+ * A method which waits until ip->i_stall methods, itself included, are
+ * running, as methods waiting for each other's services would.
+ */
+static void
+run_stalled(inst_t *ip)
+{
+	(void) pthread_mutex_lock(&stall_lock);
+	if (++stall_running == ip->i_stall)
+		(void) pthread_cond_broadcast(&stall_cv);
+	while (stall_running < ip->i_stall)
+		(void) pthread_cond_wait(&stall_cv, &stall_lock);
+	if (++stall_done == ip->i_stall)
+		(void) pthread_cond_broadcast(&stall_cv);
+	(void) pthread_mutex_unlock(&stall_lock);
+
+	(void) pthread_mutex_lock(&ip->i_lock);
+	ip->i_method_running = 0;
+	(void) pthread_mutex_unlock(&ip->i_lock);
+}
+
+/*
+ * The method:  sleeps with a few pages of stack in use, then releases the
+ * instance as method_thread() does.
+ */
+static void
+run_method(inst_t *ip)
+{
+	volatile char stack[METHOD_STACK];
+	int i;
+
+	if (ip->i_stall != 0) {
+		run_stalled(ip);
+		return;
+	}
+
+	(void) pthread_mutex_lock(&stats_lock);
+	if (++methods_running > max_methods)
+		max_methods = methods_running;
+	(void) pthread_mutex_unlock(&stats_lock);
+
+	for (i = 0; i < METHOD_STACK; i += 512)
+		stack[i] = (char)i;
+	(void) poll(NULL, 0, ip->i_method_ms);
+
+	(void) pthread_mutex_lock(&ip->i_lock);
+	ip->i_method_running = 0;
+	if (ip->i_events_deferred) {
+		ip->i_events_deferred = 0;
+		work_put(runq, (void *)(uintptr_t)ip->i_id);
+	}
+	(void) pthread_cond_broadcast(&ip->i_method_cv);
+	(void) pthread_mutex_unlock(&ip->i_lock);
+
+	(void) pthread_mutex_lock(&stats_lock);
+	methods_running--;
+	if (++ndone == (long)ninsts * nevents)
+		(void) pthread_cond_signal(&done_cv);
+	(void) pthread_mutex_unlock(&stats_lock);
+}
+
+static void *
+method_thread(void *arg)
+{
+	run_method(arg);
+	return (NULL);
+}
+
+/* As restarter_method_dispatch(). */
+static void
+method_dispatch(inst_t *ip)
+{
+	ip->i_method_queued = 1;
+	work_put(methodq, ip);
+
+	(void) pthread_mutex_lock(&method_lock);
+	(void) pthread_cond_signal(&method_cv);
+	(void) pthread_mutex_unlock(&method_lock);
+}
+
+/*ARGSUSED*/
+static void *
+method_worker(void *unused)
+{
+	inst_t *ip;
+
+	for (;;) {
+		ip = work_queue_get(methodq);
+
+		(void) pthread_mutex_lock(&method_lock);
+		methods_taken++;
+		(void) pthread_mutex_unlock(&method_lock);
+
+		(void) pthread_mutex_lock(&ip->i_lock);
+		if (!ip->i_method_queued || ip->i_method_running)
+			fail("method taken twice", ip);
+		ip->i_method_queued = 0;
+		ip->i_method_running = 1;
+		(void) pthread_mutex_unlock(&ip->i_lock);
+		run_method(ip);
+
+		(void) pthread_mutex_lock(&method_lock);
+		if (method_workers > nmethods &&
+		    work_queue_count(methodq) == 0) {
+			method_workers--;
+			(void) pthread_mutex_unlock(&method_lock);
+			return (NULL);
+		}
+		(void) pthread_mutex_unlock(&method_lock);
+	}
+	/*NOTREACHED*/
+	return (NULL);
+}
+
+/* As restarter_method_monitor(). */
+/*ARGSUSED*/
+static void *
+method_monitor(void *unused)
+{
+	long taken;
+
+	(void) pthread_mutex_lock(&method_lock);
+	for (;;) {
+		if (work_queue_count(methodq) == 0) {
+			(void) pthread_cond_wait(&method_cv, &method_lock);
+			continue;
+		}
+
+		taken = methods_taken;
+		(void) pthread_mutex_unlock(&method_lock);
+		(void) poll(NULL, 0, METHOD_STALL_MS);
+		(void) pthread_mutex_lock(&method_lock);
+
+		if (methods_taken != taken || work_queue_count(methodq) == 0)
+			continue;
+		method_workers++;
+		thread_create(method_worker, NULL);
+	}
+	/*NOTREACHED*/
+	return (NULL);
+}
+
+/*
+ * Processes e with ip->i_lock held, and starts the method for it, as
+ * start_instance() and the like do.
+ */
+static void
+process_event(inst_t *ip, event_t *e)
+{
+	if (ip->i_method_running || ip->i_method_queued)
+		fail("events processed while the method ran", ip);
+
+	if (e->e_seq != ip->i_last_seq + 1)
+		fail("event out of order", ip);
+	ip->i_last_seq = e->e_seq;
+	ip->i_method_ms = 1 + (ip->i_id * 7 + e->e_seq * 13) % sleep_ms;
+
+	if (pool) {
+		method_dispatch(ip);
+	} else {
+		ip->i_method_running = 1;
+		thread_create(method_thread, ip);
+	}
+}
+
+static void
+enter(inst_t *ip)
+{
+	if (__atomic_fetch_add(&ip->i_workers, 1, __ATOMIC_ACQ_REL) != 0)
+		fail("events processed by two threads at once", ip);
+}
+
+static void
+leave(inst_t *ip)
+{
+	(void) __atomic_fetch_sub(&ip->i_workers, 1, __ATOMIC_ACQ_REL);
+}
+
+static void
+dequeue(inst_t *ip, event_t *e)
+{
+	if (ip->i_head != e)
+		fail("processed event not at the head", ip);
+	if ((ip->i_head = e->e_next) == NULL)
+		ip->i_tail = NULL;
+	free(e);
+}
+
+/* As restarter_process_events() used to be. */
+static void *
+queue_thread(void *arg)
+{
+	inst_t *ip = arg;
+	struct timespec to;
+	event_t *e;
+
+	enter(ip);
+	(void) pthread_mutex_lock(&ip->i_queue_lock);
+	for (;;) {
+		while ((e = ip->i_head) != NULL) {
+			(void) pthread_mutex_unlock(&ip->i_queue_lock);
+
+			/* As inst_lookup_by_id(). */
+			(void) pthread_mutex_lock(&ip->i_lock);
+			while (ip->i_method_running)
+				(void) pthread_cond_wait(&ip->i_method_cv,
+				    &ip->i_lock);
+			process_event(ip, e);
+			(void) pthread_mutex_unlock(&ip->i_lock);
+
+			(void) pthread_mutex_lock(&ip->i_queue_lock);
+			dequeue(ip, e);
+		}
+
+		(void) clock_gettime(CLOCK_REALTIME, &to);
+		to.tv_sec += linger_ms / 1000;
+		to.tv_nsec += (linger_ms % 1000) * 1000000L;
+		if (to.tv_nsec >= 1000000000L) {
+			to.tv_sec++;
+			to.tv_nsec -= 1000000000L;
+		}
+		(void) pthread_cond_timedwait(&ip->i_queue_cv,
+		    &ip->i_queue_lock, &to);
+		if (ip->i_head == NULL)
+			break;
+	}
+	leave(ip);
+	ip->i_queue_busy = 0;
+	(void) pthread_mutex_unlock(&ip->i_queue_lock);
+	return (NULL);
+}
+
+/* As restarter_process_events() is now. */
+static void
+process_events(inst_t *ip)
+{
+	event_t *e;
+
+	enter(ip);
+	for (;;) {
+		(void) pthread_mutex_lock(&ip->i_lock);
+		if (ip->i_method_running || ip->i_method_queued) {
+			ip->i_events_deferred = 1;
+			leave(ip);
+			(void) pthread_mutex_unlock(&ip->i_lock);
+			return;
+		}
+
+		(void) pthread_mutex_lock(&ip->i_queue_lock);
+		if ((e = ip->i_head) == NULL) {
+			leave(ip);
+			ip->i_queue_busy = 0;
+			(void) pthread_mutex_unlock(&ip->i_queue_lock);
+			(void) pthread_mutex_unlock(&ip->i_lock);
+			return;
+		}
+		(void) pthread_mutex_unlock(&ip->i_queue_lock);
+
+		process_event(ip, e);
+
+		(void) pthread_mutex_lock(&ip->i_queue_lock);
+		dequeue(ip, e);
+		(void) pthread_mutex_unlock(&ip->i_queue_lock);
+		(void) pthread_mutex_unlock(&ip->i_lock);
+	}
+}
+
+/*ARGSUSED*/
+static void *
+event_worker(void *unused)
+{
+	for (;;)
+		process_events(&insts[(uintptr_t)work_queue_get(runq)]);
+	/*NOTREACHED*/
+	return (NULL);
+}
+
+/* As restarter_event_thread(). */
+static void
+send_event(inst_t *ip, int seq)
+{
+	event_t *e = bench_zalloc(1, sizeof (event_t));
+
+	e->e_seq = seq;
+
+	(void) pthread_mutex_lock(&ip->i_queue_lock);
+	if (ip->i_tail != NULL)
+		ip->i_tail->e_next = e;
+	else
+		ip->i_head = e;
+	ip->i_tail = e;
+
+	if (!ip->i_queue_busy) {
+		ip->i_queue_busy = 1;
+		if (pool)
+			work_put(runq, (void *)(uintptr_t)ip->i_id);
+		else
+			thread_create(queue_thread, ip);
+	} else if (!pool) {
+		(void) pthread_cond_broadcast(&ip->i_queue_cv);
+	}
+	(void) pthread_mutex_unlock(&ip->i_queue_lock);
+}
+
+/*
+ * Gives the pool nmethods + 1 methods which can only finish together, and
+ * returns the ms they took.  Waits up to ten stall intervals.
+ */
+static double
+run_stall(void)
+{
+	inst_t *sts;
+	struct timespec to;
+	double start, ms;
+	int i, n = nmethods + 1;
+
+	sts = bench_zalloc(n, sizeof (inst_t));
+	start = bench_now_ns();
+	for (i = 0; i < n; i++) {
+		sts[i].i_id = ninsts + i;
+		sts[i].i_stall = n;
+		(void) pthread_mutex_init(&sts[i].i_lock, NULL);
+		(void) pthread_mutex_lock(&sts[i].i_lock);
+		method_dispatch(&sts[i]);
+		(void) pthread_mutex_unlock(&sts[i].i_lock);
+	}
+
+	(void) clock_gettime(CLOCK_REALTIME, &to);
+	to.tv_sec += 10 * METHOD_STALL_MS / 1000;
+	(void) pthread_mutex_lock(&stall_lock);
+	while (stall_done < n) {
+		if (pthread_cond_timedwait(&stall_cv, &stall_lock, &to) ==
+		    ETIMEDOUT) {
+			(void) pthread_mutex_unlock(&stall_lock);
+			bench_fail("pool: %d methods which wait for each "
+			    "other never ran", n);
+			return (-1);
+		}
+	}
+	(void) pthread_mutex_unlock(&stall_lock);
+	ms = (bench_now_ns() - start) / 1e6;
+
+	/* The added method thread must go again. */
+	for (i = 0; i < 100; i++) {
+		(void) pthread_mutex_lock(&method_lock);
+		if (method_workers == nmethods) {
+			(void) pthread_mutex_unlock(&method_lock);
+			return (ms);
+		}
+		(void) pthread_mutex_unlock(&method_lock);
+		(void) poll(NULL, 0, 10);
+	}
+	bench_fail("pool: %d method threads after a stall", method_workers);
+	return (ms);
+}
+
+static void
+run(result_t *r)
+{
+	pthread_t stid;
+	double start;
+	int i, seq;
+
+	insts = bench_zalloc(ninsts, sizeof (inst_t));
+	for (i = 0; i < ninsts; i++) {
+		insts[i].i_id = i;
+		(void) pthread_mutex_init(&insts[i].i_lock, NULL);
+		(void) pthread_mutex_init(&insts[i].i_queue_lock, NULL);
+		(void) pthread_cond_init(&insts[i].i_method_cv, NULL);
+		(void) pthread_cond_init(&insts[i].i_queue_cv, NULL);
+	}
+
+	sampling = 1;
+	(void) pthread_create(&stid, NULL, sampler, NULL);
+
+	start = bench_now_ns();
+	if (pool) {
+		if ((runq = work_queue_create(NULL)) == NULL ||
+		    (methodq = work_queue_create(NULL)) == NULL) {
+			(void) fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		for (i = 0; i < nworkers; i++)
+			thread_create(event_worker, NULL);
+		method_workers = nmethods;
+		for (i = 0; i < nmethods; i++)
+			thread_create(method_worker, NULL);
+		thread_create(method_monitor, NULL);
+	}
+
+	for (seq = 1; seq <= nevents; seq++) {
+		for (i = 0; i < ninsts; i++)
+			send_event(&insts[i], seq);
+	}
+
+	(void) pthread_mutex_lock(&stats_lock);
+	while (ndone < (long)ninsts * nevents)
+		(void) pthread_cond_wait(&done_cv, &stats_lock);
+	(void) pthread_mutex_unlock(&stats_lock);
+	r->r_ms = (bench_now_ns() - start) / 1e6;
+
+	/* Let the instances go idle. */
+	for (i = 0; i < ninsts; i++) {
+		for (;;) {
+			(void) pthread_mutex_lock(&insts[i].i_lock);
+			seq = insts[i].i_method_running ||
+			    insts[i].i_method_queued;
+			(void) pthread_mutex_unlock(&insts[i].i_lock);
+			if (!seq)
+				break;
+			(void) poll(NULL, 0, 1);
+		}
+		if (insts[i].i_last_seq != nevents)
+			fail("not every event was processed", &insts[i]);
+	}
+
+	sampling = 0;
+	(void) pthread_join(stid, NULL);
+
+	r->r_threads = max_threads;
+	r->r_rss_kb = proc_status("VmHWM:");
+	r->r_max_methods = max_methods;
+	if (pool && max_methods > nmethods)
+		bench_fail("pool: %ld methods ran at once", max_methods);
+	if (pool)
+		r->r_stall_ms = run_stall();
+	r->r_failures = bench_failures();
+}
+
+/* Runs one way in a child process, so its threads and memory are its own. */
+static int
+run_child(int way, result_t *r)
+{
+	int fd[2], status;
+	pid_t pid;
+
+	if (pipe(fd) != 0 || (pid = fork()) == -1) {
+		perror("restarter_pool_bench");
+		exit(1);
+	}
+	if (pid == 0) {
+		(void) close(fd[0]);
+		pool = way;
+		run(r);
+		if (write(fd[1], r, sizeof (*r)) != sizeof (*r))
+			_exit(1);
+		_exit(0);
+	}
+	(void) close(fd[1]);
+	if (read(fd[0], r, sizeof (*r)) != sizeof (*r)) {
+		(void) close(fd[0]);
+		(void) waitpid(pid, &status, 0);
+		return (-1);
+	}
+	(void) close(fd[0]);
+	(void) waitpid(pid, &status, 0);
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char *names[] = { "threads", "pool" };
+	result_t r[2];
+	int c, way, bad = 0;
+
+	while ((c = getopt(argc, argv, "n:e:s:l:w:m:")) != -1) {
+		switch (c) {
+		case 'n':
+			ninsts = atoi(optarg);
+			break;
+		case 'e':
+			nevents = atoi(optarg);
+			break;
+		case 's':
+			sleep_ms = atoi(optarg);
+			break;
+		case 'l':
+			linger_ms = atoi(optarg);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		case 'm':
+			nmethods = atoi(optarg);
+			break;
+		default:
+			(void) fprintf(stderr, "usage: %s [-n instances] "
+			    "[-e events] [-s sleep_ms] [-l linger_ms] "
+			    "[-w workers] [-m methods]\n", argv[0]);
+			return (2);
+		}
+	}
+	if (ninsts < 1 || nevents < 1 || sleep_ms < 1 || linger_ms < 0 ||
+	    nworkers < 1 || nmethods < 1) {
+		(void) fprintf(stderr, "%s: counts must be positive\n",
+		    argv[0]);
+		return (2);
+	}
+
+	(void) printf("%d instances, %d events each, methods of 1-%d ms\n",
+	    ninsts, nevents, sleep_ms);
+	(void) printf("%-8s %10s %12s %12s %10s\n", "", "ms", "max threads",
+	    "peak rss kb", "methods");
+	for (way = 0; way <= 1; way++) {
+		(void) memset(&r[way], 0, sizeof (r[way]));
+		if (run_child(way, &r[way]) != 0) {
+			(void) fprintf(stderr, "%s: run failed\n", names[way]);
+			bad++;
+			continue;
+		}
+		(void) printf("%-8s %10.0f %12ld %12ld %10ld\n", names[way],
+		    r[way].r_ms, r[way].r_threads, r[way].r_rss_kb,
+		    r[way].r_max_methods);
+		bad += (r[way].r_failures != 0);
+	}
+	if (r[1].r_stall_ms > 0)
+		(void) printf("pool cleared %d methods waiting for each other "
+		    "in %.0f ms\n", nmethods + 1, r[1].r_stall_ms);
+
+	if (bad != 0) {
+		(void) printf("checks failed\n");
+		return (1);
+	}
+	return (0);
+}
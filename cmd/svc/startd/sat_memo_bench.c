@@ -0,0 +1,327 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * sat_memo_bench - cost of dependency evaluation with and without memos
+ *
+ * Builds a chain-and-fan-in graph:  a chain of C instances, each with a
+ * require_all dependency on the one before;  a milestone with a require_all
+ * dependency on the end of the chain;  and F instances, each with a
+ * optional_all dependency on the end of the chain, a require_any dependency
+ * on two instances in the chain and a require_all dependency on the
+ * milestone.  The evaluation rules are those of dependency_satisfied() and
+ * the *_satisfied() functions in graph.c, for instances and groups.
+ *
+ * Boot is played out one transition at a time:  the first satisfied
+ * instance comes online, and then each offline instance with a dependency
+ * on it is evaluated, as graph_startq_drain() does with the instances a
+ * transition reached.  While the chain is offline, each optional_all
+ * dependency on its end is evaluated for satisfiability through the whole
+ * chain.  Each batch is run with the evaluations remembered for the batch,
+ * as graph.c now does, and without, as it used to.
+ *
+ * Reports the number of vertex evaluations and the time taken each way.
+ * Checks that both give the same result for every instance in every batch
+ * and that the instances become satisfied in order.  Exits with 1 if any
+ * check failed.  Usage:
+ *
+ *	sat_memo_bench [-c chain] [-f fanin]
+ *
+ * Defaults are a chain of 200 and a fan-in of 1000.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+typedef enum { OFFLINE, ONLINE } state_t;
+typedef enum { INST, REQUIRE_ALL, REQUIRE_ANY, OPTIONAL_ALL } vtype_t;
+
+typedef struct vertex {
+	vtype_t		v_type;
+	state_t		v_state;
+	int		v_ndeps;
+	struct vertex	*v_deps[3];
+	uint32_t	v_gen[2];
+	int		v_sat[2];
+} vertex_t;
+
+static int chain = 200;
+static int fanin = 1000;
+
+static int memo;
+static uint32_t gen;
+static uint64_t evals;
+
+static int satisfied(vertex_t *, int);
+
+/* Does one of inst's dependency groups contain v? */
+static int
+reaches(vertex_t *v, vertex_t *inst)
+{
+	vertex_t *g;
+	int i, j;
+
+	for (i = 0; i < inst->v_ndeps; i++) {
+		g = inst->v_deps[i];
+		for (j = 0; j < g->v_ndeps; j++) {
+			if (g->v_deps[j] == v)
+				return (1);
+		}
+	}
+	return (0);
+}
+
+static int
+require_all(vertex_t *g, int satbility)
+{
+	int i, s, any_unsatisfied = 0;
+
+	for (i = 0; i < g->v_ndeps; i++) {
+		if ((s = satisfied(g->v_deps[i], satbility)) == 1)
+			continue;
+		if (!satbility)
+			return (0);
+		if (s == -1)
+			return (-1);
+		any_unsatisfied = 1;
+	}
+	return (any_unsatisfied ? 0 : 1);
+}
+
+static int
+require_any(vertex_t *g, int satbility)
+{
+	int i, s, satisfiable = 0;
+
+	if (g->v_ndeps == 0)
+		return (1);
+	for (i = 0; i < g->v_ndeps; i++) {
+		if ((s = satisfied(g->v_deps[i], satbility)) == 1)
+			return (1);
+		if (satbility && s == 0)
+			satisfiable = 1;
+	}
+	return ((!satbility || satisfiable) ? 0 : -1);
+}
+
+static int
+optional_all(vertex_t *g, int satbility)
+{
+	vertex_t *v;
+	int i, s, any_unsatisfied = 0;
+
+	for (i = 0; i < g->v_ndeps; i++) {
+		v = g->v_deps[i];
+		if (v->v_state == OFFLINE) {
+			if ((s = satisfied(v, 1)) == -1)
+				s = 1;
+		} else {
+			s = satisfied(v, satbility);
+		}
+		if (s == 1)
+			continue;
+		if (!satbility)
+			return (0);
+		if (s == -1)
+			return (-1);
+		any_unsatisfied = 1;
+	}
+	return (any_unsatisfied ? 0 : 1);
+}
+
+static int
+evaluate(vertex_t *v, int satbility)
+{
+	evals++;
+
+	switch (v->v_type) {
+	case INST:
+		if (v->v_state == ONLINE)
+			return (1);
+		if (!satbility)
+			return (0);
+		return (require_all(v, 1) != -1 ? 0 : -1);
+	case REQUIRE_ALL:
+		return (require_all(v, satbility));
+	case REQUIRE_ANY:
+		return (require_any(v, satbility));
+	case OPTIONAL_ALL:
+		return (optional_all(v, satbility));
+	}
+	abort();
+	/* NOTREACHED */
+}
+
+/* As dependency_satisfied(). */
+static int
+satisfied(vertex_t *v, int satbility)
+{
+	int r;
+
+	if (!memo)
+		return (evaluate(v, satbility));
+	if (v->v_gen[satbility] == gen)
+		return (v->v_sat[satbility]);
+	r = evaluate(v, satbility);
+	v->v_gen[satbility] = gen;
+	v->v_sat[satbility] = r;
+	return (r);
+}
+
+static vertex_t *
+vertex(vtype_t type)
+{
+	vertex_t *v;
+
+	v = bench_zalloc(1, sizeof (vertex_t));
+	v->v_type = type;
+	return (v);
+}
+
+static vertex_t *
+group(vtype_t type, vertex_t *a, vertex_t *b)
+{
+	vertex_t *g = vertex(type);
+
+	g->v_deps[g->v_ndeps++] = a;
+	if (b != NULL)
+		g->v_deps[g->v_ndeps++] = b;
+	return (g);
+}
+
+int
+main(int argc, char *argv[])
+{
+	vertex_t **insts, *ms, *v, *up = NULL;
+	int *res, *batch, nbatch, b;
+	uint64_t ev[2];
+	double t[2], start;
+	int ninsts, step, i, c;
+
+	while ((c = getopt(argc, argv, "c:f:")) != -1) {
+		switch (c) {
+		case 'c':
+			chain = atoi(optarg);
+			break;
+		case 'f':
+			fanin = atoi(optarg);
+			break;
+		default:
+			(void) fprintf(stderr, "usage: %s [-c chain] "
+			    "[-f fanin]\n", argv[0]);
+			return (2);
+		}
+	}
+	if (chain < 2 || fanin < 1) {
+		(void) fprintf(stderr, "%s: chain must be at least 2 and fanin "
+		    "positive\n", argv[0]);
+		return (2);
+	}
+
+	/* insts[0 .. chain - 1] are the chain, then the milestone. */
+	ninsts = chain + 1 + fanin;
+	insts = bench_zalloc(ninsts, sizeof (vertex_t *));
+	res = bench_zalloc(ninsts, sizeof (int));
+	batch = bench_zalloc(ninsts, sizeof (int));
+	for (i = 0; i < chain; i++) {
+		insts[i] = v = vertex(INST);
+		if (i > 0)
+			v->v_deps[v->v_ndeps++] =
+			    group(REQUIRE_ALL, insts[i - 1], NULL);
+	}
+	insts[chain] = ms = vertex(INST);
+	ms->v_deps[ms->v_ndeps++] = group(REQUIRE_ALL, insts[chain - 1], NULL);
+	for (i = 0; i < fanin; i++) {
+		insts[chain + 1 + i] = v = vertex(INST);
+		v->v_deps[v->v_ndeps++] =
+		    group(OPTIONAL_ALL, insts[chain - 1], NULL);
+		v->v_deps[v->v_ndeps++] = group(REQUIRE_ANY,
+		    insts[i % chain], insts[(i * 7 + 3) % chain]);
+		v->v_deps[v->v_ndeps++] = group(REQUIRE_ALL, ms, NULL);
+	}
+
+	ev[0] = ev[1] = 0;
+	t[0] = t[1] = 0;
+	for (step = 0; step <= ninsts; step++) {
+		nbatch = 0;
+		for (i = 0; i < ninsts; i++) {
+			if (insts[i]->v_state == OFFLINE &&
+			    (up == NULL || reaches(up, insts[i])))
+				batch[nbatch++] = i;
+		}
+
+		for (memo = 0; memo <= 1; memo++) {
+			evals = 0;
+			if (++gen == 0)
+				gen = 1;
+			start = bench_now_ns();
+			for (b = 0; b < nbatch; b++) {
+				i = batch[b];
+				c = require_all(insts[i], 0);
+				if (memo && c != res[i]) {
+					bench_fail("step %d: instance %d is "
+					    "%d with memos, %d without", step,
+					    i, c, res[i]);
+				}
+				res[i] = c;
+			}
+			t[memo] += bench_now_ns() - start;
+			ev[memo] += evals;
+		}
+
+		/* Bring up the first satisfied instance. */
+		for (i = 0; i < ninsts; i++) {
+			if (insts[i]->v_state == OFFLINE && res[i] == 1)
+				break;
+		}
+		if (i == ninsts)
+			break;
+		if (i != (step < chain + 1 ? step : i)) {
+			bench_fail("step %d: instance %d is satisfied first",
+			    step, i);
+		}
+		insts[i]->v_state = ONLINE;
+		res[i] = 0;
+		up = insts[i];
+	}
+	if (step != ninsts) {
+		bench_fail("only %d of %d instances came online", step,
+		    ninsts);
+	}
+
+	(void) printf("chain %d, fan-in %d, %d transitions\n", chain, fanin,
+	    step);
+	(void) printf("%-10s %14s %12s\n", "", "evaluations", "ms");
+	(void) printf("%-10s %14llu %12.1f\n", "no memos",
+	    (unsigned long long)ev[0], t[0] / 1e6);
+	(void) printf("%-10s %14llu %12.1f\n", "memos",
+	    (unsigned long long)ev[1], t[1] / 1e6);
+	(void) printf("%-10s %14llu %11.1fx\n", "avoided",
+	    (unsigned long long)(ev[0] - ev[1]), (double)ev[0] / ev[1]);
+
+	return (bench_exit());
+}
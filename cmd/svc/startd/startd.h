@@ -27,6 +27,7 @@
 #ifndef	_STARTD_H
 #define	_STARTD_H
 
+#include <sys/resource.h>
 #include <sys/time.h>
 #include <librestart.h>
 #include <librestart_priv.h>
@@ -39,6 +40,10 @@
 #include <syslog.h>
 #include <umem.h>
 
+#include "dict.h"
+#include "inst_index.h"
+#include "timeout_heap.h"
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
@@ -200,35 +205,18 @@ extern const char *log_directory;	/* Current log directory path */
 #define	FS_TIMEZONE_DIR		"/usr/share/lib/zoneinfo"
 #define	FS_LOCALE_DIR		"/usr/lib/locale"
 
-/*
- * Simple dictionary representation.
- */
-typedef struct dictionary {
-	uu_list_t		*dict_list;
-	int			dict_new_id;
-	pthread_mutex_t		dict_lock;
-} dictionary_t;
-
-typedef struct dict_entry {
-	int			de_id;
-	const char		*de_name;
-	uu_list_node_t		de_link;
-} dict_entry_t;
-
-extern dictionary_t *dictionary;
-
 typedef struct timeout_queue {
-	uu_list_t		*tq_list;
+	timeout_heap_t		*tq_heap;
 	pthread_mutex_t		tq_lock;
+	pthread_cond_t		tq_cv;		/* first timeout changed */
 } timeout_queue_t;
 
 typedef struct timeout_entry {
-	hrtime_t		te_timeout;	/* timeout expiration time */
 	ctid_t			te_ctid;
 	char			*te_fmri;
 	char			*te_logstem;
 	volatile int		te_fired;
-	uu_list_node_t		te_link;
+	timeout_heap_node_t	te_node;
 } timeout_entry_t;
 
 extern timeout_queue_t *timeouts;
@@ -291,6 +279,7 @@ typedef enum {
 #define	GV_DEATHROW	0x10	/* Service is on deathrow */
 #define	GV_TOOFFLINE	0x20	/* Services in subtree to offline */
 #define	GV_TODISABLE	0x40	/* Services in subtree to disable */
+#define	GV_STARTQ	0x80	/* On the graph start queue */
 
 /* ID must come first to support search */
 typedef struct graph_vertex {
@@ -329,6 +318,21 @@ typedef struct graph_vertex {
 
 	int32_t				gv_stn_tset;
 	int32_t				gv_reason;
+
+	/*
+	 * For GVT_INST and require_all GVT_GROUP vertices, a dependency
+	 * which was unsatisfied when the vertex was last evaluated, or NULL.
+	 * Until it is satisfied, nothing else needs to be looked at.
+	 */
+	struct graph_vertex		*gv_blocker;
+	struct graph_vertex		*gv_startq_next;
+
+	/*
+	 * dependency_satisfied() results, indexed by satbility, and the
+	 * generation in which each was computed.  See dependency_satisfied().
+	 */
+	uint32_t			gv_sat_gen[2];
+	int8_t				gv_sat[2];
 } graph_vertex_t;
 
 typedef struct graph_edge {
@@ -421,19 +425,24 @@ typedef struct restarter_inst {
 	hrtime_t		ri_start_time[RINST_START_TIMES];
 	uint_t			ri_start_index;	/* times started */
 
-	uu_list_node_t		ri_link;
+	inst_index_node_t	ri_link;
 	pthread_mutex_t		ri_lock;
 
 	/*
-	 * When we start a thread to we execute a method for this instance, we
-	 * put the thread id in ri_method_thread.  Threads with ids other than
-	 * this which acquire ri_lock while ri_method_thread is nonzero should
-	 * wait on ri_method_cv.  ri_method_waiters should be incremented while
-	 * waiting so the instance won't be deleted.
+	 * When we hand a method for this instance to the method threads, we
+	 * set ri_method_queued, and the thread which takes it clears that and
+	 * puts its id in ri_method_thread.  Threads with ids other than this
+	 * which acquire ri_lock while ri_method_queued is set or
+	 * ri_method_thread is nonzero should wait on ri_method_cv.
+	 * ri_method_waiters should be incremented while waiting so the
+	 * instance won't be deleted.  If the instance's events are put off
+	 * until the method is done, ri_events_deferred is set.
 	 */
 	pthread_t		ri_method_thread;
 	pthread_cond_t		ri_method_cv;
 	uint_t			ri_method_waiters;
+	boolean_t		ri_method_queued;
+	boolean_t		ri_events_deferred;
 
 	/*
 	 * These fields are provided so functions can operate on this structure
@@ -457,20 +466,15 @@ typedef struct restarter_inst {
 	 * of restarter_instance_qentry_t's, and the lock is held separately.
 	 * If both ri_lock and ri_queue_lock are grabbed, ri_lock must be
 	 * grabbed first.  ri_queue_lock protects all ri_queue_* structure
-	 * members.
+	 * members.  ri_queue_busy is set from when the instance is handed to
+	 * the event workers until one of them finds the queue empty.
 	 */
 	pthread_mutex_t		ri_queue_lock;
-	pthread_cond_t		ri_queue_cv;
 	uu_list_t		*ri_queue;
-	int			ri_queue_thread;
+	int			ri_queue_busy;
 
 } restarter_inst_t;
 
-typedef struct restarter_instance_list {
-	uu_list_t		*ril_instance_list;
-	pthread_mutex_t		ril_lock;
-} restarter_instance_list_t;
-
 typedef struct restarter_instance_qentry {
 	restarter_event_type_t	riq_type;
 	int32_t			riq_reason;
@@ -478,6 +482,7 @@ typedef struct restarter_instance_qentry {
 } restarter_instance_qentry_t;
 
 typedef struct fork_info {
+	restarter_inst_t	*sf_inst;
 	int			sf_id;
 	int			sf_method_type;
 	restarter_error_t	sf_event_type;
@@ -576,11 +581,6 @@ void contract_hash_store(ctid_t, int);
 void contract_hash_remove(ctid_t);
 int lookup_inst_by_contract(ctid_t);
 
-/* dict.c */
-void dict_init(void);
-int dict_lookup_byname(const char *);
-int dict_insert(const char *);
-
 /* expand.c */
 int expand_method_tokens(const char *, scf_instance_t *,
     scf_snapshot_t *, int, char **);
@@ -589,6 +589,7 @@ int expand_method_tokens(const char *, scf_instance_t *,
 void init_env(void);
 char **set_smf_env(char **, size_t, const char *,
     const restarter_inst_t *, const char *);
+void free_smf_env(char **, size_t);
 
 /* file.c */
 int file_ready(graph_vertex_t *);
@@ -704,6 +705,7 @@ void log_framework(int, const char *, ...);
 void log_framework2(int, int, const char *, ...);
 void log_console(int, const char *, ...);
 void log_preexec(void);
+int log_open(const char *);
 void setlog(const char *);
 void log_transition(const restarter_inst_t *, start_outcome_t);
 void log_instance(const restarter_inst_t *, boolean_t, const char *, ...);
@@ -732,6 +734,7 @@ int restarter_instance_update_states(scf_handle_t *, restarter_inst_t *,
     restarter_str_t);
 int stop_instance_fmri(scf_handle_t *, const char *, uint_t);
 restarter_inst_t *inst_lookup_by_id(int);
+void restarter_resume_events(restarter_inst_t *);
 void restarter_mark_pending_snapshot(const char *, uint_t);
 void *restarter_post_fsminimal_thread(void *);
 void timeout_insert(restarter_inst_t *, ctid_t, uint64_t);
@@ -773,6 +776,7 @@ void utmpx_postfork(void);
 void wait_init(void);
 void wait_prefork(void);
 void wait_postfork(pid_t);
+void wait_fd_rlimit(struct rlimit *);
 int wait_register(pid_t, const char *, int, int);
 void *wait_thread(void *);
 void wait_ignore_by_fmri(const char *);
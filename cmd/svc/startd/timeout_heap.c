@@ -0,0 +1,224 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * timeout_heap.c - method timeout queue
+ *
+ * A binary min-heap of objects ordered by expiration time, kept in an
+ * array of pointers which doubles as needed.  Each object embeds a
+ * timeout_heap_node_t recording its time and its position in the array,
+ * so the earliest object is found in constant time, and inserting,
+ * removing or rescheduling any object takes O(log n).
+ *
+ * The heap does no locking of its own.
+ *
+ * Nothing here depends on the rest of svc.startd, so it can be built and
+ * measured on its own.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "timeout_heap.h"
+
+#define	TH_MIN_SIZE	64
+
+struct timeout_heap {
+	size_t		th_offset;	/* of node within object */
+	void		**th_objs;
+	uint32_t	th_count;
+	uint32_t	th_size;
+};
+
+#define	TH_NODE(th, obj)	\
+	((timeout_heap_node_t *)((char *)(obj) + (th)->th_offset))
+#define	TH_WHEN(th, i)		(TH_NODE(th, (th)->th_objs[i])->thn_when)
+
+/*
+ * offset is the offset of the timeout_heap_node_t in the queued objects.
+ * Returns NULL if out of memory.
+ */
+timeout_heap_t *
+timeout_heap_create(size_t offset)
+{
+	timeout_heap_t *th;
+
+	if ((th = calloc(1, sizeof (*th))) == NULL)
+		return (NULL);
+	if ((th->th_objs = calloc(TH_MIN_SIZE, sizeof (void *))) == NULL) {
+		free(th);
+		return (NULL);
+	}
+	th->th_offset = offset;
+	th->th_size = TH_MIN_SIZE;
+
+	return (th);
+}
+
+/*
+ * The heap must be empty.
+ */
+void
+timeout_heap_destroy(timeout_heap_t *th)
+{
+	assert(th->th_count == 0);
+	free(th->th_objs);
+	free(th);
+}
+
+static void
+th_set(timeout_heap_t *th, uint32_t i, void *obj)
+{
+	th->th_objs[i] = obj;
+	TH_NODE(th, obj)->thn_index = i;
+}
+
+/*
+ * Moves the object at i towards the root until its parent is no later.
+ */
+static void
+th_up(timeout_heap_t *th, uint32_t i)
+{
+	void *obj = th->th_objs[i];
+	int64_t when = TH_NODE(th, obj)->thn_when;
+	uint32_t p;
+
+	while (i > 0) {
+		p = (i - 1) / 2;
+		if (TH_WHEN(th, p) <= when)
+			break;
+		th_set(th, i, th->th_objs[p]);
+		i = p;
+	}
+	th_set(th, i, obj);
+}
+
+/*
+ * Moves the object at i towards the leaves until no child is earlier.
+ */
+static void
+th_down(timeout_heap_t *th, uint32_t i)
+{
+	void *obj = th->th_objs[i];
+	int64_t when = TH_NODE(th, obj)->thn_when;
+	uint32_t c;
+
+	while ((c = 2 * i + 1) < th->th_count) {
+		if (c + 1 < th->th_count && TH_WHEN(th, c + 1) < TH_WHEN(th, c))
+			c++;
+		if (when <= TH_WHEN(th, c))
+			break;
+		th_set(th, i, th->th_objs[c]);
+		i = c;
+	}
+	th_set(th, i, obj);
+}
+
+/*
+ * Queues obj to expire at when.  Returns 0 on success, or -1 with errno
+ * set to ENOMEM if the heap had to grow and could not.
+ */
+int
+timeout_heap_insert(timeout_heap_t *th, void *obj, int64_t when)
+{
+	void **objs;
+
+	if (th->th_count == th->th_size) {
+		if ((objs = realloc(th->th_objs,
+		    2 * (size_t)th->th_size * sizeof (void *))) == NULL) {
+			errno = ENOMEM;
+			return (-1);
+		}
+		th->th_objs = objs;
+		th->th_size *= 2;
+	}
+
+	TH_NODE(th, obj)->thn_when = when;
+	th_set(th, th->th_count++, obj);
+	th_up(th, th->th_count - 1);
+
+	return (0);
+}
+
+/*
+ * Removes obj, which must be queued.
+ */
+void
+timeout_heap_remove(timeout_heap_t *th, void *obj)
+{
+	uint32_t i = TH_NODE(th, obj)->thn_index;
+	void *last;
+
+	assert(i < th->th_count && th->th_objs[i] == obj);
+
+	last = th->th_objs[--th->th_count];
+	if (last == obj)
+		return;
+
+	th_set(th, i, last);
+	if (i > 0 && TH_WHEN(th, (i - 1) / 2) > TH_NODE(th, last)->thn_when)
+		th_up(th, i);
+	else
+		th_down(th, i);
+}
+
+/*
+ * Changes the expiration time of obj, which must be queued.
+ */
+void
+timeout_heap_update(timeout_heap_t *th, void *obj, int64_t when)
+{
+	timeout_heap_node_t *n = TH_NODE(th, obj);
+	int64_t old = n->thn_when;
+
+	assert(n->thn_index < th->th_count && th->th_objs[n->thn_index] == obj);
+
+	n->thn_when = when;
+	if (when < old)
+		th_up(th, n->thn_index);
+	else
+		th_down(th, n->thn_index);
+}
+
+/*
+ * Returns the object which expires first, or NULL if the heap is empty.
+ */
+void *
+timeout_heap_min(const timeout_heap_t *th)
+{
+	return (th->th_count > 0 ? th->th_objs[0] : NULL);
+}
+
+int64_t
+timeout_heap_when(const timeout_heap_t *th, const void *obj)
+{
+	return (TH_NODE(th, obj)->thn_when);
+}
+
+uint32_t
+timeout_heap_count(const timeout_heap_t *th)
+{
+	return (th->th_count);
+}
@@ -0,0 +1,58 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_TIMEOUT_HEAP_H
+#define	_TIMEOUT_HEAP_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * A priority queue of objects by expiration time.  See timeout_heap.c.
+ */
+typedef struct timeout_heap timeout_heap_t;
+
+/* Embedded in each queued object. */
+typedef struct timeout_heap_node {
+	int64_t		thn_when;	/* expiration time, in nanoseconds */
+	uint32_t	thn_index;	/* position in the heap */
+} timeout_heap_node_t;
+
+timeout_heap_t *timeout_heap_create(size_t);
+void timeout_heap_destroy(timeout_heap_t *);
+
+int timeout_heap_insert(timeout_heap_t *, void *, int64_t);
+void timeout_heap_remove(timeout_heap_t *, void *);
+void timeout_heap_update(timeout_heap_t *, void *, int64_t);
+
+void *timeout_heap_min(const timeout_heap_t *);
+int64_t timeout_heap_when(const timeout_heap_t *, const void *);
+uint32_t timeout_heap_count(const timeout_heap_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _TIMEOUT_HEAP_H */
@@ -0,0 +1,392 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * timeout_heap_bench - method timeout queue cost and accuracy
+ *
+ * First, for each queue length N, fills a queue with N pending timeouts
+ * and measures inserting and then cancelling random timeouts, both the
+ * way restarter.c used to (a sorted uu_list) and with a timeout_heap_t.
+ * Reports nanoseconds per operation.
+ *
+ * Then runs a timeout thread the way restarter_timeouts_event_thread()
+ * does, sleeping on a CLOCK_MONOTONIC condition variable until the first
+ * deadline, while the main thread queues timeouts over the next second
+ * and cancels every other one before it is due.  Reports how late the
+ * timeouts fired and how many times the thread woke up.
+ *
+ * Checks that the heap always yields the earliest timeout, that no timeout
+ * fires early, late by more than the slop, or after being cancelled, and
+ * that every other timeout fires exactly once.  Exits with 1 if any check
+ * failed.  Usage:
+ *
+ *	timeout_heap_bench [-o ops] [-t timeouts] [-s slop_ms] [N ...]
+ *
+ * N defaults to 1000, 10000 and 50000;  2000 timeouts with 50 ms slop
+ * are fired.  The list inserts are linear, so only ops / 100 are timed.
+ */
+
+#include <sys/types.h>
+
+#include <libuutil.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "timeout_heap.h"
+
+#define	NANOSEC_LL	1000000000LL
+
+typedef struct bench_timeout {
+	int64_t			bt_when;
+	int64_t			bt_fired_at;
+	int			bt_fired;
+	int			bt_cancelled;
+	uu_list_node_t		bt_link;
+	timeout_heap_node_t	bt_node;
+} bench_timeout_t;
+
+static uu_list_pool_t *timeout_pool;
+
+static timeout_heap_t *fire_heap;
+static pthread_mutex_t fire_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fire_cv;
+static int fire_done;
+static long fire_wakeups;
+
+/* As timeout_compare() did. */
+/* ARGSUSED */
+static int
+timeout_compare(const void *lc_arg, const void *rc_arg, void *private)
+{
+	int64_t t1 = ((const bench_timeout_t *)lc_arg)->bt_when;
+	int64_t t2 = ((const bench_timeout_t *)rc_arg)->bt_when;
+
+	if (t1 > t2)
+		return (1);
+	else if (t1 < t2)
+		return (-1);
+	return (0);
+}
+
+static int
+when_compare(const void *l, const void *r)
+{
+	return (timeout_compare(l, r, NULL));
+}
+
+static int64_t
+random_when(void)
+{
+	return (((int64_t)random() << 16) ^ random());
+}
+
+static void
+run_cost(int n, long ops)
+{
+	bench_timeout_t *bts;
+	uu_list_t *list;
+	uu_list_index_t idx;
+	timeout_heap_t *th;
+	bench_timeout_t *prev, *e;
+	long i, nlist;
+	int64_t t;
+
+	bts = bench_zalloc(n + ops, sizeof (*bts));
+	list = uu_list_create(timeout_pool, NULL, UU_LIST_SORTED);
+	th = timeout_heap_create(offsetof(bench_timeout_t, bt_node));
+	if (list == NULL || th == NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < n + ops; i++)
+		bts[i].bt_when = random_when();
+
+	/*
+	 * Preload both queues.  Inserting into the list in descending
+	 * order keeps each insert at its head.
+	 */
+	qsort(bts, n, sizeof (*bts), when_compare);
+	for (i = n - 1; i >= 0; i--) {
+		uu_list_node_init(&bts[i], &bts[i].bt_link, timeout_pool);
+		(void) uu_list_find(list, &bts[i], NULL, &idx);
+		uu_list_insert(list, &bts[i], idx);
+		if (timeout_heap_insert(th, &bts[i], bts[i].bt_when) != 0) {
+			perror("timeout_heap_insert");
+			exit(1);
+		}
+	}
+	for (i = n; i < n + ops; i++)
+		uu_list_node_init(&bts[i], &bts[i].bt_link, timeout_pool);
+
+	nlist = ops / 100 > 0 ? ops / 100 : 1;
+
+	(void) printf("%d pending timeouts\n", n);
+
+	t = bench_now_ns();
+	for (i = n; i < n + nlist; i++) {
+		(void) uu_list_find(list, &bts[i], NULL, &idx);
+		uu_list_insert(list, &bts[i], idx);
+	}
+	(void) printf("  %-28s %12.1f ns\n", "insert, sorted list",
+	    (double)(bench_now_ns() - t) / nlist);
+	t = bench_now_ns();
+	for (i = n; i < n + nlist; i++)
+		uu_list_remove(list, &bts[i]);
+	(void) printf("  %-28s %12.1f ns\n", "cancel, sorted list",
+	    (double)(bench_now_ns() - t) / nlist);
+
+	t = bench_now_ns();
+	for (i = n; i < n + ops; i++) {
+		if (timeout_heap_insert(th, &bts[i], bts[i].bt_when) != 0) {
+			perror("timeout_heap_insert");
+			exit(1);
+		}
+	}
+	(void) printf("  %-28s %12.1f ns\n", "insert, timeout heap",
+	    (double)(bench_now_ns() - t) / ops);
+	t = bench_now_ns();
+	for (i = n + ops - 1; i >= n; i--)
+		timeout_heap_remove(th, &bts[i]);
+	(void) printf("  %-28s %12.1f ns\n", "cancel, timeout heap",
+	    (double)(bench_now_ns() - t) / ops);
+
+	if (timeout_heap_count(th) != n)
+		bench_fail("heap count: %u", timeout_heap_count(th));
+
+	/* Both queues must now drain in the same order. */
+	for (prev = NULL, i = 0; (e = timeout_heap_min(th)) != NULL; i++) {
+		if (e != uu_list_first(list) && e->bt_when !=
+		    ((bench_timeout_t *)uu_list_first(list))->bt_when)
+			bench_fail("heap order: %ld", i);
+		if (prev != NULL && prev->bt_when > e->bt_when)
+			bench_fail("heap order: %ld", i);
+		timeout_heap_remove(th, e);
+		uu_list_remove(list, uu_list_first(list));
+		prev = e;
+	}
+	if (i != n)
+		bench_fail("heap drained: %ld", i);
+
+	timeout_heap_destroy(th);
+	uu_list_destroy(list);
+	free(bts);
+}
+
+/*
+ * As restarter_timeouts_event_thread():  fire what is due, then sleep
+ * until the next deadline, or until woken if there is none.
+ */
+/* ARGSUSED */
+static void *
+fire_thread(void *arg)
+{
+	bench_timeout_t *e;
+	struct timespec ts;
+	int64_t now;
+
+	(void) pthread_mutex_lock(&fire_lock);
+	while (!fire_done) {
+		fire_wakeups++;
+		now = bench_now_ns();
+		while ((e = timeout_heap_min(fire_heap)) != NULL &&
+		    e->bt_when <= now) {
+			timeout_heap_remove(fire_heap, e);
+			e->bt_fired++;
+			e->bt_fired_at = now;
+		}
+		if (e == NULL) {
+			(void) pthread_cond_wait(&fire_cv, &fire_lock);
+			continue;
+		}
+		ts.tv_sec = e->bt_when / NANOSEC_LL;
+		ts.tv_nsec = e->bt_when % NANOSEC_LL;
+		(void) pthread_cond_timedwait(&fire_cv, &fire_lock, &ts);
+	}
+	(void) pthread_mutex_unlock(&fire_lock);
+	return (NULL);
+}
+
+static void
+run_accuracy(int ntimeouts, int64_t slop)
+{
+	bench_timeout_t *bts;
+	pthread_condattr_t attr;
+	pthread_t tid;
+	int64_t start, late, total = 0, max = 0;
+	int i, nfired = 0;
+
+	bts = bench_zalloc(ntimeouts, sizeof (*bts));
+	if ((fire_heap = timeout_heap_create(offsetof(bench_timeout_t,
+	    bt_node))) == NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	(void) pthread_condattr_init(&attr);
+	(void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	(void) pthread_cond_init(&fire_cv, &attr);
+	(void) pthread_condattr_destroy(&attr);
+
+	(void) pthread_create(&tid, NULL, fire_thread, NULL);
+
+	/*
+	 * Queue each timeout between 50 ms and 1 s from now, a few at a
+	 * time, waking the thread only when one becomes the first.  Every
+	 * other timeout is cancelled straight away unless it is due within
+	 * 10 ms, which could race with its firing.
+	 */
+	start = bench_now_ns();
+	for (i = 0; i < ntimeouts; i++) {
+		bench_timeout_t *e = &bts[i];
+
+		if (i % 64 == 0)
+			(void) usleep(1000);
+
+		(void) pthread_mutex_lock(&fire_lock);
+		e->bt_when = bench_now_ns() + NANOSEC_LL / 20 +
+		    random() % (NANOSEC_LL * 19 / 20);
+		if (timeout_heap_insert(fire_heap, e, e->bt_when) != 0) {
+			perror("timeout_heap_insert");
+			exit(1);
+		}
+		if (timeout_heap_min(fire_heap) == e)
+			(void) pthread_cond_signal(&fire_cv);
+		if (i % 2 == 1 &&
+		    e->bt_when - bench_now_ns() > NANOSEC_LL / 100) {
+			timeout_heap_remove(fire_heap, e);
+			e->bt_cancelled = 1;
+		}
+		(void) pthread_mutex_unlock(&fire_lock);
+	}
+
+	/* Wait for the queue to drain. */
+	for (;;) {
+		uint32_t left;
+
+		(void) pthread_mutex_lock(&fire_lock);
+		left = timeout_heap_count(fire_heap);
+		(void) pthread_mutex_unlock(&fire_lock);
+		if (left == 0)
+			break;
+		(void) usleep(10000);
+	}
+
+	(void) pthread_mutex_lock(&fire_lock);
+	fire_done = 1;
+	(void) pthread_cond_signal(&fire_cv);
+	(void) pthread_mutex_unlock(&fire_lock);
+	(void) pthread_join(tid, NULL);
+
+	for (i = 0; i < ntimeouts; i++) {
+		bench_timeout_t *e = &bts[i];
+
+		if (e->bt_cancelled) {
+			if (e->bt_fired != 0)
+				bench_fail("cancelled timeout fired: %d", i);
+			continue;
+		}
+		if (e->bt_fired != 1) {
+			bench_fail("timeout fired wrong number of times: %d",
+			    i);
+			continue;
+		}
+		late = e->bt_fired_at - e->bt_when;
+		if (late < 0)
+			bench_fail("timeout fired early: %d", i);
+		if (late > slop)
+			bench_fail("timeout fired late: %d", i);
+		total += late;
+		if (late > max)
+			max = late;
+		nfired++;
+	}
+
+	(void) printf("%d timeouts over %.2f s, %d fired\n", ntimeouts,
+	    (double)(bench_now_ns() - start) / NANOSEC_LL, nfired);
+	if (nfired > 0) {
+		(void) printf("  %-28s %12.1f us\n", "mean lateness",
+		    (double)total / nfired / 1000);
+		(void) printf("  %-28s %12.1f us\n", "max lateness",
+		    (double)max / 1000);
+	}
+	(void) printf("  %-28s %12ld\n", "timeout thread wakeups",
+	    fire_wakeups);
+
+	timeout_heap_destroy(fire_heap);
+	free(bts);
+}
+
+int
+main(int argc, char *argv[])
+{
+	long ops = 100000;
+	int ntimeouts = 2000;
+	int64_t slop = 50 * 1000000LL;
+	int c;
+
+	while ((c = getopt(argc, argv, "o:t:s:")) != -1) {
+		switch (c) {
+		case 'o':
+			ops = atol(optarg);
+			break;
+		case 't':
+			ntimeouts = atoi(optarg);
+			break;
+		case 's':
+			slop = atol(optarg) * 1000000LL;
+			break;
+		default:
+			(void) fprintf(stderr, "usage: %s [-o ops] "
+			    "[-t timeouts] [-s slop_ms] [N ...]\n", argv[0]);
+			return (2);
+		}
+	}
+	if (ops < 1)
+		ops = 1;
+
+	timeout_pool = uu_list_pool_create("bench_timeouts",
+	    sizeof (bench_timeout_t), offsetof(bench_timeout_t, bt_link),
+	    timeout_compare, 0);
+	if (timeout_pool == NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		return (1);
+	}
+
+	if (optind == argc) {
+		run_cost(1000, ops);
+		run_cost(10000, ops);
+		run_cost(50000, ops);
+	} else {
+		for (; optind < argc; optind++)
+			run_cost(atoi(argv[optind]), ops);
+	}
+	if (ntimeouts > 0)
+		run_accuracy(ntimeouts, slop);
+
+	return (bench_exit());
+}
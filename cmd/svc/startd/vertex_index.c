@@ -0,0 +1,293 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * vertex_index.c - constant time lookup of graph vertices
+ *
+ * Vertex ids are handed out densely from 0 by the dictionary (dict.c) and
+ * are never reused for a different name, so the index keeps an array of
+ * entries indexed directly by id.  Each entry also records the vertex's
+ * name and its hash, and the entries are chained from a table of hash
+ * buckets, so a lookup by name is one hash and, usually, one strcmp().
+ * Chaining through the id array means inserting a vertex allocates
+ * nothing unless one of the two tables has to grow.
+ *
+ * The index does not copy names;  a name must stay valid until its vertex
+ * is removed.  The index does no locking of its own.
+ *
+ * Nothing here depends on the rest of svc.startd, so it can be built and
+ * measured on its own.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vertex_index.h"
+
+#define	VI_MIN_IDS		64
+#define	VI_MIN_BUCKETS		64
+
+#define	VI_FNV_INIT		2166136261U
+#define	VI_FNV_PRIME		16777619U
+
+typedef struct vi_entry {
+	void		*ve_obj;	/* NULL if the slot is free */
+	const char	*ve_name;
+	uint32_t	ve_hash;
+	int		ve_next;	/* next id in bucket, or -1 */
+} vi_entry_t;
+
+struct vertex_index {
+	vi_entry_t	*vi_byid;
+	size_t		vi_nids;	/* slots in vi_byid */
+	size_t		vi_count;	/* vertices in the index */
+	size_t		vi_end;		/* slots from here on are free */
+	int		*vi_buckets;	/* first id in each bucket, or -1 */
+	size_t		vi_nbuckets;	/* always a power of two */
+};
+
+static uint32_t
+vi_hash(const char *name)
+{
+	const unsigned char *p;
+	uint32_t h = VI_FNV_INIT;
+
+	for (p = (const unsigned char *)name; *p != '\0'; p++) {
+		h ^= *p;
+		h *= VI_FNV_PRIME;
+	}
+	return (h);
+}
+
+/*
+ * Replace the bucket table with one of nbuckets buckets, and chain every
+ * vertex into it again.
+ */
+static int
+vi_rehash(vertex_index_t *vi, size_t nbuckets)
+{
+	int *buckets;
+	size_t b;
+	int id;
+
+	if ((buckets = malloc(nbuckets * sizeof (int))) == NULL)
+		return (-1);
+	for (b = 0; b < nbuckets; b++)
+		buckets[b] = -1;
+
+	for (id = 0; id < (int)vi->vi_nids; id++) {
+		vi_entry_t *e = &vi->vi_byid[id];
+
+		if (e->ve_obj == NULL)
+			continue;
+		b = e->ve_hash & (nbuckets - 1);
+		e->ve_next = buckets[b];
+		buckets[b] = id;
+	}
+
+	free(vi->vi_buckets);
+	vi->vi_buckets = buckets;
+	vi->vi_nbuckets = nbuckets;
+	return (0);
+}
+
+/*
+ * Make room for id in vi_byid.
+ */
+static int
+vi_grow_ids(vertex_index_t *vi, int id)
+{
+	vi_entry_t *n;
+	size_t nids;
+
+	nids = vi->vi_nids == 0 ? VI_MIN_IDS : vi->vi_nids;
+	while (nids <= (size_t)id)
+		nids *= 2;
+
+	if ((n = realloc(vi->vi_byid, nids * sizeof (vi_entry_t))) == NULL)
+		return (-1);
+	(void) memset(&n[vi->vi_nids], 0,
+	    (nids - vi->vi_nids) * sizeof (vi_entry_t));
+
+	vi->vi_byid = n;
+	vi->vi_nids = nids;
+	return (0);
+}
+
+/*
+ * Returns NULL, with errno set to ENOMEM, if out of memory.
+ */
+vertex_index_t *
+vertex_index_create(void)
+{
+	vertex_index_t *vi;
+
+	if ((vi = calloc(1, sizeof (*vi))) == NULL)
+		return (NULL);
+
+	if (vi_rehash(vi, VI_MIN_BUCKETS) != 0) {
+		free(vi);
+		errno = ENOMEM;
+		return (NULL);
+	}
+	return (vi);
+}
+
+void
+vertex_index_destroy(vertex_index_t *vi)
+{
+	if (vi == NULL)
+		return;
+	free(vi->vi_byid);
+	free(vi->vi_buckets);
+	free(vi);
+}
+
+/*
+ * Add obj to the index, as the vertex with the given id and name.
+ *
+ * Fails with -1 and errno set to
+ *   EINVAL - id is negative, or obj or name is NULL
+ *   EEXIST - a vertex with this id is already in the index
+ *   ENOMEM - out of memory;  the index is unchanged
+ */
+int
+vertex_index_insert(vertex_index_t *vi, int id, const char *name, void *obj)
+{
+	vi_entry_t *e;
+	size_t b;
+
+	if (id < 0 || name == NULL || obj == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if ((size_t)id < vi->vi_nids && vi->vi_byid[id].ve_obj != NULL) {
+		errno = EEXIST;
+		return (-1);
+	}
+
+	if ((size_t)id >= vi->vi_nids && vi_grow_ids(vi, id) != 0) {
+		errno = ENOMEM;
+		return (-1);
+	}
+	if (vi->vi_count + 1 > vi->vi_nbuckets &&
+	    vi_rehash(vi, vi->vi_nbuckets * 2) != 0) {
+		errno = ENOMEM;
+		return (-1);
+	}
+
+	e = &vi->vi_byid[id];
+	e->ve_obj = obj;
+	e->ve_name = name;
+	e->ve_hash = vi_hash(name);
+
+	b = e->ve_hash & (vi->vi_nbuckets - 1);
+	e->ve_next = vi->vi_buckets[b];
+	vi->vi_buckets[b] = id;
+	vi->vi_count++;
+	if ((size_t)id >= vi->vi_end)
+		vi->vi_end = (size_t)id + 1;
+
+	return (0);
+}
+
+/*
+ * Remove the vertex with the given id, and return it.  Returns NULL if
+ * there is none.
+ */
+void *
+vertex_index_remove(vertex_index_t *vi, int id)
+{
+	vi_entry_t *e;
+	void *obj;
+	int *prev;
+
+	if (id < 0 || (size_t)id >= vi->vi_nids ||
+	    vi->vi_byid[id].ve_obj == NULL)
+		return (NULL);
+
+	e = &vi->vi_byid[id];
+	prev = &vi->vi_buckets[e->ve_hash & (vi->vi_nbuckets - 1)];
+	while (*prev != id)
+		prev = &vi->vi_byid[*prev].ve_next;
+	*prev = e->ve_next;
+
+	obj = e->ve_obj;
+	(void) memset(e, 0, sizeof (*e));
+	vi->vi_count--;
+	while (vi->vi_end > 0 && vi->vi_byid[vi->vi_end - 1].ve_obj == NULL)
+		vi->vi_end--;
+
+	return (obj);
+}
+
+void *
+vertex_index_lookup_id(const vertex_index_t *vi, int id)
+{
+	if (id < 0 || (size_t)id >= vi->vi_nids)
+		return (NULL);
+	return (vi->vi_byid[id].ve_obj);
+}
+
+void *
+vertex_index_lookup_name(const vertex_index_t *vi, const char *name)
+{
+	const vi_entry_t *e;
+	uint32_t h;
+	int id;
+
+	h = vi_hash(name);
+	for (id = vi->vi_buckets[h & (vi->vi_nbuckets - 1)]; id != -1;
+	    id = e->ve_next) {
+		e = &vi->vi_byid[id];
+		if (e->ve_hash == h && strcmp(e->ve_name, name) == 0)
+			return (e->ve_obj);
+	}
+	return (NULL);
+}
+
+/*
+ * Return the vertex with the lowest id greater than id, or NULL if there
+ * is none.  Pass -1 to get the vertex with the lowest id.  New vertices
+ * usually take the highest id yet, and vi_end makes finding that they
+ * have no successor immediate.
+ */
+void *
+vertex_index_next(const vertex_index_t *vi, int id)
+{
+	size_t i;
+
+	for (i = (size_t)(id + 1); i < vi->vi_end; i++) {
+		if (vi->vi_byid[i].ve_obj != NULL)
+			return (vi->vi_byid[i].ve_obj);
+	}
+	return (NULL);
+}
+
+size_t
+vertex_index_count(const vertex_index_t *vi)
+{
+	return (vi->vi_count);
+}
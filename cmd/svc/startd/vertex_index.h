@@ -0,0 +1,52 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_VERTEX_INDEX_H
+#define	_VERTEX_INDEX_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * An index of graph vertices by their dictionary id and by their name.
+ * See vertex_index.c.
+ */
+typedef struct vertex_index vertex_index_t;
+
+vertex_index_t *vertex_index_create(void);
+void vertex_index_destroy(vertex_index_t *);
+
+int vertex_index_insert(vertex_index_t *, int, const char *, void *);
+void *vertex_index_remove(vertex_index_t *, int);
+
+void *vertex_index_lookup_id(const vertex_index_t *, int);
+void *vertex_index_lookup_name(const vertex_index_t *, const char *);
+void *vertex_index_next(const vertex_index_t *, int);
+size_t vertex_index_count(const vertex_index_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _VERTEX_INDEX_H */
@@ -0,0 +1,264 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * vertex_index_bench - compare graph vertex lookups
+ *
+ * Builds a graph of N vertices named like instance FMRIs and looks random
+ * vertices up by id and by name, both the way graph.c used to (a sorted
+ * uu_list of vertices, and a sorted uu_list dictionary from name to id)
+ * and through a vertex_index_t.  Reports nanoseconds per lookup.  Usage:
+ *
+ *	vertex_index_bench [-l lookups] [-s seed] [N ...]
+ *
+ * N defaults to 10000 and 100000.  The list lookups are linear, so only
+ * lookups / 100 of them are timed.
+ */
+
+#include <sys/types.h>
+
+#include <libuutil.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "vertex_index.h"
+
+typedef struct bench_vertex {
+	int		bv_id;
+	char		*bv_name;
+	uu_list_node_t	bv_link;
+} bench_vertex_t;
+
+typedef struct bench_entry {
+	const char	*be_name;
+	int		be_id;
+	uu_list_node_t	be_link;
+} bench_entry_t;
+
+static uu_list_pool_t *vertex_pool, *dict_pool;
+
+/* As graph_vertex_compare() did. */
+/* ARGSUSED */
+static int
+vertex_compare(const void *lc_arg, const void *rc_arg, void *private)
+{
+	int lc_id = ((const bench_vertex_t *)lc_arg)->bv_id;
+	int rc_id = *(int *)rc_arg;
+
+	if (lc_id > rc_id)
+		return (1);
+	if (lc_id < rc_id)
+		return (-1);
+	return (0);
+}
+
+/* As dict_compare() does. */
+/* ARGSUSED */
+static int
+dict_compare(const void *lc_arg, const void *rc_arg, void *private)
+{
+	return (strcmp(((const bench_entry_t *)lc_arg)->be_name,
+	    ((const bench_entry_t *)rc_arg)->be_name));
+}
+
+static void
+run(int n, long lookups)
+{
+	bench_vertex_t *vs;
+	bench_entry_t *es, tmp;
+	uu_list_t *graph, *dict;
+	uu_list_index_t idx;
+	vertex_index_t *vi;
+	int *keys;
+	long i, nlist;
+	volatile uintptr_t sink = 0;
+	double t;
+	int id;
+
+	vs = bench_zalloc(n, sizeof (*vs));
+	es = bench_zalloc(n, sizeof (*es));
+	keys = bench_zalloc(lookups, sizeof (int));
+
+	graph = uu_list_create(vertex_pool, NULL, UU_LIST_SORTED);
+	dict = uu_list_create(dict_pool, NULL, UU_LIST_SORTED);
+	if (graph == NULL || dict == NULL || (vi = vertex_index_create()) ==
+	    NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	/*
+	 * Build all three.  The names sort in id order, so adding the
+	 * vertices in descending order makes each uu_list_find() stop at
+	 * the head of the lists rather than taking quadratic time.
+	 */
+	for (id = n - 1; id >= 0; id--) {
+		bench_vertex_t *v;
+		char buf[64];
+
+		v = &vs[id];
+		v->bv_id = id;
+		(void) snprintf(buf, sizeof (buf),
+		    "svc:/site/bench/svc%06d:default", id);
+		v->bv_name = strdup(buf);
+
+		uu_list_node_init(v, &v->bv_link, vertex_pool);
+		(void) uu_list_find(graph, &id, NULL, &idx);
+		uu_list_insert(graph, v, idx);
+
+		es[id].be_name = v->bv_name;
+		es[id].be_id = id;
+		uu_list_node_init(&es[id], &es[id].be_link, dict_pool);
+		(void) uu_list_find(dict, &es[id], NULL, &idx);
+		uu_list_insert(dict, &es[id], idx);
+
+		if (vertex_index_insert(vi, id, v->bv_name, v) != 0) {
+			perror("vertex_index_insert");
+			exit(1);
+		}
+	}
+
+	/* Successors, as graph_add_vertex() looks them up. */
+	if (vertex_index_next(vi, -1) != &vs[0] ||
+	    vertex_index_next(vi, n / 2) != &vs[n / 2 + 1] ||
+	    vertex_index_next(vi, n - 1) != NULL)
+		bench_fail("wrong successor");
+	if (vertex_index_remove(vi, n - 1) != &vs[n - 1] ||
+	    vertex_index_next(vi, n - 2) != NULL ||
+	    vertex_index_insert(vi, n - 1, vs[n - 1].bv_name,
+	    &vs[n - 1]) != 0 ||
+	    vertex_index_next(vi, n - 2) != &vs[n - 1])
+		bench_fail("wrong successor after removal");
+
+	for (i = 0; i < lookups; i++)
+		keys[i] = (int)(random() % n);
+	nlist = lookups / 100 > 0 ? lookups / 100 : 1;
+
+	(void) printf("%d vertices\n", n);
+
+	t = bench_now_ns();
+	for (i = 0; i < nlist; i++) {
+		bench_vertex_t *v = uu_list_find(graph, &keys[i], NULL, NULL);
+		if (v == NULL || v->bv_id != keys[i])
+			bench_fail("list lookup: %d", keys[i]);
+		sink += (uintptr_t)v;
+	}
+	(void) printf("  %-28s %12.1f ns\n", "by id, sorted list",
+	    (bench_now_ns() - t) / nlist);
+
+	t = bench_now_ns();
+	for (i = 0; i < lookups; i++) {
+		bench_vertex_t *v = vertex_index_lookup_id(vi, keys[i]);
+		if (v == NULL || v->bv_id != keys[i])
+			bench_fail("index lookup: %d", keys[i]);
+		sink += (uintptr_t)v;
+	}
+	(void) printf("  %-28s %12.1f ns\n", "by id, vertex index",
+	    (bench_now_ns() - t) / lookups);
+
+	t = bench_now_ns();
+	for (i = 0; i < nlist; i++) {
+		bench_entry_t *e;
+		bench_vertex_t *v;
+
+		tmp.be_name = vs[keys[i]].bv_name;
+		e = uu_list_find(dict, &tmp, NULL, NULL);
+		v = uu_list_find(graph, &e->be_id, NULL, NULL);
+		if (v != &vs[keys[i]])
+			bench_fail("list lookup: %s", tmp.be_name);
+		sink += (uintptr_t)v;
+	}
+	(void) printf("  %-28s %12.1f ns\n", "by name, sorted lists",
+	    (bench_now_ns() - t) / nlist);
+
+	t = bench_now_ns();
+	for (i = 0; i < lookups; i++) {
+		bench_vertex_t *v;
+
+		v = vertex_index_lookup_name(vi, vs[keys[i]].bv_name);
+		if (v != &vs[keys[i]])
+			bench_fail("index lookup: %s", vs[keys[i]].bv_name);
+		sink += (uintptr_t)v;
+	}
+	(void) printf("  %-28s %12.1f ns\n", "by name, vertex index",
+	    (bench_now_ns() - t) / lookups);
+
+	vertex_index_destroy(vi);
+	for (i = 0; i < n; i++) {
+		uu_list_remove(dict, &es[i]);
+		uu_list_remove(graph, &vs[i]);
+		free(vs[i].bv_name);
+	}
+	uu_list_destroy(dict);
+	uu_list_destroy(graph);
+	free(keys);
+	free(es);
+	free(vs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	long lookups = 1000000;
+	int c;
+
+	while ((c = getopt(argc, argv, "l:s:")) != -1) {
+		switch (c) {
+		case 'l':
+			lookups = atol(optarg);
+			break;
+		case 's':
+			srandom(atoi(optarg));
+			break;
+		default:
+			(void) fprintf(stderr,
+			    "usage: %s [-l lookups] [-s seed] [N ...]\n",
+			    argv[0]);
+			return (2);
+		}
+	}
+	if (lookups < 1)
+		lookups = 1;
+
+	vertex_pool = uu_list_pool_create("bench_vertices",
+	    sizeof (bench_vertex_t), offsetof(bench_vertex_t, bv_link),
+	    vertex_compare, 0);
+	dict_pool = uu_list_pool_create("bench_dict",
+	    sizeof (bench_entry_t), offsetof(bench_entry_t, be_link),
+	    dict_compare, 0);
+	if (vertex_pool == NULL || dict_pool == NULL) {
+		(void) fprintf(stderr, "out of memory\n");
+		return (1);
+	}
+
+	if (optind == argc) {
+		run(10000, lookups);
+		run(100000, lookups);
+	} else {
+		for (; optind < argc; optind++)
+			run(atoi(argv[optind]), lookups);
+	}
+	return (bench_exit());
+}
@@ -0,0 +1,308 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+/*
+ * vspawn.c - start a process without copying svc.startd
+ *
+ * fork() copies the address space of the parent, or at least its page
+ * tables, which for a large svc.startd costs more than the rest of
+ * starting a method put together.  vspawn() uses vfork() instead:  the
+ * child borrows the parent's memory and the calling thread waits until
+ * the child has called exec or _exit.
+ *
+ * A child that shares memory with a running, multithreaded parent can do
+ * little safely:  no locks, no malloc(), nothing which may be in the middle
+ * of changing in another thread.  So the caller works out everything
+ * first, and the child only makes system calls:  it sets up its session,
+ * descriptors, resource limits, task, groups and ids, changes directory
+ * and executes the program.  Work which needs library code, such as
+ * looking users up or binding to a resource pool, can't be done here, and
+ * the caller must fork for it.
+ *
+ * All signals are blocked in the calling thread across vfork(), so no
+ * handler can run on the borrowed stack, and the child sets any caught
+ * signals back to the default before it restores the mask.
+ *
+ * If a step fails, the child records which and the error in the caller's
+ * vspawn_err_t, which it shares, and exits.  Its exit status is what
+ * vs_exit returns for the step and error, or 127 if vs_exit is NULL.  The
+ * child is not waited for either way.  vs_exit is called in the child, so
+ * it must look at nothing but its arguments.
+ *
+ * Nothing here depends on the rest of svc.startd, so it can be built and
+ * measured on its own.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#else
+#include <sys/task.h>
+#endif
+
+#include "vspawn.h"
+
+#if defined(__linux__)
+/*
+ * glibc's credential wrappers signal every thread of the process so they
+ * all change together, and the threads they would find are the parent's.
+ * The child is the only thread of its process, so go straight to the
+ * kernel.
+ */
+#define	VS_SETGROUPS(n, g)	syscall(SYS_setgroups, (n), (g))
+#define	VS_SETREGID(r, e)	syscall(SYS_setregid, (r), (e))
+#define	VS_SETREUID(r, e)	syscall(SYS_setreuid, (r), (e))
+#else
+#define	VS_SETGROUPS(n, g)	setgroups((n), (g))
+#define	VS_SETREGID(r, e)	setregid((r), (e))
+#define	VS_SETREUID(r, e)	setreuid((r), (e))
+#endif
+
+/*
+ * Fills in a vspawn_t which changes nothing.
+ */
+void
+vspawn_init(vspawn_t *vs)
+{
+	(void) memset(vs, 0, sizeof (*vs));
+	vs->vs_stdin = -1;
+	vs->vs_stdout = -1;
+	vs->vs_closefrom = -1;
+	vs->vs_ngroups = -1;
+	vs->vs_gid = (gid_t)-1;
+	vs->vs_egid = (gid_t)-1;
+	vs->vs_uid = (uid_t)-1;
+	vs->vs_euid = (uid_t)-1;
+}
+
+/*
+ * Whether the child can close every descriptor from vs_closefrom up with
+ * one system call.  Older Linux kernels lack close_range().
+ */
+static int
+vspawn_can_closefrom(void)
+{
+#if defined(F_CLOSEFROM)
+	return (1);
+#elif defined(__linux__) && defined(SYS_close_range)
+	static int works = -1;
+
+	if (works == -1)
+		works = (syscall(SYS_close_range, ~0U, ~0U, 0) == 0);
+	return (works);
+#else
+	return (0);
+#endif
+}
+
+/*
+ * Returns the highest descriptor the parent has open, for a child which
+ * must close them one at a time, or the highest the limit allows if
+ * /proc can't say.  A descriptor another thread opens later without
+ * close-on-exec can escape the child.
+ */
+static int
+vspawn_maxfd(void)
+{
+	struct rlimit rl;
+	struct dirent *de;
+	DIR *dir;
+	int fd, max = -1;
+
+	if ((dir = opendir("/proc/self/fd")) == NULL) {
+		if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur > INT_MAX)
+			return (INT_MAX);
+		return ((int)rl.rlim_cur - 1);
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if ((fd = atoi(de->d_name)) > max)
+			max = fd;
+	}
+	(void) closedir(dir);
+	return (max);
+}
+
+/*
+ * Closes every descriptor from lowfd up, or from lowfd to maxfd if
+ * maxfd isn't -1.
+ */
+static void
+vspawn_closefrom(int lowfd, int maxfd)
+{
+	int fd;
+
+	if (maxfd == -1) {
+#if defined(F_CLOSEFROM)
+		(void) fcntl(lowfd, F_CLOSEFROM, 0);
+#elif defined(__linux__) && defined(SYS_close_range)
+		(void) syscall(SYS_close_range, lowfd, ~0U, 0);
+#endif
+		return;
+	}
+	for (fd = lowfd; fd <= maxfd; fd++)
+		(void) close(fd);
+}
+
+/*
+ * dup2(), but clears close-on-exec if from is already to.
+ */
+static int
+vspawn_dup(int from, int to)
+{
+	if (from == to)
+		return (fcntl(to, F_SETFD, 0));
+	return (dup2(from, to));
+}
+
+/*
+ * The child.  Must not return.
+ */
+static void
+vspawn_child(const vspawn_t *vs, int maxfd, volatile vspawn_err_t *ve,
+    const sigset_t *mask)
+{
+	struct sigaction sa;
+	const char *step;
+	int i;
+
+	/* As setpgrp() in a forked child, which can't fail for a child. */
+	if (vs->vs_flags & VSPAWN_SETPGRP)
+		(void) setsid();
+
+	if (vs->vs_stdin != -1 &&
+	    vspawn_dup(vs->vs_stdin, STDIN_FILENO) == -1) {
+		step = "dup2";
+		goto fail;
+	}
+	if (vs->vs_stdout != -1 &&
+	    (vspawn_dup(vs->vs_stdout, STDOUT_FILENO) == -1 ||
+	    vspawn_dup(vs->vs_stdout, STDERR_FILENO) == -1)) {
+		step = "dup2";
+		goto fail;
+	}
+	if (vs->vs_closefrom != -1)
+		vspawn_closefrom(vs->vs_closefrom, maxfd);
+
+	for (i = 0; i < vs->vs_nrlimits; i++) {
+		if (setrlimit(vs->vs_rlimits[i].vr_resource,
+		    &vs->vs_rlimits[i].vr_limit) != 0) {
+			step = "setrlimit";
+			goto fail;
+		}
+	}
+
+#if !defined(__linux__)
+	if ((vs->vs_flags & VSPAWN_NEWTASK) &&
+	    settaskid(getprojid(), TASK_NORMAL) == -1) {
+		step = "settaskid";
+		goto fail;
+	}
+#endif
+
+	if (vs->vs_ngroups != -1 &&
+	    VS_SETGROUPS(vs->vs_ngroups, vs->vs_groups) != 0) {
+		step = "setgroups";
+		goto fail;
+	}
+	if ((vs->vs_gid != (gid_t)-1 || vs->vs_egid != (gid_t)-1) &&
+	    VS_SETREGID(vs->vs_gid, vs->vs_egid) != 0) {
+		step = "setregid";
+		goto fail;
+	}
+	if ((vs->vs_uid != (uid_t)-1 || vs->vs_euid != (uid_t)-1) &&
+	    VS_SETREUID(vs->vs_uid, vs->vs_euid) != 0) {
+		step = "setreuid";
+		goto fail;
+	}
+
+	if (vs->vs_cwd != NULL && chdir(vs->vs_cwd) != 0) {
+		step = "chdir";
+		goto fail;
+	}
+
+	for (i = 1; i < NSIG; i++) {
+		if (sigaction(i, NULL, &sa) != 0 ||
+		    sa.sa_handler == SIG_DFL || sa.sa_handler == SIG_IGN)
+			continue;
+		sa.sa_handler = SIG_DFL;
+		sa.sa_flags = 0;
+		(void) sigaction(i, &sa, NULL);
+	}
+	(void) sigprocmask(SIG_SETMASK, mask, NULL);
+
+	(void) execve(vs->vs_path, vs->vs_argv, vs->vs_envp);
+	step = "execve";
+
+fail:
+	ve->ve_errno = errno;
+	ve->ve_step = step;
+	_exit(vs->vs_exit != NULL ? vs->vs_exit(step, ve->ve_errno) : 127);
+}
+
+/*
+ * Starts vs->vs_path as described by vs.  Returns the child's pid, and sets
+ * *ve to say whether it got as far as executing the program.  Returns -1
+ * and sets errno if there is no child.
+ */
+pid_t
+vspawn(const vspawn_t *vs, vspawn_err_t *ve)
+{
+	volatile vspawn_err_t err;
+	sigset_t all, mask;
+	pid_t pid;
+	int e, maxfd = -1;
+
+	err.ve_step = NULL;
+	err.ve_errno = 0;
+	if (vs->vs_closefrom != -1 && !vspawn_can_closefrom())
+		maxfd = vspawn_maxfd();
+
+	(void) sigfillset(&all);
+	(void) pthread_sigmask(SIG_SETMASK, &all, &mask);
+
+	if ((pid = vfork()) == 0)
+		vspawn_child(vs, maxfd, &err, &mask);
+	e = errno;
+
+	(void) pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+	if (pid == -1) {
+		errno = e;
+		return (-1);
+	}
+	ve->ve_step = err.ve_step;
+	ve->ve_errno = err.ve_errno;
+	return (pid);
+}
@@ -0,0 +1,77 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#ifndef	_VSPAWN_H
+#define	_VSPAWN_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * A description of a process to start with vspawn().  See vspawn.c.
+ */
+#define	VSPAWN_SETPGRP	0x1	/* start a new session, as setpgrp() */
+#define	VSPAWN_NEWTASK	0x2	/* start a new task, on systems with tasks */
+
+typedef struct vspawn_rlimit {
+	int		vr_resource;
+	struct rlimit	vr_limit;
+} vspawn_rlimit_t;
+
+typedef struct vspawn {
+	const char		*vs_path;
+	char *const		*vs_argv;
+	char *const		*vs_envp;
+	int			vs_flags;
+	int			vs_stdin;	/* or -1 to leave alone */
+	int			vs_stdout;	/* and stderr, or -1 */
+	int			vs_closefrom;	/* or -1 to close none */
+	const vspawn_rlimit_t	*vs_rlimits;
+	int			vs_nrlimits;
+	int			vs_ngroups;	/* or -1 to leave alone */
+	const gid_t		*vs_groups;
+	gid_t			vs_gid;		/* for setregid(), -1 to */
+	gid_t			vs_egid;	/* leave alone */
+	uid_t			vs_uid;		/* for setreuid(), -1 to */
+	uid_t			vs_euid;	/* leave alone */
+	const char		*vs_cwd;	/* or NULL to leave alone */
+	int			(*vs_exit)(const char *, int);
+} vspawn_t;
+
+/* Why the child failed, if it did. */
+typedef struct vspawn_err {
+	const char	*ve_step;	/* NULL if the exec succeeded */
+	int		ve_errno;
+} vspawn_err_t;
+
+void vspawn_init(vspawn_t *);
+pid_t vspawn(const vspawn_t *, vspawn_err_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _VSPAWN_H */
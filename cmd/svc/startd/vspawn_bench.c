@@ -0,0 +1,292 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * vspawn_bench - cost of starting a process against the size of the parent
+ *
+ * Grows the process in steps to each of the given sizes, in megabytes,
+ * touching every page, and at each size starts N processes running
+ * /bin/true two ways:
+ *
+ *	fork	as method.c does for method contexts which need library
+ *		code:  fork(), and the child sets up its session,
+ *		descriptors, resource limits and directory and executes
+ *
+ *	vspawn	as it now does for the rest:  the same steps via vspawn()
+ *
+ * Reports the resident set size and, for each way, the average time until
+ * the call returns to the parent and until the child has been waited for.
+ *
+ * First checks that a vspawn() child gets the session, environment,
+ * directory, descriptors and resource limits it was given, and that every
+ * process exits with 0.  Exits with 1 if any check failed.  Usage:
+ *
+ *	vspawn_bench [-n spawns] [megabytes ...]
+ *
+ * Defaults are 200 spawns and sizes of 0, 64, 256 and 1024 megabytes.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "vspawn.h"
+
+#define	EXIT_STEP	10	/* exit status of a child whose step failed */
+#define	TEST_FD		9	/* must not survive into the child */
+
+static char *true_argv[] = { "/bin/true", NULL };
+static char *envp[] = { "VSPAWN_BENCH=1", "PATH=/usr/bin:/bin", NULL };
+static vspawn_rlimit_t rlimits[] = {
+	{ RLIMIT_NOFILE, { 256, 256 } }
+};
+
+static int nspawns = 200;
+
+/*ARGSUSED*/
+static int
+step_exit(const char *step, int err)
+{
+	return (EXIT_STEP);
+}
+
+static long
+rss_kb(void)
+{
+	char line[128];
+	long v = -1;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/status", "r")) == NULL)
+		return (-1);
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (strncmp(line, "VmRSS:", 6) == 0) {
+			v = atol(line + 6);
+			break;
+		}
+	}
+	(void) fclose(fp);
+	return (v);
+}
+
+static void
+setup(vspawn_t *vs, int nullfd, char **argv)
+{
+	vspawn_init(vs);
+	vs->vs_path = argv[0];
+	vs->vs_argv = argv;
+	vs->vs_envp = envp;
+	vs->vs_flags = VSPAWN_SETPGRP;
+	vs->vs_stdin = nullfd;
+	vs->vs_stdout = nullfd;
+	vs->vs_closefrom = 3;
+	vs->vs_rlimits = rlimits;
+	vs->vs_nrlimits = 1;
+	vs->vs_cwd = "/";
+	vs->vs_exit = step_exit;
+}
+
+static int
+wait_for(pid_t pid)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			perror("waitpid");
+			exit(1);
+		}
+	}
+	return (WIFEXITED(status) ? WEXITSTATUS(status) : 128);
+}
+
+/* The fork() way, with the same steps as vspawn(). */
+static pid_t
+fork_spawn(const vspawn_t *vs)
+{
+	pid_t pid;
+
+	if ((pid = fork()) != 0)
+		return (pid);
+
+	(void) setsid();
+	(void) dup2(vs->vs_stdin, STDIN_FILENO);
+	(void) dup2(vs->vs_stdout, STDOUT_FILENO);
+	(void) dup2(vs->vs_stdout, STDERR_FILENO);
+	closefrom(vs->vs_closefrom);
+	(void) setrlimit(rlimits[0].vr_resource, &rlimits[0].vr_limit);
+	if (chdir(vs->vs_cwd) != 0)
+		_exit(EXIT_STEP);
+	(void) execve(vs->vs_path, vs->vs_argv, vs->vs_envp);
+	_exit(EXIT_STEP);
+	/*NOTREACHED*/
+}
+
+/*
+ * Has a vspawn() child check that it got the session, environment,
+ * directory, descriptors and resource limits it was given.
+ */
+static void
+check(int nullfd)
+{
+	static char *sh_argv[] = { "/bin/sh", "-c",
+	    "test \"$(pwd)\" = / && test \"$VSPAWN_BENCH\" = 1 && "
+	    "test \"$(ulimit -n)\" = 256 && "
+	    "! (: >&9) 2>/dev/null && "
+	    "set -- $(cat /proc/$$/stat) && test \"$6\" = $$", NULL };
+	vspawn_t vs;
+	vspawn_err_t ve;
+	pid_t pid;
+	int fd, st;
+
+	if ((fd = open("/dev/null", O_RDONLY)) == -1 ||
+	    (fd != TEST_FD && dup2(fd, TEST_FD) == -1)) {
+		perror("vspawn_bench: open");
+		exit(1);
+	}
+
+	setup(&vs, nullfd, sh_argv);
+	if ((pid = vspawn(&vs, &ve)) == -1) {
+		bench_fail("vspawn: %s", strerror(errno));
+	} else {
+		st = wait_for(pid);
+		if (ve.ve_step != NULL)
+			bench_fail("%s failed with %d", ve.ve_step,
+			    ve.ve_errno);
+		else if (st != 0)
+			bench_fail("child was not set up as given");
+	}
+
+	if (fd != TEST_FD)
+		(void) close(fd);
+	(void) close(TEST_FD);
+}
+
+static void
+measure(int nullfd, long mb)
+{
+	vspawn_t vs;
+	vspawn_err_t ve;
+	double call[2], total[2];
+	int64_t t;
+	pid_t pid;
+	int way, i, st;
+
+	setup(&vs, nullfd, true_argv);
+
+	for (way = 0; way <= 1; way++) {
+		call[way] = total[way] = 0;
+		for (i = 0; i < nspawns; i++) {
+			t = bench_now_ns();
+			if (way == 0) {
+				pid = fork_spawn(&vs);
+				ve.ve_step = NULL;
+			} else {
+				pid = vspawn(&vs, &ve);
+			}
+			call[way] += (bench_now_ns() - t) / 1e3;
+			if (pid == -1) {
+				perror("vspawn_bench: spawn");
+				exit(1);
+			}
+			st = wait_for(pid);
+			total[way] += (bench_now_ns() - t) / 1e3;
+			if (ve.ve_step != NULL || st != 0)
+				bench_fail("/bin/true failed in %s (%d)",
+				    way ? "vspawn" : "fork", st);
+		}
+	}
+
+	(void) printf("%6ld %10ld %10.1f %10.1f %10.1f %10.1f\n", mb,
+	    rss_kb() / 1024, call[0] / nspawns, call[1] / nspawns,
+	    total[0] / nspawns, total[1] / nspawns);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const long def_sizes[] = { 0, 64, 256, 1024 };
+	const long *sizes;
+	long *argsizes = NULL, grown = 0, mb;
+	char *p;
+	int c, i, nsizes, nullfd;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			nspawns = atoi(optarg);
+			break;
+		default:
+			(void) fprintf(stderr, "usage: %s [-n spawns] "
+			    "[megabytes ...]\n", argv[0]);
+			return (2);
+		}
+	}
+	if (nspawns < 1) {
+		(void) fprintf(stderr, "%s: spawns must be positive\n",
+		    argv[0]);
+		return (2);
+	}
+	if (optind < argc) {
+		nsizes = argc - optind;
+		argsizes = bench_zalloc(nsizes, sizeof (long));
+		for (i = 0; i < nsizes; i++)
+			argsizes[i] = atol(argv[optind + i]);
+		sizes = argsizes;
+	} else {
+		sizes = def_sizes;
+		nsizes = sizeof (def_sizes) / sizeof (def_sizes[0]);
+	}
+
+	if ((nullfd = open("/dev/null", O_RDWR)) == -1) {
+		perror("vspawn_bench: /dev/null");
+		return (1);
+	}
+	check(nullfd);
+
+	(void) printf("%d spawns of /bin/true at each size, times in us\n",
+	    nspawns);
+	(void) printf("%6s %10s %10s %10s %10s %10s\n", "MB", "rss MB",
+	    "fork", "vspawn", "fork+wait", "vspawn+wait");
+	for (i = 0; i < nsizes; i++) {
+		if ((mb = sizes[i]) > grown) {
+			if ((p = malloc((mb - grown) << 20)) == NULL) {
+				(void) fprintf(stderr, "out of memory\n");
+				return (1);
+			}
+			(void) memset(p, 1, (mb - grown) << 20);
+			grown = mb;
+		}
+		measure(nullfd, mb);
+	}
+
+	free(argsizes);
+
+	return (bench_exit());
+}
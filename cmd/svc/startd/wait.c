@@ -30,12 +30,14 @@
  *
  * Use event ports to poll on the set of fds representing the /proc/[pid]/psinfo
  * files.  If one of these fds returns an event, then we inform the restarter
- * that it has stopped.
+ * that it has stopped.  On Linux, which has neither, each process is watched
+ * through a pidfd in an epoll set instead (see pidwait.c), and port_fd is the
+ * epoll fd.
  *
  * The wait_info_list holds the series of processes currently being monitored
  * for exit.  The wi_fd member, which contains the file descriptor of the psinfo
- * file being polled upon ("event ported upon"), will be set to -1 if the file
- * descriptor is inactive (already closed or not yet opened).
+ * file (or pidfd) being polled upon ("event ported upon"), will be set to -1
+ * if the file descriptor is inactive (already closed or not yet opened).
  */
 
 #ifdef _FILE_OFFSET_BITS
@@ -53,13 +55,18 @@
 #include <fcntl.h>
 #include <libuutil.h>
 #include <poll.h>
-#include <port.h>
 #include <pthread.h>
-#include <procfs.h>
 #include <string.h>
-#include <stropts.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include "pidwait.h"
+#else
+#include <port.h>
+#include <procfs.h>
+#include <stropts.h>
+#endif
+
 #include "startd.h"
 
 #define	WAIT_FILES	262144		/* reasonably high maximum */
@@ -189,6 +196,90 @@ wait_ignore_by_fmri(const char *fmri)
  *   Returns 0 if registration successful, 1 if child pid did not exist, and -1
  *   if a different error occurred.
  */
+#if defined(__linux__)
+int
+wait_register(pid_t pid, const char *inst_fmri, int am_parent, int direct)
+{
+	int fd;
+	wait_info_t *wi;
+
+	assert(pid != 0);
+
+	wi = startd_alloc(sizeof (wait_info_t));
+
+	uu_list_node_init(wi, &wi->wi_link, wait_info_pool);
+
+	wi->wi_fd = -1;
+	wi->wi_pid = pid;
+	wi->wi_fmri = inst_fmri;
+	wi->wi_parent = am_parent;
+	wi->wi_ignore = 0;
+
+	MUTEX_LOCK(&wait_info_lock);
+	(void) uu_list_insert_before(wait_info_list, NULL, wi);
+	MUTEX_UNLOCK(&wait_info_lock);
+
+	/*
+	 * The pidfd of a child which has already exited, but not been
+	 * reaped, is readable at once, so only a reaped child is missing.
+	 */
+	if ((fd = pidwait_open(pid)) == -1) {
+		if (errno == ESRCH) {
+			/*
+			 * Child has already exited.
+			 */
+			wait_remove(wi, direct);
+			return (1);
+		} else {
+			log_error(LOG_WARNING,
+			    "pidfd_open %ld failed; not monitoring %s: %s\n",
+			    pid, inst_fmri, strerror(errno));
+			return (-1);
+		}
+	}
+
+	wi->wi_fd = fd;
+
+	if (pidwait_associate(port_fd, fd, wi)) {
+		log_error(LOG_WARNING,
+		    "initial epoll association of %d / %s failed: %s\n", fd,
+		    inst_fmri, strerror(errno));
+		return (-1);
+	}
+
+	log_framework(LOG_DEBUG, "monitoring PID %ld on fd %d (%s)\n", pid, fd,
+	    inst_fmri);
+
+	return (0);
+}
+
+/*ARGSUSED*/
+void *
+wait_thread(void *args)
+{
+	(void) pthread_setname_np(pthread_self(), "wait");
+
+	for (;;) {
+		void *wi;
+
+		if (pidwait_get(port_fd, &wi) != 0) {
+			if (errno == EINTR)
+				continue;
+			else {
+				log_error(LOG_WARNING,
+				    "epoll_wait() failed with %s\n",
+				    strerror(errno));
+				bad_error("epoll_wait", errno);
+			}
+		}
+
+		assert(wi != NULL);
+		wait_remove(wi, 0);
+	}
+
+	/*LINTED E_FUNC_HAS_NO_RETURN_STMT*/
+}
+#else	/* __linux__ */
 int
 wait_register(pid_t pid, const char *inst_fmri, int am_parent, int direct)
 {
@@ -319,6 +410,7 @@ err_remove:
 
 	/*LINTED E_FUNC_HAS_NO_RETURN_STMT*/
 }
+#endif	/* __linux__ */
 
 void
 wait_prefork()
@@ -355,6 +447,16 @@ wait_postfork(pid_t pid)
 	(void) setrlimit(RLIMIT_NOFILE, &init_fd_rlimit);
 }
 
+/*
+ * The descriptor limits svc.startd started with, which its children should
+ * have rather than WAIT_FILES.
+ */
+void
+wait_fd_rlimit(struct rlimit *rl)
+{
+	*rl = init_fd_rlimit;
+}
+
 void
 wait_init()
 {
@@ -367,8 +469,13 @@ wait_init()
 
 	(void) setrlimit(RLIMIT_NOFILE, &fd_new);
 
+#if defined(__linux__)
+	if ((port_fd = pidwait_create()) == -1)
+		uu_die("wait_init couldn't create epoll fd");
+#else
 	if ((port_fd = port_create()) == -1)
 		uu_die("wait_init couldn't port_create");
+#endif
 
 	wait_info_pool = uu_list_pool_create("wait_info", sizeof (wait_info_t),
 	    offsetof(wait_info_t, wi_link), NULL, UU_LIST_POOL_DEBUG);
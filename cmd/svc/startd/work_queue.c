@@ -0,0 +1,165 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * work_queue.c - work for a fixed set of threads
+ *
+ * Rather than start a thread for each piece of work, svc.startd starts a
+ * fixed number of workers which take items from a work_queue_t in the
+ * order they were put there.  The items are opaque pointers, kept in a
+ * ring which doubles when it fills, and a worker with nothing to do
+ * sleeps in work_queue_get().
+ *
+ * The queue imposes no order between items once they have been taken.
+ * Callers which need the items for one object handled in order, one at a
+ * time, queue the object rather than the items, and make sure it is not
+ * queued again until its worker is done with it.
+ *
+ * Nothing here depends on the rest of svc.startd, so it can be built and
+ * measured on its own.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "work_queue.h"
+
+#define	WQ_MIN_SIZE	64	/* power of two */
+
+struct work_queue {
+	void		**wq_items;
+	uint32_t	wq_head;	/* index of the first item */
+	uint32_t	wq_count;
+	uint32_t	wq_size;
+	uint32_t	wq_waiters;
+	pthread_mutex_t	wq_lock;
+	pthread_cond_t	wq_cv;
+};
+
+/*
+ * Returns NULL if out of memory.
+ */
+work_queue_t *
+work_queue_create(const pthread_mutexattr_t *attr)
+{
+	work_queue_t *wq;
+
+	if ((wq = calloc(1, sizeof (*wq))) == NULL)
+		return (NULL);
+	if ((wq->wq_items = calloc(WQ_MIN_SIZE, sizeof (void *))) == NULL) {
+		free(wq);
+		return (NULL);
+	}
+	wq->wq_size = WQ_MIN_SIZE;
+	(void) pthread_mutex_init(&wq->wq_lock, attr);
+	(void) pthread_cond_init(&wq->wq_cv, NULL);
+	return (wq);
+}
+
+/*
+ * The queue must be empty, and no thread may be waiting on it.
+ */
+void
+work_queue_destroy(work_queue_t *wq)
+{
+	assert(wq->wq_count == 0 && wq->wq_waiters == 0);
+	(void) pthread_cond_destroy(&wq->wq_cv);
+	(void) pthread_mutex_destroy(&wq->wq_lock);
+	free(wq->wq_items);
+	free(wq);
+}
+
+/*
+ * Appends item and wakes a worker.  Fails with ENOMEM, in which case the
+ * queue is unchanged.
+ */
+int
+work_queue_put(work_queue_t *wq, void *item)
+{
+	void **items;
+	uint32_t i;
+
+	(void) pthread_mutex_lock(&wq->wq_lock);
+
+	if (wq->wq_count == wq->wq_size) {
+		if ((items = calloc((size_t)wq->wq_size * 2,
+		    sizeof (void *))) == NULL) {
+			(void) pthread_mutex_unlock(&wq->wq_lock);
+			errno = ENOMEM;
+			return (-1);
+		}
+		for (i = 0; i < wq->wq_count; i++)
+			items[i] = wq->wq_items[(wq->wq_head + i) &
+			    (wq->wq_size - 1)];
+		free(wq->wq_items);
+		wq->wq_items = items;
+		wq->wq_head = 0;
+		wq->wq_size *= 2;
+	}
+
+	wq->wq_items[(wq->wq_head + wq->wq_count) & (wq->wq_size - 1)] = item;
+	wq->wq_count++;
+
+	if (wq->wq_waiters > 0)
+		(void) pthread_cond_signal(&wq->wq_cv);
+	(void) pthread_mutex_unlock(&wq->wq_lock);
+	return (0);
+}
+
+/*
+ * Removes and returns the first item, waiting for one if need be.
+ */
+void *
+work_queue_get(work_queue_t *wq)
+{
+	void *item;
+
+	(void) pthread_mutex_lock(&wq->wq_lock);
+
+	while (wq->wq_count == 0) {
+		wq->wq_waiters++;
+		(void) pthread_cond_wait(&wq->wq_cv, &wq->wq_lock);
+		wq->wq_waiters--;
+	}
+
+	item = wq->wq_items[wq->wq_head];
+	wq->wq_head = (wq->wq_head + 1) & (wq->wq_size - 1);
+	wq->wq_count--;
+
+	(void) pthread_mutex_unlock(&wq->wq_lock);
+	return (item);
+}
+
+uint32_t
+work_queue_count(work_queue_t *wq)
+{
+	uint32_t n;
+
+	(void) pthread_mutex_lock(&wq->wq_lock);
+	n = wq->wq_count;
+	(void) pthread_mutex_unlock(&wq->wq_lock);
+	return (n);
+}
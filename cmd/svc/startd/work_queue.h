@@ -0,0 +1,50 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_WORK_QUEUE_H
+#define	_WORK_QUEUE_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * A FIFO of work items shared by a set of worker threads.  See
+ * work_queue.c.
+ */
+typedef struct work_queue work_queue_t;
+
+work_queue_t *work_queue_create(const pthread_mutexattr_t *);
+void work_queue_destroy(work_queue_t *);
+
+int work_queue_put(work_queue_t *, void *);
+void *work_queue_get(work_queue_t *);
+uint32_t work_queue_count(work_queue_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _WORK_QUEUE_H */
@@ -4,5 +4,11 @@
 #define atomic_add_32_nv(ptr, val) __sync_add_and_fetch(ptr, val)
 #define atomic_add_32(ptr, val) ((void)atomic_add_32_nv(ptr, val))
 #define atomic_inc_uint(ptr) __sync_fetch_and_add(ptr, 1)
+#define atomic_cas_32(ptr, cmp, val) __sync_val_compare_and_swap(ptr, cmp, val)
+#define atomic_swap_ptr(ptr, val) __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST)
+
+#define membar_producer() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define membar_consumer() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define membar_exit() __atomic_thread_fence(__ATOMIC_RELEASE)
 
 #endif /* ATOMIC_H_ */
@@ -2,19 +2,30 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "compat.h"
 #include "threads.h"
 
+static hrtime_t
+clock_hrtime(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts) != 0)
+		return 0;
+	return (hrtime_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 hrtime_t gethrtime(void)
 {
-	return 0;
+	return clock_hrtime(CLOCK_MONOTONIC);
 }
 
 hrtime_t gethrvtime(void)
 {
-	return 0;
+	return clock_hrtime(CLOCK_THREAD_CPUTIME_ID);
 }
 
 size_t
@@ -378,8 +378,18 @@ struct BtCursor {
   u8 wrFlag;                /* True if writable */
   u8 eSkip;                 /* Determines if next step operation is a no-op */
   u8 iMatch;                /* compare result from last sqliteBtreeMoveto() */
+  Pgno pgnoAhead;           /* Interior page whose children were read ahead */
+  int idxAhead;             /* First child of pgnoAhead not yet read ahead */
 };
 
+/*
+** Number of child pages of an interior page that a scanning cursor asks
+** the pager to read ahead at a time.
+*/
+#ifndef BTREE_READAHEAD
+# define BTREE_READAHEAD 16
+#endif
+
 /*
 ** Legal values for BtCursor.eSkip.
 */
@@ -1491,6 +1501,40 @@ static int moveToRoot(BtCursor *pCur){
   return SQLITE_OK;
 }
 
+/*
+** The cursor is about to descend from an interior page into the child
+** to the left of entry pCur->idx as part of a forward scan.  A scan
+** visits every child of the page in order, so ask the pager to start
+** reading the next few siblings now rather than stalling on each one
+** as the cursor reaches it.  Hints are issued a window at a time and
+** refilled once the cursor is half way through the previous window.
+*/
+static void readAhead(BtCursor *pCur){
+  MemPage *pPage = pCur->pPage;
+  Btree *pBt = pCur->pBt;
+  Pgno aPgno[BTREE_READAHEAD];
+  Pgno pgno;
+  int i, n;
+
+  pgno = sqlitepager_pagenumber(pPage);
+  if( pgno==pCur->pgnoAhead
+        && pCur->idx + BTREE_READAHEAD/2 < pCur->idxAhead ){
+    return;
+  }
+  i = pCur->idx;
+  if( pgno==pCur->pgnoAhead && i<pCur->idxAhead ) i = pCur->idxAhead;
+  for(n=0; n<BTREE_READAHEAD && i<=pPage->nCell; i++){
+    if( i<pPage->nCell ){
+      aPgno[n++] = SWAB32(pBt, pPage->apCell[i]->h.leftChild);
+    }else if( pPage->u.hdr.rightChild ){
+      aPgno[n++] = SWAB32(pBt, pPage->u.hdr.rightChild);
+    }
+  }
+  pCur->pgnoAhead = pgno;
+  pCur->idxAhead = i;
+  sqlitepager_readahead(pBt->pPager, aPgno, n);
+}
+
 /*
 ** Move the cursor down to the left-most leaf entry beneath the
 ** entry to which it is currently pointing.
@@ -1500,6 +1544,7 @@ static int moveToLeftmost(BtCursor *pCur){
   int rc;
 
   while( (pgno = pCur->pPage->apCell[pCur->idx]->h.leftChild)!=0 ){
+    readAhead(pCur);
     rc = moveToChild(pCur, pgno);
     if( rc ) return rc;
   }
@@ -1993,15 +2038,16 @@ static void reparentPage(Pager *pPager, Pgno pgno, MemPage *pNewParent,int idx){
   if( pgno==0 ) return;
   assert( pPager!=0 );
   pThis = sqlitepager_lookup(pPager, pgno);
-  if( pThis && pThis->isInit ){
+  if( pThis==0 ) return;
+  if( pThis->isInit ){
     if( pThis->pParent!=pNewParent ){
       if( pThis->pParent ) sqlitepager_unref(pThis->pParent);
       pThis->pParent = pNewParent;
       if( pNewParent ) sqlitepager_ref(pNewParent);
     }
     pThis->idxParent = idx;
-    sqlitepager_unref(pThis);
   }
+  sqlitepager_unref(pThis);
 }
 
 /*
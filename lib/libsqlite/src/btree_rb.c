@@ -628,10 +628,11 @@ int sqliteRbtreeOpen(
   if( sqlite_malloc_failed ) goto open_no_mem;
   (*ppRbtree)->next_idx = 3;
   (*ppRbtree)->pOps = &sqliteRbtreeOps;
-  /* Set file type to 4; this is so that "attach ':memory:' as ...."  does not
-  ** think that the database in uninitialised and refuse to attach
+  /* Set file type to 5, the format of new databases; this is so that
+  ** "attach ':memory:' as ...."  does not think that the database in
+  ** uninitialised and refuse to attach
   */
-  (*ppRbtree)->aMetaData[2] = 4;
+  (*ppRbtree)->aMetaData[2] = 5;
   
   return SQLITE_OK;
 
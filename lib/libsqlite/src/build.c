@@ -290,6 +290,7 @@ void sqliteResetInternalSchema(sqlite *db, int iDb){
 ** internal hash tables and reload them from disk.
 */
 void sqliteRollbackInternalChanges(sqlite *db){
+  db->next_format = 0;
   if( db->flags & SQLITE_InternChanges ){
     sqliteResetInternalSchema(db, 0);
   }
@@ -300,6 +301,10 @@ void sqliteRollbackInternalChanges(sqlite *db){
 */
 void sqliteCommitInternalChanges(sqlite *db){
   db->aDb[0].schema_cookie = db->next_cookie;
+  if( db->next_format ){
+    db->file_format = db->next_format;
+    db->next_format = 0;
+  }
   db->flags &= ~SQLITE_InternChanges;
 }
 
@@ -1460,6 +1465,77 @@ void sqliteDeferForeignKey(Parse *pParse, int isDeferred){
   pFKey->isDeferred = isDeferred;
 }
 
+/*
+** Generate code that fills the index pIndex, which is open for writing
+** on cursor 1, with an entry for every row of its table pTab.  Both
+** cursors are closed when the code finishes.
+*/
+static void fillIndex(Parse *pParse, Vdbe *v, Table *pTab, Index *pIndex){
+  int lbl1, lbl2;
+  int i;
+
+  sqliteVdbeAddOp(v, OP_Integer, pTab->iDb, 0);
+  sqliteVdbeOp3(v, OP_OpenRead, 2, pTab->tnum, pTab->zName, 0);
+  lbl2 = sqliteVdbeMakeLabel(v);
+  sqliteVdbeAddOp(v, OP_Rewind, 2, lbl2);
+  lbl1 = sqliteVdbeAddOp(v, OP_Recno, 2, 0);
+  for(i=0; i<pIndex->nColumn; i++){
+    int iCol = pIndex->aiColumn[i];
+    if( pTab->iPKey==iCol ){
+      sqliteVdbeAddOp(v, OP_Dup, i, 0);
+    }else{
+      sqliteVdbeAddOp(v, OP_Column, 2, iCol);
+    }
+  }
+  sqliteVdbeAddOp(v, OP_MakeIdxKey, pIndex->nColumn, 0);
+  if( pParse->db->file_format>=4 ) sqliteAddIdxKeyType(v, pIndex);
+  sqliteVdbeOp3(v, OP_IdxPut, 1, pIndex->onError!=OE_None,
+                  "indexed columns are not unique", P3_STATIC);
+  sqliteVdbeAddOp(v, OP_Next, 2, lbl1);
+  sqliteVdbeResolveLabel(v, lbl2);
+  sqliteVdbeAddOp(v, OP_Close, 2, 0);
+  sqliteVdbeAddOp(v, OP_Close, 1, 0);
+}
+
+/*
+** Generate code that changes the file format of the main database to
+** iFormat and rebuilds every index of the main and temporary databases
+** to match.  Formats 4 and 5 differ only in how the numeric fields of
+** index keys are encoded, so nothing else needs to be rewritten.
+**
+** The keys built by this statement use the new format, but the rest of
+** the connection keeps the old one until the statement commits.  If it
+** fails, the indices and the format cookie are rolled back together.
+*/
+void sqliteRebuildIndices(Parse *pParse, int iFormat){
+  sqlite *db = pParse->db;
+  Vdbe *v;
+  HashElem *x;
+  int iDb;
+
+  assert( iFormat==4 || iFormat==5 );
+  v = sqliteGetVdbe(pParse);
+  if( v==0 ) return;
+  sqliteBeginWriteOperation(pParse, 0, 0);
+  sqliteVdbeSetKeyFormat(v, iFormat);
+  for(iDb=0; iDb<2 && iDb<db->nDb; iDb++){
+    for(x=sqliteHashFirst(&db->aDb[iDb].tblHash); x; x=sqliteHashNext(x)){
+      Table *pTab = sqliteHashData(x);
+      Index *pIndex;
+      for(pIndex=pTab->pIndex; pIndex; pIndex=pIndex->pNext){
+        sqliteVdbeAddOp(v, OP_Clear, pIndex->tnum, pIndex->iDb);
+        sqliteVdbeAddOp(v, OP_Integer, pIndex->iDb, 0);
+        sqliteVdbeOp3(v, OP_OpenWrite, 1, pIndex->tnum, pIndex->zName, 0);
+        fillIndex(pParse, v, pTab, pIndex);
+      }
+    }
+  }
+  sqliteVdbeAddOp(v, OP_Integer, iFormat, 0);
+  sqliteVdbeAddOp(v, OP_SetCookie, 0, 1);
+  sqliteChangeCookie(db, v);
+  sqliteEndWriteOperation(pParse);
+}
+
 /*
 ** Create a new index for an SQL table.  pIndex is the name of the index 
 ** and pTable is the name of the table that is to be indexed.  Both will 
@@ -1683,8 +1759,6 @@ void sqliteCreateIndex(
   else if( db->init.busy==0 ){
     int n;
     Vdbe *v;
-    int lbl1, lbl2;
-    int i;
     int addr;
 
     v = sqliteGetVdbe(pParse);
@@ -1714,27 +1788,7 @@ void sqliteCreateIndex(
     sqliteVdbeAddOp(v, OP_MakeRecord, 5, 0);
     sqliteVdbeAddOp(v, OP_PutIntKey, 0, 0);
     if( pTable ){
-      sqliteVdbeAddOp(v, OP_Integer, pTab->iDb, 0);
-      sqliteVdbeOp3(v, OP_OpenRead, 2, pTab->tnum, pTab->zName, 0);
-      lbl2 = sqliteVdbeMakeLabel(v);
-      sqliteVdbeAddOp(v, OP_Rewind, 2, lbl2);
-      lbl1 = sqliteVdbeAddOp(v, OP_Recno, 2, 0);
-      for(i=0; i<pIndex->nColumn; i++){
-        int iCol = pIndex->aiColumn[i];
-        if( pTab->iPKey==iCol ){
-          sqliteVdbeAddOp(v, OP_Dup, i, 0);
-        }else{
-          sqliteVdbeAddOp(v, OP_Column, 2, iCol);
-        }
-      }
-      sqliteVdbeAddOp(v, OP_MakeIdxKey, pIndex->nColumn, 0);
-      if( db->file_format>=4 ) sqliteAddIdxKeyType(v, pIndex);
-      sqliteVdbeOp3(v, OP_IdxPut, 1, pIndex->onError!=OE_None,
-                      "indexed columns are not unique", P3_STATIC);
-      sqliteVdbeAddOp(v, OP_Next, 2, lbl1);
-      sqliteVdbeResolveLabel(v, lbl2);
-      sqliteVdbeAddOp(v, OP_Close, 2, 0);
-      sqliteVdbeAddOp(v, OP_Close, 1, 0);
+      fillIndex(pParse, v, pTab, pIndex);
     }
     if( pTable!=0 ){
       if( !isTemp ){
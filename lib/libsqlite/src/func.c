@@ -231,7 +231,7 @@ utf8textprep(const char *s, int flag)
 	}
 
 	if (rc < 0) {
-		free(res);
+		sqliteFree(res);
 		res = NULL;
 		return (NULL);
 	}
@@ -263,7 +263,7 @@ lower_utf8Func(sqlite_func *context, int argc, const char **argv)
 
 out:
 	(void) sqlite_set_result_string(context, lower, -1);
-	free(lower);
+	sqliteFree(lower);
 }
 static
 void
@@ -283,7 +283,7 @@ upper_utf8Func(sqlite_func *context, int argc, const char **argv)
 
 out:
 	(void) sqlite_set_result_string(context, upper, -1);
-	free(upper);
+	sqliteFree(upper);
 }
 #endif
 
@@ -293,11 +293,14 @@ static int sqliteInitOne(sqlite *db, int iDb, char **pzErrMsg){
     **  file_format==3    Version 2.6.0. Fix empty-string index bug.
     **  file_format==4    Version 2.7.0. Add support for separate numeric and
     **                    text datatypes.
+    **  file_format==5    Numeric fields of index keys are stored as fixed
+    **                    width binary instead of sortable text.  See
+    **                    PRAGMA key_format.
     */
     if( db->file_format==0 ){
       /* This happens if the database was initially empty */
-      db->file_format = 4;
-    }else if( db->file_format>4 ){
+      db->file_format = 5;
+    }else if( db->file_format>5 ){
       sqliteBtreeCloseCursor(curMain);
       sqliteSetString(pzErrMsg, "unsupported file format", (char*)0);
       return SQLITE_ERROR;
@@ -311,6 +314,7 @@ static int sqliteInitOne(sqlite *db, int iDb, char **pzErrMsg){
       sqliteSetString(pzErrMsg, "incompatible file format in auxiliary "
          "database: ", db->aDb[iDb].zName, (char*)0);
     }
+    sqliteBtreeCloseCursor(curMain);
     sqliteBtreeClose(db->aDb[iDb].pBt);
     db->aDb[iDb].pBt = 0;
     return SQLITE_FORMAT;
@@ -609,6 +613,7 @@ void sqliteRollbackAll(sqlite *db){
       db->aDb[i].inTrans = 0;
     }
   }
+  db->next_format = 0;
   sqliteResetInternalSchema(db, 0);
   /* sqliteRollbackInternalChanges(db); */
 }
@@ -740,7 +745,7 @@ int sqlite_compile(
       char *tmpSql = sqliteStrNDup(zSql, sParse.zTail - zSql);
       if( tmpSql ){
         db->xTrace(db->pTraceArg, tmpSql);
-        free(tmpSql);
+        sqliteFree(tmpSql);
       }else{
         /* If a memory error occurred during the copy,
         ** trace entire SQL string and fall through to the
@@ -965,11 +970,19 @@ void sqlite_interrupt(sqlite *db){
 ** SQLite is a DLL.  For some reason, it does not work to call free()
 ** directly.
 **
-** Note that we need to call free() not sqliteFree() here, since every
-** string that is exported from SQLite should have already passed through
-** sqliteStrRealloc().
+** Every string that is exported from SQLite should have already passed
+** through sqliteStrRealloc(), so calling free() directly would do.  But
+** SQLite also uses this routine internally on error messages that may
+** still be in a lookaside slot, and sqliteFree() copes with both.  In a
+** MEMORY_DEBUG build sqliteFree() only accepts its own allocations.
 */
-void sqlite_freemem(void *p){ free(p); }
+void sqlite_freemem(void *p){
+#ifdef MEMORY_DEBUG
+  free(p);
+#else
+  sqliteFree(p);
+#endif
+}
 
 /*
 ** Windows systems need functions to call to return the sqlite_version
@@ -253,6 +253,7 @@ struct openCnt {
   int nLock;            /* Number of outstanding locks */
   int nPending;         /* Number of pending close() operations */
   int *aPending;        /* Malloced space holding fd's awaiting a close() */
+  unsigned int nChange; /* Number of writes through any fd of this inode */
 };
 
 /* 
@@ -343,6 +344,7 @@ int findLockInfo(
     pOpen->nLock = 0;
     pOpen->nPending = 0;
     pOpen->aPending = 0;
+    pOpen->nChange = 0;
     pOld = sqliteHashInsert(&openHash, &pOpen->key, sizeof(key2), pOpen);
     if( pOld!=0 ){
       assert( pOld==pOpen );
@@ -1024,6 +1026,7 @@ int sqliteOsWrite(OsFile *id, const void *pBuf, int amt){
 #if OS_UNIX
   int wrote = 0;
   SimulateIOError(SQLITE_IOERR);
+  id->pOpen->nChange++;
   TIMER_START;
   while( amt>0 && (wrote = write(id->fd, pBuf, amt))>0 ){
     amt -= wrote;
@@ -1119,6 +1122,18 @@ int sqliteOsSeek(OsFile *id, off_t offset){
 #endif
 }
 
+/*
+** Advise the operating system that amt bytes of the file starting at
+** offset will be read soon, so that it can start fetching them in the
+** background.  This is only a hint; failures are ignored.
+*/
+void sqliteOsReadAhead(OsFile *id, off_t offset, int amt){
+#if OS_UNIX && defined(POSIX_FADV_WILLNEED)
+  TRACE4("AHEAD   %-3d %7d %d\n", id->fd, (int)(offset/1024 + 1), amt);
+  posix_fadvise(id->fd, offset, amt, POSIX_FADV_WILLNEED);
+#endif
+}
+
 /*
 ** Make sure all writes to a particular file are committed to disk.
 **
@@ -1175,6 +1190,7 @@ int sqliteOsSync(OsFile *id){
 int sqliteOsTruncate(OsFile *id, off_t nByte){
   SimulateIOError(SQLITE_IOERR);
 #if OS_UNIX
+  id->pOpen->nChange++;
   return ftruncate(id->fd, nByte)==0 ? SQLITE_OK : SQLITE_IOERR;
 #endif
 #if OS_WIN
@@ -1198,6 +1214,35 @@ int sqliteOsTruncate(OsFile *id, off_t nByte){
 #endif
 }
 
+/*
+** Fill *pId with the identity of a file and a stamp of its current size
+** and modification times.  Two OsFiles open on the same file get the
+** same key.  The stamp also counts the writes made to the file through
+** any OsFile in this process, so that a change made by this process is
+** seen even when it leaves the size and times of the file as they were.
+** SQLITE_ERROR is returned on systems that cannot tell.
+*/
+int sqliteOsFileId(OsFile *id, OsFileId *pId){
+#if OS_UNIX
+  struct stat buf;
+  if( fstat(id->fd, &buf)!=0 ){
+    return SQLITE_IOERR;
+  }
+  memset(pId, 0, sizeof(*pId));
+  pId->aKey[0] = buf.st_dev;
+  pId->aKey[1] = buf.st_ino;
+  pId->aStamp[0] = buf.st_size;
+  pId->aStamp[1] = buf.st_mtim.tv_sec;
+  pId->aStamp[2] = buf.st_mtim.tv_nsec;
+  pId->aStamp[3] = buf.st_ctim.tv_sec;
+  pId->aStamp[4] = buf.st_ctim.tv_nsec;
+  pId->aStamp[5] = id->pOpen->nChange;
+  return SQLITE_OK;
+#else
+  return SQLITE_ERROR;
+#endif
+}
+
 /*
 ** Determine the current size of a file in bytes
 */
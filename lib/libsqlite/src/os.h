@@ -164,6 +164,16 @@
 # define SQLITE_MIN_SLEEP_MS 17
 #endif
 
+/*
+** The identity of an open file and a stamp that changes whenever the
+** file is modified, as filled in by sqliteOsFileId().
+*/
+typedef struct OsFileId OsFileId;
+struct OsFileId {
+  off_t aKey[2];           /* Device and inode number */
+  off_t aStamp[6];         /* Size, file times and count of local writes */
+};
+
 int sqliteOsDelete(const char*);
 int sqliteOsFileExists(const char*);
 int sqliteOsFileRename(const char*, const char*);
@@ -176,9 +186,11 @@ int sqliteOsClose(OsFile*);
 int sqliteOsRead(OsFile*, void*, int amt);
 int sqliteOsWrite(OsFile*, const void*, int amt);
 int sqliteOsSeek(OsFile*, off_t offset);
+void sqliteOsReadAhead(OsFile*, off_t offset, int amt);
 int sqliteOsSync(OsFile*);
 int sqliteOsTruncate(OsFile*, off_t size);
 int sqliteOsFileSize(OsFile*, off_t *pSize);
+int sqliteOsFileId(OsFile*, OsFileId*);
 int sqliteOsReadLock(OsFile*);
 int sqliteOsWriteLock(OsFile*);
 int sqliteOsUnlock(OsFile*);
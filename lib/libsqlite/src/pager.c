@@ -153,6 +153,58 @@ struct PgHdr {
 */
 #define pager_hash(PN)  ((PN)&(N_PG_HASH-1))
 
+/*
+** Pagers that have the shared cache turned on keep a copy of each page
+** they read from the database file in a cache that is shared by every
+** connection in the process that has the same file open.  A connection
+** that misses in its own cache copies the page out of the shared cache
+** instead of reading the file, so the upper levels of the btrees stay
+** warm across transactions and across connections.
+**
+** There is one PgShared for each database file (device and inode) with
+** up to SQLITE_SHARED_CACHE_SIZE page images kept in LRU order.  Images
+** are exactly as they appear in the database file, before any codec is
+** applied.  Each image records PgShared.iChange as it was when the page
+** was read, and is only used while the two still match.  A pager that
+** takes a read lock compares the stamp of the file from sqliteOsFileId()
+** with the one last seen by the shared cache.  The stamp includes a count
+** of the writes made by this process, so any commit, checkpoint or
+** rollback that has touched the file since bumps iChange and so makes
+** every image stale.  Writes by other processes are caught through the
+** size and modification times of the file.
+**
+** A pager stops using the shared cache as soon as it writes the file
+** itself, until its next read lock.
+*/
+#ifndef SQLITE_SHARED_CACHE_SIZE
+# define SQLITE_SHARED_CACHE_SIZE 2000
+#endif
+
+typedef struct PgShared PgShared;
+typedef struct PgSharedPage PgSharedPage;
+struct PgSharedPage {
+  Pgno pgno;                     /* The page number for this page */
+  u32 iChange;                   /* PgShared.iChange when the page was read */
+  PgSharedPage *pNextHash;       /* Hash collision chain for pgno */
+  PgSharedPage *pNext, *pPrev;   /* LRU list, most recently used first */
+  /* SQLITE_PAGE_SIZE bytes of page data follow this header */
+};
+struct PgShared {
+  OsFileId id;                   /* Identity and last stamp of the file */
+  int nRef;                      /* Number of pagers using this cache */
+  u32 iChange;                   /* Bumped when the file is seen to change */
+  int nPage;                     /* Number of page images held */
+  PgSharedPage *pFirst, *pLast;  /* All page images in LRU order */
+  PgSharedPage **aHash;          /* Hash table to find images by pgno */
+  PgShared *pNext;               /* Next in the list of all shared caches */
+};
+
+/*
+** All shared caches in the process.  Access to this list and to the
+** caches on it must be protected by sqliteOsEnterMutex().
+*/
+static PgShared *pAllShared = 0;
+
 /*
 ** A open page cache is an instance of the following structure.
 */
@@ -175,6 +227,7 @@ struct Pager {
   int nRef;                   /* Number of in-memory pages with PgHdr.nRef>0 */
   int mxPage;                 /* Maximum number of pages to hold in cache */
   int nHit, nMiss, nOvfl;     /* Cache hits, missing, and LRU overflows */
+  int nRead, nWrite, nSync;   /* Pages read and written, and syncs done */
   void (*xCodec)(void*,void*,Pgno,int); /* Routine for en/decoding data */
   void *pCodecArg;            /* First argument to xCodec() */
   u8 journalOpen;             /* True if journal file descriptors is valid */
@@ -199,6 +252,26 @@ struct Pager {
   PgHdr *pAll;                /* List of all pages */
   PgHdr *pCkpt;               /* List of pages in the checkpoint journal */
   PgHdr *aHash[N_PG_HASH];    /* Hash table to map page number of PgHdr */
+  char *zWal;                 /* Name of the write-ahead log file */
+  OsFile wfd;                 /* File descriptor for the write-ahead log */
+  u8 walMode;                 /* Write through the log instead of a journal */
+  u8 walOpen;                 /* True if wfd is valid */
+  u8 walLocked;               /* True if we hold the log writer lock */
+  u8 walNoCommitSync;         /* Do not sync the log at commit if true */
+  u32 walSalt;                /* Salt of the log generation indexed below */
+  int walMax;                 /* Last frame of the log in aWalPgno[] */
+  int walCommit;              /* Last commit frame visible to this pager */
+  int walDbSize;              /* Database size in pages as of walCommit */
+  u32 walCksum;               /* Checksum of frame walMax */
+  u32 walCommitCksum;         /* Checksum of frame walCommit */
+  int walAutoCkpt;            /* Checkpoint when the log has this many frames */
+  int nWalFrame;              /* Number of slots in aWalPgno[] and aWalPrev[] */
+  Pgno *aWalPgno;             /* Page number held by each frame */
+  int *aWalPrev;              /* Earlier frame holding the same page, or 0 */
+  int nWalLatest;             /* Number of slots in aWalLatest[] */
+  int *aWalLatest;            /* Most recent frame for each page, or 0 */
+  PgShared *pShared;          /* Process-wide cache of this file, or NULL */
+  u8 sharedOk;                /* True if pShared is current for this lock */
 };
 
 /*
@@ -291,6 +364,66 @@ int journal_format = 3;
 #define JOURNAL_PG_SZ(X) \
    (SQLITE_PAGE_SIZE + sizeof(Pgno) + ((X)>=3)*sizeof(u32))
 
+/*
+** When the pager is in write-ahead log mode, changes are never written
+** into the database file by a transaction.  Instead, each modified page
+** is appended to a log file whose name is the database name with "-wal"
+** appended.  Readers look for the most recent committed copy of a page
+** in the log before going to the database file, so a single fsync() of
+** the log is all that is needed to commit, and readers only ever need a
+** shared lock on the database file.  Writers hold a shared lock on the
+** database file and an exclusive lock on the log, so there is still only
+** one writer at a time.
+**
+** From time to time the log is "checkpointed": the most recent copy of
+** every page is written back into the database file and the log is reset.
+** A checkpoint needs an exclusive lock on the database file and so only
+** happens when there are no other readers.
+**
+** The log begins with a header of WAL_HDR_SZ bytes:
+**
+**     8 bytes   aWalMagic[]
+**     4 bytes   A salt that changes each time the log is reset
+**     4 bytes   Reserved.  Always 0.
+**
+** The header is followed by zero or more frames.  Each frame is a
+** WAL_FRAME_HDR_SZ byte header followed by SQLITE_PAGE_SIZE bytes of page
+** data.  The frame header is four big-endian 32-bit integers:
+**
+**     The page number
+**     For a commit frame, the size of the database in pages.  Otherwise 0.
+**     The salt from the log header
+**     A checksum of the first two words of the header and the page data
+**
+** The checksum of each frame is seeded with the checksum of the frame
+** before it, and that of the first frame with the salt, so a frame only
+** checks out if every frame ahead of it is the one it was written after.
+** A frame whose salt or checksum does not match is garbage left behind by
+** an earlier generation of the log, by a rolled back transaction, or by a
+** crash, and ends the log.  Frames that follow the last valid commit frame
+** belong to a transaction that was never committed and are ignored.
+**
+** A rolled back transaction may leave frames in the file, including a
+** commit frame if the commit failed after it was written.  The first of
+** them is overwritten with zeros by the rollback so that none of them can
+** be mistaken for part of the log later on.
+*/
+static const unsigned char aWalMagic[] = {
+  0xd9, 0xd5, 0x05, 0xf9, 0x20, 0xa1, 0x63, 0xd7,
+};
+#define WAL_HDR_SZ        (sizeof(aWalMagic) + 2*sizeof(u32))
+#define WAL_FRAME_HDR_SZ  (4*sizeof(u32))
+#define WAL_FRAME_SZ      (WAL_FRAME_HDR_SZ + SQLITE_PAGE_SIZE)
+#define WAL_FRAME_OFFSET(F) \
+   (WAL_HDR_SZ + (off_t)((F)-1)*WAL_FRAME_SZ)
+
+/*
+** Checkpoint automatically once the log holds this many frames.
+*/
+#ifndef WAL_DEFAULT_AUTOCHECKPOINT
+# define WAL_DEFAULT_AUTOCHECKPOINT 1000
+#endif
+
 /*
 ** Enable reference count tracking here:
 */
@@ -374,6 +507,14 @@ static void store32bits(u32 val, PgHdr *p, int offset){
 }
 
 
+/*
+** Sync a file belonging to pPager, counting the sync in Pager.nSync.
+*/
+static int pager_sync(Pager *pPager, OsFile *id){
+  pPager->nSync++;
+  return sqliteOsSync(id);
+}
+
 /*
 ** Convert the bits in the pPager->errMask into an approprate
 ** return code.
@@ -464,15 +605,174 @@ static void pager_reset(Pager *pPager){
   pPager->state = SQLITE_UNLOCK;
   pPager->dbSize = -1;
   pPager->nRef = 0;
+  pPager->sharedOk = 0;
   assert( pPager->journalOpen==0 );
 }
 
+/*
+** Find the image of page pgno in a shared cache.  Return NULL if there
+** is none.
+*/
+static PgSharedPage *pager_shared_find(PgShared *p, Pgno pgno){
+  PgSharedPage *pSp;
+  if( p->aHash==0 ) return 0;
+  pSp = p->aHash[pager_hash(pgno)];
+  while( pSp && pSp->pgno!=pgno ){
+    pSp = pSp->pNextHash;
+  }
+  return pSp;
+}
+
+/*
+** Move a page image to the most recently used end of the LRU list.
+** The image must not be on the list already if isNew is true.
+*/
+static void pager_shared_touch(PgShared *p, PgSharedPage *pSp, int isNew){
+  if( !isNew ){
+    if( p->pFirst==pSp ) return;
+    pSp->pPrev->pNext = pSp->pNext;
+    if( pSp->pNext ){
+      pSp->pNext->pPrev = pSp->pPrev;
+    }else{
+      p->pLast = pSp->pPrev;
+    }
+  }
+  pSp->pPrev = 0;
+  pSp->pNext = p->pFirst;
+  if( p->pFirst ){
+    p->pFirst->pPrev = pSp;
+  }else{
+    p->pLast = pSp;
+  }
+  p->pFirst = pSp;
+}
+
+/*
+** Copy the image of page pgno out of the shared cache into pData.
+** Return 1 on success or 0 if the shared cache holds no current image
+** of the page.
+*/
+static int pager_shared_read(Pager *pPager, Pgno pgno, void *pData){
+  PgShared *p = pPager->pShared;
+  PgSharedPage *pSp;
+  int found = 0;
+
+  if( p==0 || !pPager->sharedOk ) return 0;
+  sqliteOsEnterMutex();
+  pSp = pager_shared_find(p, pgno);
+  if( pSp && pSp->iChange==p->iChange ){
+    memcpy(pData, &pSp[1], SQLITE_PAGE_SIZE);
+    pager_shared_touch(p, pSp, 0);
+    found = 1;
+  }
+  sqliteOsLeaveMutex();
+  return found;
+}
+
+/*
+** Store the image of page pgno, just read from the database file, in
+** the shared cache.  The least recently used image is recycled once the
+** cache is full.  Nothing happens if memory runs out.
+*/
+static void pager_shared_write(Pager *pPager, Pgno pgno, const void *pData){
+  PgShared *p = pPager->pShared;
+  PgSharedPage *pSp, **ppSp;
+
+  if( p==0 || !pPager->sharedOk ) return;
+  sqliteOsEnterMutex();
+  if( p->aHash==0 ){
+    p->aHash = sqliteMalloc( N_PG_HASH*sizeof(p->aHash[0]) );
+    if( p->aHash==0 ) goto shared_write_out;
+  }
+  pSp = pager_shared_find(p, pgno);
+  if( pSp ){
+    pager_shared_touch(p, pSp, 0);
+  }else{
+    if( p->nPage<SQLITE_SHARED_CACHE_SIZE ){
+      pSp = sqliteMallocRaw( sizeof(*pSp) + SQLITE_PAGE_SIZE );
+      if( pSp==0 ) goto shared_write_out;
+      p->nPage++;
+      pager_shared_touch(p, pSp, 1);
+    }else{
+      pSp = p->pLast;
+      ppSp = &p->aHash[pager_hash(pSp->pgno)];
+      while( *ppSp!=pSp ){
+        ppSp = &(*ppSp)->pNextHash;
+      }
+      *ppSp = pSp->pNextHash;
+      pager_shared_touch(p, pSp, 0);
+    }
+    pSp->pgno = pgno;
+    pSp->pNextHash = p->aHash[pager_hash(pgno)];
+    p->aHash[pager_hash(pgno)] = pSp;
+  }
+  pSp->iChange = p->iChange;
+  memcpy(&pSp[1], pData, SQLITE_PAGE_SIZE);
+
+shared_write_out:
+  sqliteOsLeaveMutex();
+}
+
+/*
+** Called after a read lock has been taken on the database file.  If the
+** file has changed since the shared cache last looked at it, every page
+** image in the shared cache is made stale.  The shared cache is used
+** under this lock only if the stamp of the file could be read.
+*/
+static void pager_shared_check(Pager *pPager){
+  PgShared *p = pPager->pShared;
+  OsFileId id;
+
+  pPager->sharedOk = 0;
+  if( p==0 || sqliteOsFileId(&pPager->fd, &id)!=SQLITE_OK ) return;
+  sqliteOsEnterMutex();
+  if( memcmp(id.aStamp, p->id.aStamp, sizeof(id.aStamp))!=0 ){
+    memcpy(p->id.aStamp, id.aStamp, sizeof(id.aStamp));
+    p->iChange++;
+  }
+  sqliteOsLeaveMutex();
+  pPager->sharedOk = 1;
+}
+
+/*
+** Drop the reference of pPager to its shared cache.  The cache is freed
+** when the last pager using it lets go.
+*/
+static void pager_shared_release(Pager *pPager){
+  PgShared *p = pPager->pShared, **pp;
+  PgSharedPage *pSp, *pNext;
+
+  if( p==0 ) return;
+  pPager->pShared = 0;
+  pPager->sharedOk = 0;
+  sqliteOsEnterMutex();
+  p->nRef--;
+  if( p->nRef==0 ){
+    for(pp=&pAllShared; *pp!=p; pp=&(*pp)->pNext){}
+    *pp = p->pNext;
+  }else{
+    p = 0;
+  }
+  sqliteOsLeaveMutex();
+  if( p ){
+    for(pSp=p->pFirst; pSp; pSp=pNext){
+      pNext = pSp->pNext;
+      sqliteFree(pSp);
+    }
+    sqliteFree(p->aHash);
+    sqliteFree(p);
+  }
+}
+
 /*
 ** When this routine is called, the pager has the journal file open and
 ** a write lock on the database.  This routine releases the database
 ** write lock and acquires a read lock in its place.  The journal file
 ** is deleted and closed.
 **
+** In write-ahead log mode the database was only ever read-locked, so all
+** that is needed is to release the lock on the log.
+**
 ** TODO: Consider keeping the journal file open for temporary databases.
 ** This might give a performance improvement on windows where opening
 ** a file is an expensive operation.
@@ -497,6 +797,13 @@ static int pager_unwritelock(Pager *pPager){
       pPg->dirty = 0;
       pPg->needSync = 0;
     }
+  }else if( pPager->walLocked ){
+    for(pPg=pPager->pAll; pPg; pPg=pPg->pNextAll){
+      pPg->inJournal = 0;
+      pPg->dirty = 0;
+    }
+    sqliteOsUnlock(&pPager->wfd);
+    pPager->walLocked = 0;
   }else{
     assert( pPager->dirtyFile==0 || pPager->useJournal==0 );
   }
@@ -567,8 +874,10 @@ static int pager_playback_one_page(Pager *pPager, OsFile *jfd, int format){
   */
   pPg = pager_lookup(pPager, pgRec.pgno);
   TRACE2("PLAYBACK %d\n", pgRec.pgno);
+  pPager->sharedOk = 0;
   sqliteOsSeek(&pPager->fd, (pgRec.pgno-1)*(off_t)SQLITE_PAGE_SIZE);
   rc = sqliteOsWrite(&pPager->fd, pgRec.aData, SQLITE_PAGE_SIZE);
+  if( rc==SQLITE_OK ) pPager->nWrite++;
   if( pPg ){
     /* No page should ever be rolled back that is in use, except for page
     ** 1 which is held in use in order to keep the lock on the database
@@ -711,6 +1020,7 @@ static int pager_playback(Pager *pPager, int useJournalSize){
     goto end_playback;
   }
   assert( pPager->origDbSize==0 || pPager->origDbSize==mxPg );
+  pPager->sharedOk = 0;
   rc = sqliteOsTruncate(&pPager->fd, SQLITE_PAGE_SIZE*(off_t)mxPg);
   if( rc!=SQLITE_OK ){
     goto end_playback;
@@ -767,6 +1077,581 @@ end_playback:
   return rc;
 }
 
+/*
+** Read or write a big-endian 32-bit integer in a buffer.  Used for the
+** write-ahead log, which is always big-endian.
+*/
+static u32 get32bits(const unsigned char *a){
+  return (a[0]<<24) | (a[1]<<16) | (a[2]<<8) | a[3];
+}
+static void put32bits(unsigned char *a, u32 val){
+  a[0] = val>>24;
+  a[1] = val>>16;
+  a[2] = val>>8;
+  a[3] = val;
+}
+
+/*
+** Compute the checksum for a log frame.  The checksum covers the page
+** number and commit size from the frame header and all of the page data.
+** It is seeded with the checksum of the previous frame, or with the log
+** salt for the first frame, so that a frame left over from an earlier
+** generation of the log or from a rolled back transaction does not check
+** out.
+*/
+static u32 pager_wal_cksum(u32 seed, const unsigned char *aHdr,
+                           const unsigned char *aData){
+  u32 s1 = seed;
+  u32 s2 = ~seed;
+  int i;
+  s1 += get32bits(&aHdr[0]);  s2 += s1;
+  s1 += get32bits(&aHdr[4]);  s2 += s1;
+  for(i=0; i<SQLITE_PAGE_SIZE; i+=4){
+    s1 += get32bits(&aData[i]);
+    s2 += s1;
+  }
+  return s1 ^ s2;
+}
+
+/*
+** Forget everything we know about the content of the log.
+*/
+static void pager_wal_reset_index(Pager *pPager){
+  if( pPager->aWalLatest ){
+    memset(pPager->aWalLatest, 0, pPager->nWalLatest*sizeof(int));
+  }
+  pPager->walMax = 0;
+  pPager->walCommit = 0;
+  pPager->walDbSize = 0;
+}
+
+/*
+** Record that frame iFrame of the log holds a copy of page pgno.  Frames
+** must be added in order.
+*/
+static int pager_wal_index_frame(Pager *pPager, int iFrame, Pgno pgno){
+  assert( iFrame==pPager->walMax+1 );
+  if( iFrame>=pPager->nWalFrame ){
+    int n = pPager->nWalFrame*2 + 64;
+    Pgno *aPgno;
+    int *aPrev;
+    aPgno = sqliteRealloc(pPager->aWalPgno, n*sizeof(Pgno));
+    if( aPgno==0 ) return SQLITE_NOMEM;
+    pPager->aWalPgno = aPgno;
+    aPrev = sqliteRealloc(pPager->aWalPrev, n*sizeof(int));
+    if( aPrev==0 ) return SQLITE_NOMEM;
+    pPager->aWalPrev = aPrev;
+    pPager->nWalFrame = n;
+  }
+  if( pgno>=(Pgno)pPager->nWalLatest ){
+    int n = pgno*2 + 64;
+    int *aLatest;
+    aLatest = sqliteRealloc(pPager->aWalLatest, n*sizeof(int));
+    if( aLatest==0 ) return SQLITE_NOMEM;
+    memset(&aLatest[pPager->nWalLatest], 0,
+           (n-pPager->nWalLatest)*sizeof(int));
+    pPager->aWalLatest = aLatest;
+    pPager->nWalLatest = n;
+  }
+  pPager->aWalPgno[iFrame] = pgno;
+  pPager->aWalPrev[iFrame] = pPager->aWalLatest[pgno];
+  pPager->aWalLatest[pgno] = iFrame;
+  pPager->walMax = iFrame;
+  return SQLITE_OK;
+}
+
+/*
+** Drop all frames after the last commit frame from the index.
+*/
+static void pager_wal_truncate_index(Pager *pPager){
+  while( pPager->walMax>pPager->walCommit ){
+    int i = pPager->walMax--;
+    pPager->aWalLatest[pPager->aWalPgno[i]] = pPager->aWalPrev[i];
+  }
+  pPager->walCksum = pPager->walCommitCksum;
+}
+
+/*
+** Return the most recent frame of the log that holds page pgno, or 0
+** if the page is not in the log.
+*/
+static int pager_wal_find(Pager *pPager, Pgno pgno){
+  if( !pPager->walOpen || pgno>=(Pgno)pPager->nWalLatest ) return 0;
+  return pPager->aWalLatest[pgno];
+}
+
+/*
+** Read the page data out of frame iFrame of the log.
+*/
+static int pager_wal_read_frame(Pager *pPager, int iFrame, void *pData){
+  int rc;
+  rc = sqliteOsSeek(&pPager->wfd, WAL_FRAME_OFFSET(iFrame)+WAL_FRAME_HDR_SZ);
+  if( rc==SQLITE_OK ){
+    rc = sqliteOsRead(&pPager->wfd, pData, SQLITE_PAGE_SIZE);
+  }
+  return rc;
+}
+
+/*
+** Open the log file if it is not open already.  If the log does not
+** exist, it is only created if the create flag is set.  If the log
+** cannot be opened, the database is accessed through the rollback
+** journal as usual.
+*/
+static int pager_wal_open(Pager *pPager, int create){
+  int readOnly;
+  int rc;
+  if( pPager->walOpen ) return SQLITE_OK;
+  if( !create && !sqliteOsFileExists(pPager->zWal) ) return SQLITE_OK;
+  rc = sqliteOsOpenReadWrite(pPager->zWal, &pPager->wfd, &readOnly);
+  if( rc!=SQLITE_OK ){
+    return create ? SQLITE_OK : rc;
+  }
+  if( create ){
+    sqliteOsOpenDirectory(pPager->zDirectory, &pPager->wfd);
+  }
+  if( readOnly ){
+    /* Changes could not be logged, so they cannot be made at all. */
+    pPager->readOnly = 1;
+  }
+  pPager->walOpen = 1;
+  pPager->walLocked = 0;
+  pPager->walSalt = 0;
+  pager_wal_reset_index(pPager);
+  return SQLITE_OK;
+}
+
+/*
+** Close the log file and free the index.
+*/
+static void pager_wal_close(Pager *pPager){
+  if( pPager->walOpen ){
+    sqliteOsClose(&pPager->wfd);
+    pPager->walOpen = 0;
+  }
+  sqliteFree(pPager->aWalPgno);
+  sqliteFree(pPager->aWalPrev);
+  sqliteFree(pPager->aWalLatest);
+  pPager->aWalPgno = 0;
+  pPager->aWalPrev = 0;
+  pPager->aWalLatest = 0;
+  pPager->nWalFrame = 0;
+  pPager->nWalLatest = 0;
+}
+
+/*
+** Bring the index up to date with the log.  Frames appended by other
+** connections since the last call are validated and added, up to the
+** last complete transaction.  If the log has been reset since the last
+** call, the index is rebuilt from scratch.
+**
+** *pChanged is set if a transaction committed by some other connection
+** has become visible.  If apply is false the index is left alone and
+** only *pChanged is computed.  That is how a connection that still holds
+** pages from its snapshot checks whether the snapshot is out of date.
+** The caller must hold at least a read lock on the database file.
+*/
+static int pager_wal_refresh(Pager *pPager, int apply, int *pChanged){
+  unsigned char aHdr[WAL_HDR_SZ];
+  unsigned char aFrame[WAL_FRAME_SZ];
+  off_t szW;
+  u32 salt;
+  u32 prevCksum;
+  int iFrame;
+  int rc;
+
+  *pChanged = 0;
+  if( !pPager->walOpen ) return SQLITE_OK;
+  rc = sqliteOsFileSize(&pPager->wfd, &szW);
+  if( rc!=SQLITE_OK ) return rc;
+  if( szW>=WAL_HDR_SZ ){
+    rc = sqliteOsSeek(&pPager->wfd, 0);
+    if( rc==SQLITE_OK ) rc = sqliteOsRead(&pPager->wfd, aHdr, sizeof(aHdr));
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  if( szW<WAL_HDR_SZ || memcmp(aHdr, aWalMagic, sizeof(aWalMagic))!=0 ){
+    /* The log is empty, so the database file is all there is. */
+    *pChanged = pPager->walCommit>0;
+    if( apply ){
+      pPager->walSalt = 0;
+      pager_wal_reset_index(pPager);
+    }
+    return SQLITE_OK;
+  }
+  salt = get32bits(&aHdr[sizeof(aWalMagic)]);
+  if( salt!=pPager->walSalt ){
+    *pChanged = pPager->walCommit>0;
+    if( apply ){
+      pPager->walSalt = salt;
+      pager_wal_reset_index(pPager);
+    }else if( *pChanged ){
+      return SQLITE_OK;
+    }
+  }
+  assert( pPager->walMax==pPager->walCommit );
+  prevCksum = pPager->walCommitCksum;
+  for(iFrame=pPager->walMax+1;
+      WAL_FRAME_OFFSET(iFrame)+WAL_FRAME_SZ<=szW;
+      iFrame++){
+    Pgno pgno;
+    u32 nTruncate;
+    u32 cksum;
+    rc = sqliteOsSeek(&pPager->wfd, WAL_FRAME_OFFSET(iFrame));
+    if( rc==SQLITE_OK ) rc = sqliteOsRead(&pPager->wfd, aFrame, sizeof(aFrame));
+    if( rc!=SQLITE_OK ) break;
+    pgno = get32bits(&aFrame[0]);
+    nTruncate = get32bits(&aFrame[4]);
+    cksum = pager_wal_cksum(iFrame==1 ? salt : prevCksum,
+                            aFrame, &aFrame[WAL_FRAME_HDR_SZ]);
+    if( pgno==0 || get32bits(&aFrame[8])!=salt
+     || get32bits(&aFrame[12])!=cksum ){
+      break;
+    }
+    prevCksum = cksum;
+    if( nTruncate ){
+      *pChanged = 1;
+      if( !apply ) break;
+    }
+    if( apply ){
+      rc = pager_wal_index_frame(pPager, iFrame, pgno);
+      if( rc!=SQLITE_OK ) break;
+      if( nTruncate ){
+        pPager->walCommit = iFrame;
+        pPager->walDbSize = nTruncate;
+        pPager->walCommitCksum = cksum;
+      }
+    }
+  }
+  if( apply ){
+    pager_wal_truncate_index(pPager);
+  }
+  return rc;
+}
+
+/*
+** Write a new log header with a fresh salt.  This invalidates every frame
+** currently in the log.
+**
+** The new salt is one more than the salt already in the header, so a
+** connection can never mistake a new generation of the log for the one
+** it has indexed.  Only a new log file gets a random salt.  The caller
+** must hold either the log writer lock or an exclusive lock on the
+** database file, so no one else can be changing the header.
+*/
+static int pager_wal_write_header(Pager *pPager){
+  unsigned char aHdr[WAL_HDR_SZ];
+  off_t szW;
+  u32 salt = 0;
+  int rc;
+
+  rc = sqliteOsFileSize(&pPager->wfd, &szW);
+  if( rc==SQLITE_OK && szW>=WAL_HDR_SZ ){
+    rc = sqliteOsSeek(&pPager->wfd, 0);
+    if( rc==SQLITE_OK ) rc = sqliteOsRead(&pPager->wfd, aHdr, sizeof(aHdr));
+    if( rc==SQLITE_OK && memcmp(aHdr, aWalMagic, sizeof(aWalMagic))==0 ){
+      salt = get32bits(&aHdr[sizeof(aWalMagic)]);
+    }
+  }
+  if( rc!=SQLITE_OK ) return rc;
+  if( salt==0 ){
+    sqliteRandomness(sizeof(salt), &salt);
+  }
+  if( ++salt==0 ) salt++;
+  memcpy(aHdr, aWalMagic, sizeof(aWalMagic));
+  put32bits(&aHdr[sizeof(aWalMagic)], salt);
+  put32bits(&aHdr[sizeof(aWalMagic)+4], 0);
+  rc = sqliteOsSeek(&pPager->wfd, 0);
+  if( rc==SQLITE_OK ) rc = sqliteOsWrite(&pPager->wfd, aHdr, sizeof(aHdr));
+  if( rc==SQLITE_OK ) pPager->walSalt = salt;
+  return rc;
+}
+
+/*
+** Append the pages on the pDirty list to the log.  If nTruncate is not
+** zero, the last frame written is marked as a commit frame and nTruncate
+** is recorded as the size of the database.  Pages beyond nTruncate are
+** not written.
+**
+** The caller must hold the log writer lock.
+*/
+static int pager_wal_append(Pager *pPager, PgHdr *pList, int nTruncate){
+  unsigned char aHdr[WAL_FRAME_HDR_SZ];
+  PgHdr *pPg;
+  u32 cksum;
+  int rc;
+
+  assert( pPager->walLocked );
+  if( pPager->walMax==0 ){
+    /* Starting a new generation of the log */
+    rc = pager_wal_write_header(pPager);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  while( pList ){
+    pPg = pList;
+    pList = pPg->pDirty;
+    if( nTruncate && pPg->pgno>(Pgno)nTruncate ){
+      pPg->dirty = 0;
+      if( pList ) continue;
+      pPg = pager_lookup(pPager, 1);
+      assert( pPg!=0 );
+    }
+    put32bits(&aHdr[0], pPg->pgno);
+    put32bits(&aHdr[4], pList==0 ? nTruncate : 0);
+    put32bits(&aHdr[8], pPager->walSalt);
+    CODEC(pPager, PGHDR_TO_DATA(pPg), pPg->pgno, 6);
+    cksum = pager_wal_cksum(pPager->walMax==0 ? pPager->walSalt
+                                              : pPager->walCksum,
+                            aHdr, PGHDR_TO_DATA(pPg));
+    put32bits(&aHdr[12], cksum);
+    rc = sqliteOsSeek(&pPager->wfd, WAL_FRAME_OFFSET(pPager->walMax+1));
+    if( rc==SQLITE_OK ) rc = sqliteOsWrite(&pPager->wfd, aHdr, sizeof(aHdr));
+    if( rc==SQLITE_OK ){
+      rc = sqliteOsWrite(&pPager->wfd, PGHDR_TO_DATA(pPg), SQLITE_PAGE_SIZE);
+      if( rc==SQLITE_OK ) pPager->nWrite++;
+    }
+    CODEC(pPager, PGHDR_TO_DATA(pPg), pPg->pgno, 0);
+    if( rc==SQLITE_OK ){
+      rc = pager_wal_index_frame(pPager, pPager->walMax+1, pPg->pgno);
+    }
+    if( rc!=SQLITE_OK ) return rc;
+    pPager->walCksum = cksum;
+    TRACE3("WAL FRAME %d page %d\n", pPager->walMax, pPg->pgno);
+    pPg->dirty = 0;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Copy the most recent committed copy of every page in the log back into
+** the database file, then reset the log.
+**
+** The caller must hold an exclusive lock on the database file and the
+** index must be current, so that no other connection is reading from the
+** log or has frames in it that we do not know about.
+*/
+static int pager_wal_checkpoint(Pager *pPager){
+  char zBuf[SQLITE_PAGE_SIZE];
+  Pgno pgno;
+  int iFrame;
+  int rc = SQLITE_OK;
+
+  if( !pPager->walOpen || pPager->walMax==0 ) return SQLITE_OK;
+  assert( pPager->walMax==pPager->walCommit );
+  if( !pPager->noSync ){
+    /* Any connection may have committed without syncing the log.  Those
+    ** frames must reach the disk before their pages are copied over the
+    ** database, or a crash part way through could leave no intact copy.
+    ** The sync costs little when the log is already clean. */
+    rc = pager_sync(pPager, &pPager->wfd);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  pPager->sharedOk = 0;
+  for(pgno=1; pgno<(Pgno)pPager->nWalLatest; pgno++){
+    iFrame = pPager->aWalLatest[pgno];
+    if( iFrame==0 || pgno>(Pgno)pPager->walDbSize ) continue;
+    rc = pager_wal_read_frame(pPager, iFrame, zBuf);
+    if( rc==SQLITE_OK ){
+      rc = sqliteOsSeek(&pPager->fd, (pgno-1)*(off_t)SQLITE_PAGE_SIZE);
+    }
+    if( rc==SQLITE_OK ) rc = sqliteOsWrite(&pPager->fd, zBuf, SQLITE_PAGE_SIZE);
+    if( rc!=SQLITE_OK ) return rc;
+    pPager->nWrite++;
+  }
+  rc = sqliteOsTruncate(&pPager->fd,
+                        SQLITE_PAGE_SIZE*(off_t)pPager->walDbSize);
+  if( rc==SQLITE_OK && !pPager->noSync ){
+    rc = pager_sync(pPager, &pPager->fd);
+  }
+  if( rc!=SQLITE_OK ) return rc;
+
+  /* The database file now holds everything.  Start a new log. */
+  TRACE2("WAL CHECKPOINT %d frames\n", pPager->walMax);
+  rc = pager_wal_write_header(pPager);
+  if( rc==SQLITE_OK ){
+    rc = sqliteOsTruncate(&pPager->wfd, WAL_HDR_SZ);
+  }
+  pager_wal_reset_index(pPager);
+  return rc;
+}
+
+/*
+** Try to checkpoint the log while holding a read lock on the database.
+** The lock is briefly upgraded to an exclusive lock, which only succeeds
+** if no other connection is reading.  SQLITE_BUSY is returned otherwise.
+** Nothing is locked if the log is already empty.
+*/
+static int pager_wal_try_checkpoint(Pager *pPager){
+  int changed;
+  int rc;
+  if( !pPager->walOpen ) return SQLITE_OK;
+  rc = pager_wal_refresh(pPager, pPager->nRef==0, &changed);
+  if( rc!=SQLITE_OK || pPager->walMax==0 ) return rc;
+  rc = sqliteOsWriteLock(&pPager->fd);
+  if( rc!=SQLITE_OK ) return rc;
+  rc = pager_wal_refresh(pPager, pPager->nRef==0, &changed);
+  if( rc==SQLITE_OK && changed && pPager->nRef>0 ){
+    /* Our pages are out of date, so the log cannot be discarded */
+    rc = SQLITE_BUSY;
+  }
+  if( rc==SQLITE_OK ){
+    rc = pager_wal_checkpoint(pPager);
+  }
+  sqliteOsReadLock(&pPager->fd);
+  return rc;
+}
+
+/*
+** Start a write transaction in write-ahead log mode.  Only one connection
+** at a time may hold the log writer lock.  SQLITE_BUSY is returned if the
+** lock cannot be obtained or if some other connection has committed since
+** our read transaction started.
+*/
+static int pager_wal_begin_write(Pager *pPager){
+  int changed;
+  int rc;
+  assert( pPager->walOpen && !pPager->walLocked );
+  rc = sqliteOsWriteLock(&pPager->wfd);
+  if( rc!=SQLITE_OK ) return rc;
+  rc = pager_wal_refresh(pPager, 0, &changed);
+  if( rc==SQLITE_OK && changed ) rc = SQLITE_BUSY;
+  if( rc!=SQLITE_OK ){
+    sqliteOsUnlock(&pPager->wfd);
+    return rc;
+  }
+  pPager->walLocked = 1;
+  return SQLITE_OK;
+}
+
+/*
+** Commit the current write transaction to the log.  Every dirty page is
+** appended and the log is synced once.  If nothing is dirty but pages
+** were spilled into the log earlier in the transaction, page 1 is written
+** again to carry the commit mark.
+**
+** If the commit sync has been turned off the log is not synced here.
+** The transaction is durable once the caller syncs the log file itself
+** or the next checkpoint runs.
+*/
+static int pager_wal_commit(Pager *pPager){
+  PgHdr *pList, *pPg;
+  int rc;
+
+  assert( pPager->walLocked );
+  pList = 0;
+  for(pPg=pPager->pAll; pPg; pPg=pPg->pNextAll){
+    if( pPg->dirty ){
+      pPg->pDirty = pList;
+      pList = pPg;
+    }
+  }
+  if( pList==0 ){
+    if( pPager->walMax==pPager->walCommit ) return SQLITE_OK;
+    pList = pager_lookup(pPager, 1);
+    assert( pList!=0 );
+    pList->pDirty = 0;
+  }
+  rc = pager_wal_append(pPager, pList, pPager->dbSize);
+  if( rc==SQLITE_OK && !pPager->noSync && !pPager->walNoCommitSync ){
+    rc = pager_sync(pPager, &pPager->wfd);
+  }
+  if( rc!=SQLITE_OK ) return rc;
+  pPager->walCommit = pPager->walMax;
+  pPager->walDbSize = pPager->dbSize;
+  pPager->walCommitCksum = pPager->walCksum;
+  if( pPager->walCommit>=pPager->walAutoCkpt && pPager->walAutoCkpt>0 ){
+    /* The transaction is already safe in the log, so a failed checkpoint
+    ** is not an error.  It will be retried after the next commit. */
+    pager_wal_try_checkpoint(pPager);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Roll back the current write transaction.  Frames appended by the
+** transaction are dropped from the index and every page changed by the
+** transaction is reloaded from the last committed copy.
+**
+** The frames stay in the file until the next writer overwrites them.
+** The first of them is zeroed and synced so that the log ends at the last
+** commit even if a failed commit had already written its commit frame.
+*/
+static int pager_wal_rollback(Pager *pPager){
+  char zBuf[SQLITE_PAGE_SIZE];
+  PgHdr *pPg;
+  int iFrame;
+  int stale;
+  int rc = SQLITE_OK;
+
+  assert( pPager->walLocked );
+  stale = pPager->walMax>pPager->walCommit;
+  pager_wal_truncate_index(pPager);
+  pPager->dbSize = -1;
+  sqlitepager_pagecount(pPager);
+  for(pPg=pPager->pAll; pPg; pPg=pPg->pNextAll){
+    if( !pPg->inJournal && !pPg->dirty ) continue;
+    iFrame = pager_wal_find(pPager, pPg->pgno);
+    if( iFrame ){
+      rc = pager_wal_read_frame(pPager, iFrame, zBuf);
+    }else if( pPg->pgno<=(Pgno)pPager->dbSize ){
+      sqliteOsSeek(&pPager->fd, (pPg->pgno-1)*(off_t)SQLITE_PAGE_SIZE);
+      rc = sqliteOsRead(&pPager->fd, zBuf, SQLITE_PAGE_SIZE);
+    }else{
+      memset(zBuf, 0, SQLITE_PAGE_SIZE);
+    }
+    if( rc!=SQLITE_OK ) break;
+    CODEC(pPager, zBuf, pPg->pgno, 3);
+    if( pPg->nRef==0 || memcmp(zBuf, PGHDR_TO_DATA(pPg), SQLITE_PAGE_SIZE) ){
+      memcpy(PGHDR_TO_DATA(pPg), zBuf, SQLITE_PAGE_SIZE);
+      memset(PGHDR_TO_EXTRA(pPg), 0, pPager->nExtra);
+    }
+    pPg->dirty = 0;
+  }
+  if( rc==SQLITE_OK && stale ){
+    unsigned char aHdr[WAL_FRAME_HDR_SZ];
+    memset(aHdr, 0, sizeof(aHdr));
+    rc = sqliteOsSeek(&pPager->wfd, WAL_FRAME_OFFSET(pPager->walCommit+1));
+    if( rc==SQLITE_OK ) rc = sqliteOsWrite(&pPager->wfd, aHdr, sizeof(aHdr));
+    if( rc==SQLITE_OK && !pPager->noSync ){
+      rc = pager_sync(pPager, &pPager->wfd);
+    }
+  }
+  if( rc!=SQLITE_OK ){
+    pPager->errMask |= PAGER_ERR_DISK;
+    rc = SQLITE_IOERR;
+  }
+  return rc;
+}
+
+/*
+** Restore one page from the checkpoint journal while in write-ahead log
+** mode.  The database file is never written during a transaction, so the
+** original content goes back into the cache, and the page is marked dirty
+** so that it is logged again at commit time.
+*/
+static int pager_wal_playback_one_page(Pager *pPager, OsFile *jfd){
+  PageRecord pgRec;
+  void *pData;
+  PgHdr *pPg;
+  int rc;
+
+  rc = read32bits(JOURNAL_FORMAT_2, jfd, &pgRec.pgno);
+  if( rc!=SQLITE_OK ) return rc;
+  rc = sqliteOsRead(jfd, &pgRec.aData, sizeof(pgRec.aData));
+  if( rc!=SQLITE_OK ) return rc;
+  if( pgRec.pgno==0 ) return SQLITE_DONE;
+  if( pgRec.pgno>(unsigned)pPager->dbSize ) return SQLITE_OK;
+  rc = sqlitepager_get(pPager, pgRec.pgno, &pData);
+  if( rc!=SQLITE_OK ) return rc;
+  pPg = DATA_TO_PGHDR(pData);
+  memcpy(pData, pgRec.aData, SQLITE_PAGE_SIZE);
+  memset(PGHDR_TO_EXTRA(pPg), 0, pPager->nExtra);
+  CODEC(pPager, pData, pPg->pgno, 3);
+  pPg->dirty = 1;
+  pPg->inJournal = 1;
+  sqlitepager_unref(pData);
+  return SQLITE_OK;
+}
+
 /*
 ** Playback the checkpoint journal.
 **
@@ -780,21 +1665,29 @@ end_playback:
 **    (2)  In addition to playing back the checkpoint journal, also
 **         playback all pages of the transaction journal beginning
 **         at offset pPager->ckptJSize.
+**
+** In write-ahead log mode there is no transaction journal.  Every page
+** changed by the checkpoint is in the checkpoint journal and is restored
+** into the cache rather than the database file.
 */
 static int pager_ckpt_playback(Pager *pPager){
   off_t szJ;               /* Size of the full journal */
   int nRec;                /* Number of Records */
   int i;                   /* Loop counter */
-  int rc;
+  int rc = SQLITE_OK;
 
   /* Truncate the database back to its original size.
   */
-  rc = sqliteOsTruncate(&pPager->fd, SQLITE_PAGE_SIZE*(off_t)pPager->ckptSize);
+  if( !pPager->walLocked ){
+    pPager->sharedOk = 0;
+    rc = sqliteOsTruncate(&pPager->fd,
+                          SQLITE_PAGE_SIZE*(off_t)pPager->ckptSize);
+  }
   pPager->dbSize = pPager->ckptSize;
 
   /* Figure out how many records are in the checkpoint journal.
   */
-  assert( pPager->ckptInUse && pPager->journalOpen );
+  assert( pPager->ckptInUse && (pPager->journalOpen || pPager->walLocked) );
   sqliteOsSeek(&pPager->cpfd, 0);
   nRec = pPager->ckptNRec;
   
@@ -804,10 +1697,17 @@ static int pager_ckpt_playback(Pager *pPager){
   ** power failures corrupting the journal and can thus omit the checksums.
   */
   for(i=nRec-1; i>=0; i--){
-    rc = pager_playback_one_page(pPager, &pPager->cpfd, 2);
+    if( pPager->walLocked ){
+      rc = pager_wal_playback_one_page(pPager, &pPager->cpfd);
+    }else{
+      rc = pager_playback_one_page(pPager, &pPager->cpfd, 2);
+    }
     assert( rc!=SQLITE_DONE );
     if( rc!=SQLITE_OK ) goto end_ckpt_playback;
   }
+  if( pPager->walLocked ){
+    goto end_ckpt_playback;
+  }
 
   /* Figure out how many pages need to be copied out of the transaction
   ** journal.
@@ -892,6 +1792,131 @@ void sqlitepager_set_safety_level(Pager *pPager, int level){
   if( pPager->noSync==0 ) pPager->needSync = 0;
 }
 
+/*
+** Turn write-ahead log mode on or off.  The change takes effect at the
+** start of the next transaction.  Temporary databases and databases
+** without a journal always use the rollback journal.
+**
+** When the log is turned off, anything still in it is checkpointed into
+** the database file by the next write transaction.
+*/
+void sqlitepager_set_wal(Pager *pPager, int onoff){
+  pPager->walMode = onoff && !pPager->tempFile && pPager->useJournal;
+}
+
+/*
+** Return true if write-ahead log mode is turned on.
+*/
+int sqlitepager_get_wal(Pager *pPager){
+  return pPager->walMode;
+}
+
+/*
+** Turn the sync of the write-ahead log at each commit on or off.  With
+** it off a commit returns once its frames have been written.  A crash
+** may then lose the most recent transactions, but because each frame's
+** checksum covers the frames before it, whatever is left of them on disk
+** never checks out and the database stays consistent.  That still needs
+** the syncs made by rollbacks and checkpoints, so it does not hold with
+** the no-sync flag set.  Has no effect in rollback journal mode.
+*/
+void sqlitepager_set_wal_commit_sync(Pager *pPager, int onoff){
+  pPager->walNoCommitSync = !onoff;
+}
+
+/*
+** Return true if the write-ahead log is synced at each commit.
+*/
+int sqlitepager_get_wal_commit_sync(Pager *pPager){
+  return !pPager->walNoCommitSync;
+}
+
+/*
+** Turn the process-wide shared page cache on or off for this pager.
+** Pagers of temporary files never use it.  SQLITE_NOMEM is returned if
+** the cache cannot be created and SQLITE_ERROR if the OS layer cannot
+** identify the file.
+*/
+int sqlitepager_set_shared(Pager *pPager, int onoff){
+  PgShared *p;
+  OsFileId id;
+
+  if( !onoff || pPager->tempFile ){
+    pager_shared_release(pPager);
+    return SQLITE_OK;
+  }
+  if( pPager->pShared ) return SQLITE_OK;
+  if( sqliteOsFileId(&pPager->fd, &id)!=SQLITE_OK ) return SQLITE_ERROR;
+  sqliteOsEnterMutex();
+  for(p=pAllShared; p; p=p->pNext){
+    if( memcmp(p->id.aKey, id.aKey, sizeof(id.aKey))==0 ) break;
+  }
+  if( p==0 ){
+    p = sqliteMalloc( sizeof(*p) );
+    if( p==0 ){
+      sqliteOsLeaveMutex();
+      return SQLITE_NOMEM;
+    }
+    p->id = id;
+    p->pNext = pAllShared;
+    pAllShared = p;
+  }
+  p->nRef++;
+  sqliteOsLeaveMutex();
+
+  /* Not used until the next read lock has checked the file stamp */
+  pPager->pShared = p;
+  pPager->sharedOk = 0;
+  return SQLITE_OK;
+}
+
+/*
+** Return true if the shared page cache is turned on.
+*/
+int sqlitepager_get_shared(Pager *pPager){
+  return pPager->pShared!=0;
+}
+
+/*
+** Set the number of log frames that triggers an automatic checkpoint
+** at commit.  Zero or a negative number turns automatic checkpoints off.
+*/
+void sqlitepager_set_wal_autocheckpoint(Pager *pPager, int nFrame){
+  pPager->walAutoCkpt = nFrame>0 ? nFrame : 0;
+}
+
+/*
+** Return the automatic checkpoint threshold.
+*/
+int sqlitepager_get_wal_autocheckpoint(Pager *pPager){
+  return pPager->walAutoCkpt;
+}
+
+/*
+** Copy everything in the write-ahead log into the database file and
+** reset the log.  SQLITE_BUSY is returned if some other connection is
+** reading the database, or if this connection is in a write transaction.
+*/
+int sqlitepager_checkpoint(Pager *pPager){
+  int rc;
+  if( pPager->errMask ) return pager_errcode(pPager);
+  if( pPager->state==SQLITE_WRITELOCK ) return SQLITE_BUSY;
+  if( pPager->state==SQLITE_READLOCK ){
+    return pager_wal_try_checkpoint(pPager);
+  }
+  if( !pPager->walOpen && !sqliteOsFileExists(pPager->zWal) ){
+    return SQLITE_OK;
+  }
+  rc = sqliteOsReadLock(&pPager->fd);
+  if( rc!=SQLITE_OK ) return rc;
+  rc = pager_wal_open(pPager, 0);
+  if( rc==SQLITE_OK ){
+    rc = pager_wal_try_checkpoint(pPager);
+  }
+  sqliteOsUnlock(&pPager->fd);
+  return rc;
+}
+
 /*
 ** Open a temporary file.  Write the name of the file into zName
 ** (zName must be at least SQLITE_TEMPNAME_SIZE bytes long.)  Write
@@ -960,7 +1985,7 @@ int sqlitepager_open(
     return SQLITE_CANTOPEN;
   }
   nameLen = strlen(zFullPathname);
-  pPager = sqliteMalloc( sizeof(*pPager) + nameLen*3 + 30 );
+  pPager = sqliteMalloc( sizeof(*pPager) + nameLen*4 + 40 );
   if( pPager==0 ){
     sqliteOsClose(&fd);
     sqliteFree(zFullPathname);
@@ -977,6 +2002,9 @@ int sqlitepager_open(
   strcpy(pPager->zJournal, zFullPathname);
   sqliteFree(zFullPathname);
   strcpy(&pPager->zJournal[nameLen], "-journal");
+  pPager->zWal = &pPager->zJournal[nameLen+9];
+  strcpy(pPager->zWal, pPager->zFilename);
+  strcpy(&pPager->zWal[nameLen], "-wal");
   pPager->fd = fd;
   pPager->journalOpen = 0;
   pPager->useJournal = useJournal;
@@ -999,6 +2027,7 @@ int sqlitepager_open(
   pPager->pLast = 0;
   pPager->nExtra = nExtra;
   memset(pPager->aHash, 0, sizeof(pPager->aHash));
+  pPager->walAutoCkpt = WAL_DEFAULT_AUTOCHECKPOINT;
   *ppPager = pPager;
   return SQLITE_OK;
 }
@@ -1025,11 +2054,14 @@ int sqlitepager_pagecount(Pager *pPager){
   if( pPager->dbSize>=0 ){
     return pPager->dbSize;
   }
-  if( sqliteOsFileSize(&pPager->fd, &n)!=SQLITE_OK ){
+  if( pPager->walOpen && pPager->walCommit>0 ){
+    n = pPager->walDbSize;
+  }else if( sqliteOsFileSize(&pPager->fd, &n)!=SQLITE_OK ){
     pPager->errMask |= PAGER_ERR_DISK;
     return 0;
+  }else{
+    n /= SQLITE_PAGE_SIZE;
   }
-  n /= SQLITE_PAGE_SIZE;
   if( pPager->state!=SQLITE_UNLOCK ){
     pPager->dbSize = n;
   }
@@ -1056,7 +2088,13 @@ int sqlitepager_truncate(Pager *pPager, Pgno nPage){
   if( nPage>=(unsigned)pPager->dbSize ){
     return SQLITE_OK;
   }
+  if( pPager->walLocked ){
+    /* The new size is recorded in the commit frame */
+    pPager->dbSize = nPage;
+    return SQLITE_OK;
+  }
   syncJournal(pPager);
+  pPager->sharedOk = 0;
   rc = sqliteOsTruncate(&pPager->fd, SQLITE_PAGE_SIZE*(off_t)nPage);
   if( rc==SQLITE_OK ){
     pPager->dbSize = nPage;
@@ -1091,10 +2129,20 @@ int sqlitepager_close(Pager *pPager){
       break;
     }
   }
+  if( pPager->walOpen ){
+    /* Fold the log back into the database if nobody else is using it */
+    if( pPager->errMask==0 && sqliteOsReadLock(&pPager->fd)==SQLITE_OK ){
+      pPager->nRef = 0;
+      pager_wal_try_checkpoint(pPager);
+      sqliteOsUnlock(&pPager->fd);
+    }
+    pager_wal_close(pPager);
+  }
   for(pPg=pPager->pAll; pPg; pPg=pNext){
     pNext = pPg->pNextAll;
     sqliteFree(pPg);
   }
+  pager_shared_release(pPager);
   sqliteOsClose(&pPager->fd);
   assert( pPager->journalOpen==0 );
   /* Temp files are automatically deleted by the OS
@@ -1211,7 +2259,7 @@ static int syncJournal(Pager *pPager){
         off_t szJ;
         if( pPager->fullSync ){
           TRACE1("SYNC\n");
-          rc = sqliteOsSync(&pPager->jfd);
+          rc = pager_sync(pPager, &pPager->jfd);
           if( rc!=0 ) return rc;
         }
         sqliteOsSeek(&pPager->jfd, sizeof(aJournalMagic1));
@@ -1222,7 +2270,7 @@ static int syncJournal(Pager *pPager){
         sqliteOsSeek(&pPager->jfd, szJ);
       }
       TRACE1("SYNC\n");
-      rc = sqliteOsSync(&pPager->jfd);
+      rc = pager_sync(pPager, &pPager->jfd);
       if( rc!=0 ) return rc;
       pPager->journalStarted = 1;
     }
@@ -1263,12 +2311,17 @@ static int pager_write_pagelist(PgHdr *pList){
 
   if( pList==0 ) return SQLITE_OK;
   pPager = pList->pPager;
+  if( pPager->walLocked ){
+    return pager_wal_append(pPager, pList, 0);
+  }
+  pPager->sharedOk = 0;
   while( pList ){
     assert( pList->dirty );
     sqliteOsSeek(&pPager->fd, (pList->pgno-1)*(off_t)SQLITE_PAGE_SIZE);
     CODEC(pPager, PGHDR_TO_DATA(pList), pList->pgno, 6);
     TRACE2("STORE %d\n", pList->pgno);
     rc = sqliteOsWrite(&pPager->fd, PGHDR_TO_DATA(pList), SQLITE_PAGE_SIZE);
+    if( rc==SQLITE_OK ) pPager->nWrite++;
     CODEC(pPager, PGHDR_TO_DATA(pList), pList->pgno, 0);
     if( rc ) return rc;
     pList->dirty = 0;
@@ -1382,6 +2435,23 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
          return rc;
        }
     }
+
+    /* If there is a write-ahead log, find out what it holds.  In
+    ** write-ahead log mode, create the log if it does not exist.
+    */
+    if( pPager->useJournal && !pPager->tempFile ){
+      int changed;
+      rc = pager_wal_open(pPager, pPager->walMode && !pPager->readOnly);
+      if( rc==SQLITE_OK ){
+        rc = pager_wal_refresh(pPager, 1, &changed);
+      }
+      if( rc!=SQLITE_OK ){
+        sqliteOsUnlock(&pPager->fd);
+        pPager->state = SQLITE_UNLOCK;
+        return rc;
+      }
+    }
+    pager_shared_check(pPager);
     pPg = 0;
   }else{
     /* Search for page in cache */
@@ -1390,6 +2460,7 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
   if( pPg==0 ){
     /* The requested page is not in the page cache. */
     int h;
+    int iFrame;
     pPager->nMiss++;
     if( pPager->nPage<pPager->mxPage || pPager->pFirst==0 ){
       /* Create a new page */
@@ -1526,11 +2597,31 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
     }
     if( pPager->dbSize<(int)pgno ){
       memset(PGHDR_TO_DATA(pPg), 0, SQLITE_PAGE_SIZE);
+    }else if( (iFrame = pager_wal_find(pPager, pgno))!=0 ){
+      rc = pager_wal_read_frame(pPager, iFrame, PGHDR_TO_DATA(pPg));
+      TRACE3("FETCH %d from frame %d\n", pPg->pgno, iFrame);
+      pPager->nRead++;
+      if( rc!=SQLITE_OK ){
+        sqlitepager_unref(PGHDR_TO_DATA(pPg));
+        return rc;
+      }
+      CODEC(pPager, PGHDR_TO_DATA(pPg), pPg->pgno, 3);
+      if( iFrame>pPager->walCommit ){
+        /* Changed earlier in this transaction and spilled to the log */
+        pPg->inJournal = 1;
+      }
+    }else if( pager_shared_read(pPager, pgno, PGHDR_TO_DATA(pPg)) ){
+      TRACE2("FETCH %d from shared cache\n", pPg->pgno);
+      CODEC(pPager, PGHDR_TO_DATA(pPg), pPg->pgno, 3);
     }else{
       int rc;
       sqliteOsSeek(&pPager->fd, (pgno-1)*(off_t)SQLITE_PAGE_SIZE);
       rc = sqliteOsRead(&pPager->fd, PGHDR_TO_DATA(pPg), SQLITE_PAGE_SIZE);
       TRACE2("FETCH %d\n", pPg->pgno);
+      pPager->nRead++;
+      if( rc==SQLITE_OK ){
+        pager_shared_write(pPager, pgno, PGHDR_TO_DATA(pPg));
+      }
       CODEC(pPager, PGHDR_TO_DATA(pPg), pPg->pgno, 3);
       if( rc!=SQLITE_OK ){
         off_t fileSize;
@@ -1581,6 +2672,43 @@ void *sqlitepager_lookup(Pager *pPager, Pgno pgno){
   return PGHDR_TO_DATA(pPg);
 }
 
+/*
+** Hint that the pages listed in aPgno[] are about to be read.  Pages
+** that are already in the cache, that lie past the end of the file or
+** that will be read out of the write-ahead log are skipped.  The rest
+** are passed to the OS layer, with runs of adjacent pages merged into
+** a single request, so that the disk reads are under way by the time
+** sqlitepager_get() asks for them.  This is only a hint and never
+** fails.
+*/
+void sqlitepager_readahead(Pager *pPager, Pgno *aPgno, int nPgno){
+  Pgno iFirst = 0, iLast = 0;
+  Pgno nPage;
+  int i;
+
+  assert( pPager!=0 );
+  if( pPager->nRef==0 || pPager->errMask ) return;
+  nPage = sqlitepager_pagecount(pPager);
+  for(i=0; i<nPgno; i++){
+    Pgno pgno = aPgno[i];
+    if( pgno==0 || pgno>nPage ) continue;
+    if( pager_lookup(pPager, pgno) || pager_wal_find(pPager, pgno) ) continue;
+    if( iFirst && pgno==iLast+1 ){
+      iLast = pgno;
+      continue;
+    }
+    if( iFirst ){
+      sqliteOsReadAhead(&pPager->fd, (iFirst-1)*(off_t)SQLITE_PAGE_SIZE,
+                        (iLast-iFirst+1)*SQLITE_PAGE_SIZE);
+    }
+    iFirst = iLast = pgno;
+  }
+  if( iFirst ){
+    sqliteOsReadAhead(&pPager->fd, (iFirst-1)*(off_t)SQLITE_PAGE_SIZE,
+                      (iLast-iFirst+1)*SQLITE_PAGE_SIZE);
+  }
+}
+
 /*
 ** Release a page.
 **
@@ -1718,6 +2846,11 @@ static int pager_open_journal(Pager *pPager){
 ** temporary files, the opening of the journal file is deferred until
 ** there is an actual need to write to the journal.
 **
+** In write-ahead log mode no journal is used.  The log writer lock is
+** taken instead and the database file stays read-locked.  If the log is
+** not in use but still holds committed pages, those pages are first
+** copied back into the database file.
+**
 ** If the database is already write-locked, this routine is a no-op.
 */
 int sqlitepager_begin(void *pData){
@@ -1728,10 +2861,39 @@ int sqlitepager_begin(void *pData){
   assert( pPager->state!=SQLITE_UNLOCK );
   if( pPager->state==SQLITE_READLOCK ){
     assert( pPager->aInJournal==0 );
+    if( pPager->walMode && pPager->walOpen && !pPager->readOnly ){
+      rc = pager_wal_begin_write(pPager);
+      if( rc!=SQLITE_OK ){
+        return rc;
+      }
+      pPager->state = SQLITE_WRITELOCK;
+      pPager->dirtyFile = 0;
+      pPager->alwaysRollback = 0;
+      sqlitepager_pagecount(pPager);
+      pPager->origDbSize = pPager->dbSize;
+      TRACE1("WAL TRANSACTION\n");
+      if( pPager->ckptAutoopen ){
+        rc = sqlitepager_ckpt_begin(pPager);
+        if( rc!=SQLITE_OK ){
+          pager_unwritelock(pPager);
+        }
+      }
+      return rc;
+    }
     rc = sqliteOsWriteLock(&pPager->fd);
     if( rc!=SQLITE_OK ){
       return rc;
     }
+    if( pPager->walOpen ){
+      int changed;
+      rc = pager_wal_refresh(pPager, 0, &changed);
+      if( rc==SQLITE_OK && changed ) rc = SQLITE_BUSY;
+      if( rc==SQLITE_OK ) rc = pager_wal_checkpoint(pPager);
+      if( rc!=SQLITE_OK ){
+        sqliteOsReadLock(&pPager->fd);
+        return rc;
+      }
+    }
     pPager->state = SQLITE_WRITELOCK;
     pPager->dirtyFile = 0;
     TRACE1("TRANSACTION\n");
@@ -1795,18 +2957,24 @@ int sqlitepager_write(void *pData){
     return rc;
   }
   assert( pPager->state==SQLITE_WRITELOCK );
-  if( !pPager->journalOpen && pPager->useJournal ){
+  if( !pPager->journalOpen && pPager->useJournal && !pPager->walLocked ){
     rc = pager_open_journal(pPager);
     if( rc!=SQLITE_OK ) return rc;
   }
-  assert( pPager->journalOpen || !pPager->useJournal );
+  assert( pPager->journalOpen || pPager->walLocked || !pPager->useJournal );
   pPager->dirtyFile = 1;
 
   /* The transaction journal now exists and we have a write lock on the
   ** main database file.  Write the current page to the transaction 
   ** journal if it is not there already.
+  **
+  ** In write-ahead log mode the original content of the page is still
+  ** in the database file or the log, so there is nothing to journal.
+  ** The inJournal flag just marks the page as changed by this transaction.
   */
-  if( !pPg->inJournal && pPager->useJournal ){
+  if( !pPg->inJournal && pPager->walLocked ){
+    pPg->inJournal = 1;
+  }else if( !pPg->inJournal && pPager->useJournal ){
     if( (int)pPg->pgno <= pPager->origDbSize ){
       int szPg;
       u32 saved;
@@ -1821,6 +2989,7 @@ int sqlitepager_write(void *pData){
       store32bits(pPg->pgno, pPg, -4);
       CODEC(pPager, pData, pPg->pgno, 7);
       rc = sqliteOsWrite(&pPager->jfd, &((char*)pData)[-4], szPg);
+      if( rc==SQLITE_OK ) pPager->nWrite++;
       TRACE3("JOURNAL %d %d\n", pPg->pgno, pPg->needSync);
       CODEC(pPager, pData, pPg->pgno, 0);
       if( journal_format>=JOURNAL_FORMAT_3 ){
@@ -1859,6 +3028,7 @@ int sqlitepager_write(void *pData){
     store32bits(pPg->pgno, pPg, -4);
     CODEC(pPager, pData, pPg->pgno, 7);
     rc = sqliteOsWrite(&pPager->cpfd, &((char*)pData)[-4], SQLITE_PAGE_SIZE+4);
+    if( rc==SQLITE_OK ) pPager->nWrite++;
     TRACE2("CKPT-JOURNAL %d\n", pPg->pgno);
     CODEC(pPager, pData, pPg->pgno, 0);
     if( rc!=SQLITE_OK ){
@@ -2019,6 +3189,15 @@ int sqlitepager_commit(Pager *pPager){
     pPager->dbSize = -1;
     return rc;
   }
+  if( pPager->walLocked ){
+    rc = pager_wal_commit(pPager);
+    if( rc!=SQLITE_OK ){
+      goto commit_abort;
+    }
+    rc = pager_unwritelock(pPager);
+    pPager->dbSize = -1;
+    return rc;
+  }
   assert( pPager->journalOpen );
   rc = syncJournal(pPager);
   if( rc!=SQLITE_OK ){
@@ -2027,7 +3206,7 @@ int sqlitepager_commit(Pager *pPager){
   pPg = pager_get_all_dirty_pages(pPager);
   if( pPg ){
     rc = pager_write_pagelist(pPg);
-    if( rc || (!pPager->noSync && sqliteOsSync(&pPager->fd)!=SQLITE_OK) ){
+    if( rc || (!pPager->noSync && pager_sync(pPager, &pPager->fd)!=SQLITE_OK) ){
       goto commit_abort;
     }
   }
@@ -2060,6 +3239,16 @@ commit_abort:
 int sqlitepager_rollback(Pager *pPager){
   int rc;
   TRACE1("ROLLBACK\n");
+  if( pPager->walLocked ){
+    int rc2;
+    rc = pPager->dirtyFile ? pager_wal_rollback(pPager) : SQLITE_OK;
+    rc2 = pager_unwritelock(pPager);
+    pPager->dbSize = -1;
+    if( pPager->errMask!=0 && pPager->errMask!=PAGER_ERR_FULL ){
+      return pager_errcode(pPager);
+    }
+    return rc!=SQLITE_OK ? rc : rc2;
+  }
   if( !pPager->dirtyFile || !pPager->journalOpen ){
     rc = pager_unwritelock(pPager);
     pPager->dbSize = -1;
@@ -2096,7 +3285,7 @@ int sqlitepager_isreadonly(Pager *pPager){
 ** This routine is used for testing and analysis only.
 */
 int *sqlitepager_stats(Pager *pPager){
-  static int a[9];
+  static int a[12];
   a[0] = pPager->nRef;
   a[1] = pPager->nPage;
   a[2] = pPager->mxPage;
@@ -2106,6 +3295,9 @@ int *sqlitepager_stats(Pager *pPager){
   a[6] = pPager->nHit;
   a[7] = pPager->nMiss;
   a[8] = pPager->nOvfl;
+  a[9] = pPager->nRead;
+  a[10] = pPager->nWrite;
+  a[11] = pPager->nSync;
   return a;
 }
 
@@ -2119,11 +3311,11 @@ int *sqlitepager_stats(Pager *pPager){
 int sqlitepager_ckpt_begin(Pager *pPager){
   int rc;
   char zTemp[SQLITE_TEMPNAME_SIZE];
-  if( !pPager->journalOpen ){
+  if( !pPager->journalOpen && !pPager->walLocked ){
     pPager->ckptAutoopen = 1;
     return SQLITE_OK;
   }
-  assert( pPager->journalOpen );
+  assert( pPager->journalOpen || pPager->walLocked );
   assert( !pPager->ckptInUse );
   pPager->aInCkpt = sqliteMalloc( pPager->dbSize/8 + 1 );
   if( pPager->aInCkpt==0 ){
@@ -2131,10 +3323,12 @@ int sqlitepager_ckpt_begin(Pager *pPager){
     return SQLITE_NOMEM;
   }
 #ifndef NDEBUG
-  rc = sqliteOsFileSize(&pPager->jfd, &pPager->ckptJSize);
-  if( rc ) goto ckpt_begin_failed;
-  assert( pPager->ckptJSize == 
-    pPager->nRec*JOURNAL_PG_SZ(journal_format)+JOURNAL_HDR_SZ(journal_format) );
+  if( pPager->journalOpen ){
+    rc = sqliteOsFileSize(&pPager->jfd, &pPager->ckptJSize);
+    if( rc ) goto ckpt_begin_failed;
+    assert( pPager->ckptJSize == 
+      pPager->nRec*JOURNAL_PG_SZ(journal_format)+JOURNAL_HDR_SZ(journal_format) );
+  }
 #endif
   pPager->ckptJSize = pPager->nRec*JOURNAL_PG_SZ(journal_format)
                          + JOURNAL_HDR_SZ(journal_format);
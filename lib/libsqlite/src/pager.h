@@ -80,6 +80,7 @@ void sqlitepager_set_cachesize(Pager*, int);
 int sqlitepager_close(Pager *pPager);
 int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage);
 void *sqlitepager_lookup(Pager *pPager, Pgno pgno);
+void sqlitepager_readahead(Pager *pPager, Pgno *aPgno, int nPgno);
 int sqlitepager_ref(void*);
 int sqlitepager_unref(void*);
 Pgno sqlitepager_pagenumber(void*);
@@ -99,6 +100,15 @@ void sqlitepager_dont_rollback(void*);
 void sqlitepager_dont_write(Pager*, Pgno);
 int *sqlitepager_stats(Pager*);
 void sqlitepager_set_safety_level(Pager*,int);
+void sqlitepager_set_wal(Pager*,int);
+int sqlitepager_get_wal(Pager*);
+void sqlitepager_set_wal_commit_sync(Pager*,int);
+int sqlitepager_get_wal_commit_sync(Pager*);
+void sqlitepager_set_wal_autocheckpoint(Pager*,int);
+int sqlitepager_get_wal_autocheckpoint(Pager*);
+int sqlitepager_set_shared(Pager*,int);
+int sqlitepager_get_shared(Pager*);
+int sqlitepager_checkpoint(Pager*);
 const char *sqlitepager_filename(Pager*);
 int sqlitepager_rename(Pager*, const char *zNewName);
 void sqlitepager_set_codec(Pager*,void(*)(void*,void*,Pgno,int),void*);
@@ -17,6 +17,7 @@
 ** $Id: pragma.c,v 1.19 2004/04/23 17:04:45 drh Exp $
 */
 #include "sqliteInt.h"
+#include "pager.h"
 #include <ctype.h>
 
 /*
@@ -352,6 +353,206 @@ void sqlitePragma(Parse *pParse, Token *pLeft, Token *pRight, int minusFlag){
     }
   }else
 
+  /*
+  **   PRAGMA journal_mode
+  **   PRAGMA journal_mode=DELETE|WAL
+  **
+  ** Return or set the journaling mode of the main database.  In WAL mode
+  ** changes are appended to a write-ahead log beside the database file
+  ** instead of being journaled and written in place.  Like the local
+  ** synchronous flag, the setting is not stored in the database file.
+  */
+  if( sqliteStrICmp(zLeft,"journal_mode")==0 ){
+    static VdbeOpList getJournalMode[] = {
+      { OP_ColumnName,  0, 1,        "journal_mode"},
+      { OP_Callback,    1, 0,        0},
+    };
+    Pager *pPager = sqliteBtreePager(db->aDb[0].pBt);
+    if( pRight->z==pLeft->z ){
+      sqliteVdbeOp3(v, OP_String, 0, 0,
+          pPager && sqlitepager_get_wal(pPager) ? "wal" : "delete",
+          P3_STATIC);
+      sqliteVdbeAddOpList(v, ArraySize(getJournalMode), getJournalMode);
+    }else if( pPager ){
+      if( sqliteStrICmp(zRight,"wal")==0 ){
+        sqlitepager_set_wal(pPager, 1);
+      }else if( sqliteStrICmp(zRight,"delete")==0 ){
+        sqlitepager_set_wal(pPager, 0);
+      }else{
+        sqliteErrorMsg(pParse, "unknown journal mode: %s", zRight);
+      }
+    }
+  }else
+
+  /*
+  **   PRAGMA wal_checkpoint
+  **
+  ** Copy the content of the write-ahead log into the main database file
+  ** and reset the log.  Returns a single row which is 1 if the checkpoint
+  ** could not run because the database is in use and 0 otherwise.
+  */
+  if( sqliteStrICmp(zLeft,"wal_checkpoint")==0 ){
+    static VdbeOpList getBusy[] = {
+      { OP_ColumnName,  0, 1,        "busy"},
+      { OP_Callback,    1, 0,        0},
+    };
+    Pager *pPager = sqliteBtreePager(db->aDb[0].pBt);
+    int rc = pPager ? sqlitepager_checkpoint(pPager) : SQLITE_OK;
+    if( rc!=SQLITE_OK && rc!=SQLITE_BUSY ){
+      sqliteErrorMsg(pParse, "checkpoint failed: %s", sqlite_error_string(rc));
+    }else{
+      sqliteVdbeAddOp(v, OP_Integer, rc==SQLITE_BUSY, 0);
+      sqliteVdbeAddOpList(v, ArraySize(getBusy), getBusy);
+    }
+  }else
+
+  /*
+  **   PRAGMA wal_autocheckpoint
+  **   PRAGMA wal_autocheckpoint=N
+  **
+  ** Return or set the number of log frames after which a commit tries to
+  ** checkpoint the write-ahead log.  Zero turns automatic checkpoints off.
+  */
+  if( sqliteStrICmp(zLeft,"wal_autocheckpoint")==0 ){
+    static VdbeOpList getAutoCkpt[] = {
+      { OP_ColumnName,  0, 1,        "wal_autocheckpoint"},
+      { OP_Callback,    1, 0,        0},
+    };
+    Pager *pPager = sqliteBtreePager(db->aDb[0].pBt);
+    if( pRight->z==pLeft->z ){
+      sqliteVdbeAddOp(v, OP_Integer,
+          pPager ? sqlitepager_get_wal_autocheckpoint(pPager) : 0, 0);
+      sqliteVdbeAddOpList(v, ArraySize(getAutoCkpt), getAutoCkpt);
+    }else if( pPager ){
+      sqlitepager_set_wal_autocheckpoint(pPager, atoi(zRight));
+    }
+  }else
+
+  /*
+  **   PRAGMA wal_commit_sync
+  **   PRAGMA wal_commit_sync=ON|OFF
+  **
+  ** Return or set whether each commit syncs the write-ahead log before it
+  ** returns.  With it off, commits are made durable by the next checkpoint
+  ** or by the application syncing the log file itself; a crash before
+  ** then loses those commits but leaves the database consistent, unless
+  ** synchronous is also OFF.  The setting is not stored in the database
+  ** file.
+  */
+  if( sqliteStrICmp(zLeft,"wal_commit_sync")==0 ){
+    static VdbeOpList getCommitSync[] = {
+      { OP_ColumnName,  0, 1,        "wal_commit_sync"},
+      { OP_Callback,    1, 0,        0},
+    };
+    Pager *pPager = sqliteBtreePager(db->aDb[0].pBt);
+    if( pRight->z==pLeft->z ){
+      sqliteVdbeAddOp(v, OP_Integer,
+          pPager ? sqlitepager_get_wal_commit_sync(pPager) : 0, 0);
+      sqliteVdbeAddOpList(v, ArraySize(getCommitSync), getCommitSync);
+    }else if( pPager ){
+      sqlitepager_set_wal_commit_sync(pPager, getBoolean(zRight));
+    }
+  }else
+
+  /*
+  **   PRAGMA shared_cache
+  **   PRAGMA shared_cache=ON|OFF
+  **
+  ** Return or set whether the main database reads pages through a page
+  ** cache shared with every other connection in the process that has the
+  ** same file open.  Changes made by other processes are only noticed
+  ** through the size and modification times of the file, so this should
+  ** only be turned on for a database that no other process writes.  Like
+  ** the journal mode, the setting is not stored in the database file.
+  */
+  if( sqliteStrICmp(zLeft,"shared_cache")==0 ){
+    static VdbeOpList getSharedCache[] = {
+      { OP_ColumnName,  0, 1,        "shared_cache"},
+      { OP_Callback,    1, 0,        0},
+    };
+    Pager *pPager = sqliteBtreePager(db->aDb[0].pBt);
+    if( pRight->z==pLeft->z ){
+      sqliteVdbeAddOp(v, OP_Integer,
+          pPager ? sqlitepager_get_shared(pPager) : 0, 0);
+      sqliteVdbeAddOpList(v, ArraySize(getSharedCache), getSharedCache);
+    }else if( pPager ){
+      int rc = sqlitepager_set_shared(pPager, getBoolean(zRight));
+      if( rc!=SQLITE_OK ){
+        sqliteErrorMsg(pParse, "cannot share page cache: %s",
+            sqlite_error_string(rc));
+      }
+    }
+  }else
+
+  /*
+  **   PRAGMA key_format
+  **   PRAGMA key_format=BINARY|TEXT
+  **
+  ** Return or set the encoding of numeric fields in index keys.  BINARY
+  ** keys (file format 5) are fixed width and cheaper to build; TEXT keys
+  ** (file format 4) can be read by older versions of the library.
+  ** Changing the format rebuilds every index of the main and temporary
+  ** databases, so it is not allowed inside a transaction or while other
+  ** databases are attached.
+  */
+  if( sqliteStrICmp(zLeft,"key_format")==0 ){
+    static VdbeOpList getKeyFormat[] = {
+      { OP_ColumnName,  0, 1,        "key_format"},
+      { OP_Callback,    1, 0,        0},
+    };
+    if( pRight->z==pLeft->z ){
+      sqliteVdbeOp3(v, OP_String, 0, 0,
+          db->file_format>=5 ? "binary" : "text", P3_STATIC);
+      sqliteVdbeAddOpList(v, ArraySize(getKeyFormat), getKeyFormat);
+    }else{
+      int iFormat;
+      if( sqliteStrICmp(zRight,"binary")==0 ){
+        iFormat = 5;
+      }else if( sqliteStrICmp(zRight,"text")==0 ){
+        iFormat = 4;
+      }else{
+        sqliteErrorMsg(pParse, "unknown key format: %s", zRight);
+        iFormat = db->file_format;
+      }
+      if( iFormat!=db->file_format ){
+        if( db->flags & SQLITE_InTrans ){
+          sqliteErrorMsg(pParse, "cannot change key format "
+                "from within a transaction");
+        }else if( db->nDb>2 ){
+          sqliteErrorMsg(pParse, "cannot change key format "
+                "while databases are attached");
+        }else{
+          sqliteRebuildIndices(pParse, iFormat);
+        }
+      }
+    }
+  }else
+
+  /*
+  **   PRAGMA lookaside_status
+  **
+  ** Return one row for each counter of the lookaside allocator: its
+  ** configuration, how many allocations were served from slots, how many
+  ** went to malloc() because they were too large or the pool was empty,
+  ** and a histogram of requested sizes.  The pools belong to threads, not
+  ** connections, so the counters cover the whole process.
+  */
+  if( sqliteStrICmp(zLeft, "lookaside_status")==0 ){
+    static VdbeOpList lookasidePreface[] = {
+      { OP_ColumnName,  0, 0,       "name"},
+      { OP_ColumnName,  1, 1,       "value"},
+    };
+    const char *zName;
+    int i, iValue;
+
+    sqliteVdbeAddOpList(v, ArraySize(lookasidePreface), lookasidePreface);
+    for(i=0; sqliteLookasideStatus(i, &zName, &iValue); i++){
+      sqliteVdbeOp3(v, OP_String, 0, 0, zName, P3_STATIC);
+      sqliteVdbeAddOp(v, OP_Integer, iValue, 0);
+      sqliteVdbeAddOp(v, OP_Callback, 2, 0);
+    }
+  }else
+
 #ifndef NDEBUG
   if( sqliteStrICmp(zLeft, "trigger_overhead_test")==0 ){
     if( getBoolean(zRight) ){
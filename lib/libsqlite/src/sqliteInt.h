@@ -166,6 +166,12 @@ typedef unsigned INTPTR_TYPE uptr; /* Big enough to hold a pointer */
 #define MAX_BYTES_PER_ROW  1048576
 /* #define MAX_BYTES_PER_ROW 16777198 */
 
+/*
+** Beginning with file format 5, numeric fields of index keys are stored
+** in this many bytes.  See sqliteRealToBinary().
+*/
+#define SQLITE_BINARY_KEY_SIZE 10
+
 /*
 ** If memory allocation problems are found, recompile with
 **
@@ -187,10 +193,8 @@ typedef unsigned INTPTR_TYPE uptr; /* Big enough to hold a pointer */
 # define sqliteRealloc(X,Y) sqliteRealloc_(X,Y,__FILE__,__LINE__)
 # define sqliteStrDup(X)    sqliteStrDup_(X,__FILE__,__LINE__)
 # define sqliteStrNDup(X,Y) sqliteStrNDup_(X,Y,__FILE__,__LINE__)
-  void sqliteStrRealloc(char**);
 #else
 # define sqliteRealloc_(X,Y) sqliteRealloc(X,Y)
-# define sqliteStrRealloc(X)
 #endif
 
 /*
@@ -320,6 +324,12 @@ struct Db {
 **     file_format==3    Version 2.6.0. Fix empty-string index bug.
 **     file_format==4    Version 2.7.0. Add support for separate numeric and
 **                       text datatypes.
+**     file_format==5    Numeric fields of index keys are stored as fixed
+**                       width binary instead of sortable text.
+**
+** PRAGMA key_format switches between formats 4 and 5.  Writing the
+** format cookie records the new format in sqlite.next_format, which
+** replaces sqlite.file_format when the transaction commits.
 **
 ** The sqlite.temp_store determines where temporary database files
 ** are stored.  If 1, then a file is created to hold those tables.  If
@@ -355,6 +365,7 @@ struct sqlite {
   u8 temp_store;                /* 1=file, 2=memory, 0=compile-time default */
   u8 onError;                   /* Default conflict algorithm */
   int next_cookie;              /* Next value of aDb[0].schema_cookie */
+  u8 next_format;               /* If not 0, file_format after this commit */
   int cache_size;               /* Number of pages to use in the cache */
   int nTable;                   /* Number of tables in the database */
   void *pBusyArg;               /* 1st Argument to the busy callback */
@@ -812,6 +823,7 @@ struct WhereLevel {
   int top;             /* First instruction of interior of the loop */
   int inOp, inP1, inP2;/* Opcode used to implement an IN operator */
   int bRev;            /* Do the scan in the reverse direction */
+  int addrMoveTo;      /* OP_MoveTo from the index to the table, or 0 */
 };
 
 /*
@@ -1105,6 +1117,7 @@ int sqliteIsNumber(const char*);
 int sqliteCompare(const char *, const char *);
 int sqliteSortCompare(const char *, const char *);
 void sqliteRealToSortable(double r, char *);
+void sqliteRealToBinary(double r, char *);
 #ifdef MEMORY_DEBUG
   void *sqliteMalloc_(int,int,char*,int);
   void sqliteFree_(void*,char*,int);
@@ -1121,6 +1134,8 @@ void sqliteRealToSortable(double r, char *);
   char *sqliteStrNDup(const char*, int);
 # define sqliteCheckMemory(a,b)
 #endif
+void sqliteStrRealloc(char**);
+int sqliteLookasideStatus(int, const char**, int*);
 char *sqliteMPrintf(const char*, ...);
 char *sqliteVMPrintf(const char*, va_list);
 void sqliteSetString(char **, const char *, ...);
@@ -1165,6 +1180,7 @@ void sqliteSrcListAddAlias(SrcList*, Token*);
 void sqliteSrcListAssignCursors(Parse*, SrcList*);
 void sqliteIdListDelete(IdList*);
 void sqliteSrcListDelete(SrcList*);
+void sqliteRebuildIndices(Parse*, int);
 void sqliteCreateIndex(Parse*,Token*,SrcList*,IdList*,int,Token*,Token*);
 void sqliteDropIndex(Parse*, SrcList*);
 void sqliteAddKeyType(Vdbe*, ExprList*);
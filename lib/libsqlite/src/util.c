@@ -20,6 +20,7 @@
 ** $Id: util.c,v 1.74.2.1 2004/07/15 13:08:41 drh Exp $
 */
 #include "sqliteInt.h"
+#include "os.h"
 #include <stdarg.h>
 #include <ctype.h>
 
@@ -248,13 +249,265 @@ char *sqliteStrNDup_(const char *z, int n, char *zFile, int line){
 */
 #if !defined(MEMORY_DEBUG)
 
+/*
+** Small allocations are carved out of lookaside pools of fixed size
+** slots instead of going to malloc().  Parsing and running even a
+** trivial statement makes dozens of short lived allocations of a few
+** dozen bytes each (Expr, Token, IdList and SrcList nodes, Mem strings,
+** cursors) and under a multi-threaded workload those calls spend much of
+** their time waiting on the lock inside malloc().
+**
+** The allocation routines have no connection argument, so each thread
+** rather than each connection owns a pool.  The owning thread takes and
+** returns slots without any locking.  A slot freed by some other thread
+** goes onto the owner's remote list under the pool mutex, and the owner
+** collects those when its own free list runs dry.  When a thread exits,
+** its pool is released for the next thread that needs one.  Threads
+** beyond the number of pools, and allocations larger than a slot, simply
+** use malloc().
+**
+** All pools live in one static array so that sqliteFree() can tell a
+** slot from a malloc()ed pointer, and find the pool it belongs to, with
+** nothing more than a range check.  Pages of pools that no thread ever
+** uses are never touched.
+**
+** LOOKASIDE_SLOT_SIZE was chosen from the size histogram reported by
+** PRAGMA lookaside_status.
+**
+** Compile with -DSQLITE_OMIT_LOOKASIDE to send every allocation to
+** malloc().
+*/
+#if OS_UNIX && !defined(SQLITE_OMIT_LOOKASIDE)
+#include <pthread.h>
+
+#ifndef LOOKASIDE_SLOT_SIZE
+# define LOOKASIDE_SLOT_SIZE 128   /* Bytes per slot.  Multiple of 8 */
+#endif
+#ifndef LOOKASIDE_SLOTS
+# define LOOKASIDE_SLOTS 256       /* Slots in each pool */
+#endif
+#ifndef LOOKASIDE_POOLS
+# define LOOKASIDE_POOLS 32        /* Number of pools */
+#endif
+
+/*
+** Size classes of the allocation histogram.  Class i counts requests of
+** no more than 16<<i bytes, and the last class counts everything larger.
+*/
+#define LOOKASIDE_NHIST 8
+
+typedef struct LookasideSlot LookasideSlot;
+typedef struct Lookaside Lookaside;
+
+struct LookasideSlot {
+  LookasideSlot *pNext;      /* Next free slot */
+};
+
+struct Lookaside {
+  LookasideSlot *pFree;      /* Free slots.  Used only by the owner */
+  LookasideSlot *pRemote;    /* Slots freed by other threads */
+  pthread_mutex_t mutex;     /* Protects pRemote and nRemoteFree */
+  int isOwned;               /* True while a thread owns this pool */
+  int isInit;                /* True once the slots have been threaded */
+  int nAlloc;                /* Allocations served from a slot */
+  int nFree;                 /* Slots freed by the owner */
+  int nRemoteFree;           /* Slots freed by other threads */
+  int nMissSize;             /* Allocations too large for a slot */
+  int nMissFull;             /* Allocations made while the pool was empty */
+  int aHist[LOOKASIDE_NHIST];  /* Histogram of requested sizes */
+};
+
+static Lookaside aLookaside[LOOKASIDE_POOLS];
+static union {
+  double notUsed;            /* Force 8-byte alignment of the slots */
+  char a[LOOKASIDE_POOLS][LOOKASIDE_SLOTS*LOOKASIDE_SLOT_SIZE];
+} lookasideSpace;
+
+static pthread_once_t lookasideOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t lookasideMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t lookasideKey;
+
+/*
+** The pool owned by the calling thread.  lookasideTried is set once the
+** thread has asked for a pool, so that a thread that did not get one
+** does not keep asking.
+*/
+static __thread Lookaside *pMyLookaside;
+static __thread int lookasideTried;
+
+/*
+** Return the pool that slot p belongs to, or NULL if p did not come
+** from a lookaside pool.
+*/
+static Lookaside *lookasideOwner(void *p){
+  char *z = (char*)p;
+  char *zStart = lookasideSpace.a[0];
+  if( z<zStart || z>=zStart+sizeof(lookasideSpace.a) ) return 0;
+  return &aLookaside[(z - zStart)/(LOOKASIDE_SLOTS*LOOKASIDE_SLOT_SIZE)];
+}
+
+/*
+** Thread exit handler.  Give the thread's pool back.  Slots that are
+** still in use stay valid and go back to the pool when they are freed.
+*/
+static void lookasideRelease(void *pArg){
+  Lookaside *pPool = (Lookaside*)pArg;
+  pthread_mutex_lock(&lookasideMutex);
+  pPool->isOwned = 0;
+  pthread_mutex_unlock(&lookasideMutex);
+}
+
+static void lookasideInit(void){
+  int i;
+  for(i=0; i<LOOKASIDE_POOLS; i++){
+    pthread_mutex_init(&aLookaside[i].mutex, 0);
+  }
+  pthread_key_create(&lookasideKey, lookasideRelease);
+}
+
+/*
+** Find a pool for the calling thread.  Return NULL if every pool is
+** owned by some other thread.
+*/
+static Lookaside *lookasideAcquire(void){
+  Lookaside *pPool = 0;
+  int i;
+
+  lookasideTried = 1;
+  pthread_once(&lookasideOnce, lookasideInit);
+  pthread_mutex_lock(&lookasideMutex);
+  for(i=0; i<LOOKASIDE_POOLS; i++){
+    if( !aLookaside[i].isOwned ){
+      pPool = &aLookaside[i];
+      pPool->isOwned = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lookasideMutex);
+  if( pPool==0 ) return 0;
+  if( !pPool->isInit ){
+    char *z = lookasideSpace.a[i];
+    int j;
+    for(j=LOOKASIDE_SLOTS-1; j>=0; j--){
+      LookasideSlot *pSlot = (LookasideSlot*)&z[j*LOOKASIDE_SLOT_SIZE];
+      pSlot->pNext = pPool->pFree;
+      pPool->pFree = pSlot;
+    }
+    pPool->isInit = 1;
+  }
+  pthread_setspecific(lookasideKey, pPool);
+  pMyLookaside = pPool;
+  return pPool;
+}
+
+/*
+** Return a slot for an allocation of n bytes, or NULL if the allocation
+** must come from malloc().
+*/
+static void *lookasideAlloc(int n){
+  Lookaside *pPool = pMyLookaside;
+  LookasideSlot *pSlot;
+  int i;
+
+  if( pPool==0 ){
+    if( lookasideTried || (pPool = lookasideAcquire())==0 ) return 0;
+  }
+  for(i=0; i<LOOKASIDE_NHIST-1 && n>(16<<i); i++){}
+  pPool->aHist[i]++;
+  if( n>LOOKASIDE_SLOT_SIZE ){
+    pPool->nMissSize++;
+    return 0;
+  }
+  if( pPool->pFree==0 && pPool->pRemote!=0 ){
+    pthread_mutex_lock(&pPool->mutex);
+    pPool->pFree = pPool->pRemote;
+    pPool->pRemote = 0;
+    pthread_mutex_unlock(&pPool->mutex);
+  }
+  if( (pSlot = pPool->pFree)==0 ){
+    pPool->nMissFull++;
+    return 0;
+  }
+  pPool->pFree = pSlot->pNext;
+  pPool->nAlloc++;
+  return (void*)pSlot;
+}
+
+/*
+** Return slot p to pool pPool.
+*/
+static void lookasideFree(Lookaside *pPool, void *p){
+  LookasideSlot *pSlot = (LookasideSlot*)p;
+  if( pPool==pMyLookaside ){
+    pSlot->pNext = pPool->pFree;
+    pPool->pFree = pSlot;
+    pPool->nFree++;
+  }else{
+    pthread_mutex_lock(&pPool->mutex);
+    pSlot->pNext = pPool->pRemote;
+    pPool->pRemote = pSlot;
+    pPool->nRemoteFree++;
+    pthread_mutex_unlock(&pPool->mutex);
+  }
+}
+
+/*
+** Report the iStat-th lookaside counter, summed over all pools.  Write
+** its name into *pzName and its value into *pValue and return 1, or
+** return 0 if there is no such counter.  The counters of pools owned by
+** other threads are read without locking, so they are approximate.
+*/
+int sqliteLookasideStatus(int iStat, const char **pzName, int *pValue){
+  static const char *azName[] = {
+    "slot_size", "slots", "pools", "used", "hit", "miss_size", "miss_full",
+    "remote_free",
+    "size_16", "size_32", "size_64", "size_128", "size_256", "size_512",
+    "size_1024", "size_large",
+  };
+  int i, v;
+
+  if( iStat<0 || iStat>=ArraySize(azName) ) return 0;
+  *pzName = azName[iStat];
+  switch( iStat ){
+    case 0:  *pValue = LOOKASIDE_SLOT_SIZE;  return 1;
+    case 1:  *pValue = LOOKASIDE_SLOTS;      return 1;
+    case 2:  *pValue = LOOKASIDE_POOLS;      return 1;
+  }
+  for(i=v=0; i<LOOKASIDE_POOLS; i++){
+    Lookaside *pPool = &aLookaside[i];
+    switch( iStat ){
+      case 3: v += pPool->nAlloc - pPool->nFree - pPool->nRemoteFree; break;
+      case 4: v += pPool->nAlloc;       break;
+      case 5: v += pPool->nMissSize;    break;
+      case 6: v += pPool->nMissFull;    break;
+      case 7: v += pPool->nRemoteFree;  break;
+      default: v += pPool->aHist[iStat-8];  break;
+    }
+  }
+  *pValue = v;
+  return 1;
+}
+
+#else  /* !OS_UNIX || SQLITE_OMIT_LOOKASIDE */
+# define LOOKASIDE_SLOT_SIZE   0
+# define lookasideAlloc(N)     0
+# define lookasideOwner(P)     0
+# define lookasideFree(L,P)
+
+int sqliteLookasideStatus(int iStat, const char **pzName, int *pValue){
+  return 0;
+}
+#endif /* OS_UNIX && !SQLITE_OMIT_LOOKASIDE */
+
 /*
 ** Allocate new memory and set it to zero.  Return NULL if
 ** no memory is available.  See also sqliteMallocRaw().
 */
 void *sqliteMalloc(int n){
   void *p;
-  if( (p = malloc(n))==0 ){
+  if( (p = lookasideAlloc(n))!=0 ){
+    memset(p, 0, n);
+  }else if( (p = malloc(n))==0 ){
     if( n>0 ) sqlite_malloc_failed++;
   }else{
     memset(p, 0, n);
@@ -268,7 +521,7 @@ void *sqliteMalloc(int n){
 */
 void *sqliteMallocRaw(int n){
   void *p;
-  if( (p = malloc(n))==0 ){
+  if( (p = lookasideAlloc(n))==0 && (p = malloc(n))==0 ){
     if( n>0 ) sqlite_malloc_failed++;
   }
   return p;
@@ -279,7 +532,12 @@ void *sqliteMallocRaw(int n){
 */
 void sqliteFree(void *p){
   if( p ){
-    free(p);
+    void *pPool = lookasideOwner(p);
+    if( pPool ){
+      lookasideFree(pPool, p);
+    }else{
+      free(p);
+    }
   }
 }
 
@@ -290,6 +548,7 @@ void sqliteFree(void *p){
 */
 void *sqliteRealloc(void *p, int n){
   void *p2;
+  void *pPool;
   if( p==0 ){
     return sqliteMalloc(n);
   }
@@ -297,6 +556,17 @@ void *sqliteRealloc(void *p, int n){
     sqliteFree(p);
     return 0;
   }
+  if( (pPool = lookasideOwner(p))!=0 ){
+    /* A slot cannot grow.  Move the allocation to malloc() instead. */
+    if( n<=LOOKASIDE_SLOT_SIZE ) return p;
+    if( (p2 = malloc(n))==0 ){
+      sqlite_malloc_failed++;
+      return 0;
+    }
+    memcpy(p2, p, LOOKASIDE_SLOT_SIZE);
+    lookasideFree(pPool, p);
+    return p2;
+  }
   p2 = realloc(p, n);
   if( p2==0 ){
     sqlite_malloc_failed++;
@@ -304,6 +574,26 @@ void *sqliteRealloc(void *p, int n){
   return p2;
 }
 
+/*
+** Make sure a string that is passed outside of the SQLite library is in
+** memory obtained from malloc(), so that clients can free it using free()
+** rather than having to call sqliteFree().  Only strings that were put
+** in a lookaside slot need to be copied.
+*/
+void sqliteStrRealloc(char **pz){
+  char *zNew;
+  void *pPool;
+  if( pz==0 || *pz==0 || (pPool = lookasideOwner(*pz))==0 ) return;
+  zNew = malloc( strlen(*pz) + 1 );
+  if( zNew ){
+    strcpy(zNew, *pz);
+  }else{
+    sqlite_malloc_failed++;
+  }
+  lookasideFree(pPool, *pz);
+  *pz = zNew;
+}
+
 /*
 ** Make a copy of a string in memory obtained from sqliteMalloc()
 */
@@ -859,6 +1149,40 @@ void sqliteRealToSortable(double r, char *z){
   *z = 0;
 }
 
+/*
+** Convert a double-precision floating point number into the fixed-width
+** key encoding used by file format 5.  Like sqliteRealToSortable(), the
+** results compare with memcmp() in the same order as the numbers, but
+** they take no arithmetic to build and are exact.
+**
+** The IEEE bit pattern is made to sort as an unsigned integer (by
+** flipping the sign bit of positive numbers and every bit of negative
+** ones) and then written big-endian, seven bits per byte, with the high
+** bit of each byte set.  That keeps the key free of '\000' bytes, which
+** separate the fields of a key.
+**
+** The result is always SQLITE_BINARY_KEY_SIZE bytes plus a terminating
+** '\000', so z[] must have room for SQLITE_BINARY_KEY_SIZE+1 characters.
+*/
+void sqliteRealToBinary(double r, char *z){
+  unsigned long long x;
+  int i;
+
+  if( r==0.0 ) r = 0.0;   /* -0.0 and 0.0 are the same key */
+  assert( sizeof(x)==sizeof(r) );
+  memcpy(&x, &r, sizeof(x));
+  if( x>>63 ){
+    x = ~x;
+  }else{
+    x |= 1ULL<<63;
+  }
+  for(i=SQLITE_BINARY_KEY_SIZE-1; i>=0; i--){
+    z[i] = (char)(0x80 | (x & 0x7f));
+    x >>= 7;
+  }
+  z[SQLITE_BINARY_KEY_SIZE] = 0;
+}
+
 #ifdef SQLITE_UTF8
 /*
 ** X is a pointer to the first byte of a UTF-8 character.  Increment
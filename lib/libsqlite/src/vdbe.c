@@ -214,29 +214,6 @@ static int hardStringify(Mem *pStack){
   return 0;
 }
 
-/*
-** Convert the given stack entity into a string that has been obtained
-** from sqliteMalloc().  This is different from Stringify() above in that
-** Stringify() will use the NBFS bytes of static string space if the string
-** will fit but this routine always mallocs for space.
-** Return non-zero if we run out of memory.
-*/
-#define Dynamicify(P) (((P)->flags & MEM_Dyn)==0 ? hardDynamicify(P):0)
-static int hardDynamicify(Mem *pStack){
-  int fg = pStack->flags;
-  char *z;
-  if( (fg & MEM_Str)==0 ){
-    hardStringify(pStack);
-  }
-  assert( (fg & MEM_Dyn)==0 );
-  z = sqliteMallocRaw( pStack->n );
-  if( z==0 ) return 1;
-  memcpy(z, pStack->z, pStack->n);
-  pStack->z = z;
-  pStack->flags |= MEM_Dyn;
-  return 0;
-}
-
 /*
 ** An ephemeral string value (signified by the MEM_Ephem flag) contains
 ** a pointer to a dynamically allocated string where some other entity
@@ -354,35 +331,41 @@ static void hardRealify(Mem *pStack){
 }
 
 /*
-** The parameters are pointers to the head of two sorted lists
-** of Sorter structures.  Merge these two lists together and return
-** a single sorted list.  This routine forms the core of the merge-sort
-** algorithm.
-**
-** In the case of a tie, left sorts in front of right.
-*/
-static Sorter *Merge(Sorter *pLeft, Sorter *pRight){
-  Sorter sHead;
-  Sorter *pTail;
-  pTail = &sHead;
-  pTail->pNext = 0;
-  while( pLeft && pRight ){
-    int c = sqliteSortCompare(pLeft->zKey, pRight->zKey);
-    if( c<=0 ){
-      pTail->pNext = pLeft;
-      pLeft = pLeft->pNext;
-    }else{
-      pTail->pNext = pRight;
-      pRight = pRight->pNext;
-    }
-    pTail = pTail->pNext;
-  }
-  if( pLeft ){
-    pTail->pNext = pLeft;
-  }else if( pRight ){
-    pTail->pNext = pRight;
+** Comparison routine for sorting the sorter array with qsort().  Elements
+** with equal keys come out most recently added first, just as they did
+** from the linked-list merge sort this replaces.
+*/
+static int sorterCompare(const void *pA, const void *pB){
+  const Sorter *pLeft = (const Sorter*)pA;
+  const Sorter *pRight = (const Sorter*)pB;
+  int c = sqliteSortCompare(pLeft->zKey, pRight->zKey);
+  if( c==0 ){
+    c = pRight->iSeq - pLeft->iSeq;
+  }
+  return c;
+}
+
+/*
+** Make sure the string value of the given stack entry lives in the
+** sorter arena, so that it can be put on the sorter.  Values built by
+** SortMakeKey and SortMakeRec are already there.  Anything else is
+** copied in and its original storage released.
+**
+** Return 1 if we run out of memory.
+*/
+static int sorterSave(Vdbe *p, Mem *pStack){
+  char *z;
+  Stringify(pStack);
+  if( (pStack->flags & MEM_Static)!=0 && sqliteVdbeSorterOwns(p, pStack->z) ){
+    return 0;
   }
-  return sHead.pNext;
+  z = sqliteVdbeSorterAlloc(p, pStack->n);
+  if( z==0 ) return 1;
+  memcpy(z, pStack->z, pStack->n);
+  Release(pStack);
+  pStack->z = z;
+  pStack->flags = MEM_Str | MEM_Static;
+  return 0;
 }
 
 /*
@@ -1982,12 +1965,13 @@ case OP_MakeRecord: {
 ** of characters that represent the number such that a comparison of
 ** the character string using memcpy() sorts the numbers in numerical
 ** order.  The character strings for numbers are generated using the
-** sqliteRealToSortable() function.  A text field is introduced by a
-** 'c' character and is followed by the exact text of the field.  The
-** use of an 'a', 'b', or 'c' character at the beginning of each field
-** guarantees that NULLs sort before numbers and that numbers sort
-** before text.  0x00 characters do not occur except as separators
-** between fields.
+** sqliteRealToSortable() function or, in databases of file format 5
+** or later, the fixed-width sqliteRealToBinary().  A text field is
+** introduced by a 'c' character and is followed by the exact text of
+** the field.  The use of an 'a', 'b', or 'c' character at the
+** beginning of each field guarantees that NULLs sort before numbers
+** and that numbers sort before text.  0x00 characters do not occur
+** except as separators between fields.
 **
 ** See also: MakeIdxKey, SortMakeKey
 */
@@ -2055,8 +2039,13 @@ case OP_MakeKey: {
       }
       Release(pRec);
       z = pRec->zShort;
-      sqliteRealToSortable(pRec->r, z);
-      len = strlen(z);
+      if( p->keyFormat>=5 ){
+        sqliteRealToBinary(pRec->r, z);
+        len = SQLITE_BINARY_KEY_SIZE;
+      }else{
+        sqliteRealToSortable(pRec->r, z);
+        len = strlen(z);
+      }
       pRec->z = 0;
       pRec->flags = MEM_Real;
       pRec->n = len+1;
@@ -2297,6 +2286,9 @@ case OP_ReadCookie: {
 ** the main database file and P1==1 is the database file used to store
 ** temporary tables.
 **
+** A new format for the main database takes effect for the rest of the
+** connection when the transaction commits.
+**
 ** A transaction must be started before executing this opcode.
 */
 case OP_SetCookie: {
@@ -2310,6 +2302,9 @@ case OP_SetCookie: {
   if( rc==SQLITE_OK ){
     aMeta[1+pOp->p2] = pTos->i;
     rc = sqliteBtreeUpdateMeta(db->aDb[pOp->p1].pBt, aMeta);
+    if( rc==SQLITE_OK && pOp->p1==0 && pOp->p2==1 ){
+      db->next_format = pTos->i;
+    }
   }
   Release(pTos);
   pTos--;
@@ -3539,6 +3534,68 @@ case OP_IdxRecno: {
   break;
 }
 
+/* Opcode: IdxColumn P1 P2 *
+**
+** Push onto the stack the P2-th field of the key to the current entry
+** in index P1.  The field must be NULL or text, as described under
+** MakeKey, so that the value pushed is exactly the value of the column
+** that went into the index.  This lets a query that reads nothing else
+** from a table skip the move from the index entry to the table row.
+**
+** See also: IdxRecno, MakeIdxKey.
+*/
+case OP_IdxColumn: {
+  int i = pOp->p1;
+  Cursor *pC;
+  BtCursor *pCrsr;
+  char zTemp[NBFS];
+
+  assert( i>=0 && i<p->nCursor );
+  pC = &p->aCsr[i];
+  pTos++;
+  pTos->flags = MEM_Null;
+  if( (pCrsr = pC->pCursor)!=0 && !pC->nullRow ){
+    int sz, j, k;
+    char *zKey;
+    assert( pC->deferredMoveto==0 );
+    sqliteBtreeKeySize(pCrsr, &sz);
+    if( sz<=NBFS ){
+      zKey = zTemp;
+    }else{
+      zKey = sqliteMallocRaw( sz );
+      if( zKey==0 ) goto no_mem;
+    }
+    sqliteBtreeKey(pCrsr, 0, sz, zKey);
+    sz -= sizeof(u32);
+    for(k=0, j=pOp->p2; j>0 && k<sz; j--){
+      while( k<sz && zKey[k] ){ k++; }
+      k++;
+    }
+    if( k<sz && zKey[k]!='a' ){
+      assert( zKey[k]=='c' );
+      k++;
+      j = k;
+      while( j<sz && zKey[j] ){ j++; }
+      pTos->n = j - k + 1;
+      if( pTos->n<=NBFS ){
+        pTos->z = pTos->zShort;
+        pTos->flags = MEM_Str | MEM_Short;
+      }else{
+        pTos->z = sqliteMallocRaw( pTos->n );
+        if( pTos->z==0 ){
+          if( zKey!=zTemp ) sqliteFree(zKey);
+          goto no_mem;
+        }
+        pTos->flags = MEM_Str | MEM_Dyn;
+      }
+      memcpy(pTos->z, &zKey[k], pTos->n-1);
+      pTos->z[pTos->n-1] = 0;
+    }
+    if( zKey!=zTemp ) sqliteFree(zKey);
+  }
+  break;
+}
+
 /* Opcode: IdxGT P1 P2 *
 **
 ** Compare the top of the stack against the key on the index entry that
@@ -3924,17 +3981,20 @@ case OP_SortPut: {
   Mem *pNos = &pTos[-1];
   Sorter *pSorter;
   assert( pNos>=p->aStack );
-  if( Dynamicify(pTos) || Dynamicify(pNos) ) goto no_mem;
-  pSorter = sqliteMallocRaw( sizeof(Sorter) );
-  if( pSorter==0 ) goto no_mem;
-  pSorter->pNext = p->pSort;
-  p->pSort = pSorter;
-  assert( pTos->flags & MEM_Dyn );
+  if( p->nSort>=p->nSortAlloc ){
+    int nNew = p->nSortAlloc ? p->nSortAlloc*2 : 64;
+    Sorter *aNew = sqliteRealloc(p->aSort, nNew*sizeof(Sorter));
+    if( aNew==0 ) goto no_mem;
+    p->aSort = aNew;
+    p->nSortAlloc = nNew;
+  }
+  if( sorterSave(p, pTos) || sorterSave(p, pNos) ) goto no_mem;
+  pSorter = &p->aSort[p->nSort];
   pSorter->nKey = pTos->n;
   pSorter->zKey = pTos->z;
-  assert( pNos->flags & MEM_Dyn );
   pSorter->nData = pNos->n;
   pSorter->pData = pNos->z;
+  pSorter->iSeq = p->nSort++;
   pTos -= 2;
   break;
 }
@@ -3964,7 +4024,7 @@ case OP_SortMakeRec: {
     }
   }
   nByte += sizeof(char*)*(nField+1);
-  azArg = sqliteMallocRaw( nByte );
+  azArg = (char**)sqliteVdbeSorterAlloc(p, nByte);
   if( azArg==0 ) goto no_mem;
   z = (char*)&azArg[nField+1];
   for(pRec=&pTos[1-nField], i=0; i<nField; i++, pRec++){
@@ -3980,7 +4040,7 @@ case OP_SortMakeRec: {
   pTos++;
   pTos->n = nByte;
   pTos->z = (char*)azArg;
-  pTos->flags = MEM_Str | MEM_Dyn;
+  pTos->flags = MEM_Str | MEM_Static;
   break;
 }
 
@@ -4017,7 +4077,7 @@ case OP_SortMakeKey: {
       nByte += pRec->n+2;
     }
   }
-  zNewKey = sqliteMallocRaw( nByte );
+  zNewKey = sqliteVdbeSorterAlloc(p, nByte);
   if( zNewKey==0 ) goto no_mem;
   j = 0;
   k = 0;
@@ -4038,45 +4098,25 @@ case OP_SortMakeKey: {
   popStack(&pTos, nField);
   pTos++;
   pTos->n = nByte;
-  pTos->flags = MEM_Str|MEM_Dyn;
+  pTos->flags = MEM_Str|MEM_Static;
   pTos->z = zNewKey;
   break;
 }
 
 /* Opcode: Sort * * *
 **
-** Sort all elements on the sorter.  The algorithm is a
-** mergesort.
+** Sort all elements on the sorter.
 */
 case OP_Sort: {
-  int i;
-  Sorter *pElem;
-  Sorter *apSorter[NSORT];
-  for(i=0; i<NSORT; i++){
-    apSorter[i] = 0;
-  }
-  while( p->pSort ){
-    pElem = p->pSort;
-    p->pSort = pElem->pNext;
-    pElem->pNext = 0;
-    for(i=0; i<NSORT-1; i++){
-    if( apSorter[i]==0 ){
-        apSorter[i] = pElem;
-        break;
-      }else{
-        pElem = Merge(apSorter[i], pElem);
-        apSorter[i] = 0;
-      }
-    }
-    if( i>=NSORT-1 ){
-      apSorter[NSORT-1] = Merge(apSorter[NSORT-1],pElem);
-    }
+  if( p->iSort>0 ){
+    /* Drop the elements SortNext has already returned */
+    p->nSort -= p->iSort;
+    memmove(p->aSort, &p->aSort[p->iSort], p->nSort*sizeof(Sorter));
   }
-  pElem = 0;
-  for(i=0; i<NSORT; i++){
-    pElem = Merge(apSorter[i], pElem);
+  if( p->nSort>1 ){
+    qsort(p->aSort, p->nSort, sizeof(Sorter), sorterCompare);
   }
-  p->pSort = pElem;
+  p->iSort = 0;
   break;
 }
 
@@ -4086,19 +4126,21 @@ case OP_Sort: {
 ** stack, then remove the element from the sorter.  If the sorter
 ** is empty, push nothing on the stack and instead jump immediately 
 ** to instruction P2.
+**
+** The data stays in the sorter arena, so it is pushed as an ephemeral
+** string.  Anything that keeps it past the next SortReset, such as
+** MemStore, makes its own copy.
 */
 case OP_SortNext: {
-  Sorter *pSorter = p->pSort;
   CHECK_FOR_INTERRUPT;
-  if( pSorter!=0 ){
-    p->pSort = pSorter->pNext;
+  if( p->iSort<p->nSort ){
+    Sorter *pSorter = &p->aSort[p->iSort++];
     pTos++;
     pTos->z = pSorter->pData;
     pTos->n = pSorter->nData;
-    pTos->flags = MEM_Str|MEM_Dyn;
-    sqliteFree(pSorter->zKey);
-    sqliteFree(pSorter);
+    pTos->flags = MEM_Str|MEM_Ephem;
   }else{
+    p->nSort = p->iSort = 0;
     pc = pOp->p2 - 1;
   }
   break;
@@ -108,6 +108,7 @@ int sqliteVdbeFinalize(Vdbe*,char**);
 void sqliteVdbeResolveLabel(Vdbe*, int);
 int sqliteVdbeCurrentAddr(Vdbe*);
 void sqliteVdbeTrace(Vdbe*,FILE*);
+void sqliteVdbeSetKeyFormat(Vdbe*,int);
 void sqliteVdbeCompressSpace(Vdbe*,int);
 int sqliteVdbeReset(Vdbe*,char **);
 int sqliteVdbeSetVariables(Vdbe*,int,const char**);
@@ -84,8 +84,9 @@ struct Cursor {
 typedef struct Cursor Cursor;
 
 /*
-** A sorter builds a list of elements to be sorted.  Each element of
-** the list is an instance of the following structure.
+** A sorter builds an array of elements to be sorted.  Each element of
+** the array is an instance of the following structure.  The key and
+** data both live in the sorter arena.
 */
 typedef struct Sorter Sorter;
 struct Sorter {
@@ -93,13 +94,27 @@ struct Sorter {
   char *zKey;         /* The key by which we will sort */
   int nData;          /* Number of bytes in the data */
   char *pData;        /* The data associated with this key */
-  Sorter *pNext;      /* Next in the list */
+  int iSeq;           /* Order in which the element was added */
 };
 
-/* 
-** Number of buckets used for merge-sort.  
+/*
+** Sort keys and records, and the rows they are built from, are carved
+** out of a list of chunks that is only freed when the sorter is reset.
+** Each chunk is at least twice the size of the one before it, so sorting
+** N rows takes O(log N) calls to malloc() rather than O(N).
+*/
+typedef struct SortChunk SortChunk;
+struct SortChunk {
+  SortChunk *pNext;   /* Next older chunk */
+  int nByte;          /* Number of bytes of space in a[] */
+  int nUsed;          /* Number of bytes of a[] handed out so far */
+  double a[1];        /* Space for records.  Actually nByte bytes */
+};
+
+/*
+** Size of the first chunk of the sorter arena.
 */
-#define NSORT 30
+#define SORT_CHUNK_MIN 4096
 
 /*
 ** Number of bytes of string storage space available to each stack
@@ -246,7 +261,11 @@ struct Vdbe {
   char **azColName;   /* Becomes the 4th parameter to callbacks */
   int nCursor;        /* Number of slots in aCsr[] */
   Cursor *aCsr;       /* One element of this array for each open cursor */
-  Sorter *pSort;      /* A linked list of objects to be sorted */
+  Sorter *aSort;      /* Array of objects to be sorted */
+  int nSort;          /* Number of entries in aSort[] */
+  int nSortAlloc;     /* Number of slots allocated for aSort[] */
+  int iSort;          /* Next entry of aSort[] for SortNext */
+  SortChunk *pSortChunk;  /* Sorter arena.  Newest chunk first */
   FILE *pFile;        /* At most one open file handler */
   int nField;         /* Number of file fields */
   char **azField;     /* Data for each file field */
@@ -281,6 +300,7 @@ struct Vdbe {
   int popStack;           /* Pop the stack this much on entry to VdbeExec() */
   char *zErrMsg;          /* Error message written here */
   u8 explain;             /* True if EXPLAIN present on SQL command */
+  u8 keyFormat;           /* file_format for OP_MakeKey's number encoding */
 };
 
 /*
@@ -296,6 +316,8 @@ struct Vdbe {
 */
 void sqliteVdbeCleanupCursor(Cursor*);
 void sqliteVdbeSorterReset(Vdbe*);
+char *sqliteVdbeSorterAlloc(Vdbe*, int);
+int sqliteVdbeSorterOwns(Vdbe*, const char*);
 void sqliteVdbeAggReset(Agg*);
 void sqliteVdbeKeylistFree(Keylist*);
 void sqliteVdbePopStack(Vdbe*,int);
@@ -38,6 +38,7 @@ Vdbe *sqliteVdbeCreate(sqlite *db){
   p = sqliteMalloc( sizeof(Vdbe) );
   if( p==0 ) return 0;
   p->db = db;
+  p->keyFormat = db->file_format;
   if( db->pVdbe ){
     db->pVdbe->pPrev = p;
   }
@@ -55,6 +56,16 @@ void sqliteVdbeTrace(Vdbe *p, FILE *trace){
   p->trace = trace;
 }
 
+/*
+** Set the file format whose key encoding OP_MakeKey and OP_MakeIdxKey
+** use.  It defaults to the format of the database when the VDBE was
+** created.  PRAGMA key_format overrides it to build keys in the format
+** it is converting to.
+*/
+void sqliteVdbeSetKeyFormat(Vdbe *p, int iFormat){
+  p->keyFormat = iFormat;
+}
+
 /*
 ** Add a new instruction to the list of instructions current in the
 ** VDBE.  Return the address of the new instruction.
@@ -654,16 +665,56 @@ void sqliteVdbeMakeReady(
 
 
 /*
-** Remove any elements that remain on the sorter for the VDBE given.
+** Remove any elements that remain on the sorter for the VDBE given,
+** and release the sorter arena.
 */
 void sqliteVdbeSorterReset(Vdbe *p){
-  while( p->pSort ){
-    Sorter *pSorter = p->pSort;
-    p->pSort = pSorter->pNext;
-    sqliteFree(pSorter->zKey);
-    sqliteFree(pSorter->pData);
-    sqliteFree(pSorter);
+  SortChunk *pChunk;
+  while( (pChunk = p->pSortChunk)!=0 ){
+    p->pSortChunk = pChunk->pNext;
+    sqliteFree(pChunk);
+  }
+  sqliteFree(p->aSort);
+  p->aSort = 0;
+  p->nSort = 0;
+  p->nSortAlloc = 0;
+  p->iSort = 0;
+}
+
+/*
+** Allocate nByte bytes from the sorter arena.  The space is suitably
+** aligned for any use and lasts until the next sqliteVdbeSorterReset().
+** Return NULL if we run out of memory.
+*/
+char *sqliteVdbeSorterAlloc(Vdbe *p, int nByte){
+  SortChunk *pChunk = p->pSortChunk;
+  char *z;
+  nByte = (nByte + 7) & ~7;
+  if( pChunk==0 || pChunk->nUsed + nByte > pChunk->nByte ){
+    int nChunk = pChunk ? pChunk->nByte*2 : SORT_CHUNK_MIN;
+    while( nChunk<nByte ) nChunk *= 2;
+    pChunk = sqliteMallocRaw( sizeof(SortChunk) - sizeof(pChunk->a) + nChunk );
+    if( pChunk==0 ) return 0;
+    pChunk->nByte = nChunk;
+    pChunk->nUsed = 0;
+    pChunk->pNext = p->pSortChunk;
+    p->pSortChunk = pChunk;
+  }
+  z = &((char*)pChunk->a)[pChunk->nUsed];
+  pChunk->nUsed += nByte;
+  return z;
+}
+
+/*
+** Return true if z points into the sorter arena.
+*/
+int sqliteVdbeSorterOwns(Vdbe *p, const char *z){
+  SortChunk *pChunk;
+  for(pChunk=p->pSortChunk; pChunk; pChunk=pChunk->pNext){
+    const char *zBase = (const char*)pChunk->a;
+    if( z>=zBase && z<&zBase[pChunk->nUsed] ) return 1;
   }
+  return 0;
 }
 
 /*
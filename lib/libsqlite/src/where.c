@@ -862,7 +862,7 @@ WhereInfo *sqliteWhereBegin(
       if( i==pTabList->nSrc-1 && pushKey ){
         haveKey = 1;
       }else{
-        sqliteVdbeAddOp(v, OP_MoveTo, iCur, 0);
+        pLevel->addrMoveTo = sqliteVdbeAddOp(v, OP_MoveTo, iCur, 0);
         haveKey = 0;
       }
       pLevel->p1 = pLevel->iCur;
@@ -1125,7 +1125,7 @@ WhereInfo *sqliteWhereBegin(
       if( i==pTabList->nSrc-1 && pushKey ){
         haveKey = 1;
       }else{
-        sqliteVdbeAddOp(v, OP_MoveTo, iCur, 0);
+        pLevel->addrMoveTo = sqliteVdbeAddOp(v, OP_MoveTo, iCur, 0);
         haveKey = 0;
       }
 
@@ -1186,6 +1186,104 @@ WhereInfo *sqliteWhereBegin(
   return pWInfo;
 }
 
+/*
+** Return the position of column iCol of table pTab within index pIdx if
+** the index key holds the exact value of that column, or -1 if it does
+** not.  Numeric fields are stored in a sortable form that does not keep
+** the original text, so only text columns qualify.  A column of -1 is
+** the rowid, which every index entry ends with.
+*/
+static int indexColumnOf(Table *pTab, Index *pIdx, int iCol){
+  int k;
+  if( iCol<0 || iCol==pTab->iPKey ) return pIdx->nColumn;
+  if( (pTab->aCol[iCol].sortOrder & SQLITE_SO_TYPEMASK)!=SQLITE_SO_TEXT ){
+    return -1;
+  }
+  for(k=0; k<pIdx->nColumn; k++){
+    if( pIdx->aiColumn[k]==iCol ) return k;
+  }
+  return -1;
+}
+
+/*
+** The loop for pLevel scans an index and then moves the table cursor
+** iCur to each row that the index selects.  If every column that the
+** body of the loop reads from the table can be taken from the index
+** key instead, rewrite those reads to use the index cursor and drop the
+** move, so that each row costs one btree search instead of two.
+**
+** This only works for database files whose index keys record whether
+** each field is text, which is file format 4 and later.
+*/
+static void coverIndex(
+  Parse *pParse,          /* The parser context */
+  Table *pTab,            /* The table being scanned */
+  int iCur,               /* Cursor number for pTab */
+  WhereLevel *pLevel      /* The level of the loop that scans pTab */
+){
+  Vdbe *v = pParse->pVdbe;
+  int nOp = sqliteVdbeCurrentAddr(v);
+  int addr;
+  VdbeOp *pOp;
+
+  if( pParse->db->file_format<4 ) return;
+  for(addr=pLevel->addrMoveTo+1; addr<nOp; addr++){
+    pOp = sqliteVdbeGetOp(v, addr);
+    if( pOp->p1!=iCur ) continue;
+    switch( pOp->opcode ){
+      case OP_Column: {
+        if( indexColumnOf(pTab, pLevel->pIdx, pOp->p2)<0 ) return;
+        break;
+      }
+      case OP_Recno:
+        break;
+      case OP_RowData:
+      case OP_RowKey:
+      case OP_FullKey:
+      case OP_KeyAsData:
+      case OP_NullRow:
+      case OP_MoveTo:
+      case OP_MoveLt:
+      case OP_NotExists:
+      case OP_Found:
+      case OP_NotFound:
+      case OP_IsUnique:
+      case OP_Next:
+      case OP_Prev:
+      case OP_Rewind:
+      case OP_Last:
+      case OP_NewRecno:
+      case OP_PutIntKey:
+      case OP_PutStrKey:
+      case OP_Delete:
+        return;
+    }
+  }
+  for(addr=pLevel->addrMoveTo+1; addr<nOp; addr++){
+    pOp = sqliteVdbeGetOp(v, addr);
+    if( pOp->p1!=iCur ) continue;
+    if( pOp->opcode==OP_Column ){
+      int k = indexColumnOf(pTab, pLevel->pIdx, pOp->p2);
+      if( k<pLevel->pIdx->nColumn ){
+        pOp->opcode = OP_IdxColumn;
+        pOp->p1 = pLevel->iCur;
+        pOp->p2 = k;
+      }else{
+        pOp->opcode = OP_IdxRecno;
+        pOp->p1 = pLevel->iCur;
+      }
+    }else if( pOp->opcode==OP_Recno ){
+      pOp->opcode = OP_IdxRecno;
+      pOp->p1 = pLevel->iCur;
+    }
+  }
+  pOp = sqliteVdbeGetOp(v, pLevel->addrMoveTo-1);
+  assert( pOp->opcode==OP_IdxRecno );
+  pOp->opcode = OP_Noop;
+  pOp = sqliteVdbeGetOp(v, pLevel->addrMoveTo);
+  pOp->opcode = OP_Noop;
+}
+
 /*
 ** Generate the end of the WHERE loop.  See comments on 
 ** sqliteWhereBegin() for additional information.
@@ -1196,6 +1294,13 @@ void sqliteWhereEnd(WhereInfo *pWInfo){
   WhereLevel *pLevel;
   SrcList *pTabList = pWInfo->pTabList;
 
+  for(i=0; i<pTabList->nSrc; i++){
+    pLevel = &pWInfo->a[i];
+    if( pLevel->addrMoveTo && pLevel->iLeftJoin==0 ){
+      coverIndex(pWInfo->pParse, pTabList->a[i].pTab,
+                 pTabList->a[i].iCursor, pLevel);
+    }
+  }
   for(i=pTabList->nSrc-1; i>=0; i--){
     pLevel = &pWInfo->a[i];
     sqliteVdbeResolveLabel(v, pLevel->cont);
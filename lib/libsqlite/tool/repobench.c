@@ -0,0 +1,744 @@
+/*
+** A benchmark that runs the library the way svc.configd(1M) does.
+**
+** A synthetic repository is built with the schema of configd's
+** backend.c:  N services, each with M instances, every service and
+** instance with P property groups of Q properties.  Each instance has a
+** "running" snapshot.  The repository is then put through a mix of the
+** operations configd performs, using the same SQL:
+**
+**     fill      list the property groups of a service or instance, then
+**               read the properties of one of them and all their values
+**     commit    a property group transaction that changes one property
+**     snapshot  take a snapshot of an instance
+**     new_id    allocate an id, as backend_new_id() does, on its own
+**     delete    delete a property group and add it back
+**
+** For each kind of operation the throughput and the 50th and 99th
+** percentile latency are reported, together with the pages read and
+** written and the syncs done by the pager.  Usage:
+**
+**     repobench ?OPTIONS? FILE
+**
+**     -s N         services (default 100)
+**     -i M         instances per service (default 2)
+**     -p P         property groups per service and instance (default 6)
+**     -q Q         properties per property group (default 8)
+**     -n OPS       operations to run (default 20000)
+**     -m MIX       percentages of fill,commit,snapshot,new_id,delete
+**                  (default 70,20,4,4,2)
+**     -j MODE      journal mode, wal or delete (default wal)
+**     -y LEVEL     synchronous level, off, normal or full (default normal)
+**     -c PAGES     page cache size
+**     -r SEED      seed for the random number generator
+**
+** FILE and its journal and log are deleted before the repository is
+** built.  The build itself runs with synchronous off and is only timed.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "sqliteInt.h"
+#include "pager.h"
+
+/*
+** The schema version configd writes into new repositories.
+*/
+#define SCHEMA_VERSION 6
+
+/*
+** The tables and indices of configd's persistent repository, as in
+** tbls_normal[], tbls_common[], idxs_normal[] and idxs_common[] of
+** cmd/svc/configd/backend.c.  Keep them in sync.
+*/
+static const char *azTable[] = {
+  "service_tbl",
+    "svc_id          INTEGER PRIMARY KEY,"
+    "svc_name        CHAR(256) NOT NULL",
+  "instance_tbl",
+    "instance_id     INTEGER PRIMARY KEY,"
+    "instance_name   CHAR(256) NOT NULL,"
+    "instance_svc    INTEGER NOT NULL",
+  "snapshot_lnk_tbl",
+    "lnk_id          INTEGER PRIMARY KEY,"
+    "lnk_inst_id     INTEGER NOT NULL,"
+    "lnk_snap_name   CHAR(256) NOT NULL,"
+    "lnk_snap_id     INTEGER NOT NULL",
+  "snaplevel_tbl",
+    "snap_id                 INTEGER NOT NULL,"
+    "snap_level_num          INTEGER NOT NULL,"
+    "snap_level_id           INTEGER NOT NULL,"
+    "snap_level_service_id   INTEGER NOT NULL,"
+    "snap_level_service      CHAR(256) NOT NULL,"
+    "snap_level_instance_id  INTEGER NULL,"
+    "snap_level_instance     CHAR(256) NULL",
+  "snaplevel_lnk_tbl",
+    "snaplvl_level_id INTEGER NOT NULL,"
+    "snaplvl_pg_id    INTEGER NOT NULL,"
+    "snaplvl_pg_name  CHAR(256) NOT NULL,"
+    "snaplvl_pg_type  CHAR(256) NOT NULL,"
+    "snaplvl_pg_flags INTEGER NOT NULL,"
+    "snaplvl_gen_id   INTEGER NOT NULL",
+  "pg_tbl",
+    "pg_id           INTEGER PRIMARY KEY,"
+    "pg_parent_id    INTEGER NOT NULL,"
+    "pg_name         CHAR(256) NOT NULL,"
+    "pg_type         CHAR(256) NOT NULL,"
+    "pg_flags        INTEGER NOT NULL,"
+    "pg_gen_id       INTEGER NOT NULL",
+  "prop_lnk_tbl",
+    "lnk_prop_id     INTEGER PRIMARY KEY,"
+    "lnk_pg_id       INTEGER NOT NULL,"
+    "lnk_gen_id      INTEGER NOT NULL,"
+    "lnk_prop_name   CHAR(256) NOT NULL,"
+    "lnk_prop_type   CHAR(2) NOT NULL,"
+    "lnk_val_id      INTEGER",
+  "value_tbl",
+    "value_id        INTEGER PRIMARY KEY,"
+    "value_type      CHAR(1) NOT NULL,"
+    "value_hash      INTEGER NOT NULL,"
+    "value_count     INTEGER NOT NULL,"
+    "value_value     VARCHAR NOT NULL",
+  "id_tbl",
+    "id_name         STRING NOT NULL,"
+    "id_next         INTEGER NOT NULL",
+  "schema_version",
+    "schema_version  INTEGER",
+  0
+};
+static const char *azIndex[] = {
+  "service_tbl",        "name",   "svc_name",
+  "instance_tbl",       "name",   "instance_svc, instance_name",
+  "snapshot_lnk_tbl",   "name",   "lnk_inst_id, lnk_snap_name",
+  "snapshot_lnk_tbl",   "snapid", "lnk_snap_id",
+  "snaplevel_tbl",      "id",     "snap_id",
+  "snaplevel_tbl",      "level",  "snap_level_id",
+  "snaplevel_lnk_tbl",  "id",     "snaplvl_pg_id",
+  "snaplevel_lnk_tbl",  "level",  "snaplvl_level_id",
+  "pg_tbl",             "parent", "pg_parent_id",
+  "pg_tbl",             "name",   "pg_parent_id, pg_name",
+  "pg_tbl",             "type",   "pg_parent_id, pg_type",
+  "prop_lnk_tbl",       "base",   "lnk_pg_id, lnk_gen_id",
+  "prop_lnk_tbl",       "val",    "lnk_val_id",
+  "value_tbl",          "hash",   "value_hash",
+  "id_tbl",             "id",     "id_name",
+  0
+};
+
+/*
+** The id spaces of id_tbl, in the order of configd's enum id_space.
+*/
+#define ID_SI     0
+#define ID_PG     1
+#define ID_GEN    2
+#define ID_PROP   3
+#define ID_VAL    4
+#define ID_SNAME  5
+#define ID_SHOT   6
+#define ID_SLVL   7
+#define N_ID      8
+static const char *azIdName[N_ID] = {
+  "SI", "PG", "GEN", "PROP", "VAL", "SNAME", "SHOT", "SLVL"
+};
+
+/*
+** A service or an instance, and one of its property groups.
+*/
+typedef struct Ent Ent;
+typedef struct Pg Pg;
+struct Ent {
+  int id;               /* svc_id or instance_id */
+  Ent *pSvc;            /* The service of an instance, or NULL */
+  char zName[24];       /* svc_name or instance_name */
+  int lnkId;            /* lnk_id of the "running" snapshot of an instance */
+  int levelId;          /* snap_level_id last taken of this entity */
+  int dirty;            /* A pg has changed since levelId was taken */
+};
+struct Pg {
+  int id;               /* pg_id */
+  int gen;              /* pg_gen_id */
+  int iName;            /* Suffix of pg_name */
+  Ent *pEnt;            /* The service or instance the pg belongs to */
+};
+
+/*
+** The kinds of operation, and what was measured for each.
+*/
+#define OP_FILL      0
+#define OP_COMMIT    1
+#define OP_SNAPSHOT  2
+#define OP_NEWID     3
+#define OP_DELETE    4
+#define N_OP         5
+static const char *azOpName[N_OP] = {
+  "fill", "commit", "snapshot", "new_id", "delete"
+};
+typedef struct OpStat OpStat;
+struct OpStat {
+  int nOp;              /* Number of operations run */
+  double *aUs;          /* Latency of each operation, in microseconds */
+  double rTotal;        /* Sum of aUs[] */
+  int nRead;            /* Pages read */
+  int nWrite;           /* Pages written */
+  int nSync;            /* Syncs */
+};
+
+static sqlite *db;              /* The repository */
+static Ent *aEnt;               /* All services and instances */
+static int nEnt;
+static Pg *aPg;                 /* All property groups */
+static int nPg;
+static int nProp = 8;           /* Properties per property group */
+static int idNext[N_ID];        /* Next ids, while building */
+static unsigned int iRandom = 1;
+
+/*
+** Report an error and give up.
+*/
+static void fatal(const char *zMsg, const char *zErr){
+  fprintf(stderr, "repobench: %s: %s\n", zMsg, zErr ? zErr : "error");
+  exit(1);
+}
+
+/*
+** Run SQL that is not expected to fail.  The result rows, if any, go to
+** xCallback.
+*/
+static void run(sqlite_callback xCallback, void *pArg, const char *zFormat,
+                ...){
+  va_list ap;
+  char *zErr = 0;
+  int rc;
+  va_start(ap, zFormat);
+  rc = sqlite_exec_vprintf(db, zFormat, xCallback, pArg, &zErr, ap);
+  va_end(ap);
+  if( rc!=SQLITE_OK ) fatal(zFormat, zErr);
+}
+
+/*
+** A small random number generator, so that runs can be repeated.
+*/
+static int randomInt(int n){
+  iRandom ^= iRandom<<13;
+  iRandom ^= iRandom>>17;
+  iRandom ^= iRandom<<5;
+  return (int)(iRandom % (unsigned int)n);
+}
+
+static double now(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1e6 + t.tv_nsec/1e3;
+}
+
+/*
+** Callbacks that store the first column of a row as an integer, and that
+** collect the first column of every row into an IdList.
+*/
+typedef struct IntList IntList;
+struct IntList {
+  int n, nAlloc;
+  int *a;
+};
+static int intCallback(void *pArg, int nCol, char **azVal, char **azCol){
+  *(int*)pArg = azVal[0] ? atoi(azVal[0]) : 0;
+  return 0;
+}
+static int listCallback(void *pArg, int nCol, char **azVal, char **azCol){
+  IntList *p = (IntList*)pArg;
+  if( p->n>=p->nAlloc ){
+    p->nAlloc = p->nAlloc*2 + 16;
+    p->a = realloc(p->a, p->nAlloc*sizeof(int));
+    if( p->a==0 ) fatal("out of memory", 0);
+  }
+  p->a[p->n++] = azVal[0] ? atoi(azVal[0]) : 0;
+  return 0;
+}
+static int countCallback(void *pArg, int nCol, char **azVal, char **azCol){
+  (*(int*)pArg)++;
+  return 0;
+}
+
+/*
+** Allocate a new id the way backend_new_id() does.
+*/
+static int newId(int iSpace){
+  int id = 0;
+  run(intCallback, &id,
+      "SELECT id_next FROM id_tbl WHERE (id_name = '%q');"
+      "UPDATE id_tbl SET id_next = id_next + 1 WHERE (id_name = '%q');",
+      azIdName[iSpace], azIdName[iSpace]);
+  if( id==0 ) fatal("no id", azIdName[iSpace]);
+  return id;
+}
+
+/*
+** Ids come from newId() when running, or from idNext[] while building.
+*/
+static int takeId(int iSpace, int isBuild){
+  return isBuild ? idNext[iSpace]++ : newId(iSpace);
+}
+
+/*
+** Store a set of nVal string values the way tx_store_values() does:
+** packed into a single row as "<length>:<value>" for each value, and
+** shared by every property with the same values.  Return its value id.
+*/
+static int storeValues(const char **azVal, int nVal, int isBuild){
+  char zPacked[1024];
+  unsigned int h = 2166136261U;
+  int i, n, id = 0;
+  char *z;
+
+  for(i=n=0; i<nVal; i++){
+    n += snprintf(&zPacked[n], sizeof(zPacked)-n, "%d:%s",
+                  (int)strlen(azVal[i]), azVal[i]);
+    assert( n<(int)sizeof(zPacked) );
+  }
+  for(z=zPacked; *z; z++){
+    h = (h ^ (unsigned char)*z) * 16777619U;
+  }
+  run(intCallback, &id,
+      "SELECT value_id FROM value_tbl "
+      "    WHERE (value_hash = %u AND value_type = 's' AND "
+      "    value_value = '%q')", h, zPacked);
+  if( id ) return id;
+  id = takeId(ID_VAL, isBuild);
+  run(0, 0,
+      "INSERT INTO value_tbl "
+      "    (value_id, value_type, value_hash, value_count, value_value) "
+      "VALUES (%d, 's', %u, %d, '%q');", id, h, nVal, zPacked);
+  return id;
+}
+
+/*
+** Add a property group with nProp properties at generation pPg->gen.
+** Odd numbered properties have the same values in every property group.
+*/
+static void addPg(Pg *pPg, int isBuild){
+  int i, j, nVal, valId;
+  char azBuf[3][64];
+  const char *azVal[3];
+  pPg->id = takeId(ID_PG, isBuild);
+  pPg->gen = takeId(ID_GEN, isBuild);
+  run(0, 0,
+      "INSERT INTO pg_tbl "
+      "    (pg_id, pg_parent_id, pg_name, pg_type, pg_flags, pg_gen_id) "
+      "VALUES (%d, %d, 'pg%d', '%s', 0, %d);",
+      pPg->id, pPg->pEnt->id, pPg->iName,
+      pPg->iName%3==0 ? "framework" : "application", pPg->gen);
+  for(i=0; i<nProp; i++){
+    nVal = i%4==3 ? 3 : 1;
+    for(j=0; j<nVal; j++){
+      snprintf(azBuf[j], sizeof(azBuf[j]), "/lib/svc/method/value-%d-%d-%d",
+               i%2 ? 0 : pPg->id, i, j);
+      azVal[j] = azBuf[j];
+    }
+    valId = storeValues(azVal, nVal, isBuild);
+    run(0, 0,
+        "INSERT INTO prop_lnk_tbl "
+        "    (lnk_pg_id, lnk_gen_id, lnk_prop_name, lnk_prop_type, "
+        "    lnk_val_id) "
+        "VALUES (%d, %d, 'property_%d', 's', %d);",
+        pPg->id, pPg->gen, i, valId);
+  }
+}
+
+/*
+** Record the snaplevel of entity pEnt at level iLevel of snapshot
+** snapId.  The snaplevel is shared with the last snapshot taken of
+** pEnt unless one of its property groups has changed since.
+*/
+static void takeLevel(Ent *pEnt, Ent *pInst, int snapId, int iLevel,
+                      int isBuild){
+  Ent *pSvc = pInst->pSvc;
+  if( pEnt->levelId==0 || pEnt->dirty ){
+    int nPgs = 0;
+    run(countCallback, &nPgs,
+        "SELECT pg_id, pg_gen_id FROM pg_tbl WHERE (pg_parent_id = %d);",
+        pEnt->id);
+    pEnt->levelId = takeId(ID_SLVL, isBuild);
+    pEnt->dirty = 0;
+    run(0, 0,
+        "INSERT INTO snaplevel_lnk_tbl "
+        "    (snaplvl_level_id, snaplvl_pg_id, snaplvl_pg_name, "
+        "    snaplvl_pg_type, snaplvl_pg_flags, snaplvl_gen_id) "
+        "SELECT %d, pg_id, pg_name, pg_type, pg_flags, pg_gen_id "
+        "    FROM pg_tbl WHERE (pg_parent_id = %d);",
+        pEnt->levelId, pEnt->id);
+  }
+  run(0, 0,
+      "INSERT INTO snaplevel_tbl "
+      "    (snap_id, snap_level_num, snap_level_id, "
+      "    snap_level_service_id, snap_level_service, "
+      "    snap_level_instance_id, snap_level_instance) "
+      "VALUES (%d, %d, %d, %d, %Q, %d, %Q);",
+      snapId, iLevel, pEnt->levelId, pSvc->id, pSvc->zName,
+      pEnt==pInst ? pInst->id : 0, pEnt==pInst ? pInst->zName : 0);
+}
+
+/*
+** Take a snapshot of instance pInst, as object_snapshot_do_take() and
+** object_snapshot_attach() do.
+*/
+static void takeSnapshot(Ent *pInst, int isBuild){
+  int snapId = takeId(ID_SHOT, isBuild);
+  takeLevel(pInst->pSvc, pInst, snapId, 1, isBuild);
+  takeLevel(pInst, pInst, snapId, 2, isBuild);
+  if( pInst->lnkId==0 ){
+    pInst->lnkId = takeId(ID_SNAME, isBuild);
+    run(0, 0,
+        "INSERT INTO snapshot_lnk_tbl "
+        "    (lnk_id, lnk_inst_id, lnk_snap_name, lnk_snap_id) "
+        "VALUES (%d, %d, 'running', %d);",
+        pInst->lnkId, pInst->id, snapId);
+  }else{
+    run(0, 0,
+        "UPDATE snapshot_lnk_tbl SET lnk_snap_id = %d WHERE lnk_id = %d;",
+        snapId, pInst->lnkId);
+  }
+}
+
+/*
+** Build the repository.
+*/
+static void build(int nSvc, int nInst, int nPgPer){
+  int i, j, k;
+  Ent *pEnt;
+  Pg *pPg;
+
+  for(i=0; azTable[i]; i+=2){
+    run(0, 0, "CREATE TABLE %s (%s);", azTable[i], azTable[i+1]);
+  }
+  for(i=0; azIndex[i]; i+=3){
+    run(0, 0, "CREATE INDEX %s_%s ON %s (%s);",
+        azIndex[i], azIndex[i+1], azIndex[i], azIndex[i+2]);
+  }
+  run(0, 0, "INSERT INTO schema_version (schema_version) VALUES (%d);",
+      SCHEMA_VERSION);
+
+  nEnt = nSvc*(1+nInst);
+  nPg = nEnt*nPgPer;
+  aEnt = calloc(nEnt, sizeof(aEnt[0]));
+  aPg = calloc(nPg, sizeof(aPg[0]));
+  if( aEnt==0 || aPg==0 ) fatal("out of memory", 0);
+  for(i=0; i<N_ID; i++) idNext[i] = 1;
+
+  run(0, 0, "BEGIN TRANSACTION;");
+  pEnt = aEnt;
+  pPg = aPg;
+  for(i=0; i<nSvc; i++){
+    Ent *pSvc = pEnt;
+    for(j=0; j<=nInst; j++, pEnt++){
+      pEnt->id = idNext[ID_SI]++;
+      if( j==0 ){
+        snprintf(pEnt->zName, sizeof(pEnt->zName), "system/service%d", i);
+        run(0, 0, "INSERT INTO service_tbl (svc_id, svc_name) "
+                  "VALUES (%d, '%q');", pEnt->id, pEnt->zName);
+      }else{
+        pEnt->pSvc = pSvc;
+        snprintf(pEnt->zName, sizeof(pEnt->zName),
+                 j==1 ? "default" : "instance%d", j);
+        run(0, 0, "INSERT INTO instance_tbl "
+                  "    (instance_id, instance_name, instance_svc) "
+                  "VALUES (%d, '%q', %d);", pEnt->id, pEnt->zName, pSvc->id);
+      }
+      for(k=0; k<nPgPer; k++, pPg++){
+        pPg->pEnt = pEnt;
+        pPg->iName = k;
+        addPg(pPg, 1);
+      }
+      if( j>0 ) takeSnapshot(pEnt, 1);
+    }
+  }
+  for(i=0; i<N_ID; i++){
+    run(0, 0, "INSERT INTO id_tbl (id_name, id_next) VALUES ('%q', %d);",
+        azIdName[i], idNext[i]);
+  }
+  run(0, 0, "COMMIT TRANSACTION;");
+}
+
+/*
+** The operations.  The SQL is that of the configd code named.
+*/
+static void opFill(void){
+  Pg *pPg = &aPg[randomInt(nPg)];
+  IntList vals;
+  int i, nRow = 0;
+
+  /* rc_node fill of the property groups of an entity */
+  run(countCallback, &nRow,
+      "SELECT pg_name, pg_id, pg_gen_id, pg_type, pg_flags FROM pg_tbl "
+      "WHERE (pg_parent_id = %d)", pPg->pEnt->id);
+
+  /* fill_property_callback() and the values of each property */
+  memset(&vals, 0, sizeof(vals));
+  run(listCallback, &vals,
+      "SELECT lnk_val_id, lnk_prop_name, lnk_prop_id, lnk_prop_type "
+      "FROM prop_lnk_tbl "
+      "WHERE (lnk_pg_id = %d AND lnk_gen_id = %d)", pPg->id, pPg->gen);
+  for(i=0; i<vals.n; i++){
+    run(countCallback, &nRow,
+        "SELECT value_count, value_value FROM value_tbl "
+        "WHERE (value_id = %d)", vals.a[i]);
+  }
+  free(vals.a);
+}
+
+static void opCommit(void){
+  Pg *pPg = &aPg[randomInt(nPg)];
+  int oldGen, newGen, pinned = 0, valId;
+  int iProp = randomInt(nProp);
+  IntList vals;
+  char zVal[32];
+  const char *azVal[1];
+  int i;
+
+  /* object_tx_commit() */
+  run(0, 0, "BEGIN TRANSACTION;");
+  run(intCallback, &oldGen,
+      "SELECT pg_gen_id FROM pg_tbl WHERE (pg_id = %d);", pPg->id);
+  newGen = newId(ID_GEN);
+  run(0, 0, "UPDATE pg_tbl SET pg_gen_id = %d "
+            "    WHERE (pg_id = %d AND pg_gen_id = %d);",
+      newGen, pPg->id, oldGen);
+  run(countCallback, &pinned,
+      "SELECT 1 FROM snaplevel_lnk_tbl "
+      "    WHERE (snaplvl_pg_id = %d AND snaplvl_gen_id = %d)",
+      pPg->id, oldGen);
+  memset(&vals, 0, sizeof(vals));
+  run(listCallback, &vals,
+      "SELECT lnk_val_id, lnk_prop_name, lnk_prop_type FROM prop_lnk_tbl "
+      "WHERE (lnk_pg_id = %d AND lnk_gen_id = %d AND "
+      "    lnk_prop_name IN ('property_%d'))",
+      pPg->id, oldGen, iProp);
+  if( pinned ){
+    run(0, 0,
+        "INSERT INTO prop_lnk_tbl"
+        "    (lnk_pg_id, lnk_gen_id, lnk_prop_name, lnk_prop_type,"
+        "    lnk_val_id) "
+        "SELECT lnk_pg_id, %d, lnk_prop_name, lnk_prop_type, lnk_val_id "
+        "FROM prop_lnk_tbl "
+        "WHERE (lnk_pg_id = %d AND lnk_gen_id = %d AND "
+        "    lnk_prop_name NOT IN ('property_%d'));",
+        newGen, pPg->id, oldGen, iProp);
+  }else{
+    run(0, 0,
+        "UPDATE prop_lnk_tbl SET lnk_gen_id = %d "
+        "WHERE (lnk_pg_id = %d AND lnk_gen_id = %d AND "
+        "    lnk_prop_name NOT IN ('property_%d'));",
+        newGen, pPg->id, oldGen, iProp);
+
+    /* tx_process_cmds() removes what is left of the old generation */
+    run(0, 0, "DELETE FROM prop_lnk_tbl"
+              "    WHERE (lnk_pg_id = %d AND lnk_gen_id = %d)",
+        pPg->id, oldGen);
+    for(i=0; i<vals.n; i++){
+      int nUse = 0;
+      run(countCallback, &nUse,
+          "SELECT 1 FROM prop_lnk_tbl WHERE (lnk_val_id = %d);", vals.a[i]);
+      if( nUse==0 ){
+        run(0, 0, "DELETE FROM value_tbl WHERE (value_id = %d)", vals.a[i]);
+      }
+    }
+  }
+  free(vals.a);
+  snprintf(zVal, sizeof(zVal), "changed value %d", newGen);
+  azVal[0] = zVal;
+  valId = storeValues(azVal, 1, 0);
+  run(0, 0,
+      "INSERT INTO prop_lnk_tbl "
+      "    (lnk_pg_id, lnk_gen_id, lnk_prop_name, lnk_prop_type, lnk_val_id) "
+      "VALUES (%d, %d, 'property_%d', 's', %d);",
+      pPg->id, newGen, iProp, valId);
+  run(0, 0, "COMMIT TRANSACTION;");
+  pPg->gen = newGen;
+  pPg->pEnt->dirty = 1;
+}
+
+static void opSnapshot(void){
+  Ent *pInst;
+  do{
+    pInst = &aEnt[randomInt(nEnt)];
+  }while( pInst->pSvc==0 );
+  run(0, 0, "BEGIN TRANSACTION;");
+  takeSnapshot(pInst, 0);
+  run(0, 0, "COMMIT TRANSACTION;");
+}
+
+static void opNewId(void){
+  run(0, 0, "BEGIN TRANSACTION;");
+  newId(randomInt(N_ID));
+  run(0, 0, "COMMIT TRANSACTION;");
+}
+
+static void opDelete(void){
+  Pg *pPg = &aPg[randomInt(nPg)];
+  IntList vals;
+  int i;
+
+  /* The property group deletion in file_object.c, and value_gc_run() */
+  memset(&vals, 0, sizeof(vals));
+  run(0, 0, "BEGIN TRANSACTION;");
+  run(listCallback, &vals,
+      "SELECT DISTINCT lnk_val_id FROM prop_lnk_tbl WHERE (lnk_pg_id = %d);",
+      pPg->id);
+  run(0, 0, "DELETE FROM prop_lnk_tbl WHERE (lnk_pg_id = %d); "
+            "DELETE FROM pg_tbl WHERE pg_id IN (%d);", pPg->id, pPg->id);
+  for(i=0; i<vals.n; i++){
+    run(0, 0,
+        "DELETE FROM value_tbl "
+        "    WHERE (value_id IN (%d) AND value_id NOT IN "
+        "    (SELECT lnk_val_id FROM prop_lnk_tbl "
+        "    WHERE lnk_val_id IN (%d)))", vals.a[i], vals.a[i]);
+  }
+  free(vals.a);
+  addPg(pPg, 0);
+  run(0, 0, "COMMIT TRANSACTION;");
+  pPg->pEnt->dirty = 1;
+}
+
+static int doubleCompare(const void *p1, const void *p2){
+  double r1 = *(const double*)p1, r2 = *(const double*)p2;
+  return r1<r2 ? -1 : r1>r2;
+}
+
+static double percentile(OpStat *p, int iPct){
+  int i;
+  if( p->nOp==0 ) return 0.0;
+  i = (p->nOp*iPct + 99)/100 - 1;
+  return p->aUs[i<0 ? 0 : i];
+}
+
+static void usage(const char *argv0){
+  fprintf(stderr,
+     "Usage: %s ?-s N? ?-i M? ?-p P? ?-q Q? ?-n OPS? ?-m MIX? ?-j MODE?\n"
+     "           ?-y LEVEL? ?-c PAGES? ?-r SEED? FILE\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv){
+  int nSvc = 100, nInst = 2, nPgPer = 6, nOps = 20000, nCache = 0;
+  int aMix[N_OP] = { 70, 20, 4, 4, 2 };
+  const char *zJournal = "wal", *zSync = "normal", *zFile;
+  char zName[300];
+  char *zErr = 0;
+  OpStat aStat[N_OP], tot;
+  Pager *pPager;
+  int *a, i, c, iOp, nMix;
+  int aIo[3];
+  double rStart, rBuild, rRun, r;
+
+  while( (c = getopt(argc, argv, "s:i:p:q:n:m:j:y:c:r:"))!=-1 ){
+    switch( c ){
+      case 's': nSvc = atoi(optarg); break;
+      case 'i': nInst = atoi(optarg); break;
+      case 'p': nPgPer = atoi(optarg); break;
+      case 'q': nProp = atoi(optarg); break;
+      case 'n': nOps = atoi(optarg); break;
+      case 'j': zJournal = optarg; break;
+      case 'y': zSync = optarg; break;
+      case 'c': nCache = atoi(optarg); break;
+      case 'r': iRandom = (unsigned int)atoi(optarg) | 1; break;
+      case 'm':
+        if( sscanf(optarg, "%d,%d,%d,%d,%d", &aMix[0], &aMix[1], &aMix[2],
+                   &aMix[3], &aMix[4])!=N_OP ){
+          usage(argv[0]);
+        }
+        break;
+      default: usage(argv[0]);
+    }
+  }
+  if( optind!=argc-1 || nSvc<1 || nInst<1 || nPgPer<1 || nProp<1 ){
+    usage(argv[0]);
+  }
+  for(nMix=i=0; i<N_OP; i++) nMix += aMix[i];
+  if( nMix<=0 ) usage(argv[0]);
+  zFile = argv[optind];
+
+  unlink(zFile);
+  snprintf(zName, sizeof(zName), "%.280s-journal", zFile);
+  unlink(zName);
+  snprintf(zName, sizeof(zName), "%.280s-wal", zFile);
+  unlink(zName);
+  db = sqlite_open(zFile, 0600, &zErr);
+  if( db==0 ) fatal(zFile, zErr);
+  run(0, 0, "PRAGMA journal_mode = %s;", zJournal);
+  if( nCache>0 ) run(0, 0, "PRAGMA cache_size = %d;", nCache);
+  pPager = sqliteBtreePager(db->aDb[0].pBt);
+
+  /* Build the repository */
+  run(0, 0, "PRAGMA synchronous = off;");
+  rStart = now();
+  build(nSvc, nInst, nPgPer);
+  rBuild = now() - rStart;
+  run(0, 0, "PRAGMA synchronous = %s;", zSync);
+  printf("built %d services, %d instances, %d property groups, "
+         "%d properties in %.3f s\n",
+         nSvc, nSvc*nInst, nPg, nPg*nProp, rBuild/1e6);
+
+  /* Run the operations */
+  memset(aStat, 0, sizeof(aStat));
+  for(i=0; i<N_OP; i++){
+    aStat[i].aUs = malloc(nOps*sizeof(double));
+    if( aStat[i].aUs==0 ) fatal("out of memory", 0);
+  }
+  rStart = now();
+  for(i=0; i<nOps; i++){
+    OpStat *p;
+    a = sqlitepager_stats(pPager);
+    aIo[0] = a[9];
+    aIo[1] = a[10];
+    aIo[2] = a[11];
+    c = randomInt(nMix);
+    for(iOp=0; c>=aMix[iOp]; iOp++) c -= aMix[iOp];
+    r = now();
+    switch( iOp ){
+      case OP_FILL:     opFill();      break;
+      case OP_COMMIT:   opCommit();    break;
+      case OP_SNAPSHOT: opSnapshot();  break;
+      case OP_NEWID:    opNewId();     break;
+      case OP_DELETE:   opDelete();    break;
+    }
+    r = now() - r;
+    a = sqlitepager_stats(pPager);
+    p = &aStat[iOp];
+    p->aUs[p->nOp++] = r;
+    p->rTotal += r;
+    p->nRead += a[9] - aIo[0];
+    p->nWrite += a[10] - aIo[1];
+    p->nSync += a[11] - aIo[2];
+  }
+  rRun = now() - rStart;
+
+  /* Report */
+  printf("%d operations in %.3f s, %.0f ops/s, journal_mode=%s "
+         "synchronous=%s\n", nOps, rRun/1e6, nOps/(rRun/1e6),
+         zJournal, zSync);
+  printf("%-9s %7s %9s %9s %9s %9s %8s %8s %7s\n",
+         "op", "count", "ops/s", "mean(us)", "p50(us)", "p99(us)",
+         "rd/op", "wr/op", "sync/op");
+  memset(&tot, 0, sizeof(tot));
+  for(i=0; i<N_OP; i++){
+    OpStat *p = &aStat[i];
+    int n = p->nOp ? p->nOp : 1;
+    qsort(p->aUs, p->nOp, sizeof(double), doubleCompare);
+    printf("%-9s %7d %9.0f %9.1f %9.1f %9.1f %8.2f %8.2f %7.2f\n",
+           azOpName[i], p->nOp, p->rTotal>0 ? p->nOp/(p->rTotal/1e6) : 0.0,
+           p->rTotal/n, percentile(p, 50), percentile(p, 99),
+           (double)p->nRead/n, (double)p->nWrite/n, (double)p->nSync/n);
+    tot.nRead += p->nRead;
+    tot.nWrite += p->nWrite;
+    tot.nSync += p->nSync;
+  }
+  a = sqlitepager_stats(pPager);
+  printf("pages read %d, pages written %d, syncs %d, "
+         "cache hits %d, cache misses %d\n",
+         tot.nRead, tot.nWrite, tot.nSync, a[6], a[7]);
+
+  run(0, 0, "PRAGMA integrity_check;");
+  sqlite_close(db);
+  return 0;
+}